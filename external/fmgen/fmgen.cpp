@@ -238,7 +238,7 @@ void MakeLFOTable()
 //	`bvŋʂȕ
 //
 Chip::Chip()
-: ratio_(0), aml_(0), pml_(0), pmv_(0), optype_(typeN)
+: ratio_(0), aml_(0), pml_(0), pmv_(0), egshift_(0), optype_(typeN)
 {
 }
 
@@ -538,52 +538,57 @@ inline void Operator::SetEGRate(uint rate)
 }
 
 //	EG vZ
+//	Chip  EGShift  n ȂC3 * 2^n TvƂ 2^n 񕪂܂Ƃ߂Đi߂
 void FM::Operator::EGCalc()
 {
-	eg_count_ = (2047 * 3) << FM_RATIOBITS;				// ##̎蔲͍Čቺ
+	uint shift = chip_->GetEGShift();
+	eg_count_ = ((2047 * 3) << FM_RATIOBITS) << shift;		// ##̎蔲͍Čቺ
 	
-	if (eg_phase_ == attack)
+	for (int n = 1 << shift; n > 0; n--)
 	{
-		int c = attacktable[eg_rate_][eg_curve_count_ & 7];
-		if (c >= 0)
+		if (eg_phase_ == attack)
 		{
-			eg_level_ -= 1 + (eg_level_ >> c);
-			if (eg_level_ <= 0)
-				ShiftPhase(decay);
-		}
-		EGUpdate();
-	}
-	else
-	{
-		if (!ssg_type_)
-		{
-			eg_level_ += decaytable1[eg_rate_][eg_curve_count_ & 7];
-			if (eg_level_ >= eg_level_on_next_phase_)
-				ShiftPhase(EGPhase(eg_phase_+1));
+			int c = attacktable[eg_rate_][eg_curve_count_ & 7];
+			if (c >= 0)
+			{
+				eg_level_ -= 1 + (eg_level_ >> c);
+				if (eg_level_ <= 0)
+					ShiftPhase(decay);
+			}
 			EGUpdate();
 		}
 		else
 		{
-			eg_level_ += 4 * decaytable1[eg_rate_][eg_curve_count_ & 7];
-			if (eg_level_ >= eg_level_on_next_phase_)
+			if (!ssg_type_)
 			{
+				eg_level_ += decaytable1[eg_rate_][eg_curve_count_ & 7];
+				if (eg_level_ >= eg_level_on_next_phase_)
+					ShiftPhase(EGPhase(eg_phase_+1));
 				EGUpdate();
-				switch (eg_phase_)
+			}
+			else
+			{
+				eg_level_ += 4 * decaytable1[eg_rate_][eg_curve_count_ & 7];
+				if (eg_level_ >= eg_level_on_next_phase_)
 				{
-				case decay:
-					ShiftPhase(sustain);
-					break;
-				case sustain:
-					ShiftPhase(attack);
-					break;
-				case release:
-					ShiftPhase(off);
-					break;
+					EGUpdate();
+					switch (eg_phase_)
+					{
+					case decay:
+						ShiftPhase(sustain);
+						break;
+					case sustain:
+						ShiftPhase(attack);
+						break;
+					case release:
+						ShiftPhase(off);
+						break;
+					}
 				}
 			}
 		}
+		eg_curve_count_++;
 	}
-	eg_curve_count_++;
 }
 
 inline void FM::Operator::EGStep()
@@ -595,6 +600,32 @@ inline void FM::Operator::EGStep()
 		EGCalc();
 }
 
+//	Calc  nsamples Ă񂾂̂Ɠ PG  EG i߂ (Ȃꍇp)
+void FM::Operator::Skip(int nsamples)
+{
+	pg_count_ += pg_diff_ * nsamples;
+	while (nsamples > 0)
+	{
+		//  EGCalc Ă΂܂ł̉
+		long long steps = 1;
+		if (eg_count_ > 0)
+			steps = eg_count_diff_ > 0 ? (eg_count_ + (long long)eg_count_diff_ - 1) / eg_count_diff_ : (long long)nsamples + 1;
+		if (steps > nsamples)
+		{
+			eg_count_ -= eg_count_diff_ * nsamples;
+			return;
+		}
+		EGCalc();
+		nsamples -= int(steps);
+	}
+}
+
+//	݂ EG  TL ł̏o͂̐U (ɉʂςꍇpALFO ɂω͊܂܂Ȃ)
+FM::ISample FM::Operator::GetAmplitude()
+{
+	return IsOn() ? LogToLin(eg_out_) : 0;
+}
+
 //	PG vZ
 //	ret:2^(20+PGBITS) / cycle
 inline uint32 FM::Operator::PGCalc()
@@ -731,6 +762,20 @@ void Channel4::Reset()
 	op[3].Reset();
 }
 
+//	 PG  EG i߂
+void Channel4::Skip(int nsamples)
+{
+	for (int i=0; i<4; i++)
+		op[i].Skip(nsamples);
+}
+
+//	o͂ɉIy[^ (rbg n: op[n])
+uint Channel4::GetCarriers()
+{
+	static const uint8 table[8] = { 0x08, 0x08, 0x08, 0x08, 0x0a, 0x0e, 0x0e, 0x0f };
+	return table[algo_];
+}
+
 //	Calc ̗p
 int Channel4::Prepare()
 {
@@ -64,6 +64,8 @@ namespace FM
 		void	Reset();
 		void	ResetFB();
 		int		IsOn();
+		template<class Hash>
+		void	HashState(Hash& hash) const;
 
 		void	SetDT(uint dt);
 		void	SetDT2(uint dt2);
@@ -87,6 +89,8 @@ namespace FM
 //		static void SetPML(uint l);
 
 		int		Out() { return out_; }
+		uint32	PGDiff() { return pg_diff_; }	// 1  Calc Őiވʑ (2^(20+FM_PGBITS)  1 )
+		ISample	GetAmplitude();
 
 		int		dbgGetIn2() { return in2_; } 
 		void	dbgStopPG() { pg_diff_ = 0; pg_diff_lfo_ = 0; }
@@ -119,6 +123,7 @@ namespace FM
 		void	SSGShiftPhase(int mode);
 		void	SetEGRate(uint);
 		void	EGUpdate();
+		void	Skip(int nsamples);
 		int		FBCalc(int fb);
 		ISample LogToLin(uint a);
 
@@ -212,6 +217,8 @@ namespace FM
 		void SetMS(uint ms);
 		void Mute(bool);
 		void Refresh();
+		void Skip(int nsamples);
+		uint GetCarriers();
 
 		void dbgStopPG() { for (int i=0; i<4; i++) op[i].dbgStopPG(); }
 		
@@ -244,12 +251,14 @@ namespace FM
 		void	SetAML(uint l);
 		void	SetPML(uint l);
 		void	SetPMV(int pmv) { pmv_ = pmv; }
+		void	SetEGShift(uint shift) { egshift_ = shift; }	// EG  2^shift 񕪂܂Ƃ߂čXV
 
 		uint32	GetMulValue(uint dt2, uint mul) { return multable_[dt2][mul]; }
 		uint	GetAML() { return aml_; }
 		uint	GetPML() { return pml_; }
 		int		GetPMV() { return pmv_; }
 		uint	GetRatio() { return ratio_; }
+		uint	GetEGShift() { return egshift_; }
 
 	private:
 		void	MakeTable();
@@ -258,9 +267,34 @@ namespace FM
 		uint	aml_;
 		uint	pml_;
 		int		pmv_;
+		uint	egshift_;
 		OpType	optype_;
 		uint32	multable_[4][16];
 	};
+
+	//	Ȍ̏o͂߂ԂnbVlɉ (WX^狁܂p[^͏)
+	//	off ̊Ԃ̈ʑ KeyOn  0 ɖ߂Ao͂ɂeȂ߉Ȃ
+	template<class Hash>
+	void Operator::HashState(Hash& hash) const
+	{
+		hash.Add(int(eg_phase_));
+		hash.Add(keyon_);
+		if (eg_phase_ != off)
+			hash.Add(pg_count_);
+		hash.Add(out_);
+		hash.Add(out2_);
+		hash.Add(in2_);
+		hash.Add(eg_level_);
+		hash.Add(eg_level_on_next_phase_);
+		hash.Add(eg_count_);
+		hash.Add(eg_count_diff_);
+		hash.Add(eg_rate_);
+		hash.Add(eg_curve_count_ & 7);		// e[u̎QƂɂ͉ 3 rbgg
+		hash.Add(ssg_offset_);
+		hash.Add(ssg_vector_);
+		hash.Add(ssg_phase_);
+		hash.Add(tl_);
+	}
 }
 
 #endif // FM_GEN_H
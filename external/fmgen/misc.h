@@ -16,6 +16,38 @@ inline int Limit(int v, int max, int min)
 	return v > max ? max : (v < min ? min : v); 
 }
 
+// ---------------------------------------------------------------------------
+//	o̓Tvւ̉Z
+//	data  16bit ̒l
+//	int16:	NbsO
+//	int32:	32bit Ɋg債ĖOa
+//	float:	}1.0 ɐK (NbsOȂ)
+//
+inline void AddSample(short& dest, int data)
+{
+	dest = (short) Limit(dest + data, 0x7fff, -0x8000);
+}
+
+inline void AddSample(int& dest, int data)
+{
+	long long v = (long long) dest + ((long long) data << 16);
+	dest = (int) (v > 0x7fffffffLL ? 0x7fffffffLL : (v < -0x80000000LL ? -0x80000000LL : v));
+}
+
+inline void AddSample(float& dest, int data)
+{
+	dest += data * (1.0f / 32768.0f);
+}
+
+//	Channels  (1:m 2:XeI) ̃XbgɓlZĎ̃Tv֐i߂
+template<int Channels, class T>
+inline void StoreSamples(T*& dest, int data)
+{
+	for (int c=0; c<Channels; c++)
+		AddSample(dest[c], data);
+	dest += Channels;
+}
+
 inline unsigned int BSwap(unsigned int a)
 {
 	return (a >> 24) | ((a >> 8) & 0xff00) | ((a << 8) & 0xff0000) | (a << 24);
@@ -42,6 +42,7 @@ uint32	OPNBase::lfotable[8];			// OPNA/B 
 OPNBase::OPNBase()
 {
 	prescale = 0;
+	interpolation = false;
 }
 
 //	p[^Zbg
@@ -118,7 +119,7 @@ void OPNBase::SetPrescaler(uint p)
 		
 		uint fmclock = clock / table[p][0] / 12;
 		
-		rate = psgrate;
+		rate = interpolation ? fmclock : psgrate;
 		
 		// gƏo͎g̔
 		assert(fmclock < (0x80000000 >> FM_RATIOBITS));
@@ -178,6 +179,8 @@ OPN::OPN()
 	SetVolumePSG(0);
 
 	csmch = &ch[2];
+	fmmask = 0;
+	levelch = 0;
 
 	for (int i=0; i<3; i++)
 	{
@@ -201,10 +204,13 @@ bool OPN::Init(uint c, uint r, bool ip, const char*)
 }
 
 //	TvO[gύX
-bool OPN::SetRate(uint c, uint r, bool)
+bool OPN::SetRate(uint c, uint r, bool ip)
 {
+	interpolation = ip;
 	OPNBase::Init(c, r);
 	RebuildTimeTable();
+	mixc = mixc1 = 0;
+	mixdelta = 0;
 	return true;
 }
 
@@ -323,18 +329,51 @@ void OPN::SetChannelMask(uint mask)
 {
 	for (int i=0; i<3; i++)
 		ch[i].Mute(!!(mask & (1 << i)));
+	fmmask = mask & 7;
 	psg.SetChannelMask(mask >> 6);
 }
 
 
-//	(2ch)
-void OPN::Mix(Sample* buffer, int nsamples)
+//	FM ̑SIy[^̃Gx[v off (ĂȂ) ǂ
+//	}XN`l͏o͂ȂߐȂ
+bool OPN::IsFMSilent()
+{
+	for (int c=0; c<3; c++)
+	{
+		if (fmmask & (1 << c))
+			continue;
+		for (int i=0; i<4; i++)
+		{
+			if (ch[c].op[i].IsOn())
+				return false;
+		}
+	}
+	return true;
+}
+
+//	S`lĂ炸Ao͂肩ǂ
+bool OPN::IsIdle()
+{
+	return IsFMSilent() && psg.IsIdle();
+}
+
+//	 IsIdle() ̊Ԃ̂
+//	̏o͂݁AMix Ɠ̏Ԃi߂
+template<class T, int Channels>
+void OPN::MixIdle(T* buffer, int nsamples)
+{
+	psg.MixIdle<T, Channels>(buffer, nsamples);
+	if (fmmask)
+	{
+		SetFNum();
+		SkipMaskedChannels(CountCalc(nsamples));
+	}
+	mixc = mixc1 = 0;
+}
+
+//	F-Number ݒ
+void OPN::SetFNum()
 {
-#define IStoSample(s)	((Limit(s, 0x7fff, -0x8000) * fmvolume) >> 14)
-	
-	psg.Mix(buffer, nsamples);
-	
-	// Set F-Number
 	ch[0].SetFNum(fnum[0]);
 	ch[1].SetFNum(fnum[1]);
 	if (!(regtc & 0xc0))
@@ -346,25 +385,186 @@ void OPN::Mix(Sample* buffer, int nsamples)
 		ch[2].op[2].SetFNum(fnum3[0]);
 		ch[2].op[3].SetFNum(fnum[2]);
 	}
+}
+
+//	nsamples ̍Ŋe`l Calc Ăԉ
+uint OPN::CountCalc(int nsamples)
+{
+	if (!interpolation)
+		return nsamples;
+	return uint(((long long)mixdelta + (long long)rate * nsamples) / psgrate);
+}
+
+//	}XN`l̂̂̂́A Calc  count Ă񂾂̂Ɠ PG  EG i߂
+//	ret: i߂`l Prepare() ̌ (Mix  actch Ɠzu)
+int OPN::SkipMaskedChannels(uint count)
+{
+	int skipped = 0;
+	for (int i=0; i<3; i++)
+	{
+		if (fmmask & (1 << i))
+		{
+			int act = ch[i].Prepare();
+			if (act & 1)
+			{
+				ch[i].Skip(count);
+				skipped |= act << (i * 2);
+			}
+		}
+	}
+	return skipped;
+}
+
+//	ɉʂςꍇɁAWX^ւ݂̏ Skip  GetLevels ɔf
+//	(Mix ̍ŏƓŁAWX^ނт Skip  GetLevels ɌĂ)
+void OPN::PrepareLevels()
+{
+	levelch = 0;
+	// MixIdle ƓlɁAS`lĂȂԂ F-Number 𔽉fȂ
+	if (!fmmask && IsFMSilent())
+		return;
+	SetFNum();
+	for (int i=0; i<3; i++)
+		levelch |= (ch[i].Prepare() & 1) << i;
+}
+
+//	 nsamples ̏Ԃi߂ (GetLevels ŉʂςꍇp)
+void OPN::Skip(int nsamples)
+{
+	psg.Skip(nsamples);
+	uint count = CountCalc(nsamples);
+	for (int i=0; i<3; i++)
+	{
+		if (levelch & (1 << i))
+			ch[i].Skip(count);
+	}
+	mixc = mixc1 = 0;
+}
+
+//	݂̏o͂̉Ƃ̐U (}1.0 ) Ǝg (Hz)
+//	0-11: FM `l 1-3  op[0-3] (LAȊOEĂȂ́E}XN`l͐UEgƂ 0)
+//	12-14: SSG `l A-C (̏o͂͐U 0AmCY̏ꍇ͎g 0)
+//	ϒɂ{ LFO ͊܂܂Ȃ
+void OPN::GetLevels(float amplitude[levelsources], float frequency[levelsources])
+{
+	float fmscale = fmvolume / (16384.0f * 32768.0f);
+	float pgscale = float(rate) / float(1u << (20+FM_PGBITS));
+	for (int c=0; c<3; c++)
+	{
+		uint carriers = (levelch & ~fmmask & (1 << c)) ? ch[c].GetCarriers() : 0;
+		for (int i=0; i<4; i++)
+		{
+			Operator& op = ch[c].op[i];
+			ISample a = (carriers & (1 << i)) ? op.GetAmplitude() : 0;
+			amplitude[c*4+i] = a * fmscale;
+			frequency[c*4+i] = a ? op.PGDiff() * pgscale : 0.0f;
+		}
+	}
+	psg.GetLevels(amplitude + psglevelsource, frequency + psglevelsource);
+	for (int c=psglevelsource; c<levelsources; c++)
+		frequency[c] *= float(psgrate);
+}
+
+//	(Channels: 1:m 2:XeI)
+template<class T, int Channels>
+void OPN::Mix(T* buffer, int nsamples)
+{
+#define IStoSample(s)	((Limit(s, 0x7fff, -0x8000) * fmvolume) >> 14)
+	
+	psg.Mix<T, Channels>(buffer, nsamples);
+	
+	// Set F-Number
+	SetFNum();
 	
 	int actch = (((ch[2].Prepare() << 2) | ch[1].Prepare()) << 2) | ch[0].Prepare();
+	if (fmmask)
+		actch &= ~SkipMaskedChannels(CountCalc(nsamples));
 	if (actch & 0x15)
 	{
-		Sample* limit = buffer + nsamples * 2;
-		for (Sample* dest = buffer; dest < limit; dest+=2)
+		T* limit = buffer + nsamples * Channels;
+		if (!interpolation)
+		{
+			for (T* dest = buffer; dest < limit; )
+			{
+				ISample s = 0;
+				if (actch & 0x01) s  = ch[0].Calc();
+				if (actch & 0x04) s += ch[1].Calc();
+				if (actch & 0x10) s += ch[2].Calc();
+				s = IStoSample(s);
+				StoreSamples<Channels>(dest, s);
+			}
+		}
+		else
+		{
+			// rate ō mixc1  mixc ̊ԂԂ psgrate ŏo͂
+			for (T* dest = buffer; dest < limit; )
+			{
+				int32 d = int32((long long)(mixc - mixc1) * mixdelta / psgrate);
+				StoreSamples<Channels>(dest, mixc1 + d);
+				
+				for (mixdelta += rate; mixdelta >= psgrate; mixdelta -= psgrate)
+				{
+					ISample s = 0;
+					if (actch & 0x01) s  = ch[0].Calc();
+					if (actch & 0x04) s += ch[1].Calc();
+					if (actch & 0x10) s += ch[2].Calc();
+					mixc1 = mixc;
+					mixc = IStoSample(s);
+				}
+			}
+		}
+	}
+	else
+		mixc = mixc1 = 0;
+#undef IStoSample
+}
+
+//	`lƂ̍ (mAԂȂꍇ̂)
+//	buffer[0-2]: FM `l 1-3, buffer[3-5]: SSG `l A-C
+//	Mix Ɠ̏Ԃi߂
+template<class T>
+void OPN::MixChannels(T* const buffer[6], int nsamples)
+{
+#define IStoSample(s)	((Limit(s, 0x7fff, -0x8000) * fmvolume) >> 14)
+	
+	assert(!interpolation);
+	psg.MixChannels<T>(buffer + 3, nsamples);
+	
+	SetFNum();
+	
+	int actch = (((ch[2].Prepare() << 2) | ch[1].Prepare()) << 2) | ch[0].Prepare();
+	if (fmmask)
+		actch &= ~SkipMaskedChannels(nsamples);
+	for (int c=0; c<3; c++)
+	{
+		if (actch & (1 << (c * 2)))
 		{
-			ISample s = 0;
-			if (actch & 0x01) s  = ch[0].Calc();
-			if (actch & 0x04) s += ch[1].Calc();
-			if (actch & 0x10) s += ch[2].Calc();
-			s = IStoSample(s);
-			StoreSample(dest[0], s);
-			StoreSample(dest[1], s);
+			T* dest = buffer[c];
+			for (int i=0; i<nsamples; i++)
+				StoreSamples<1>(dest, IStoSample(ch[c].Calc()));
 		}
 	}
+	mixc = mixc1 = 0;
 #undef IStoSample
 }
 
+//	o͌`Ƃ̎
+template void OPN::Mix<int16, 1>(int16*, int);
+template void OPN::Mix<int16, 2>(int16*, int);
+template void OPN::Mix<int32, 1>(int32*, int);
+template void OPN::Mix<int32, 2>(int32*, int);
+template void OPN::Mix<float, 1>(float*, int);
+template void OPN::Mix<float, 2>(float*, int);
+template void OPN::MixIdle<int16, 1>(int16*, int);
+template void OPN::MixIdle<int16, 2>(int16*, int);
+template void OPN::MixIdle<int32, 1>(int32*, int);
+template void OPN::MixIdle<int32, 2>(int32*, int);
+template void OPN::MixIdle<float, 1>(float*, int);
+template void OPN::MixIdle<float, 2>(float*, int);
+template void OPN::MixChannels<int16>(int16* const*, int);
+template void OPN::MixChannels<int32>(int32* const*, int);
+template void OPN::MixChannels<float>(float* const*, int);
+
 #endif // BUILD_OPN
 
 // ---------------------------------------------------------------------------
@@ -16,7 +16,7 @@
 //	OPN/OPNA ɗǂ𐶐鉹jbg
 //	
 //	interface:
-//	bool Init(uint clock, uint rate, bool, const char* path);
+//	bool Init(uint clock, uint rate, bool ip, const char* path);
 //		D̃NXgpOɂȂ炸ĂłƁD
 //		OPNA ̏ꍇ͂̊֐ŃYTvǂݍ
 //
@@ -24,6 +24,9 @@
 //
 //		rate:	 PCM ̕W{g(Hz)
 //
+//		ip:		(OPN ̂) true Ȃ FM {̃[g (clock / 72) 
+//				Crate ɐ`Ԃ
+//
 //		path:	YTṽpX(OPNA ̂ݗL)
 //				ȗ̓JgfBNgǂݍ
 //				̖ɂ '\'  '/' Ȃǂ邱
@@ -46,6 +49,8 @@
 //		Ei[` L, R, L, R... ƂȂD
 //		E܂ŉZȂ̂ŁC炩ߔz[NAKv
 //		EFM_SAMPLETYPE  short ^̏ꍇNbsOs.
+//		EOPN ł dest ̌^ (int16/int32/float)  Channels (1:m 2:XeI) 
+//		  ev[gŎwł (Z̕@ misc.h  AddSample Q)
 //		E̊֐͉̃^C}[Ƃ͓ƗĂD
 //		  Timer  Count  GetNextEvent ő삷KvD
 //	
@@ -78,6 +83,13 @@
 //		ẻʂ{|ɒ߂DWl 0.
 //		Pʂ͖ 1/2 dBCL͈͂̏ 20 (10dB)
 //
+//	void SetPSGOversampling(int n)
+//		PSG  PCM 1 Tv̍񐔂 2^n ɂ (n: 0`3, W 2)
+//
+//	void SetEGShift(uint shift)
+//		FM  EG  2^shift 񕪂܂Ƃ߂čXV (W 0)
+//		傫ƃGx[v̕ωeȂ
+//
 namespace FM
 {
 	//	OPN Base -------------------------------------------------------
@@ -92,6 +104,8 @@ namespace FM
 		void	SetVolumeFM(int db);
 		void	SetVolumePSG(int db);
 		void	SetLPFCutoff(uint freq) {}	// obsolete
+		void	SetPSGOversampling(int n) { psg.SetOversampling(n); }
+		void	SetEGShift(uint shift) { chip.SetEGShift(shift); }
 
 	protected:
 		void	SetParameter(Channel4* ch, uint addr, uint data);
@@ -103,6 +117,7 @@ namespace FM
 		uint	clock;				// OPN NbN
 		uint	rate;				// FM [g
 		uint	psgrate;			// FMGen  o̓[g
+		bool	interpolation;		// FM {̃[gōCo̓[gɕԂ
 		uint	status;
 		Channel4* csmch;
 		
@@ -231,13 +246,27 @@ namespace FM
 		bool	SetRate(uint c, uint r, bool=false);
 		
 		void	Reset();
-		void 	Mix(Sample* buffer, int nsamples);
+		template<class T, int Channels = 2>
+		void 	Mix(T* buffer, int nsamples);
 		void 	SetReg(uint addr, uint data);
 		uint	GetReg(uint addr);
 		uint	ReadStatus() { return status & 0x03; }
 		uint	ReadStatusEx() { return 0xff; }
 		
 		void	SetChannelMask(uint mask);
+		bool	IsFMSilent();
+		bool	IsIdle();
+		template<class T, int Channels = 2>
+		void	MixIdle(T* buffer, int nsamples);
+		uint	GetPSGCounterUsage() { return psg.GetCounterUsage(); }
+		enum { levelsources = 15, psglevelsource = 12 };
+		void	PrepareLevels();
+		void	Skip(int nsamples);
+		void	GetLevels(float amplitude[levelsources], float frequency[levelsources]);
+		template<class Hash>
+		void	HashState(Hash& hash, uint psgusage) const;
+		template<class T>
+		void	MixChannels(T* const buffer[6], int nsamples);
 		
 		int		dbgGetOpOut(int c, int s) { return ch[c].op[s].dbgopout_; }
 		int		dbgGetPGOut(int c, int s) { return ch[c].op[s].dbgpgout_; }
@@ -248,11 +277,20 @@ namespace FM
 		
 		void	SetStatus(uint bit);
 		void	ResetStatus(uint bit);
+		void	SetFNum();
+		uint	CountCalc(int nsamples);
+		int		SkipMaskedChannels(uint count);
 		
+		uint	fmmask;			// }XN FM `l ( PG  EG i߂)
+		uint	levelch;		// PrepareLevels ̎_ŔĂ FM `l (Skip  GetLevels Ŏg)
 		uint	fnum[3];
 		uint	fnum3[3];
 		uint8	fnum2[6];
 		
+	// `ԗp[N
+		int32	mixc, mixc1;
+		uint	mixdelta;		// mixc1 o͈ʒu܂ł̎ (1 / (rate * psgrate) bP)
+		
 		Channel4 ch[3];
 	};
 
@@ -416,4 +454,22 @@ inline void FM::OPNBase::SetVolumePSG(int db)
 	psg.SetVolume(db);
 }
 
+//	WX^̒lłȌ̏o͂ς (FM  PG/EG, PSG ̃JE^, }XN, Ԃ̃[N) nbVlɉ
+//	lɂȂ 2 _̌́AWX^݂̏ɑ΂ēo͂ɂȂ
+//	psgusage:  PSG ̃JE^ (GetPSGCounterUsage ̒l 2 _̊Ԃł܂Ƃ߂)
+template<class Hash>
+void FM::OPN::HashState(Hash& hash, uint psgusage) const
+{
+	for (int c=0; c<3; c++)
+	{
+		for (int i=0; i<4; i++)
+			ch[c].op[i].HashState(hash);
+	}
+	psg.HashState(hash, psgusage);
+	hash.Add(fmmask);
+	hash.Add(mixc);
+	hash.Add(mixc1);
+	hash.Add(mixdelta);
+}
+
 #endif // FM_OPNA_H
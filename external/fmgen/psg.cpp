@@ -13,10 +13,12 @@
 //
 PSG::PSG()
 {
-	SetVolume(0);
+	oversampling = 2;
+	mask = 0x3f;
+	volume = 0;
+	MakeVolumeTable();
 	MakeNoiseTable();
 	Reset();
-	mask = 0x3f;
 }
 
 PSG::~PSG()
@@ -29,6 +31,10 @@ PSG::~PSG()
 //
 void PSG::Reset()
 {
+	for (int i=0; i<3; i++)
+		scount[i] = 0;
+	ncount = 0;
+
 	for (int i=0; i<14; i++)
 		SetReg(i, 0);
 	SetReg(7, 0xff);
@@ -59,12 +65,38 @@ void PSG::SetClock(int clock, int rate)
 	eperiod = tmp ? eperiodbase / tmp : eperiodbase * 2;
 }
 
+// ---------------------------------------------------------------------------
+//	I[o[TvO̐ݒ (PCM 1 Tv 2^n 񍇐)
+//	JE^ 2^oversampling {̒PʂŎĂ̂ŁC킹Ă
+//
+void PSG::SetOversampling(int n)
+{
+	n = Limit(n, 3, 0);
+	int d = n - oversampling;
+	if (d > 0)
+	{
+		for (int i=0; i<3; i++)
+			scount[i] <<= d;
+		ncount <<= d;
+		ecount <<= d;
+	}
+	else if (d < 0)
+	{
+		for (int i=0; i<3; i++)
+			scount[i] >>= -d;
+		ncount >>= -d;
+		ecount >>= -d;
+	}
+	oversampling = n;
+}
+
 // ---------------------------------------------------------------------------
 //	mCYe[u쐬
 //
 void PSG::MakeNoiseTable()
 {
-	if (!noisetable[0])
+	// ʃXbhœɍĂx쐬
+	static const bool made = []
 	{
 		int noise = 14321;
 		for (int i=0; i<noisetablesize; i++)
@@ -77,14 +109,27 @@ void PSG::MakeNoiseTable()
 			}
 			noisetable[i] = n;
 		}
-	}
+		return true;
+	}();
+	(void)made;
 }
 
 // ---------------------------------------------------------------------------
 //	o̓e[u쐬
 //	fɃe[uŎقȃXy[XB
+//	ʂ Init ꍇ (ėpȂ) ̓e[u蒼Ȃ
 //
-void PSG::SetVolume(int volume)
+void PSG::SetVolume(int vol)
+{
+	if (vol == volume)
+		return;
+	volume = vol;
+	MakeVolumeTable();
+
+	SetChannelMask(~mask);
+}
+
+void PSG::MakeVolumeTable()
 {
 	double base = 0x4000 / 3.0 * pow(10.0, volume / 40.0);
 	for (int i=31; i>=2; i--)
@@ -95,8 +140,6 @@ void PSG::SetVolume(int volume)
 	EmitTable[1] = 0;
 	EmitTable[0] = 0;
 	MakeEnvelopTable();
-
-	SetChannelMask(~mask);
 }
 
 void PSG::SetChannelMask(int c)
@@ -198,14 +241,116 @@ void PSG::SetReg(uint regnum, uint8 data)
 }
 
 // ---------------------------------------------------------------------------
+//	o͂肩ǂ
+//	Gx[vgpAe`l̏o̓x 0 ( 0 ܂̓}XN) 
+//	g[EmCYƂɖȂAJE^̒lɂ炸ɂȂ
+//	}XN`lGx[vgpĂꍇ́A}XNƂ
+//	Gx[v̈ʒu悤AăJE^i߂
+//
+bool PSG::IsIdle()
+{
+	uint8 r7 = ~reg[7];
+	for (int c=0; c<3; c++)
+	{
+		if (reg[8+c] & 0x10)
+			return false;
+		bool tone = (r7 & (1 << c)) && (speriod[c] <= (1 << toneshift));
+		bool noise = (r7 >> (3+c)) & 1;
+		if (olevel[c] && (tone || noise))
+			return false;
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+//	݂̃WX^̒lŏo͂JE^̒lɈˑ
+//	rbg 0-2: `lƂ̃g[, 3: mCY, 4: Gx[v
+//	o̓x 0 Ńg[EmCYƂȃ`ĺAJE^ɂ炸̒lɂȂ
 //
+uint PSG::GetCounterUsage()
+{
+	uint8 r7 = ~reg[7];
+	uint usage = 0;
+	for (int c=0; c<3; c++)
+	{
+		bool env = (reg[8+c] & 0x10) != 0;
+		if (!env && !olevel[c])
+			continue;
+		if (r7 & (1 << c))
+			usage |= 1 << c;
+		if (r7 & (8 << c))
+			usage |= 8;
+		if (env)
+			usage |= 16;
+	}
+	return usage;
+}
+
+// ---------------------------------------------------------------------------
+//	IsIdle() ̊Ԃ PCM f[^fo(2ch)
+//	Ɉ̏o͂݁AMix ƓJE^i߂
+//
+template<class T, int Channels>
+void PSG::MixIdle(T* dest, int nsamples)
+{
+	uint8 r7 = ~reg[7];
+	if (!((r7 & 0x3f) | ((reg[8] | reg[9] | reg[10]) & 0x1f)))
+		return;
+	
+	// g[EmCYƂɖȃ`l -olevel o͂
+	int sample = -int(olevel[0] + olevel[1] + olevel[2]);
+	if (sample)
+	{
+		for (int i=0; i<nsamples; i++)
+			StoreSamples<Channels>(dest, sample);
+	}
+	AdvanceIdle(nsamples);
+}
+
+//	IsIdle() ̊Ԃ nsamples ̂ƓJE^i߂
+void PSG::AdvanceIdle(int nsamples)
+{
+	uint8 r7 = ~reg[7];
+	uint32 n = uint32(nsamples) << oversampling;
+	for (int c=0; c<3; c++)
+		scount[c] += speriod[c] * n;
+	if (r7 & 0x38)
+		ncount += nperiod * n;
+	
+	ecount = (ecount >> 8) + (eperiod >> (8-oversampling)) * nsamples;
+	if (ecount >= (1u << (envshift+6+oversampling-8)))
+	{
+		if ((reg[0x0d] & 0x0b) != 0x0a)
+			ecount |= (1u << (envshift+5+oversampling-8));
+		ecount &= (1u << (envshift+6+oversampling-8)) - 1;
+	}
+	ecount <<= 8;
+}
+
+// ---------------------------------------------------------------------------
+//	 nsamples JE^i߂ (ʂςꍇp)
+//
+void PSG::Skip(int nsamples)
+{
+	AdvanceIdle(nsamples);
+}
+
+// ---------------------------------------------------------------------------
+//	݂̏o͂̃`lƂ̐U (}1.0 ) Ǝg (o 1 Tv̎)
+//	g[EmCYƂɖȃ`l͈̒lo͂邽 0AmCỸ`l̎g 0 Ƃ
 //
-inline void PSG::StoreSample(Sample& dest, int32 data)
+void PSG::GetLevels(float amplitude[3], float frequency[3])
 {
-	if (sizeof(Sample) == 2)
-		dest = (Sample) Limit(dest + data, 0x7fff, -0x8000);
-	else
-		dest += data;
+	uint8 r7 = ~reg[7];
+	uint env = envelop[ecount >> (envshift+oversampling)];
+	for (int c=0; c<3; c++)
+	{
+		bool tone = (r7 & (1 << c)) && (speriod[c] <= (1 << toneshift));
+		bool noise = (r7 >> (3+c)) & 1;
+		uint level = ((mask & (1 << c)) && (reg[8+c] & 0x10)) ? env : olevel[c];
+		amplitude[c] = (tone || noise) ? level * (1.0f / 32768.0f) : 0.0f;
+		frequency[c] = tone ? speriod[c] / float(1u << (toneshift+1)) : 0.0f;
+	}
 }
 
 // ---------------------------------------------------------------------------
@@ -213,7 +358,27 @@ inline void PSG::StoreSample(Sample& dest, int32 data)
 //	dest		PCM f[^WJ|C^
 //	nsamples	WJ PCM ̃Tv
 //
-void PSG::Mix(Sample* dest, int nsamples)
+template<class T, int Channels>
+void PSG::Mix(T* dest, int nsamples)
+{
+	if (IsIdle())
+	{
+		MixIdle<T, Channels>(dest, nsamples);
+		return;
+	}
+	
+	// ̃[vWJł悤CI[o[TvỎ񐔂ƂɎ̂𕪂
+	switch (oversampling)
+	{
+	case 0:	MixImpl<T, Channels, 0>(dest, nsamples); break;
+	case 1:	MixImpl<T, Channels, 1>(dest, nsamples); break;
+	case 2:	MixImpl<T, Channels, 2>(dest, nsamples); break;
+	case 3:	MixImpl<T, Channels, 3>(dest, nsamples); break;
+	}
+}
+
+template<class T, int Channels, int Oversampling>
+void PSG::MixImpl(T* dest, int nsamples)
 {
 	uint8 chenable[3], nenable[3];
 	uint8 r7 = ~reg[7];
@@ -233,9 +398,10 @@ void PSG::Mix(Sample* dest, int nsamples)
 		uint* p2 = ((mask & 2) && (reg[ 9] & 0x10)) ? &env : &olevel[1];
 		uint* p3 = ((mask & 4) && (reg[10] & 0x10)) ? &env : &olevel[2];
 		
-		#define SCOUNT(ch)	(scount[ch] >> (toneshift+oversampling))
+		#define SCOUNT(ch)	(scount[ch] >> (toneshift+Oversampling))
 		
-		if (p1 != &env && p2 != &env && p3 != &env)
+		// }XN`l̃Gx[vA܂Ƃ߂Đi߂ƈʒu邽ߓ
+		if (!((reg[8] | reg[9] | reg[10]) & 0x10))
 		{
 			// Gx[v
 			if ((r7 & 0x38) == 0)
@@ -244,7 +410,7 @@ void PSG::Mix(Sample* dest, int nsamples)
 				for (int i=0; i<nsamples; i++)
 				{
 					sample = 0;
-					for (int j=0; j < (1 << oversampling); j++)
+					for (int j=0; j < (1 << Oversampling); j++)
 					{
 						int x, y, z;
 						x = (SCOUNT(0) & chenable[0]) - 1;
@@ -257,10 +423,8 @@ void PSG::Mix(Sample* dest, int nsamples)
 						sample += (olevel[2] + z) ^ z;
 						scount[2] += speriod[2];
 					}
-					sample /= (1 << oversampling);
-					StoreSample(dest[0], sample);
-					StoreSample(dest[1], sample);
-					dest += 2;
+					sample /= (1 << Oversampling);
+					StoreSamples<Channels>(dest, sample);
 				}
 			}
 			else
@@ -269,14 +433,14 @@ void PSG::Mix(Sample* dest, int nsamples)
 				for (int i=0; i<nsamples; i++)
 				{
 					sample = 0;
-					for (int j=0; j < (1 << oversampling); j++)
+					for (int j=0; j < (1 << Oversampling); j++)
 					{
 #ifdef _M_IX86
-						noise = noisetable[(ncount >> (noiseshift+oversampling+6)) & (noisetablesize-1)] 
-							>> (ncount >> (noiseshift+oversampling+1));
+						noise = noisetable[(ncount >> (noiseshift+Oversampling+6)) & (noisetablesize-1)] 
+							>> (ncount >> (noiseshift+Oversampling+1));
 #else
-						noise = noisetable[(ncount >> (noiseshift+oversampling+6)) & (noisetablesize-1)] 
-							>> (ncount >> (noiseshift+oversampling+1) & 31);
+						noise = noisetable[(ncount >> (noiseshift+Oversampling+6)) & (noisetablesize-1)] 
+							>> (ncount >> (noiseshift+Oversampling+1) & 31);
 #endif
 						ncount += nperiod;
 
@@ -291,20 +455,18 @@ void PSG::Mix(Sample* dest, int nsamples)
 						sample += (olevel[2] + z) ^ z;
 						scount[2] += speriod[2];
 					}
-					sample /= (1 << oversampling);
-					StoreSample(dest[0], sample);
-					StoreSample(dest[1], sample);
-					dest += 2;
+					sample /= (1 << Oversampling);
+					StoreSamples<Channels>(dest, sample);
 				}
 			}
 
 			// Gx[v̌vZڂK킹
-			ecount = (ecount >> 8) + (eperiod >> (8-oversampling)) * nsamples;
-			if (ecount >= (1 << (envshift+6+oversampling-8)))
+			ecount = (ecount >> 8) + (eperiod >> (8-Oversampling)) * nsamples;
+			if (ecount >= (1u << (envshift+6+Oversampling-8)))
 			{
 				if ((reg[0x0d] & 0x0b) != 0x0a)
-					ecount |= (1 << (envshift+5+oversampling-8));
-				ecount &= (1 << (envshift+6+oversampling-8)) - 1;
+					ecount |= (1u << (envshift+5+Oversampling-8));
+				ecount &= (1u << (envshift+6+Oversampling-8)) - 1;
 			}
 			ecount <<= 8;
 		}
@@ -314,22 +476,22 @@ void PSG::Mix(Sample* dest, int nsamples)
 			for (int i=0; i<nsamples; i++)
 			{
 				sample = 0;
-				for (int j=0; j < (1 << oversampling); j++)
+				for (int j=0; j < (1 << Oversampling); j++)
 				{
-					env = envelop[ecount >> (envshift+oversampling)];
+					env = envelop[ecount >> (envshift+Oversampling)];
 					ecount += eperiod;
-					if (ecount >= (1 << (envshift+6+oversampling)))
+					if (ecount >= (1u << (envshift+6+Oversampling)))
 					{
 						if ((reg[0x0d] & 0x0b) != 0x0a)
-							ecount |= (1 << (envshift+5+oversampling));
-						ecount &= (1 << (envshift+6+oversampling)) - 1;
+							ecount |= (1u << (envshift+5+Oversampling));
+						ecount &= (1u << (envshift+6+Oversampling)) - 1;
 					}
 #ifdef _M_IX86
-					noise = noisetable[(ncount >> (noiseshift+oversampling+6)) & (noisetablesize-1)] 
-						>> (ncount >> (noiseshift+oversampling+1));
+					noise = noisetable[(ncount >> (noiseshift+Oversampling+6)) & (noisetablesize-1)] 
+						>> (ncount >> (noiseshift+Oversampling+1));
 #else
-					noise = noisetable[(ncount >> (noiseshift+oversampling+6)) & (noisetablesize-1)] 
-						>> (ncount >> (noiseshift+oversampling+1) & 31);
+					noise = noisetable[(ncount >> (noiseshift+Oversampling+6)) & (noisetablesize-1)] 
+						>> (ncount >> (noiseshift+Oversampling+1) & 31);
 #endif
 					ncount += nperiod;
 
@@ -344,18 +506,140 @@ void PSG::Mix(Sample* dest, int nsamples)
 					sample += (*p3 + z) ^ z;
 					scount[2] += speriod[2];
 				}
-				sample /= (1 << oversampling);
-				StoreSample(dest[0], sample);
-				StoreSample(dest[1], sample);
-				dest += 2;
+				sample /= (1 << Oversampling);
+				StoreSamples<Channels>(dest, sample);
 			}
 		}
 	}
 }
 
+// ---------------------------------------------------------------------------
+//	`lƂ PCM f[^fo (m)
+//	dest		`l A-C  PCM f[^WJ|C^
+//	Mix ƓJE^i߁Ae`l̏o̘͂a Mix ̏o͂Ɠ
+//	(I[o[TvO̕ς̊ۂ߂ɂ鍷)
+//
+template<class T>
+void PSG::MixChannels(T* const dest[3], int nsamples)
+{
+	uint8 r7 = ~reg[7];
+	if (!((r7 & 0x3f) | ((reg[8] | reg[9] | reg[10]) & 0x1f)))
+		return;
+	
+	if (IsIdle())
+	{
+		for (int c=0; c<3; c++)
+		{
+			T* d = dest[c];
+			if (olevel[c])
+			{
+				for (int i=0; i<nsamples; i++)
+					StoreSamples<1>(d, -int(olevel[c]));
+			}
+		}
+		AdvanceIdle(nsamples);
+		return;
+	}
+	
+	switch (oversampling)
+	{
+	case 0:	MixChannelsImpl<T, 0>(dest, nsamples); break;
+	case 1:	MixChannelsImpl<T, 1>(dest, nsamples); break;
+	case 2:	MixChannelsImpl<T, 2>(dest, nsamples); break;
+	case 3:	MixChannelsImpl<T, 3>(dest, nsamples); break;
+	}
+}
+
+//	MixImpl ƓɃJE^i߁A`lƂɏo͂
+template<class T, int Oversampling>
+void PSG::MixChannelsImpl(T* const dest[3], int nsamples)
+{
+	uint8 chenable[3], nenable[3];
+	uint8 r7 = ~reg[7];
+	uint env = 0;
+	uint* p[3];
+	for (int c=0; c<3; c++)
+	{
+		chenable[c] = (r7 & (1 << c)) && (speriod[c] <= (1 << toneshift));
+		nenable[c]  = (r7 >> (3+c)) & 1;
+		p[c] = ((mask & (1 << c)) && (reg[8+c] & 0x10)) ? &env : &olevel[c];
+	}
+	bool useenv = ((reg[8] | reg[9] | reg[10]) & 0x10) != 0;
+	bool usenoise = useenv || (r7 & 0x38);
+	
+	T* d[3] = { dest[0], dest[1], dest[2] };
+	for (int i=0; i<nsamples; i++)
+	{
+		int sample[3] = { 0, 0, 0 };
+		for (int j=0; j < (1 << Oversampling); j++)
+		{
+			if (useenv)
+			{
+				env = envelop[ecount >> (envshift+Oversampling)];
+				ecount += eperiod;
+				if (ecount >= (1u << (envshift+6+Oversampling)))
+				{
+					if ((reg[0x0d] & 0x0b) != 0x0a)
+						ecount |= (1u << (envshift+5+Oversampling));
+					ecount &= (1u << (envshift+6+Oversampling)) - 1;
+				}
+			}
+			int noise = 0;
+			if (usenoise)
+			{
+#ifdef _M_IX86
+				noise = noisetable[(ncount >> (noiseshift+Oversampling+6)) & (noisetablesize-1)] 
+					>> (ncount >> (noiseshift+Oversampling+1));
+#else
+				noise = noisetable[(ncount >> (noiseshift+Oversampling+6)) & (noisetablesize-1)] 
+					>> (ncount >> (noiseshift+Oversampling+1) & 31);
+#endif
+				ncount += nperiod;
+			}
+			
+			for (int c=0; c<3; c++)
+			{
+				int x = (((scount[c] >> (toneshift+Oversampling)) & chenable[c]) | (nenable[c] & noise)) - 1;
+				sample[c] += (*p[c] + x) ^ x;
+				scount[c] += speriod[c];
+			}
+		}
+		for (int c=0; c<3; c++)
+			StoreSamples<1>(d[c], sample[c] / (1 << Oversampling));
+	}
+	
+	if (!useenv)
+	{
+		// Gx[v̌vZڂK킹 (MixImpl Ɠ)
+		ecount = (ecount >> 8) + (eperiod >> (8-Oversampling)) * nsamples;
+		if (ecount >= (1u << (envshift+6+Oversampling-8)))
+		{
+			if ((reg[0x0d] & 0x0b) != 0x0a)
+				ecount |= (1u << (envshift+5+Oversampling-8));
+			ecount &= (1u << (envshift+6+Oversampling-8)) - 1;
+		}
+		ecount <<= 8;
+	}
+}
+
+//	o͌`Ƃ̎
+template void PSG::Mix<int16, 1>(int16*, int);
+template void PSG::Mix<int16, 2>(int16*, int);
+template void PSG::Mix<int32, 1>(int32*, int);
+template void PSG::Mix<int32, 2>(int32*, int);
+template void PSG::Mix<float, 1>(float*, int);
+template void PSG::Mix<float, 2>(float*, int);
+template void PSG::MixIdle<int16, 1>(int16*, int);
+template void PSG::MixIdle<int16, 2>(int16*, int);
+template void PSG::MixIdle<int32, 1>(int32*, int);
+template void PSG::MixIdle<int32, 2>(int32*, int);
+template void PSG::MixIdle<float, 1>(float*, int);
+template void PSG::MixIdle<float, 2>(float*, int);
+template void PSG::MixChannels<int16>(int16* const*, int);
+template void PSG::MixChannels<int32>(int32* const*, int);
+template void PSG::MixChannels<float>(float* const*, int);
+
 // ---------------------------------------------------------------------------
 //	e[u
 //
 uint	PSG::noisetable[noisetablesize] = { 0, };
-int		PSG::EmitTable[0x20] = { -1, };
-uint	PSG::enveloptable[16][64] = { 0, };
@@ -27,6 +27,8 @@
 //	void Mix(Sample* dest, int nsamples)
 //		PCM  nsamples C dest Ŏn܂zɉ(Z)
 //		܂ŉZȂ̂ŁCŏɔz[NAKv
+//		dest ̌^ (int16/int32/float)  Channels (1:m 2:XeI) 
+//		ev[gŎw肷 (Z̕@ misc.h  AddSample Q)
 //	
 //	void Reset()
 //		Zbg
@@ -41,6 +43,10 @@
 //		ẻʂ𒲐߂
 //		Pʂ͖ 1/2 dB
 //
+//	void SetOversampling(int n)
+//		PCM 1 Tv 2^n  (n: 0`3, W 2) ĕς
+//		葬xDȂ猸炷Ƃ
+//
 class PSG
 {
 public:
@@ -52,27 +58,43 @@ public:
 		toneshift = 24,
 		envshift = 22,
 		noiseshift = 14,
-		oversampling = 2,		//  葬xDȂ猸炷Ƃ
 	};
 
 public:
 	PSG();
 	~PSG();
 
-	void Mix(Sample* dest, int nsamples);
+	template<class T, int Channels = 2>
+	void Mix(T* dest, int nsamples);
+	template<class T, int Channels = 2>
+	void MixIdle(T* dest, int nsamples);
+	template<class T>
+	void MixChannels(T* const dest[3], int nsamples);
+	bool IsIdle();
+	uint GetCounterUsage();
+	void Skip(int nsamples);
+	void GetLevels(float amplitude[3], float frequency[3]);
+	template<class Hash>
+	void HashState(Hash& hash, uint usage) const;
 	void SetClock(int clock, int rate);
 	
 	void SetVolume(int vol);
 	void SetChannelMask(int c);
+	void SetOversampling(int n);
 	
 	void Reset();
 	void SetReg(uint regnum, uint8 data);
 	uint GetReg(uint regnum) { return reg[regnum & 0x0f]; }
 
 protected:
+	template<class T, int Channels, int Oversampling>
+	void MixImpl(T* dest, int nsamples);
+	template<class T, int Oversampling>
+	void MixChannelsImpl(T* const dest[3], int nsamples);
+	void AdvanceIdle(int nsamples);
 	void MakeNoiseTable();
+	void MakeVolumeTable();
 	void MakeEnvelopTable();
-	static void StoreSample(Sample& dest, int32 data);
 	
 	uint8 reg[16];
 
@@ -86,10 +108,34 @@ protected:
 	uint32 nperiodbase;
 	int volume;
 	int mask;
+	int oversampling;
 
-	static uint enveloptable[16][64];
+	// ʂŕςe[u͉ƂɎ (̉ SetVolume ̉e󂯂Ȃ)
+	uint enveloptable[16][64];
+	int EmitTable[32];
 	static uint noisetable[noisetablesize];
-	static int EmitTable[32];
 };
 
+// ---------------------------------------------------------------------------
+//	Ȍ̏o͂߂JE^nbVlɉ
+//	JE^͔ĂȂԂi݁Aɔ̈ʑɂȂ
+//	usage (GetCounterUsage ̒l) Ɋ܂܂ȂJE^͉Ȃ
+//	g[͏o͂Ɏgrbg
+//
+template<class Hash>
+void PSG::HashState(Hash& hash, uint usage) const
+{
+	hash.Add(usage);
+	for (int c=0; c<3; c++)
+	{
+		if (usage & (1 << c))
+			hash.Add(uint32(scount[c] & ((1u << (toneshift+oversampling+1)) - 1)));
+	}
+	if (usage & 8)
+		hash.Add(ncount);
+	if (usage & 16)
+		hash.Add(ecount);
+	hash.Add(mask);
+}
+
 #endif // PSG_H
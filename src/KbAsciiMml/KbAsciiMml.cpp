@@ -1,9 +1,26 @@
-﻿#include "musiccom/musiccom.h"
+﻿#include "musiccom/capturewriter.h"
+#include "musiccom/musiccom.h"
+#include "musiccom/periodic.h"
+#include "musiccom/prefetcher.h"
+#include "musiccom/soundparser.h"
 #include "resource.h"
 #include <Windows.h>
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
 #include <kmp_pi.h>
+#include <memory>
 #include <shlwapi.h>
+#include <sstream>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
 
 #pragma comment(lib, "Shlwapi.lib")
 
@@ -29,42 +46,290 @@ T GetSetting(LPCWSTR fileName, LPCWSTR key, T defaultValue)
     }
 }
 
+std::wstring GetIniFileName()
+{
+    wchar_t iniName[MAX_PATH];
+    GetModuleFileNameW(hDllModule, iniName, sizeof(iniName));
+    PathRemoveExtensionW(iniName);
+    PathAddExtensionW(iniName, L".ini");
+    return iniName;
+}
+
+std::wstring GetStringSetting(LPCWSTR fileName, LPCWSTR key)
+{
+    wchar_t buf[MAX_PATH];
+    GetPrivateProfileStringW(L"KbAsciiMml", key, L"", buf, MAX_PATH, fileName);
+    return buf;
+}
+
+// パートの一覧 (チャンネル番号 1-6 と D の並び、例: "13D") をパート番号のビットに変換する
+uint32_t ParseParts(const std::wstring& parts)
+{
+    uint32_t result = 0;
+    for (auto c : parts)
+    {
+        if (L'1' <= c && c <= L'6')
+        {
+            result |= 1u << (c - L'1');
+        }
+        else if (c == L'D' || c == L'd')
+        {
+            result |= 1u << 6;
+        }
+    }
+    return result;
+}
+
 class KbAsciiMml
 {
 public:
     KbAsciiMml();
-    BOOL Open(const char* cszFileName, SOUNDINFO* pInfo);
+    // prefetch: 次の曲の先読み (エラーを表示せず、録音は TakeOver まで始めない)
+    BOOL Open(const char* cszFileName, SOUNDINFO* pInfo, bool prefetch = false);
+    // 先読みで準備した曲を、Open した場合と同じ状態にする
+    void TakeOver(SOUNDINFO* pInfo);
+    BOOL OpenFromBuffer(const BYTE* Buffer, DWORD dwSize, SOUNDINFO* pInfo);
     DWORD Render(BYTE* pBuffer, DWORD dwSize);
     DWORD SetPosition(DWORD dwPos);
     ~KbAsciiMml();
 
 private:
+    BOOL OpenImpl(const char* name, SOUNDINFO* pInfo, std::function<bool()> load, bool prefetch);
+    void StartStatisticsWriter();
+    void WatchStatistics(std::stop_token stop);
+    void WriteStatistics();
+    void StartReloadWatcher();
+    void WatchReload(std::stop_token stop);
+    void LoadLiveSettings();
+    void WatchSettings(std::stop_token stop);
+    void StartCapture(const char* name);
+    void CloseCapture();
+
     MusicCom::MusicCom musicCom;
     uint bytespersample;
+    // 出力形式 (16: 16bit 整数, 32: 32bit 整数, -32: 32bit 浮動小数点)
+    int bitsPerSample;
+    uint channels;
     SOUNDINFO info;
+
+    // 処理時間の統計
+    std::string fileName;
+    std::wstring statisticsLogName;
+    uint statisticsInterval; // 秒
+    uint statisticsIntervalSamples;
+    uint statisticsSamples;
+
+    // 編集中の MML の再読み込み
+    bool hotReload;
+    std::filesystem::file_time_type lastWriteTime;
+
+    // 演奏中の設定の変更 (音量・効果音のテンポ・パートのミュート)
+    std::wstring iniFileName;
+    std::filesystem::file_time_type iniWriteTime;
+
+    // 演奏した PCM の録音
+    std::filesystem::path captureDirectory;
+    MusicCom::CaptureWriter::Format captureFormat;
+    size_t captureBufferSize;
+    std::wstring captureLogName; // 書き込みが間に合わずに欠けた録音を記録する
+    std::string capturePath;
+    std::unique_ptr<MusicCom::CaptureWriter> capture;
+    // 最初に破棄して監視を止めるため最後に宣言する
+    std::jthread settingsWatcher;
+    // 統計のファイルへの書き出し (演奏のスレッドは集計を渡すだけで待たない)
+    std::jthread statisticsWriter;
+    // 編集中の MML の更新の確認と解析 (演奏のスレッドには解析済みのデータだけを渡す)
+    std::jthread reloadWatcher;
 };
 
+// 再読み込みのためにファイルの更新を確認する間隔 (実時間)
+static const std::chrono::milliseconds HOT_RELOAD_INTERVAL(250);
+// 演奏中の設定の変更を確認する間隔 (実時間)
+static const std::chrono::milliseconds SETTINGS_WATCH_INTERVAL(250);
+// 書き出し待ちの統計を確認する間隔 (実時間)
+static const std::chrono::milliseconds STATISTICS_WRITE_INTERVAL(500);
+
 KbAsciiMml::KbAsciiMml()
+    : bytespersample(0),
+      bitsPerSample(16),
+      channels(2),
+      info(),
+      statisticsInterval(0),
+      statisticsIntervalSamples(0),
+      statisticsSamples(0),
+      hotReload(false),
+      captureFormat(MusicCom::CaptureWriter::Format::WAV),
+      captureBufferSize(0)
 {
-    wchar_t iniName[MAX_PATH];
-    GetModuleFileNameW(hDllModule, iniName, sizeof(iniName));
-    PathRemoveExtensionW(iniName);
-    PathAddExtensionW(iniName, L".ini");
+    iniFileName = GetIniFileName();
+    auto iniName = iniFileName.c_str();
+
+    LoadLiveSettings();
+
+    int bits = GetSetting(iniName, L"BitsPerSample", 16);
+    bitsPerSample = (bits == 32 || bits == -32) ? bits : 16;
+    channels = (GetSetting(iniName, L"Channels", 2) == 1) ? 1 : 2;
+    musicCom.SetChannels(channels);
+    musicCom.EnableNativeRate(GetSetting(iniName, L"NativeRate", 0) != 0);
+    switch (GetSetting(iniName, L"Quality", 1))
+    {
+    case 0:
+        musicCom.SetQuality(MusicCom::MusicCom::Quality::Draft);
+        break;
+    case 2:
+        musicCom.SetQuality(MusicCom::MusicCom::Quality::High);
+        break;
+    default:
+        musicCom.SetQuality(MusicCom::MusicCom::Quality::Standard);
+        break;
+    }
+
+    auto songCacheDirectory = GetStringSetting(iniName, L"SongCacheDirectory");
+    if (!songCacheDirectory.empty())
+    {
+        musicCom.SetSongCacheDirectory(std::filesystem::path(songCacheDirectory).string());
+    }
+
+    int loopCacheSize = GetSetting(iniName, L"LoopCacheSize", 0);
+    if (loopCacheSize > 0)
+    {
+        musicCom.SetLoopCacheSize(static_cast<size_t>(loopCacheSize) * 1024 * 1024);
+    }
+
+    if (GetSetting(iniName, L"HotReload", 0) != 0)
+    {
+        hotReload = true;
+        musicCom.EnableHotReload(true);
+    }
+
+    // 統計などはプラグインと同じディレクトリの KbAsciiMml.log に追記する
+    wchar_t logName[MAX_PATH];
+    wcscpy_s(logName, iniName);
+    PathRenameExtensionW(logName, L".log");
+
+    if (GetSetting(iniName, L"Statistics", 0) != 0)
+    {
+        statisticsLogName = logName;
+        int interval = GetSetting(iniName, L"StatisticsInterval", 10);
+        statisticsInterval = (interval > 0) ? interval : 10;
+        musicCom.EnableStatistics(true);
+    }
 
-    int fmvol = GetSetting(iniName, L"FMVolume", 0);
-    int psgvol = GetSetting(iniName, L"PSGVolume", 0);
-    int soundtempo = GetSetting(iniName, L"SoundTempo", MusicCom::MusicCom::SOUND_EFFECT_DEFAULT_TEMPO);
+    auto captureDirectorySetting = GetStringSetting(iniName, L"CaptureDirectory");
+    if (!captureDirectorySetting.empty())
+    {
+        captureDirectory = captureDirectorySetting;
+        captureLogName = logName;
+        if (GetSetting(iniName, L"CaptureFormat", 0) == 1)
+        {
+            captureFormat = MusicCom::CaptureWriter::Format::RAW;
+        }
+        int bufferSize = GetSetting(iniName, L"CaptureBufferSize", 4);
+        captureBufferSize = static_cast<size_t>((bufferSize > 0) ? bufferSize : 4) * 1024 * 1024;
+    }
 
+    if (GetSetting(iniName, L"LiveSettings", 0) != 0)
+    {
+        // 音量などは再生を止めずに反映できるため、ini の更新を別スレッドで監視する
+        std::error_code ec;
+        iniWriteTime = std::filesystem::last_write_time(iniFileName, ec);
+        settingsWatcher = std::jthread(
+            [this](std::stop_token stop)
+            {
+                WatchSettings(stop);
+            });
+    }
+}
+
+void KbAsciiMml::LoadLiveSettings()
+{
+    int fmvol = GetSetting(iniFileName.c_str(), L"FMVolume", 0);
+    int psgvol = GetSetting(iniFileName.c_str(), L"PSGVolume", 0);
+    int soundtempo = GetSetting(iniFileName.c_str(), L"SoundTempo", MusicCom::MusicCom::SOUND_EFFECT_DEFAULT_TEMPO);
+    int mastergain = GetSetting(iniFileName.c_str(), L"MasterGain", 0);
+    uint32_t muteParts = ParseParts(GetStringSetting(iniFileName.c_str(), L"MuteParts"));
+    uint32_t soloParts = ParseParts(GetStringSetting(iniFileName.c_str(), L"SoloParts"));
+
+    // 演奏中に呼ばれても、演奏側が次のフレームの区切りで反映する
     musicCom.SetFMVolume(fmvol);
     musicCom.SetPSGVolume(psgvol);
     musicCom.SetSoundTempo(soundtempo);
+    musicCom.SetMasterGain(mastergain);
+    for (int part = 0; part < 7; part++)
+    {
+        musicCom.SetPartMute(part, (muteParts >> part) & 1);
+        musicCom.SetPartSolo(part, (soloParts >> part) & 1);
+    }
+}
+
+void KbAsciiMml::WatchSettings(std::stop_token stop)
+{
+    // 一定間隔で ini の更新を確認し、停止を要求されたらすぐに抜ける
+    MusicCom::RunPeriodically(
+        stop,
+        SETTINGS_WATCH_INTERVAL,
+        [this]()
+        {
+            std::error_code ec;
+            auto writeTime = std::filesystem::last_write_time(iniFileName, ec);
+            if (ec || writeTime == iniWriteTime)
+            {
+                return;
+            }
+            iniWriteTime = writeTime;
+            LoadLiveSettings();
+        });
 }
 
 KbAsciiMml::~KbAsciiMml()
 {
+    if (statisticsWriter.joinable())
+    {
+        // 演奏は終わっているので、書き出しのスレッドを止めてから残りの統計をここで書き出す
+        statisticsWriter.request_stop();
+        statisticsWriter.join();
+        WriteStatistics();
+        if (statisticsSamples > 0 && musicCom.PublishStatistics())
+        {
+            WriteStatistics();
+        }
+    }
+    CloseCapture();
 }
 
-BOOL KbAsciiMml::Open(const char* cszFileName, SOUNDINFO* pInfo)
+BOOL KbAsciiMml::Open(const char* cszFileName, SOUNDINFO* pInfo, bool prefetch)
+{
+    if (hotReload)
+    {
+        std::error_code ec;
+        lastWriteTime = std::filesystem::last_write_time(cszFileName, ec);
+    }
+    return OpenImpl(
+        cszFileName,
+        pInfo,
+        [this, cszFileName]()
+        {
+            return musicCom.Load(cszFileName);
+        },
+        prefetch);
+}
+
+BOOL KbAsciiMml::OpenFromBuffer(const BYTE* Buffer, DWORD dwSize, SOUNDINFO* pInfo)
+{
+    // SOUND.DAT は参照できないため組み込みのデータを使用する
+    return OpenImpl(
+        "(memory)",
+        pInfo,
+        [this, Buffer, dwSize]()
+        {
+            // 再読み込みするファイルがない
+            hotReload = false;
+            return musicCom.Load(reinterpret_cast<const char*>(Buffer), dwSize);
+        },
+        false);
+}
+
+BOOL KbAsciiMml::OpenImpl(const char* name, SOUNDINFO* pInfo, std::function<bool()> load, bool prefetch)
 {
     if (pInfo == NULL)
     {
@@ -75,9 +340,9 @@ BOOL KbAsciiMml::Open(const char* cszFileName, SOUNDINFO* pInfo)
     {
         pInfo->dwSamplesPerSec = 55466;
     }
-    pInfo->dwBitsPerSample = 16;
+    pInfo->dwBitsPerSample = static_cast<DWORD>(bitsPerSample);
     pInfo->dwLength = 0xFFFFFFFF;
-    pInfo->dwChannels = 2;
+    pInfo->dwChannels = channels;
     pInfo->dwSeekable = 0;
     pInfo->dwUnitRender = 0;
     pInfo->dwReserved1 = 0xFFFFFFFF;
@@ -85,41 +350,330 @@ BOOL KbAsciiMml::Open(const char* cszFileName, SOUNDINFO* pInfo)
 
     try
     {
-        if (!musicCom.Load(cszFileName))
+        if (!load())
         {
             return FALSE;
         }
     }
     catch (std::exception& e)
     {
-        MessageBoxA(NULL, e.what(), "エラー", MB_OK);
+        // 先読みの失敗は、実際に開くときに表示する
+        if (!prefetch)
+        {
+            MessageBoxA(NULL, e.what(), "エラー", MB_OK);
+        }
         return FALSE;
     }
 
     if (!musicCom.PrepareMix(pInfo->dwSamplesPerSec))
         return FALSE;
 
-    bytespersample = pInfo->dwChannels * pInfo->dwBitsPerSample / 8;
+    bytespersample = channels * std::abs(bitsPerSample) / 8;
     info = *pInfo;
+    fileName = name;
+    statisticsIntervalSamples = statisticsInterval * pInfo->dwSamplesPerSec;
+    if (!captureDirectory.empty() && !prefetch)
+    {
+        StartCapture(name);
+    }
+    if (!prefetch)
+    {
+        StartStatisticsWriter();
+        StartReloadWatcher();
+    }
     return TRUE;
 }
 
+void KbAsciiMml::TakeOver(SOUNDINFO* pInfo)
+{
+    *pInfo = info;
+    // 先読みは音源の初期化まで別スレッドで行うが、演奏中の曲の音源には触れない (PSG の音量テーブルも音源ごと)
+    // 先読みの後に ini が変わっていることがあるため、音量などはここで読み直して最初のフレームで反映する
+    LoadLiveSettings();
+    if (!captureDirectory.empty())
+    {
+        StartCapture(fileName.c_str());
+    }
+    StartStatisticsWriter();
+    StartReloadWatcher();
+}
+
+void KbAsciiMml::StartCapture(const char* name)
+{
+    // 前の曲の録音はここで閉じる (残りの書き出しを待つのは演奏を始める前)
+    CloseCapture();
+
+    auto extension = (captureFormat == MusicCom::CaptureWriter::Format::WAV) ? ".wav" : ".raw";
+    capturePath = (captureDirectory / std::filesystem::path(name).filename().replace_extension(extension)).string();
+    capture = std::make_unique<MusicCom::CaptureWriter>(
+        capturePath, captureFormat, info.dwSamplesPerSec, channels, bitsPerSample, captureBufferSize);
+    if (!capture->IsOpen())
+    {
+        // 書き込めない場合も演奏は続ける
+        capture.reset();
+    }
+}
+
+void KbAsciiMml::CloseCapture()
+{
+    if (!capture)
+    {
+        return;
+    }
+    capture->Close();
+
+    // 書き込みが間に合わずに欠けた録音は、気付けるようにログとデバッグ出力に残す (WAV はファイルの注釈にも残る)
+    if (auto dropped = capture->GetDroppedSamples(); dropped > 0)
+    {
+        auto message = std::format("[{}] capture dropped {} samples (CaptureBufferSize may be too small)\n", capturePath, dropped);
+        OutputDebugStringA(message.c_str());
+        std::ofstream log(captureLogName, std::ios::app);
+        log << message;
+    }
+    capture.reset();
+}
+
 DWORD KbAsciiMml::Render(BYTE* Buffer, DWORD dwSize)
 {
-    musicCom.Mix((int16*)Buffer, dwSize / bytespersample);
+    uint nsamples = dwSize / bytespersample;
+    switch (bitsPerSample)
+    {
+    case 32:
+        musicCom.Mix(reinterpret_cast<int32_t*>(Buffer), nsamples);
+        break;
+    case -32:
+        musicCom.Mix(reinterpret_cast<float*>(Buffer), nsamples);
+        break;
+    default:
+        musicCom.Mix(reinterpret_cast<int16*>(Buffer), nsamples);
+        break;
+    }
+
+    if (capture)
+    {
+        // 演奏中の設定の変更も含め、出力したとおりに録音する (コピーするだけでファイルへの書き込みは待たない)
+        capture->Write(Buffer, nsamples * bytespersample);
+    }
+
+    if (musicCom.IsStatisticsEnabled())
+    {
+        // 出力したサンプル数で一定間隔ごとに書き出しのスレッドへ渡す
+        // 前回の分が書き出されていなければ、次の Render でもう一度渡す
+        statisticsSamples += nsamples;
+        if (statisticsSamples >= statisticsIntervalSamples && musicCom.PublishStatistics())
+        {
+            statisticsSamples = 0;
+        }
+    }
     return dwSize;
 }
 
+void KbAsciiMml::StartReloadWatcher()
+{
+    if (!hotReload || reloadWatcher.joinable())
+    {
+        return;
+    }
+    reloadWatcher = std::jthread(
+        [this](std::stop_token stop)
+        {
+            WatchReload(stop);
+        });
+}
+
+void KbAsciiMml::WatchReload(std::stop_token stop)
+{
+    // ファイルの確認・読み込み・解析はこのスレッドで行い、演奏のスレッドは次の Render で解析済みのデータを受け取る
+    MusicCom::RunPeriodically(
+        stop,
+        HOT_RELOAD_INTERVAL,
+        [this]()
+        {
+            // 前回の変更がまだ反映されていなければ次回に確認する
+            if (musicCom.IsReloadPending())
+            {
+                return;
+            }
+
+            std::error_code ec;
+            auto writeTime = std::filesystem::last_write_time(fileName, ec);
+            if (ec || writeTime == lastWriteTime)
+            {
+                return;
+            }
+
+            try
+            {
+                // 保存中で読めなかった場合は次回に読み直す
+                if (musicCom.Reload(fileName.c_str()))
+                {
+                    lastWriteTime = writeTime;
+                }
+            }
+            catch (std::exception& e)
+            {
+                // 開くときと同じくメッセージボックスで表示し、変更前の曲の演奏を続ける
+                // 演奏のスレッドは待たせない (閉じるときは、表示中のメッセージボックスが閉じられるのを待つ)
+                lastWriteTime = writeTime;
+                MessageBoxA(NULL, e.what(), "エラー", MB_OK);
+            }
+        });
+}
+
+void KbAsciiMml::StartStatisticsWriter()
+{
+    // 録音などの準備が済んでから始める (書き出しのスレッドからも参照するため)
+    if (!musicCom.IsStatisticsEnabled() || statisticsWriter.joinable())
+    {
+        return;
+    }
+    statisticsWriter = std::jthread(
+        [this](std::stop_token stop)
+        {
+            WatchStatistics(stop);
+        });
+}
+
+void KbAsciiMml::WatchStatistics(std::stop_token stop)
+{
+    MusicCom::RunPeriodically(
+        stop,
+        STATISTICS_WRITE_INTERVAL,
+        [this]()
+        {
+            WriteStatistics();
+        });
+}
+
+void KbAsciiMml::WriteStatistics()
+{
+    // 書き出し待ちの統計がある場合だけファイルを開く
+    std::ostringstream report;
+    if (!musicCom.WriteStatistics(report) || report.tellp() == 0)
+    {
+        return;
+    }
+
+    std::ofstream log(statisticsLogName, std::ios::app);
+    if (!log)
+    {
+        return;
+    }
+    log << "[" << fileName << "] " << report.str();
+    if (capture)
+    {
+        // 録音の書き込みが間に合わずに捨てた量 (曲の先頭からの累計)
+        log << "  capture dropped: " << capture->GetDroppedSamples() << " samples\n";
+    }
+}
+
 DWORD KbAsciiMml::SetPosition(DWORD dwPos)
 {
     musicCom.PrepareMix(info.dwSamplesPerSec);
     return 0;
 }
 
+// 次の曲の先読み (Prefetch=1 の場合のみ)
+static std::unique_ptr<MusicCom::Prefetcher<KbAsciiMml>> prefetcher;
+
+// 先読みした曲を使える条件 (同じファイル名・要求されたレートで、MML と SOUND.DAT が更新されていない)
+static std::string GetPrefetchKey(const std::string& fileName, DWORD samplesPerSec)
+{
+    auto writeTime = [](const std::string& path)
+    {
+        std::error_code ec;
+        auto time = std::filesystem::last_write_time(path, ec);
+        return ec ? 0 : time.time_since_epoch().count();
+    };
+    return std::format(
+        "{}|{}|{}|{}",
+        fileName,
+        samplesPerSec,
+        writeTime(fileName),
+        writeTime(MusicCom::GetSoundFilePath(fileName)));
+}
+
+// プレイリストの次の曲として、同じディレクトリで名前順に次の MML ファイルを返す (なければ空)
+static std::string FindNextFile(const std::string& fileName)
+{
+    std::filesystem::path current(fileName);
+    std::vector<std::filesystem::path> files;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(current.parent_path(), ec))
+    {
+        if (entry.is_regular_file(ec) && _stricmp(entry.path().extension().string().c_str(), ".mml") == 0)
+        {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    auto next = std::upper_bound(files.begin(), files.end(), current);
+    return (next != files.end()) ? next->string() : std::string();
+}
+
+static void StartPrefetch(const std::string& fileName, DWORD samplesPerSec)
+{
+    auto nextFileName = FindNextFile(fileName);
+    if (nextFileName.empty())
+    {
+        return;
+    }
+    prefetcher->Start(
+        GetPrefetchKey(nextFileName, samplesPerSec),
+        [nextFileName, samplesPerSec]()
+        {
+            // 解析・SOUND.DAT の読み込み・音源の初期化まで済ませておく
+            auto pKbAsciiMml = std::make_unique<KbAsciiMml>();
+            SOUNDINFO info = {};
+            info.dwSamplesPerSec = samplesPerSec;
+            if (!pKbAsciiMml->Open(nextFileName.c_str(), &info, true))
+            {
+                pKbAsciiMml.reset();
+            }
+            return pKbAsciiMml;
+        });
+}
+
+static void WINAPI kmp_Init()
+{
+    if (GetSetting(GetIniFileName().c_str(), L"Prefetch", 0) != 0)
+    {
+        prefetcher = std::make_unique<MusicCom::Prefetcher<KbAsciiMml>>();
+    }
+}
+
+static void WINAPI kmp_Deinit()
+{
+    // 先読み中の曲は準備が終わるのを待って破棄する
+    prefetcher.reset();
+}
+
 static HKMP WINAPI kmp_Open(const char* cszFileName, SOUNDINFO* pInfo)
 {
     OutputDebugStringA(cszFileName);
 
+    if (prefetcher && pInfo)
+    {
+        DWORD samplesPerSec = pInfo->dwSamplesPerSec;
+        // 先読みした曲であれば、準備済みのものを渡すだけ
+        KbAsciiMml* pKbAsciiMml = prefetcher->Take(GetPrefetchKey(cszFileName, samplesPerSec)).release();
+        if (pKbAsciiMml)
+        {
+            pKbAsciiMml->TakeOver(pInfo);
+        }
+        else
+        {
+            pKbAsciiMml = new KbAsciiMml;
+            if (!pKbAsciiMml->Open(cszFileName, pInfo))
+            {
+                delete pKbAsciiMml;
+                return NULL;
+            }
+        }
+        StartPrefetch(cszFileName, samplesPerSec);
+        return (HKMP)pKbAsciiMml;
+    }
+
     KbAsciiMml* pKbAsciiMml = new KbAsciiMml;
     if (pKbAsciiMml->Open(cszFileName, pInfo))
     {
@@ -132,6 +686,20 @@ static HKMP WINAPI kmp_Open(const char* cszFileName, SOUNDINFO* pInfo)
     }
 }
 
+static HKMP WINAPI kmp_OpenFromBuffer(const BYTE* Buffer, DWORD dwSize, SOUNDINFO* pInfo)
+{
+    KbAsciiMml* pKbAsciiMml = new KbAsciiMml;
+    if (pKbAsciiMml->OpenFromBuffer(Buffer, dwSize, pInfo))
+    {
+        return (HKMP)pKbAsciiMml;
+    }
+    else
+    {
+        delete pKbAsciiMml;
+        return NULL;
+    }
+}
+
 static void WINAPI kmp_Close(HKMP hKMP)
 {
     KbAsciiMml* pKbAsciiMml = (KbAsciiMml*)hKMP;
@@ -176,10 +744,10 @@ KMPMODULE* WINAPI kmp_GetTestModule()
             VER_FILE_DESCRIPTION, // pszDescription
             ppszSupportExts, // ppszSupportExts
             1, // dwReentrant
-            NULL, // Init
-            NULL, // Deinit
+            kmp_Init, // Init
+            kmp_Deinit, // Deinit
             kmp_Open, // Open
-            NULL, // OpenFromBuffer
+            kmp_OpenFromBuffer, // OpenFromBuffer
             kmp_Close, // Close
             kmp_Render, // Render
             kmp_SetPosition // SetPosition
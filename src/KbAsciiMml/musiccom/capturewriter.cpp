@@ -0,0 +1,205 @@
+﻿#include "capturewriter.h"
+#include "periodic.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <limits>
+
+namespace MusicCom
+{
+    namespace
+    {
+        // 書き込みスレッドがリングバッファを確認する間隔
+        const std::chrono::milliseconds DRAIN_INTERVAL(50);
+        // 少しずつ書き込まないよう、この大きさ (バッファの半分を超える場合は半分) が溜まるまで待つ
+        const size_t WRITE_SIZE = 256 * 1024;
+
+        const uint16_t WAVE_FORMAT_PCM = 1;
+        const uint16_t WAVE_FORMAT_IEEE_FLOAT = 3;
+        const uint16_t WAVE_FORMAT_EXTENSIBLE = 0xfffe;
+        // RIFF + fmt (16 バイト) + data
+        const uint32_t WAVE_HEADER_SIZE = 44;
+        // RIFF + fmt (WAVEFORMATEXTENSIBLE の 40 バイト) + fact + data
+        const uint32_t WAVE_EXTENSIBLE_HEADER_SIZE = 80;
+        // KSDATAFORMAT_SUBTYPE_PCM/IEEE_FLOAT の先頭 4 バイト (フォーマットの番号) を除いた残り
+        const unsigned char KSDATAFORMAT_SUBTYPE_TAIL[12] = {0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
+    } // namespace
+
+    CaptureWriter::CaptureWriter(const std::string& path, Format format, int rate, int channels, int bits_per_sample, size_t buffer_size)
+        : stream_(path, std::ios::binary),
+          format_(format),
+          rate_(rate),
+          channels_(channels),
+          bits_per_sample_(bits_per_sample),
+          block_align_(channels * std::abs(bits_per_sample) / 8),
+          written_(0),
+          buffer_(std::bit_ceil(std::max<size_t>(buffer_size, 2))),
+          mask_(buffer_.size() - 1),
+          tail_(0),
+          head_(0),
+          dropped_(0)
+    {
+        if (!stream_)
+        {
+            return;
+        }
+        if (format_ == Format::WAV)
+        {
+            // 長さは閉じるときに書き直す
+            WriteHeader(0, 0);
+        }
+        writer_ = std::jthread(
+            [this](std::stop_token stop)
+            {
+                Drain(stop);
+            });
+    }
+
+    CaptureWriter::~CaptureWriter()
+    {
+        Close();
+    }
+
+    void CaptureWriter::Close()
+    {
+        if (!writer_.joinable())
+        {
+            return;
+        }
+        // 書き込みスレッドは停止の前に残りをすべて書き出す
+        writer_.request_stop();
+        writer_.join();
+        if (format_ == Format::WAV)
+        {
+            uint32_t trailer_size = (GetDroppedSamples() > 0) ? WriteDroppedNote() : 0;
+            stream_.seekp(0);
+            WriteHeader(written_, trailer_size);
+        }
+        stream_.close();
+    }
+
+    void CaptureWriter::Write(const void* data, size_t size)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (size > buffer_.size() - (tail - head_.load(std::memory_order_acquire)))
+        {
+            dropped_.fetch_add(size / block_align_, std::memory_order_relaxed);
+            return;
+        }
+        // バッファの末尾で折り返す
+        size_t offset = tail & mask_;
+        size_t first = std::min(size, buffer_.size() - offset);
+        std::memcpy(&buffer_[offset], data, first);
+        std::memcpy(&buffer_[0], static_cast<const char*>(data) + first, size - first);
+        // データを書いてから位置を進める (位置を読んだ側には書き込んだデータが見える)
+        tail_.store(tail + size, std::memory_order_release);
+    }
+
+    void CaptureWriter::Drain(std::stop_token stop)
+    {
+        size_t write_size = std::min(WRITE_SIZE, buffer_.size() / 2);
+        RunPeriodically(
+            stop,
+            DRAIN_INTERVAL,
+            [this, write_size]()
+            {
+                Flush(write_size);
+            });
+        Flush(1);
+    }
+
+    void CaptureWriter::Flush(size_t min_size)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t size = tail_.load(std::memory_order_acquire) - head;
+        if (size == 0 || size < min_size)
+        {
+            return;
+        }
+        // 溜まった分を折り返しの前後の最大 2 回の書き込みで書き出す
+        size_t offset = head & mask_;
+        size_t first = std::min(size, buffer_.size() - offset);
+        stream_.write(&buffer_[offset], first);
+        stream_.write(&buffer_[0], size - first);
+        // 書き出してから位置を進める (演奏側が同じ場所に書き込むのはその後)
+        head_.store(head + size, std::memory_order_release);
+        written_ += size;
+    }
+
+    uint32_t CaptureWriter::GetHeaderSize() const
+    {
+        return (bits_per_sample_ == 16) ? WAVE_HEADER_SIZE : WAVE_EXTENSIBLE_HEADER_SIZE;
+    }
+
+    void CaptureWriter::WriteHeader(uint64_t data_size, uint32_t trailer_size)
+    {
+        // 4GB を超えた場合は上限の値にする (ヘッダの長さを無視して読めるソフトのため、データはそのまま残す)
+        uint32_t header_size = GetHeaderSize();
+        uint32_t size = static_cast<uint32_t>(std::min<uint64_t>(data_size, std::numeric_limits<uint32_t>::max() - (header_size - 8) - trailer_size));
+        uint16_t bits = static_cast<uint16_t>(std::abs(bits_per_sample_));
+        uint16_t format = (bits_per_sample_ < 0) ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+
+        auto write = [this](const auto& value)
+        {
+            stream_.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        };
+        stream_.write("RIFF", 4);
+        write(static_cast<uint32_t>(size + header_size - 8 + trailer_size));
+        stream_.write("WAVEfmt ", 8);
+        if (header_size == WAVE_HEADER_SIZE)
+        {
+            write(static_cast<uint32_t>(16));
+            write(format);
+        }
+        else
+        {
+            // 16 ビット以外の PCM や浮動小数点を受け付けないソフトがあるため、WAVEFORMATEXTENSIBLE で書く
+            write(static_cast<uint32_t>(40));
+            write(WAVE_FORMAT_EXTENSIBLE);
+        }
+        write(static_cast<uint16_t>(channels_));
+        write(static_cast<uint32_t>(rate_));
+        write(static_cast<uint32_t>(rate_ * block_align_));
+        write(static_cast<uint16_t>(block_align_));
+        write(bits);
+        if (header_size != WAVE_HEADER_SIZE)
+        {
+            write(static_cast<uint16_t>(22));
+            write(bits); // wValidBitsPerSample
+            // モノラルは中央、ステレオは左右 (SPEAKER_FRONT_*)
+            write(static_cast<uint32_t>((channels_ == 1) ? 0x4 : (channels_ == 2) ? 0x3 : 0));
+            write(static_cast<uint32_t>(format));
+            stream_.write(reinterpret_cast<const char*>(KSDATAFORMAT_SUBTYPE_TAIL), sizeof(KSDATAFORMAT_SUBTYPE_TAIL));
+
+            // PCM 以外の形式に必要なサンプル数
+            stream_.write("fact", 4);
+            write(static_cast<uint32_t>(4));
+            write(static_cast<uint32_t>(std::min<uint64_t>(size / block_align_, std::numeric_limits<uint32_t>::max())));
+        }
+        stream_.write("data", 4);
+        write(size);
+    }
+
+    uint32_t CaptureWriter::WriteDroppedNote()
+    {
+        // 終端の NUL を含め、チャンクの大きさは偶数にそろえる
+        std::string note = std::format("dropped {} samples (capture buffer full)", GetDroppedSamples());
+        note.resize((note.size() + 2) & ~size_t(1), '\0');
+        uint32_t note_size = static_cast<uint32_t>(note.size());
+
+        auto write = [this](uint32_t value)
+        {
+            stream_.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        };
+        stream_.write("LIST", 4);
+        write(4 + 8 + note_size);
+        stream_.write("INFOICMT", 8);
+        write(note_size);
+        stream_.write(note.data(), note.size());
+        return 8 + 4 + 8 + note_size;
+    }
+
+} // namespace MusicCom
@@ -0,0 +1,82 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace MusicCom
+{
+    // 演奏した PCM をそのままファイルに書き出す (録音)
+    // 演奏側は固定長のリングバッファにコピーするだけで、ファイルへの書き込みは別のスレッドがまとめて行う
+    class CaptureWriter
+    {
+    public:
+        enum class Format
+        {
+            WAV, // 16 ビットは PCM、それ以外は WAVE_FORMAT_EXTENSIBLE (fact チャンク付き)
+            RAW  // ヘッダなし (リトルエンディアン、チャンネルはインターリーブ)
+        };
+
+        // bits_per_sample: 16, 32 (整数), -32 (浮動小数点)
+        // buffer_size は 2 のべき乗に切り上げる
+        CaptureWriter(const std::string& path, Format format, int rate, int channels, int bits_per_sample, size_t buffer_size);
+        // Close する
+        ~CaptureWriter();
+
+        CaptureWriter(const CaptureWriter&) = delete;
+        CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+        bool IsOpen() const
+        {
+            return writer_.joinable();
+        }
+
+        // 演奏側 (1 スレッド)
+        // ロックもファイルへの書き込みも行わず、入りきらない場合は待たずに size 全体を捨てて数だけを記録する
+        void Write(const void* data, size_t size);
+
+        // 満杯のため捨てたサンプル数 (全チャンネルで 1 サンプル、開いてからの累計)
+        // 0 でなければ、録音はその分だけ欠けている
+        uint64_t GetDroppedSamples() const
+        {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+        // 残りを書き出してファイルを閉じる (演奏側の Write が終わってから呼ぶ)
+        // WAV の場合はヘッダの長さを確定し、捨てたサンプルがあればその数を INFO チャンクの注釈 (ICMT) に残す
+        void Close();
+
+    private:
+        void Drain(std::stop_token stop);
+        // 溜まったデータを書き出す (min_size 未満の場合は次回にまとめる)
+        void Flush(size_t min_size);
+        uint32_t GetHeaderSize() const;
+        // trailer_size: データの後に続くチャンクの大きさ
+        void WriteHeader(uint64_t data_size, uint32_t trailer_size);
+        // 捨てたサンプル数の注釈を書き、その大きさを返す
+        uint32_t WriteDroppedNote();
+
+        std::ofstream stream_;
+        const Format format_;
+        const int rate_;
+        const int channels_;
+        const int bits_per_sample_;
+        const int block_align_; // 1 サンプル (全チャンネル) のバイト数
+        uint64_t written_; // 書き出したデータのバイト数 (書き込みスレッドのみ更新)
+
+        std::vector<char> buffer_;
+        const size_t mask_;
+        // 書き込み側と読み出し側で別のキャッシュラインに置く
+        alignas(64) std::atomic<size_t> tail_; // 次に書き込む位置 (演奏側のみ更新)
+        alignas(64) std::atomic<size_t> head_; // 次に読み出す位置 (書き込みスレッドのみ更新)
+        alignas(64) std::atomic<uint64_t> dropped_; // サンプル数
+
+        std::jthread writer_;
+    };
+
+} // namespace MusicCom
@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <list>
+#include <memory_resource>
 #include <string>
 
 namespace MusicCom
@@ -103,6 +104,7 @@ namespace MusicCom
         std::string strarg;
     };
 
-    using CommandList = std::list<Command>;
+    // 要素は MusicData の領域から確保する
+    using CommandList = std::pmr::list<Command>;
     using CommandIterator = CommandList::const_iterator;
 } // namespace MusicCom
@@ -0,0 +1,42 @@
+﻿#include "eventqueue.h"
+#include <algorithm>
+#include <bit>
+
+namespace MusicCom
+{
+    EventQueue::EventQueue(size_t capacity)
+        : events_(std::bit_ceil(std::max<size_t>(capacity, 2))),
+          mask_(events_.size() - 1),
+          tail_(0),
+          head_(0),
+          dropped_(0)
+    {
+    }
+
+    void EventQueue::Push(const SequencerEvent& event)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) > mask_)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        events_[tail & mask_] = event;
+        // イベントを書いてから位置を進める (位置を読んだ側には書き込んだイベントが見える)
+        tail_.store(tail + 1, std::memory_order_release);
+    }
+
+    bool EventQueue::Pop(SequencerEvent& event)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        event = events_[head & mask_];
+        // 読み終えてから位置を進める (演奏側が同じ場所に書き込むのはその後)
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+} // namespace MusicCom
@@ -0,0 +1,56 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MusicCom
+{
+    enum class EventType : uint8_t
+    {
+        NOTE_ON,
+        NOTE_OFF,
+        TONE,        // 音色 (@) の変更
+        VOLUME,      // 音量 (V) の変更
+        SOUND_EFFECT // D パートの効果音の開始
+    };
+
+    // 表示用のシーケンサのイベント
+    struct SequencerEvent
+    {
+        uint64_t Sample; // 先頭からの出力サンプル位置 (合成したレートでの値)
+        int8_t Part;     // パート番号 (0-5: チャンネル, 6: D パート)
+        EventType Type;
+        int16_t Value; // NOTE_ON: オクターブ×12+音名 (C=0), TONE: 音色番号, VOLUME: 0-15, SOUND_EFFECT: 効果音番号
+    };
+
+    // 演奏側の 1 スレッドが書き込み、表示側の 1 スレッドが読み出す固定長のキュー
+    // どちらもロックせず、演奏側は満杯でも待たずにイベントを捨てて数だけを記録する
+    class EventQueue
+    {
+    public:
+        // capacity は 2 のべき乗に切り上げる
+        explicit EventQueue(size_t capacity);
+
+        // 演奏側
+        void Push(const SequencerEvent& event);
+
+        // 表示側 (空の場合は false)
+        bool Pop(SequencerEvent& event);
+        // 満杯のため捨てたイベントの数
+        uint64_t GetDroppedCount() const
+        {
+            return dropped_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        std::vector<SequencerEvent> events_;
+        const size_t mask_;
+        // 書き込み側と読み出し側で別のキャッシュラインに置く
+        alignas(64) std::atomic<size_t> tail_; // 次に書き込む位置 (演奏側のみ更新)
+        alignas(64) std::atomic<size_t> head_; // 次に読み出す位置 (表示側のみ更新)
+        alignas(64) std::atomic<uint64_t> dropped_;
+    };
+
+} // namespace MusicCom
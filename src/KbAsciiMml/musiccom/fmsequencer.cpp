@@ -12,14 +12,10 @@ namespace MusicCom
     // clang-format on
     const int* const F_NUMBER = &F_NUMBER_BASE[1];
 
-    FmSequencer::FmSequencer(FM::OPN& opn, FMWrap& fmwrap, const MusicData& music, int channel, int rate)
+    FmSequencer::FmSequencer(OPNWrap& opn, FMWrap& fmwrap, const MusicData& music, int channel, int rate)
         : PartSequencerBase(opn, music, music.GetChannelTail(channel), rate),
           channel_(channel),
-          fmwrap_(fmwrap),
-          GetSound([this](int no) -> const FMSound&
-                   { return GetMusicData().GetFMSound(no); }),
-          GetHeadImpl([this, channel]()
-                      { return GetMusicData().GetChannelHead(channel); })
+          fmwrap_(fmwrap)
     {
     }
 
@@ -41,7 +37,8 @@ namespace MusicCom
         {
         case CommandType::TYPE_TONE:
             part_data.SoundNo = command.GetArg(0);
-            fmwrap_.SetSound(channel_, GetSound(part_data.SoundNo));
+            fmwrap_.SetSound(channel_, GetMusicData().GetFMSound(part_data.SoundNo));
+            PublishEvent(EventType::TONE, part_data.SoundNo);
             break;
         default:
             return_ptr = PartSequencerBase::ProcessCommandImpl(ptr, current_frame, part_data);
@@ -92,7 +89,7 @@ namespace MusicCom
 
     const CommandIterator FmSequencer::GetHead() const
     {
-        return GetHeadImpl();
+        return GetMusicData().GetChannelHead(channel_);
     }
 
     int FmSequencer::CalculateTone(int base_tone, int detune) const
@@ -24,7 +24,106 @@ namespace MusicCom
 
     const int FMWrap::op_table[4] = {0, 2, 1, 3};
 
-    FMWrap::FMWrap(FM::OPN& o) : opn(o)
+    OPNWrap::OPNWrap(FM::OPN& o) : opn(o), state()
+    {
+    }
+
+    void OPNWrap::SetReg(uint addr, uint data)
+    {
+        state.Regs[addr & 0xff] = static_cast<uint8_t>(data);
+        state.Written.set(addr & 0xff);
+        if (addr == 0x28 && (data & 0x3) < 3)
+        {
+            state.KeyOn[data & 0x3] = static_cast<uint8_t>(data);
+        }
+
+        opn.SetReg(addr, data);
+        if (write_observer)
+        {
+            write_observer(addr, data);
+        }
+#ifdef MUSICCOM_ENABLE_TRACE
+        if (trace_observer)
+        {
+            trace_observer(trace_context, addr, data);
+        }
+#endif
+    }
+
+    void OPNWrap::SetWriteObserver(WriteObserver observer)
+    {
+        write_observer = observer;
+    }
+
+    const OPNWrap::State& OPNWrap::GetState() const
+    {
+        return state;
+    }
+
+    void OPNWrap::RestoreState(const State& s)
+    {
+        opn.Reset();
+        state = State();
+
+        // SSG (0x0d はエンベロープを最初から始め直すため書き込まれていた場合のみ、0x0e/0x0f は I/O ポート)
+        for (uint addr = 0x00; addr < 0x0e; addr++)
+        {
+            if (addr != 0x0d || s.Written[addr])
+            {
+                SetReg(addr, s.Regs[addr]);
+            }
+        }
+        // 効果音モード
+        if (s.Written[0x27])
+        {
+            SetReg(0x27, s.Regs[0x27]);
+        }
+        // FM (各チャンネルの 4 番目のアドレスは存在しない)
+        for (uint addr = 0x30; addr < 0xb7; addr++)
+        {
+            if ((addr & 0x3) != 3)
+            {
+                SetReg(addr, s.Regs[addr]);
+            }
+        }
+        // 周波数は上位 (0xa4-0xa6, 0xac-0xae) を書いてから下位を書いたときに反映されるため、下位を書き直す
+        for (uint addr : {0xa0, 0xa1, 0xa2, 0xa8, 0xa9, 0xaa})
+        {
+            SetReg(addr, s.Regs[addr]);
+        }
+        for (uint ch = 0; ch < 3; ch++)
+        {
+            if (s.KeyOn[ch] & 0xf0)
+            {
+                SetReg(0x28, (s.KeyOn[ch] & 0xf0) | ch);
+            }
+        }
+    }
+
+#ifdef MUSICCOM_ENABLE_TRACE
+    void OPNWrap::SetTraceObserver(TraceObserver observer)
+    {
+        trace_observer = observer;
+    }
+
+    const TraceContext& OPNWrap::GetTraceContext() const
+    {
+        return trace_context;
+    }
+
+    void OPNWrap::SetTraceContext(const TraceContext& context)
+    {
+        trace_context = context;
+    }
+#endif
+
+    void OPNWrap::HashState(StateHash& hash) const
+    {
+        hash.Add(state.Regs, sizeof(state.Regs));
+        hash.Add(state.KeyOn, sizeof(state.KeyOn));
+    }
+
+    FMWrap::FMWrap(OPNWrap& o) : opn(o)
     {
         fill_n(vol, 3, 15);
     }
@@ -49,6 +148,43 @@ namespace MusicCom
         SetVolume(ch, vol[ch]);
     }
 
+    FMWrap::State FMWrap::GetState() const
+    {
+        State state;
+        copy_n(sound, 3, state.Sound);
+        copy_n(vol, 3, state.Vol);
+        return state;
+    }
+
+    void FMWrap::RestoreState(const State& state)
+    {
+        copy_n(state.Sound, 3, sound);
+        copy_n(state.Vol, 3, vol);
+    }
+
+    void FMWrap::HashState(StateHash& hash) const
+    {
+        for (int ch = 0; ch < 3; ch++)
+        {
+            const FMSound& s = sound[ch];
+            hash.Add(s.LFOForm);
+            hash.Add(s.LFOSpeed);
+            hash.Add(s.LFODepth);
+            hash.Add(s.AlgFb);
+            for (const auto& op : s.Op)
+            {
+                hash.Add(op.DtMl);
+                hash.Add(op.Tl);
+                hash.Add(op.KsAr);
+                hash.Add(op.Dr);
+                hash.Add(op.Sr);
+                hash.Add(op.SlRr);
+                hash.Add(op.Dt2);
+            }
+            hash.Add(vol[ch]);
+        }
+    }
+
     void FMWrap::SetVolume(int ch, int v)
     {
         assert(0 <= ch && ch < 3);
@@ -118,7 +254,7 @@ namespace MusicCom
         opn.SetReg(lowaddr, fnumber & 0xff);
     }
 
-    SSGWrap::SSGWrap(FM::OPN& o) : opn(o)
+    SSGWrap::SSGWrap(OPNWrap& o) : opn(o)
     {
         fill_n(tone, 3, true);
         fill_n(noise, 3, false);
@@ -127,6 +263,38 @@ namespace MusicCom
         fill_n(vol, 3, 15);
     }
 
+    SSGWrap::State SSGWrap::GetState() const
+    {
+        State state;
+        copy_n(tone, 3, state.Tone);
+        copy_n(noise, 3, state.Noise);
+        copy_n(keyon, 3, state.KeyOn);
+        copy_n(env, 3, state.Env);
+        copy_n(vol, 3, state.Vol);
+        return state;
+    }
+
+    void SSGWrap::RestoreState(const State& state)
+    {
+        copy_n(state.Tone, 3, tone);
+        copy_n(state.Noise, 3, noise);
+        copy_n(state.KeyOn, 3, keyon);
+        copy_n(state.Env, 3, env);
+        copy_n(state.Vol, 3, vol);
+    }
+
+    void SSGWrap::HashState(StateHash& hash) const
+    {
+        for (int ch = 0; ch < 3; ch++)
+        {
+            hash.Add(tone[ch]);
+            hash.Add(noise[ch]);
+            hash.Add(keyon[ch]);
+            hash.Add(env[ch]);
+            hash.Add(vol[ch]);
+        }
+    }
+
     void SSGWrap::SetEnvForm(int form)
     {
         opn.SetReg(0x0d, form);
@@ -1,6 +1,12 @@
 ﻿#pragma once
 
 #include "musdata.h"
+#include "regtrace.h"
+#include "statehash.h"
+#include <bitset>
+#include <cstdint>
+#include <fmgen/types.h>
+#include <functional>
 
 namespace FM
 {
@@ -9,21 +15,113 @@ namespace FM
 
 namespace MusicCom
 {
+    // OPN へのレジスタ書き込みはすべてここを経由させる
+    class OPNWrap
+    {
+    public:
+        using WriteObserver = std::function<void(uint addr, uint data)>;
+
+        OPNWrap(FM::OPN& o);
+        void SetReg(uint addr, uint data);
+        void SetWriteObserver(WriteObserver observer);
+
+        // 書き込んだレジスタの値 (同期点の状態の保存・復元に使用する)
+        struct State
+        {
+            uint8_t Regs[0x100];
+            std::bitset<0x100> Written;
+            uint8_t KeyOn[3]; // チャンネルごとの 0x28 の値
+        };
+        const State& GetState() const;
+        // OPN をリセットしてから保存したレジスタを書き込み直す
+        // エンベロープの位相などは復元できないため、発音中の音はキーオンし直す
+        void RestoreState(const State& state);
+        void HashState(StateHash& hash) const;
+
+#ifdef MUSICCOM_ENABLE_TRACE
+        using TraceObserver = std::function<void(const TraceContext& context, uint addr, uint data)>;
+        void SetTraceObserver(TraceObserver observer);
+        const TraceContext& GetTraceContext() const;
+        void SetTraceContext(const TraceContext& context);
+#endif
+
+    private:
+        FM::OPN& opn;
+        WriteObserver write_observer;
+        State state;
+#ifdef MUSICCOM_ENABLE_TRACE
+        TraceObserver trace_observer;
+        TraceContext trace_context;
+#endif
+    };
+
+#ifdef MUSICCOM_ENABLE_TRACE
+    // スコープ内の書き込み元を設定する
+    class TraceScope
+    {
+    public:
+        TraceScope(OPNWrap& opn, int part, int frame)
+            : opn_(opn),
+              saved_(opn.GetTraceContext())
+        {
+            auto context = saved_;
+            context.Part = part;
+            context.Frame = frame;
+            opn_.SetTraceContext(context);
+        }
+        TraceScope(OPNWrap& opn, TraceSource source, CommandType command = CommandType::TYPE_UNKNOWN)
+            : opn_(opn),
+              saved_(opn.GetTraceContext())
+        {
+            auto context = saved_;
+            context.Source = source;
+            context.Command = command;
+            opn_.SetTraceContext(context);
+        }
+        ~TraceScope()
+        {
+            opn_.SetTraceContext(saved_);
+        }
+
+    private:
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+        OPNWrap& opn_;
+        TraceContext saved_;
+    };
+
+#define MUSICCOM_TRACE_CONCAT_IMPL(a, b) a##b
+#define MUSICCOM_TRACE_CONCAT(a, b) MUSICCOM_TRACE_CONCAT_IMPL(a, b)
+#define MUSICCOM_TRACE_SCOPE(opn, ...) ::MusicCom::TraceScope MUSICCOM_TRACE_CONCAT(trace_scope_, __LINE__)(opn, __VA_ARGS__)
+#else
+#define MUSICCOM_TRACE_SCOPE(opn, ...) ((void)0)
+#endif
+
     // ch は0-origin
     class FMWrap
     {
     public:
-        FMWrap(FM::OPN& o);
+        FMWrap(OPNWrap& o);
         void SetSound(int ch, const FMSound& sound);
         void SetTone(int ch, int block, int fnumber);
         void SetVolume(int ch, int vol);
 
         void KeyOnOff(int ch, bool on);
 
+        struct State
+        {
+            FMSound Sound[3];
+            int Vol[3];
+        };
+        State GetState() const;
+        void RestoreState(const State& state);
+        void HashState(StateHash& hash) const;
+
     private:
         void SetToneReg(int highaddr, int lowaddr, int block, int fnumber);
 
-        FM::OPN& opn;
+        OPNWrap& opn;
         FMSound sound[3];
         int vol[3];
         static const double detune2_table[4];
@@ -34,7 +132,7 @@ namespace MusicCom
     class SSGWrap
     {
     public:
-        SSGWrap(FM::OPN& o);
+        SSGWrap(OPNWrap& o);
         void SetEnv(int ch, bool on);
         void SetEnvForm(int form);
         void SetEnvPeriod(int period);
@@ -47,8 +145,20 @@ namespace MusicCom
         void KeyOnOff(int ch, bool on);
         void SetNoiseToneEnable();
 
+        struct State
+        {
+            bool Tone[3];
+            bool Noise[3];
+            bool KeyOn[3];
+            bool Env[3];
+            int Vol[3];
+        };
+        State GetState() const;
+        void RestoreState(const State& state);
+        void HashState(StateHash& hash) const;
+
     private:
-        FM::OPN& opn;
+        OPNWrap& opn;
         bool tone[3];
         bool noise[3];
         bool keyon[3];
@@ -0,0 +1,153 @@
+﻿#include "lineindex.h"
+#include "musdata.h"
+#include "opnpool.h"
+#include <fmgen/opna.h>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+
+namespace MusicCom
+{
+    namespace
+    {
+        // 無限ループなどで行末に達しないパートがあっても、この時間で打ち切る
+        const uint64_t MAX_INDEX_SECONDS = 30 * 60;
+
+        // パートの一時停止コマンドと、その行の MML ファイル上の行番号
+        struct PartLines
+        {
+            const std::pmr::vector<int>* Lines;
+            std::unordered_map<const Command*, int> Pauses; // 一時停止コマンド -> パート内の行の番号
+            std::vector<bool> Started;
+        };
+
+        bool CollectPauses(CommandIterator head, CommandIterator tail, const std::pmr::vector<int>& lines, PartLines& part)
+        {
+            part.Lines = &lines;
+            for (auto ptr = head; ptr != tail; ++ptr)
+            {
+                if (ptr->GetType() == CommandType::TYPE_PAUSE)
+                {
+                    int n = static_cast<int>(part.Pauses.size());
+                    part.Pauses.emplace(&*ptr, n);
+                }
+            }
+            part.Started.assign(lines.size(), false);
+            // 行番号を記録していないデータ (古いキャッシュなど) は対象外
+            return !lines.empty() && part.Pauses.size() == lines.size();
+        }
+    } // namespace
+
+    LineIndex::LineIndex(MusicData& music, SoundData& sound, int soundtempo, uint rate, std::stop_token stop)
+    {
+        std::map<int, PartLines> parts;
+        for (int ch = 0; ch < 6; ch++)
+        {
+            if (music.IsChannelPresent(ch) && !CollectPauses(music.GetChannelHead(ch), music.GetChannelTail(ch), music.GetChannelLines(ch), parts[ch]))
+            {
+                parts.erase(ch);
+            }
+        }
+        if (music.IsRhythmPartPresent() && !CollectPauses(music.GetRhythmPartHead(), music.GetRhythmPartTail(), music.GetRhythmPartLines(), parts[6]))
+        {
+            parts.erase(6);
+        }
+        if (parts.empty())
+        {
+            return;
+        }
+
+        // 演奏用とは別の OPN でシーケンス処理だけを行う
+        PooledOPN opn(static_cast<int>(rate));
+        Sequencer sequencer(*opn, &music, &sound, soundtempo);
+        if (!sequencer.Init(rate))
+        {
+            return;
+        }
+
+        // 各パートが line_number 行目 (パート内の 0-origin) を演奏し始める位置として記録する
+        size_t remaining = 0;
+        for (const auto& [part, part_lines] : parts)
+        {
+            remaining += part_lines.Lines->size();
+        }
+        auto record = [&](std::vector<std::pair<PartLines*, int>>& starts)
+        {
+            size_t entry = entries.size();
+            bool added = false;
+            for (auto [part_lines, line_number] : starts)
+            {
+                if (part_lines->Started[line_number])
+                {
+                    continue;
+                }
+                part_lines->Started[line_number] = true;
+                remaining--;
+                lines.emplace((*part_lines->Lines)[line_number], entry);
+                added = true;
+            }
+            if (added)
+            {
+                entries.push_back(Entry{sequencer.GetMixedSamples(), sequencer.SaveState()});
+            }
+        };
+
+        // 先頭はすべてのパートが 1 行目から
+        std::vector<std::pair<PartLines*, int>> starts;
+        for (auto& [part, part_lines] : parts)
+        {
+            starts.emplace_back(&part_lines, 0);
+        }
+        record(starts);
+
+        uint64_t limit = MAX_INDEX_SECONDS * rate;
+        std::vector<std::pair<int, CommandIterator>> paused;
+        while (remaining > 0 && sequencer.GetMixedSamples() < limit && !stop.stop_requested())
+        {
+            if (!sequencer.SkipToSync(limit - sequencer.GetMixedSamples(), paused))
+            {
+                break;
+            }
+
+            // 一時停止していた行の次の行 (最後の行ならパートの先頭) から再開している
+            starts.clear();
+            for (auto [part, ptr] : paused)
+            {
+                auto it = parts.find(part);
+                if (it == parts.end())
+                {
+                    continue;
+                }
+                auto& part_lines = it->second;
+                auto pause = part_lines.Pauses.find(&*ptr);
+                if (pause == part_lines.Pauses.end())
+                {
+                    continue;
+                }
+                int next = pause->second + 1;
+                starts.emplace_back(&part_lines, (next < static_cast<int>(part_lines.Lines->size())) ? next : 0);
+            }
+            record(starts);
+        }
+    }
+
+    LineIndex::~LineIndex()
+    {
+    }
+
+    const LineIndex::Entry* LineIndex::Find(int line) const
+    {
+        if (entries.empty())
+        {
+            return nullptr;
+        }
+
+        auto it = lines.upper_bound(line);
+        if (it == lines.begin())
+        {
+            return &entries.front();
+        }
+        return &entries[std::prev(it)->second];
+    }
+
+} // namespace MusicCom
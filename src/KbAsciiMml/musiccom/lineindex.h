@@ -0,0 +1,40 @@
+﻿#pragma once
+
+#include "sequencer.h"
+#include <cstdint>
+#include <map>
+#include <stop_token>
+#include <vector>
+
+namespace MusicCom
+{
+    class MusicData;
+    class SoundData;
+
+    // MML の行番号から演奏位置を引く索引
+    // 各パートは CH/D 行の末尾 (TYPE_PAUSE) で一時停止し、全パートが揃ったところで再開する (同期点)。
+    // 音を合成せずにシーケンス処理だけを進め、各行を初めて演奏し始める同期点での状態を記録しておく
+    // 曲の長さによっては時間がかかるため、演奏とは別のスレッドで作成してよい (音源は OPNPool から借りる)
+    class LineIndex
+    {
+    public:
+        // stop が要求されたら作成を打ち切る (それまでに記録した行だけの索引になる)
+        LineIndex(MusicData& music, SoundData& sound, int soundtempo, uint rate, std::stop_token stop = {});
+        ~LineIndex();
+        LineIndex(const LineIndex&) = delete;
+        LineIndex& operator=(const LineIndex&) = delete;
+
+        struct Entry
+        {
+            uint64_t Sample; // 先頭からのサンプル位置
+            Sequencer::State State;
+        };
+        // line 以前で最も近い CH/D 行の演奏開始位置 (最初の CH/D 行より前なら先頭、索引が空なら nullptr)
+        const Entry* Find(int line) const;
+
+    private:
+        std::vector<Entry> entries;
+        std::map<int, size_t> lines; // 行番号 -> entries の位置
+    };
+
+} // namespace MusicCom
@@ -0,0 +1,110 @@
+﻿#include "liveparameters.h"
+#include <algorithm>
+#include <cmath>
+
+namespace MusicCom
+{
+    namespace
+    {
+        int LimitVolume(int volume)
+        {
+            return std::min(std::max(volume, -192), 20);
+        }
+
+        const uint32_t ALL_PARTS = (1u << LiveParameters::PART_COUNT) - 1;
+    } // namespace
+
+    LiveParameters::LiveParameters(int sound_tempo)
+        : fm_volume_(0),
+          psg_volume_(0),
+          sound_tempo_(sound_tempo),
+          master_gain_(0),
+          master_gain_scale_(1.0f),
+          mute_parts_(0),
+          solo_parts_(0),
+          version_(0)
+    {
+    }
+
+    void LiveParameters::SetFMVolume(int volume)
+    {
+        Store(fm_volume_, LimitVolume(volume));
+    }
+
+    void LiveParameters::SetPSGVolume(int volume)
+    {
+        Store(psg_volume_, LimitVolume(volume));
+    }
+
+    void LiveParameters::SetSoundTempo(int tempo)
+    {
+        Store(sound_tempo_, std::min(std::max(tempo, 128), 255));
+    }
+
+    void LiveParameters::SetMasterGain(int gain)
+    {
+        gain = LimitVolume(gain);
+        // 演奏側で変換しなくて済むよう、倍率はここで求めて一緒に公開する (FM/PSG の音量と同じく 0.5dB 単位)
+        master_gain_scale_.store((gain > -192) ? static_cast<float>(std::pow(10.0, gain / 40.0)) : 0.0f, std::memory_order_relaxed);
+        Store(master_gain_, gain);
+    }
+
+    void LiveParameters::SetPartMute(int part, bool mute)
+    {
+        UpdateParts(mute_parts_, part, mute);
+    }
+
+    void LiveParameters::SetPartSolo(int part, bool solo)
+    {
+        UpdateParts(solo_parts_, part, solo);
+    }
+
+    void LiveParameters::SetMuteParts(uint32_t parts)
+    {
+        Store(mute_parts_, parts & ALL_PARTS);
+    }
+
+    void LiveParameters::SetSoloParts(uint32_t parts)
+    {
+        Store(solo_parts_, parts & ALL_PARTS);
+    }
+
+    LiveParameters::Values LiveParameters::GetValues() const
+    {
+        return Values{
+            fm_volume_.load(std::memory_order_relaxed),
+            psg_volume_.load(std::memory_order_relaxed),
+            sound_tempo_.load(std::memory_order_relaxed),
+            master_gain_.load(std::memory_order_relaxed),
+            master_gain_scale_.load(std::memory_order_relaxed),
+            mute_parts_.load(std::memory_order_relaxed),
+            solo_parts_.load(std::memory_order_relaxed)};
+    }
+
+    template<typename T>
+    void LiveParameters::Store(std::atomic<T>& field, T value)
+    {
+        // 値を書いてから版数を進める (版数を読んだ側には、その版までの値が見える)
+        field.store(value, std::memory_order_relaxed);
+        version_.fetch_add(1, std::memory_order_release);
+    }
+
+    void LiveParameters::UpdateParts(std::atomic<uint32_t>& field, int part, bool on)
+    {
+        if (part < 0 || part >= PART_COUNT)
+        {
+            return;
+        }
+        // 他のパートを同時に変更されても失われないよう、ビット単位で更新する
+        if (on)
+        {
+            field.fetch_or(1u << part, std::memory_order_relaxed);
+        }
+        else
+        {
+            field.fetch_and(~(1u << part), std::memory_order_relaxed);
+        }
+        version_.fetch_add(1, std::memory_order_release);
+    }
+
+} // namespace MusicCom
@@ -0,0 +1,65 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace MusicCom
+{
+    // 演奏中に変更できるパラメータ
+    // 書き込みはどのスレッドからでもよく、ロックせずに値を更新して版数を進める
+    // 演奏側はフレームの区切りで版数を比較し、変わっていれば値を読み直して反映する
+    // (値の読み込み中に書き込まれても、版数が進むため次のフレームで読み直される)
+    class LiveParameters
+    {
+    public:
+        struct Values
+        {
+            int FMVolume;   // 0.5dB 単位 (-192 以下で無音、最大 20)
+            int PSGVolume;  // 0.5dB 単位 (-192 以下で無音、最大 20)
+            int SoundTempo; // 効果音のテンポ (128-255)
+            int MasterGain; // 出力全体の音量 (0.5dB 単位、-192 以下で無音、最大 20)
+            float MasterGainScale; // MasterGain を倍率にしたもの (無音は 0)
+            uint32_t MuteParts; // ミュートするパート (ビット 0-5: チャンネル, ビット 6: D パート)
+            uint32_t SoloParts; // ソロで鳴らすパート (1 つでもあれば、それ以外のパートはミュート)
+        };
+
+        // パート番号 (0-5: チャンネル, 6: D パート) の数
+        static const int PART_COUNT = 7;
+
+        explicit LiveParameters(int sound_tempo);
+
+        void SetFMVolume(int volume);
+        void SetPSGVolume(int volume);
+        void SetSoundTempo(int tempo);
+        void SetMasterGain(int gain);
+        // part: パート番号 (範囲外は無視)
+        void SetPartMute(int part, bool mute);
+        void SetPartSolo(int part, bool solo);
+        // ビットごとにまとめて設定する (ビットの配置は Values と同じ)
+        void SetMuteParts(uint32_t parts);
+        void SetSoloParts(uint32_t parts);
+        // 値を変更するたびに進む
+        uint32_t GetVersion() const
+        {
+            return version_.load(std::memory_order_acquire);
+        }
+        Values GetValues() const;
+
+    private:
+        template<typename T>
+        void Store(std::atomic<T>& field, T value);
+        void UpdateParts(std::atomic<uint32_t>& field, int part, bool on);
+
+        static_assert(std::atomic<int>::is_always_lock_free);
+        static_assert(std::atomic<float>::is_always_lock_free);
+        std::atomic<int> fm_volume_;
+        std::atomic<int> psg_volume_;
+        std::atomic<int> sound_tempo_;
+        std::atomic<int> master_gain_;
+        std::atomic<float> master_gain_scale_;
+        std::atomic<uint32_t> mute_parts_;
+        std::atomic<uint32_t> solo_parts_;
+        std::atomic<uint32_t> version_;
+    };
+
+} // namespace MusicCom
@@ -0,0 +1,117 @@
+﻿#include "loopcache.h"
+#include <algorithm>
+
+namespace MusicCom
+{
+    LoopCache::LoopCache(size_t budget)
+        : capacity_(std::max<size_t>(budget, 1)),
+          buffer_(capacity_),
+          recorded_(0),
+          positions_(SYNC_POINT_COUNT),
+          replaying_(false),
+          loop_start_(0),
+          loop_length_(0),
+          replay_position_(0)
+    {
+    }
+
+    void LoopCache::Reset()
+    {
+        // バッファは確保したまま使い回す
+        recorded_ = 0;
+        std::fill(positions_.begin(), positions_.end(), SyncPoint{});
+        replaying_ = false;
+        loop_start_ = 0;
+        loop_length_ = 0;
+        replay_position_ = 0;
+    }
+
+    void LoopCache::Record(const void* src, size_t size)
+    {
+        auto ptr = static_cast<const uint8_t*>(src);
+        while (size > 0)
+        {
+            auto position = static_cast<size_t>(recorded_ % capacity_);
+            auto length = std::min(size, capacity_ - position);
+            std::copy(ptr, ptr + length, buffer_.begin() + position);
+
+            ptr += length;
+            size -= length;
+            recorded_ += length;
+        }
+    }
+
+    bool LoopCache::IsExpired(const SyncPoint& point) const
+    {
+        return !point.Used || recorded_ - point.Position > capacity_;
+    }
+
+    bool LoopCache::Synchronize(uint64_t hash)
+    {
+        // 同じハッシュ値の同期点か、空き (リングバッファから外れたものを含む)、なければ最も古いものを使う
+        size_t first = static_cast<size_t>(hash % SYNC_POINT_COUNT);
+        SyncPoint* found = nullptr;
+        SyncPoint* slot = nullptr;
+        for (size_t i = 0; i < SYNC_POINT_PROBES; i++)
+        {
+            auto& point = positions_[(first + i) % SYNC_POINT_COUNT];
+            if (!IsExpired(point) && point.Hash == hash)
+            {
+                found = &point;
+                break;
+            }
+            if (!slot || (!IsExpired(*slot) && (IsExpired(point) || point.Position < slot->Position)))
+            {
+                slot = &point;
+            }
+        }
+
+        // 音源を含めて同じ状態に戻ったので、以後はその間の出力の繰り返しになる
+        auto length = found ? recorded_ - found->Position : 0;
+        if (found && length > 0 && length <= capacity_)
+        {
+            // ループ区間はリングバッファ上にそのまま残し、先頭の位置から繰り返し読み出す
+            loop_start_ = static_cast<size_t>(found->Position % capacity_);
+            loop_length_ = static_cast<size_t>(length);
+            std::fill(positions_.begin(), positions_.end(), SyncPoint{});
+
+            replaying_ = true;
+            replay_position_ = 0;
+            return true;
+        }
+
+        *(found ? found : slot) = SyncPoint{hash, recorded_, true};
+        return false;
+    }
+
+    bool LoopCache::IsReplaying() const
+    {
+        return replaying_;
+    }
+
+    size_t LoopCache::GetReplayPosition() const
+    {
+        return replay_position_;
+    }
+
+    void LoopCache::Replay(void* dest, size_t size)
+    {
+        auto ptr = static_cast<uint8_t*>(dest);
+        while (size > 0)
+        {
+            // ループ区間の終端とバッファの終端の手前までずつコピーする
+            auto position = (loop_start_ + replay_position_) % capacity_;
+            auto length = std::min({size, loop_length_ - replay_position_, capacity_ - position});
+            std::copy(buffer_.begin() + position, buffer_.begin() + position + length, ptr);
+
+            ptr += length;
+            size -= length;
+            replay_position_ += length;
+            if (replay_position_ == loop_length_)
+            {
+                replay_position_ = 0;
+            }
+        }
+    }
+
+} // namespace MusicCom
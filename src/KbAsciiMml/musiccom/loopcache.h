@@ -0,0 +1,60 @@
+﻿#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace MusicCom
+{
+    // ループ本体の PCM キャッシュ
+    // 出力を直近 budget バイト分のリングバッファに記録しておき、同期点での演奏状態のハッシュ値が
+    // 以前と一致したら、その間の出力をループとして繰り返し再生する
+    // ハッシュ値には音源の内部状態 (位相やエンベロープ) も含めること (一致した後の出力が合成と同じになる)
+    // 出力の形式によらないよう、バイト単位で扱う (Reset するまでは同じ形式で記録すること)
+    // 演奏中にメモリを確保しないよう、バッファと同期点の表は作成時に確保しておく
+    class LoopCache
+    {
+    public:
+        explicit LoopCache(size_t budget);
+        void Reset();
+
+        // 出力を記録する
+        void Record(const void* src, size_t size);
+        // 同期点での演奏状態を登録する (記録済みの区間がループになったら true)
+        bool Synchronize(uint64_t hash);
+
+        bool IsReplaying() const;
+        // ループ区間の先頭からの再生位置 (バイト)
+        size_t GetReplayPosition() const;
+        // ループ区間を繰り返し出力する
+        void Replay(void* dest, size_t size);
+
+    private:
+        struct SyncPoint
+        {
+            uint64_t Hash;
+            uint64_t Position; // 同期点での記録済みバイト数
+            bool Used;
+        };
+        // 同期点の表の大きさと、ハッシュ値ごとに探す範囲
+        // 範囲内が埋まっていれば最も古い同期点を上書きする (ループを見つけるのが遅れるだけ)
+        static const size_t SYNC_POINT_COUNT = 4096;
+        static const size_t SYNC_POINT_PROBES = 8;
+
+        // リングバッファから外れた同期点
+        bool IsExpired(const SyncPoint& point) const;
+
+        // 記録できるバイト数
+        const size_t capacity_;
+        std::vector<uint8_t> buffer_;
+        uint64_t recorded_;
+        std::vector<SyncPoint> positions_; // ハッシュ値から、最後にその状態になった同期点
+
+        bool replaying_;
+        size_t loop_start_;  // ループ区間の先頭のバッファ上の位置
+        size_t loop_length_; // ループ区間のバイト数
+        size_t replay_position_;
+    };
+
+} // namespace MusicCom
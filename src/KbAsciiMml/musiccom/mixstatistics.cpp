@@ -0,0 +1,225 @@
+﻿#include "mixstatistics.h"
+#include <algorithm>
+#include <bit>
+#include <format>
+
+namespace MusicCom
+{
+    LatencyHistogram::LatencyHistogram()
+    {
+        Clear();
+    }
+
+    void LatencyHistogram::Record(uint64_t value)
+    {
+        buckets_[GetIndex(value)]++;
+        count_++;
+        max_ = std::max(max_, value);
+    }
+
+    void LatencyHistogram::Clear()
+    {
+        buckets_.fill(0);
+        count_ = 0;
+        max_ = 0;
+    }
+
+    uint64_t LatencyHistogram::GetValueAtPercentile(double percentile) const
+    {
+        if (count_ == 0)
+        {
+            return 0;
+        }
+
+        uint64_t threshold = static_cast<uint64_t>(count_ * std::min(percentile, 100.0) / 100.0 + 0.5);
+        uint64_t accumulated = 0;
+        for (int index = 0; index < BUCKET_COUNT; index++)
+        {
+            accumulated += buckets_[index];
+            if (accumulated >= std::max<uint64_t>(threshold, 1))
+            {
+                return std::min(GetUpperBound(index), max_);
+            }
+        }
+        return max_;
+    }
+
+    int LatencyHistogram::GetIndex(uint64_t value)
+    {
+        // SUB_BUCKET_COUNT 未満はそのまま、それ以上は上位 SUB_BUCKET_BITS+1 ビットで区分する
+        if (value < SUB_BUCKET_COUNT)
+        {
+            return static_cast<int>(value);
+        }
+        int exponent = static_cast<int>(std::bit_width(value)) - 1;
+        int sub_bucket = static_cast<int>((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1));
+        return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + sub_bucket;
+    }
+
+    uint64_t LatencyHistogram::GetUpperBound(int index)
+    {
+        if (index < SUB_BUCKET_COUNT)
+        {
+            return index;
+        }
+        int exponent = index / SUB_BUCKET_COUNT + SUB_BUCKET_BITS - 1;
+        uint64_t sub_bucket = index % SUB_BUCKET_COUNT;
+        uint64_t width = uint64_t(1) << (exponent - SUB_BUCKET_BITS);
+        return ((SUB_BUCKET_COUNT + sub_bucket) << (exponent - SUB_BUCKET_BITS)) + width - 1;
+    }
+
+    MixStatistics::MixStatistics()
+        : rate_(0),
+          recording_(0),
+          published_(NONE)
+    {
+        for (auto& counters : counters_)
+        {
+            counters.Clear();
+        }
+    }
+
+    void MixStatistics::SetRate(int rate)
+    {
+        rate_.store(rate, std::memory_order_relaxed);
+    }
+
+    void MixStatistics::RecordSection(Section section, std::chrono::nanoseconds elapsed)
+    {
+        auto& counters = counters_[recording_];
+        switch (section)
+        {
+        case Section::SYNTHESIS:
+            counters.SynthesisNanoseconds += elapsed.count();
+            break;
+        case Section::SEQUENCING:
+            counters.SequencingNanoseconds += elapsed.count();
+            break;
+        }
+    }
+
+    void MixStatistics::RecordSynthesisCall(bool silent, int nsamples)
+    {
+        auto& counters = counters_[recording_];
+        counters.SynthesisSamples += nsamples;
+        if (silent)
+        {
+            counters.SilentCalls++;
+            counters.SilentSamples += nsamples;
+            return;
+        }
+        counters.SynthesisCalls++;
+    }
+
+    void MixStatistics::RecordCommands(int commands, int frames, int max_commands_per_frame)
+    {
+        auto& counters = counters_[recording_];
+        counters.Commands += commands;
+        counters.Frames += frames;
+        counters.MaxCommandsPerFrame = std::max(counters.MaxCommandsPerFrame, max_commands_per_frame);
+    }
+
+    void MixStatistics::RecordRender(std::chrono::nanoseconds elapsed, int nsamples)
+    {
+        auto& counters = counters_[recording_];
+        counters.RenderHistogram.Record(elapsed.count());
+        counters.RenderSamples += nsamples;
+        counters.RenderNanoseconds += elapsed.count();
+
+        // 負荷率 = 処理時間 / 出力したサンプルの再生時間
+        int rate = rate_.load(std::memory_order_relaxed);
+        if (rate > 0 && nsamples > 0)
+        {
+            double deadline = nsamples * 1.0e9 / rate;
+            counters.MaxLoad = std::max(counters.MaxLoad, elapsed.count() / deadline);
+        }
+
+        counters.TotalSynthesisCalls += counters.SynthesisCalls;
+        counters.MaxSynthesisCalls = std::max(counters.MaxSynthesisCalls, counters.SynthesisCalls);
+        counters.SynthesisCalls = 0;
+    }
+
+    bool MixStatistics::Publish()
+    {
+        if (published_.load(std::memory_order_acquire) != NONE)
+        {
+            return false;
+        }
+        // もう一方の面は前回の書き出しでリセット済み
+        published_.store(recording_, std::memory_order_release);
+        recording_ ^= 1;
+        return true;
+    }
+
+    bool MixStatistics::WriteReport(std::ostream& stream)
+    {
+        int published = published_.load(std::memory_order_acquire);
+        if (published == NONE)
+        {
+            return false;
+        }
+        auto& counters = counters_[published];
+
+        auto renders = counters.RenderHistogram.GetCount();
+        if (renders > 0)
+        {
+            auto us = [](uint64_t ns)
+            {
+                return ns / 1000.0;
+            };
+            auto ratio = [&counters](uint64_t ns)
+            {
+                return (counters.RenderNanoseconds > 0) ? ns * 100.0 / counters.RenderNanoseconds : 0.0;
+            };
+            int rate = rate_.load(std::memory_order_relaxed);
+            double average_load = (rate > 0 && counters.RenderSamples > 0) ? counters.RenderNanoseconds / (counters.RenderSamples * 1.0e9 / rate) : 0.0;
+
+            stream << std::format("renders={} samples={} rate={}\n", renders, counters.RenderSamples, rate);
+            stream << std::format(
+                "  render(us): p50={:.1f} p90={:.1f} p99={:.1f} p99.9={:.1f} max={:.1f}\n",
+                us(counters.RenderHistogram.GetValueAtPercentile(50.0)),
+                us(counters.RenderHistogram.GetValueAtPercentile(90.0)),
+                us(counters.RenderHistogram.GetValueAtPercentile(99.0)),
+                us(counters.RenderHistogram.GetValueAtPercentile(99.9)),
+                us(counters.RenderHistogram.GetMax()));
+            stream << std::format("  load: avg={:.2f}% max={:.2f}%\n", average_load * 100.0, counters.MaxLoad * 100.0);
+            stream << std::format(
+                "  time: opn.Mix={:.1f}% parts={:.1f}% other={:.1f}%\n",
+                ratio(counters.SynthesisNanoseconds),
+                ratio(counters.SequencingNanoseconds),
+                std::max(0.0, 100.0 - ratio(counters.SynthesisNanoseconds) - ratio(counters.SequencingNanoseconds)));
+            stream << std::format("  opn.Mix calls/render: avg={:.1f} max={}\n", counters.TotalSynthesisCalls / static_cast<double>(renders), counters.MaxSynthesisCalls);
+            // 出力のレートの RenderSamples ではなく、同じ合成のレートで数えたサンプル数と比べる
+            stream << std::format(
+                "  silent: skipped calls={} samples={:.1f}%\n",
+                counters.SilentCalls,
+                (counters.SynthesisSamples > 0) ? counters.SilentSamples * 100.0 / counters.SynthesisSamples : 0.0);
+            stream << std::format("  commands/frame: avg={:.2f} max={}\n", (counters.Frames > 0) ? counters.Commands / static_cast<double>(counters.Frames) : 0.0, counters.MaxCommandsPerFrame);
+            stream.flush();
+        }
+
+        counters.Clear();
+        published_.store(NONE, std::memory_order_release);
+        return true;
+    }
+
+    void MixStatistics::Counters::Clear()
+    {
+        RenderHistogram.Clear();
+        RenderSamples = 0;
+        RenderNanoseconds = 0;
+        MaxLoad = 0.0;
+        SynthesisNanoseconds = 0;
+        SequencingNanoseconds = 0;
+        SynthesisCalls = 0;
+        TotalSynthesisCalls = 0;
+        MaxSynthesisCalls = 0;
+        SilentCalls = 0;
+        SynthesisSamples = 0;
+        SilentSamples = 0;
+        Commands = 0;
+        Frames = 0;
+        MaxCommandsPerFrame = 0;
+    }
+
+} // namespace MusicCom
@@ -0,0 +1,128 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace MusicCom
+{
+    // HDR Histogram 風の対数-線形ヒストグラム
+    // 2のべき乗ごとの区間を SUB_BUCKET_COUNT 個に等分して記録する (相対誤差 1/16 以下)
+    class LatencyHistogram
+    {
+    public:
+        LatencyHistogram();
+        void Record(uint64_t value);
+        void Clear();
+        uint64_t GetCount() const { return count_; }
+        uint64_t GetMax() const { return max_; }
+        // percentile: 0.0 - 100.0
+        uint64_t GetValueAtPercentile(double percentile) const;
+
+    private:
+        static const int SUB_BUCKET_BITS = 4;
+        static const int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+        static const int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+        static int GetIndex(uint64_t value);
+        static uint64_t GetUpperBound(int index);
+
+        std::array<uint64_t, BUCKET_COUNT> buckets_;
+        uint64_t count_;
+        uint64_t max_;
+    };
+
+    // Mix の処理時間などの統計
+    // 記録 (Record*, Publish) は演奏のスレッド、書き出し (WriteReport) は別の 1 スレッドから行う
+    // 集計は 2 面持ち、Publish で記録する面を切り替えて、書き出し中の面には演奏側から触れない
+    class MixStatistics
+    {
+    public:
+        enum class Section
+        {
+            SYNTHESIS, // opn.Mix
+            SEQUENCING // パートの処理
+        };
+
+        MixStatistics();
+        void SetRate(int rate);
+
+        void RecordSection(Section section, std::chrono::nanoseconds elapsed);
+        // silent: 無音のため合成を省略した
+        // nsamples は合成のレートでのサンプル数 (リサンプルする場合は出力のレートと異なる)
+        void RecordSynthesisCall(bool silent, int nsamples);
+        void RecordCommands(int commands, int frames, int max_commands_per_frame);
+        void RecordRender(std::chrono::nanoseconds elapsed, int nsamples);
+
+        // 前回の Publish 以降の統計を書き出し待ちにして、記録する面を切り替える
+        // 前回の分がまだ書き出されていなければ何もせずに false を返す (記録は続ける)
+        bool Publish();
+        // 書き出し待ちの統計を書き出してリセットする (書き出し待ちがなければ false)
+        bool WriteReport(std::ostream& stream);
+
+    private:
+        struct Counters
+        {
+            void Clear();
+
+            LatencyHistogram RenderHistogram;
+            uint64_t RenderSamples;
+            uint64_t RenderNanoseconds;
+            double MaxLoad;
+
+            uint64_t SynthesisNanoseconds;
+            uint64_t SequencingNanoseconds;
+
+            int SynthesisCalls;
+            uint64_t TotalSynthesisCalls;
+            int MaxSynthesisCalls;
+            uint64_t SilentCalls;
+            uint64_t SynthesisSamples; // 合成のレート
+            uint64_t SilentSamples;    // 合成のレート
+
+            uint64_t Commands;
+            uint64_t Frames;
+            int MaxCommandsPerFrame;
+        };
+
+        static const int NONE = -1;
+
+        std::atomic<int> rate_;
+        std::array<Counters, 2> counters_;
+        int recording_;              // 記録中の面 (演奏のスレッドのみ参照)
+        std::atomic<int> published_; // 書き出し待ちの面 (なければ NONE)
+    };
+
+    // スコープ内の処理時間を記録する (statistics が nullptr の場合は何もしない)
+    class ScopedMixTimer
+    {
+    public:
+        ScopedMixTimer(MixStatistics* statistics, MixStatistics::Section section)
+            : statistics_(statistics),
+              section_(section)
+        {
+            if (statistics_)
+            {
+                start_ = std::chrono::steady_clock::now();
+            }
+        }
+        ~ScopedMixTimer()
+        {
+            if (statistics_)
+            {
+                statistics_->RecordSection(section_, std::chrono::steady_clock::now() - start_);
+            }
+        }
+
+    private:
+        ScopedMixTimer(const ScopedMixTimer&) = delete;
+        ScopedMixTimer& operator=(const ScopedMixTimer&) = delete;
+
+        MixStatistics* statistics_;
+        MixStatistics::Section section_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+} // namespace MusicCom
@@ -2,31 +2,112 @@
 #include "musdata.h"
 
 #include <algorithm>
-#include <boost/lexical_cast.hpp>
-#include <boost/spirit/include/classic_core.hpp>
-#include <boost/spirit/include/classic_file_iterator.hpp>
-#include <boost/spirit/include/classic_utility.hpp>
+#include <charconv>
 #include <format>
+#include <fstream>
 #include <memory>
 #include <numeric>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <variant>
 #include <vector>
 
 using namespace std;
-using namespace boost::spirit::classic;
-using boost::bad_lexical_cast;
-using boost::lexical_cast;
 
 namespace MusicCom
 {
-    int ParseLength(string s)
+    namespace
+    {
+        // 旧実装 (boost::lexical_cast) が送出していた例外と同じメッセージ
+        // エラーメッセージの互換性のために残している
+        const char BAD_NUMBER_MESSAGE[] = "bad lexical cast: source type value could not be interpreted as target";
+
+        // [+-]?[0-9]+ で int の範囲に収まる場合のみ変換する (boost::lexical_cast<int> と同じ規則)
+        bool TryParseInt(string_view s, int& value)
+        {
+            if (!s.empty() && s[0] == '+')
+            {
+                s.remove_prefix(1);
+                if (s.empty() || s[0] == '-')
+                    return false;
+            }
+            const char* last = s.data() + s.size();
+            auto [ptr, ec] = from_chars(s.data(), last, value);
+            return ec == errc() && ptr == last;
+        }
+
+        // first から last までの改行の数 (\r\n, \n, \r をそれぞれ 1 つと数える)
+        int CountLines(const char* first, const char* last)
+        {
+            int count = 0;
+            for (const char* p = first; p != last; ++p)
+            {
+                if (*p == '\n' || (*p == '\r' && (p + 1 == last || p[1] != '\n')))
+                    count++;
+            }
+            return count;
+        }
+
+        bool IsBlank(char c)
+        {
+            return c == ' ' || c == '\t';
+        }
+
+        bool IsDigit(char c)
+        {
+            return '0' <= c && c <= '9';
+        }
+
+        bool IsCntrl(char c)
+        {
+            unsigned char uc = static_cast<unsigned char>(c);
+            return uc < 0x20 || uc == 0x7f;
+        }
+
+        char ToLower(char c)
+        {
+            return ('A' <= c && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+
+        // マクロ名に使える文字
+        bool IsMacroNameChar(char c)
+        {
+            return c != '$' && c != ',' && c != '=' && !IsBlank(c) && !IsCntrl(c);
+        }
+
+        // LFO/OP 行の数値以外の引数に使われる文字
+        bool IsInvalidArgChar(char c)
+        {
+            return !IsDigit(c) && c != '+' && c != '-' && !IsBlank(c) && !IsCntrl(c) && c != ',';
+        }
+
+        // 制御コマンドの文字 (小文字化した後に判定する)
+        bool IsCtrlChar(char c)
+        {
+            switch (c)
+            {
+            case '@':
+            case '{':
+            case '}':
+            case '<':
+            case '>':
+            case '&':
+                return true;
+            default:
+                return 'h' <= c && c <= 'z';
+            }
+        }
+    } // namespace
+
+    int ParseLength(string_view s)
     {
         if (s.empty())
             return 0;
         bool dotted;
-        if (*s.rbegin() == '.')
+        if (s.back() == '.')
         {
-            s.erase(--s.end());
+            s.remove_suffix(1);
             dotted = true;
         }
         else
@@ -34,7 +115,11 @@ namespace MusicCom
             dotted = false;
         }
 
-        int len = lexical_cast<int>(s);
+        int len;
+        if (!TryParseInt(s, len))
+        {
+            throw invalid_argument(BAD_NUMBER_MESSAGE);
+        }
         if (len <= 0 || 64 < len)
         {
             //throw runtime_error("illegal note length");
@@ -47,39 +132,58 @@ namespace MusicCom
         return len;
     }
 
-    int StringToInt(string s)
+    int StringToInt(string_view s)
     {
-        try
-        {
-            return lexical_cast<int>(s);
-        }
-        catch (bad_lexical_cast)
-        {
-            return 0;
-        }
+        int value;
+        return TryParseInt(s, value) ? value : 0;
     }
 
     // LFO/OP用
-    vector<int> ParseSoundArgs(vector<string>& args, int num)
+    vector<int> ParseSoundArgs(const vector<string_view>& args, int num)
     {
         vector<int> container(args.size());
-        try
-        {
-            transform(args.begin(), args.end(), container.begin(), [](std::string& s)
-                      { return lexical_cast<int>(s); });
-        }
-        catch (bad_lexical_cast)
+        for (size_t i = 0; i < args.size(); i++)
         {
-            // 数値以外が含まれていた場合は処理を中断
-            // 以降の値はすべて 0 として扱う
+            if (!TryParseInt(args[i], container[i]))
+            {
+                // 数値以外が含まれていた場合は処理を中断
+                // 以降の値はすべて 0 として扱う
+                container[i] = 0;
+                break;
+            }
         }
         container.resize(num, 0);
 
         return container;
     }
 
-    struct MMLParser : public grammar<MMLParser>
+    // MML の走査器
+    // 以前の Spirit (classic) による文法を 1 パスの手書き走査に置き換えたもの。
+    // 行番号やエラー位置を変えないよう、以下の挙動を旧文法と揃えている。
+    // - 各要素の直前の空白 (スペース/タブ) は読み飛ばし、引数の範囲には含めない
+    // - 選択 (|), 繰り返し (*), 省略可能 (!) は失敗すると開始位置に戻るが、連接 (>>) は戻らない
+    // - 解析途中で実行した処理 (行番号の更新やコマンドの追加) は取り消さない
+    class MMLParser
     {
+    public:
+        MMLParser(const char* first, const char* last, MusicData* pMusicData)
+            : cur(first),
+              last(last),
+              pMusicData(pMusicData),
+              LineStart(first),
+              CountedPosition(first),
+              SourceLine(1),
+              LineNumber(1),
+              LineType(UNDEFINED),
+              LastLineType(UNDEFINED),
+              ChNumber(),
+              CommandType(),
+              SoundNumber(),
+              Finished(false),
+              pOperations(nullptr)
+        {
+        }
+
         enum MMLLineType
         {
             UNDEFINED,
@@ -92,546 +196,970 @@ namespace MusicCom
             STR
         };
 
-        struct MMLParserState
+        // 行をまたいで引き継がれる解析状態 (差分解析で解析を再開する際に使用する)
+        struct State
         {
-            MMLParserState()
-                : pMusicData(nullptr),
-                  LineNumber(1),
-                  LineType(UNDEFINED),
-                  ChNumber(),
-                  CommandType(),
-                  SoundNumber(),
-                  Finished(false)
+            MMLLineType LineType;
+            int ChNumber;
+            MusicCom::CommandType CommandType;
+            string MacroName;
+            FMSound Sound;
+            int SoundNumber;
+
+            bool operator==(const State& other) const
             {
+                return IsSameExceptSound(other) && IsSameSound(Sound, other.Sound) && SoundNumber == other.SoundNumber;
             }
+            // 音色の状態は SOUND/LFO/OP 行でしか参照しない
+            // チャンネル番号やマクロ名は行の先頭で設定し直されるため、行の種類が引き継がれる場合 ([EOF] の後) のみ比較する
+            bool IsSameExceptSound(const State& other) const
+            {
+                if (LineType != other.LineType)
+                    return false;
+                return LineType == UNDEFINED || (ChNumber == other.ChNumber && MacroName == other.MacroName);
+            }
+        };
 
-            vector<string> args;
-
-            MusicData* pMusicData;
-
-            // Line
-            int LineNumber;
+        // 差分解析のために記録する MusicData への操作
+        struct AddCommandOperation
+        {
             MMLLineType LineType;
+            int ChNumber;
+            string MacroName;
+            Command Cmd;
+        };
+        struct SetTempoOperation
+        {
+            int Tempo;
+        };
+        struct SetFMSoundOperation
+        {
+            int No;
+            FMSound Sound;
+        };
+        struct SetSSGEnvOperation
+        {
+            int No;
+            SSGEnv Env;
+        };
+        using Operation = variant<AddCommandOperation, SetTempoOperation, SetFMSoundOperation, SetSSGEnvOperation>;
 
-            int ChNumber; // ch番号 (0-origin)
+        static void ApplyOperation(const Operation& operation, MusicData& music_data)
+        {
+            if (auto p = get_if<AddCommandOperation>(&operation))
+            {
+                switch (p->LineType)
+                {
+                case CH:
+                    music_data.AddCommandToChannel(p->ChNumber, p->Cmd);
+                    break;
+                case RHYTHM:
+                    music_data.AddCommandToRhythmPart(p->Cmd);
+                    break;
+                case STR:
+                    music_data.AddCommandToMacro(p->MacroName, p->Cmd);
+                    break;
+                default:
+                    assert(0);
+                    break;
+                }
+            }
+            else if (auto p = get_if<SetTempoOperation>(&operation))
+            {
+                music_data.SetTempo(p->Tempo);
+            }
+            else if (auto p = get_if<SetFMSoundOperation>(&operation))
+            {
+                music_data.SetFMSound(p->No, p->Sound);
+            }
+            else if (auto p = get_if<SetSSGEnvOperation>(&operation))
+            {
+                music_data.SetSSGEnv(p->No, p->Env);
+            }
+        }
 
-            CommandType CommandType;
-            string MacroName;
+        // 指定した場合、MusicData に書き込む代わりに操作を記録する
+        void SetOperations(vector<Operation>* operations) { pOperations = operations; }
 
-            // Sound
-            FMSound Sound;
-            int SoundNumber;
+        // 直前に解析した行が音色の状態を参照・変更する行 (SOUND/LFO/OP) かどうか
+        bool IsSoundLine() const
+        {
+            return LastLineType == SOUND || LastLineType == LFO || LastLineType == OP;
+        }
 
-            bool Finished;
-        };
+        State GetState() const
+        {
+            return State{LineType, ChNumber, CommandType, MacroName, Sound, SoundNumber};
+        }
 
-        MMLParser(MMLParserState& s) : state(s)
+        // 行の先頭 p から、指定した状態で解析を再開する
+        void Restart(const char* p, int line_number, const State& state)
         {
+            cur = p;
+            LineNumber = line_number;
+            LineType = state.LineType;
+            ChNumber = state.ChNumber;
+            CommandType = state.CommandType;
+            MacroName = state.MacroName;
+            Sound = state.Sound;
+            SoundNumber = state.SoundNumber;
+            Finished = false;
         }
-        MMLParserState& state;
+
+        // 1行を解析する
+        // 失敗した場合は false を返し、GetPosition() は解析が止まった位置を指す
+        bool ParseLine()
+        {
+            using LineParser = bool (MMLParser::*)();
+            static const LineParser line_parsers[] = {
+                &MMLParser::ParseChLine,
+                &MMLParser::ParseDrumLine,
+                &MMLParser::ParseSoundLine,
+                &MMLParser::ParseLFOLine,
+                &MMLParser::ParseOPLine,
+                &MMLParser::ParseSSGEnvLine,
+                &MMLParser::ParseStrLine,
+                &MMLParser::ParseArrowLine,
+            };
+
+            // いずれにも一致しなければ空行
+            LastLineType = UNDEFINED;
+            LineStart = cur;
+            const char* save = cur;
+            for (LineParser parser : line_parsers)
+            {
+                if ((this->*parser)())
+                    break;
+                cur = save;
+            }
+
+            save = cur;
+            if (!ParseComment())
+                cur = save;
+
+            // 0x1a = [EOF]
+            save = cur;
+            if (MatchEol())
+            {
+                ChangeLine();
+                return true;
+            }
+            cur = save;
+            if (AtEnd())
+            {
+                Finish();
+                return true;
+            }
+            cur = save;
+            return MatchChar(0x1a);
+        }
+
+        const char* GetPosition() const { return cur; }
+        void SetPosition(const char* p) { cur = p; }
+        int GetLineNumber() const { return LineNumber; }
+        bool IsFinished() const { return Finished; }
 
     private:
-        static void AddCommand(MMLParserState& state, const Command& command)
+        static bool IsSameSound(const FMSound& a, const FMSound& b)
         {
-            switch (state.LineType)
+            if (a.LFOForm != b.LFOForm || a.LFOSpeed != b.LFOSpeed || a.LFODepth != b.LFODepth || a.AlgFb != b.AlgFb)
+                return false;
+            for (int i = 0; i < 4; i++)
             {
-            case CH:
-                state.pMusicData->AddCommandToChannel(state.ChNumber, command);
-                break;
-            case RHYTHM:
-                state.pMusicData->AddCommandToRhythmPart(command);
-                break;
-            case STR:
-                state.pMusicData->AddCommandToMacro(state.MacroName, command);
-                break;
-            default:
-                assert(0);
-                break;
+                const auto& x = a.Op[i];
+                const auto& y = b.Op[i];
+                if (x.DtMl != y.DtMl || x.Tl != y.Tl || x.KsAr != y.KsAr || x.Dr != y.Dr ||
+                    x.Sr != y.Sr || x.SlRr != y.SlRr || x.Dt2 != y.Dt2)
+                    return false;
             }
+            return true;
         }
 
-        struct ChangeLine
+        const char* cur;
+        const char* last;
+
+        vector<string_view> args;
+
+        MusicData* pMusicData;
+
+        // MML ファイル上の行番号 (LineNumber は SSGENV 行の先読みの分ずれるため別に数える)
+        const char* LineStart;
+        const char* CountedPosition;
+        int SourceLine;
+
+        // Line
+        int LineNumber;
+        MMLLineType LineType;
+        MMLLineType LastLineType;
+
+        int ChNumber; // ch番号 (0-origin)
+
+        MusicCom::CommandType CommandType;
+        string MacroName;
+
+        // Sound
+        FMSound Sound;
+        int SoundNumber;
+
+        bool Finished;
+
+        vector<Operation>* pOperations;
+
+        // 字句の照合
+        void SkipBlank()
+        {
+            while (cur != last && IsBlank(*cur))
+                ++cur;
+        }
+
+        bool AtEnd()
+        {
+            SkipBlank();
+            return cur == last;
+        }
+
+        bool MatchChar(char c)
+        {
+            if (!AtEnd() && *cur == c)
+            {
+                ++cur;
+                return true;
+            }
+            return false;
+        }
+
+        void MatchOptionalChar(char c)
         {
-            ChangeLine(MMLParserState& s) : state(s) {}
+            const char* save = cur;
+            if (!MatchChar(c))
+                cur = save;
+        }
 
-            template<typename IteratorT>
-            void operator()(IteratorT first, IteratorT last) const
+        // 0個以上の ',' (スペースで区切るMML対策)
+        void SkipCommas()
+        {
+            for (;;)
             {
-                // パート解析の場合は一時停止コマンドを追加
-                if (state.LineType == CH || state.LineType == RHYTHM)
+                const char* save = cur;
+                if (!MatchChar(','))
                 {
-                    AddCommand(state, CommandType::TYPE_PAUSE);
+                    cur = save;
+                    return;
                 }
-
-                state.LineNumber++;
-                state.LineType = UNDEFINED;
             }
+        }
 
-            MMLParserState& state;
-        };
+        // 大文字小文字を区別しないキーワード (途中に空白は置けない)
+        bool MatchKeyword(const char* keyword)
+        {
+            SkipBlank();
+            for (; *keyword != '\0'; ++keyword, ++cur)
+            {
+                if (cur == last || ToLower(*cur) != *keyword)
+                    return false;
+            }
+            return true;
+        }
 
-        struct Finish
+        bool MatchEol()
         {
-            Finish(MMLParserState& s) : state(s) {}
+            SkipBlank();
+            bool matched = false;
+            if (cur != last && *cur == '\r')
+            {
+                ++cur;
+                matched = true;
+            }
+            if (cur != last && *cur == '\n')
+            {
+                ++cur;
+                matched = true;
+            }
+            return matched;
+        }
 
-            template<typename IteratorT>
-            void operator()(IteratorT first, IteratorT last) const
+        // 行末の手前 (末尾の空白の前) まで読み飛ばす
+        void SkipToEol()
+        {
+            for (;;)
             {
-                // パート解析の場合は一時停止コマンドを追加
-                if (state.LineType == CH || state.LineType == RHYTHM)
+                const char* save = cur;
+                SkipBlank();
+                if (cur == last || *cur == '\r' || *cur == '\n')
                 {
-                    AddCommand(state, CommandType::TYPE_PAUSE);
+                    cur = save;
+                    return;
                 }
+                ++cur;
+            }
+        }
 
-                state.Finished = true;
+        bool MatchInt(int& value)
+        {
+            SkipBlank();
+            const char* first = cur;
+            if (cur != last && (*cur == '+' || *cur == '-'))
+                ++cur;
+            const char* digits = cur;
+            while (cur != last && IsDigit(*cur))
+                ++cur;
+            if (cur == digits)
+            {
+                cur = first;
+                return false;
+            }
+            // 桁あふれした場合は一致しない
+            auto [ptr, ec] = from_chars(*first == '+' ? digits : first, cur, value);
+            if (ec != errc())
+            {
+                cur = first;
+                return false;
             }
+            return true;
+        }
 
-            MMLParserState& state;
-        };
+        bool MatchRun(bool (*pred)(char))
+        {
+            SkipBlank();
+            const char* first = cur;
+            while (cur != last && pred(*cur))
+                ++cur;
+            return cur != first;
+        }
 
-        template<enum MMLLineType t>
-        struct BeginLine
+        void PushArg(const char* first, const char* last)
         {
-            BeginLine(MMLParserState& s) : state(s) {}
+            args.emplace_back(first, static_cast<size_t>(last - first));
+        }
 
-            template<typename IteratorT>
-            void operator()(IteratorT first, IteratorT last) const
-            {
-                state.args.clear();
-                state.LineType = t;
-            }
+        // 行
+        bool ParseComment()
+        {
+            if (!MatchChar(';'))
+                return false;
+            SkipToEol();
+            return true;
+        }
 
-            MMLParserState& state;
-        };
+        // チャンネル定義 1:, ...
+        bool ParseChLine()
+        {
+            SkipBlank();
+            if (cur == last || *cur < '1' || '6' < *cur)
+                return false;
+            ChNumber = *cur++ - '1';
+            if (!MatchChar(':'))
+                return false;
+            BeginLine(CH);
+            ParseCommands();
+            return true;
+        }
 
-        struct SetChNumber
+        // D: パート (SOUND.DATのリズム音)
+        bool ParseDrumLine()
         {
-            SetChNumber(MMLParserState& s) : state(s) {}
+            if (!MatchKeyword("d:"))
+                return false;
+            BeginLine(RHYTHM);
+            ParseCommands();
+            return true;
+        }
 
-            void operator()(char c) const
-            {
-                state.ChNumber = c - '1';
-            }
+        bool ParseSoundLine()
+        {
+            if (!MatchKeyword("sound") || !MatchChar(':'))
+                return false;
+            BeginLine(SOUND);
+            MatchOptionalChar('@');
+            int no;
+            if (!MatchInt(no))
+                return false;
+            SoundNumber = no;
+            return true;
+        }
 
-            MMLParserState& state;
-        };
+        bool ParseLFOLine()
+        {
+            if (!MatchKeyword("lfo") || !MatchChar(':'))
+                return false;
+            BeginLine(LFO);
+            if (!ParseSoundArgList())
+                return false;
+            ProcessLFO();
+            return true;
+        }
 
-        struct SetMacroName
+        bool ParseOPLine()
         {
-            SetMacroName(MMLParserState& s) : state(s) {}
+            if (!MatchKeyword("op"))
+                return false;
+            SkipBlank();
+            if (cur == last || *cur < '1' || '4' < *cur)
+                return false;
+            ChNumber = *cur++ - '1';
+            if (!MatchChar(':'))
+                return false;
+            BeginLine(OP);
+            if (!ParseSoundArgList())
+                return false;
+            ProcessOP();
+            return true;
+        }
+
+        bool ParseSSGEnvLine()
+        {
+            if (!MatchKeyword("ssgenv") || !MatchChar(':'))
+                return false;
+            BeginLine(SSGENV);
+            MatchOptionalChar('@');
 
-            template<typename IteratorT>
-            void operator()(IteratorT first, IteratorT last) const
+            ParseSSGEnvArg();
+            for (;;)
             {
-                state.MacroName.assign(first, last);
+                const char* save = cur;
+                if (!ParseSSGEnvSeparator())
+                {
+                    cur = save;
+                    break;
+                }
+                ParseSSGEnvArg();
             }
+            ProcessSSGEnv();
+            return true;
+        }
 
-            MMLParserState& state;
-        };
-
-        struct PushArg
+        // 数値がなければ空の引数とする
+        void ParseSSGEnvArg()
         {
-            PushArg(MMLParserState& s) : state(s) {}
+            SkipBlank();
+            const char* first = cur;
+            int value;
+            if (!MatchInt(value))
+                cur = first;
+            PushArg(first, cur);
+        }
 
-            template<typename IteratorT>
-            void operator()(IteratorT first, IteratorT last) const
+        // ',' または 改行 (コメント/空行を挟んでもよい) の後の "->"
+        // "->" が続かなかった場合も、読み進めた改行の分だけ行番号は進んだままになる
+        bool ParseSSGEnvSeparator()
+        {
+            const char* save = cur;
+            if (MatchEol())
             {
-                string s(first, last);
-                state.args.push_back(s);
+                ChangeLine();
+                for (;;)
+                {
+                    const char* line_start = cur;
+                    if (!ParseComment())
+                        cur = line_start;
+                    if (!MatchEol())
+                    {
+                        cur = line_start;
+                        break;
+                    }
+                    ChangeLine();
+                }
+                if (MatchKeyword("->"))
+                    return true;
             }
+            cur = save;
+            return MatchChar(',');
+        }
 
-            MMLParserState& state;
-        };
+        bool ParseStrLine()
+        {
+            if (!MatchKeyword("str") || !MatchChar(':'))
+                return false;
+            BeginLine(STR);
+            SkipBlank();
+            const char* first = cur;
+            if (!MatchRun(IsMacroNameChar))
+                return false;
+            MacroName.assign(first, cur);
+            MatchOptionalChar('$');
+            if (!MatchChar('='))
+                return false;
+            ParseCommands();
+            return true;
+        }
 
-        // Sound
-        struct ProcessLFO
+        // SSGENV外の -> は無視する
+        bool ParseArrowLine()
         {
-            ProcessLFO(MMLParserState& s) : state(s) {}
+            if (!MatchKeyword("->"))
+                return false;
+            SkipToEol();
+            return true;
+        }
 
-            template<typename IteratorT>
-            void operator()(IteratorT first, IteratorT last) const
+        // LFO/OP用の引数
+        bool ParseSoundArgList()
+        {
+            if (!ParseSoundArg())
+                return false;
+            for (;;)
             {
-                auto a = ParseSoundArgs(state.args, 5);
+                const char* save = cur;
+                SkipCommas();
+                if (!ParseSoundArg())
+                {
+                    cur = save;
+                    break;
+                }
+            }
+            SkipCommas();
+            return true;
+        }
 
-                // LFO:	WF,SPEED,DEPTH,ALG,FB
-                FMSound& sound = state.Sound;
-                sound.SetLFO(a[0], a[1], a[2]);
-                sound.SetAlgFb(a[3], a[4]);
-                state.pMusicData->SetFMSound(state.SoundNumber, sound);
+        // 数値の直後に続く数値以外の文字列は別の引数とする
+        bool ParseSoundArg()
+        {
+            SkipBlank();
+            const char* first = cur;
+            if (!MatchRun(IsInvalidArgChar))
+            {
+                cur = first;
+                int value;
+                if (!MatchInt(value))
+                    return false;
             }
+            PushArg(first, cur);
 
-            MMLParserState& state;
-        };
+            for (;;)
+            {
+                const char* save = cur;
+                SkipBlank();
+                first = cur;
+                if (!MatchRun(IsInvalidArgChar))
+                {
+                    cur = save;
+                    break;
+                }
+                PushArg(first, cur);
+            }
+            return true;
+        }
 
-        struct ProcessOP
+        // MML コマンド
+        void ParseCommands()
         {
-            ProcessOP(MMLParserState& s) : state(s) {}
+            for (;;)
+            {
+                const char* save = cur;
+                if (!ParseCommand())
+                {
+                    cur = save;
+                    return;
+                }
+            }
+        }
 
-            template<typename IteratorT>
-            void operator()(IteratorT first, IteratorT last) const
+        // コマンドの種類は先頭の 1 文字で決まる
+        bool ParseCommand()
+        {
+            if (AtEnd())
+                return false;
+            char c = ToLower(*cur);
+            if ('a' <= c && c <= 'g')
+            {
+                ParseNote();
+                ProcessNote();
+                return true;
+            }
+            if (IsCtrlChar(c))
+            {
+                ParseCtrl();
+                ProcessCtrl();
+                return true;
+            }
+            if (c == '$' && ParseCall())
             {
-                int op = state.ChNumber;
-                auto a = ParseSoundArgs(state.args, 10);
+                ProcessCall();
+                return true;
+            }
+            return false;
+        }
+
+        void ParseNote()
+        {
+            BeginCommand(ToLower(*cur++));
 
-                // OP1:	AR,DR,SR,RR,SL,TL,KS,ML,DT,DT2
-                FMSound& sound = state.Sound;
-                sound.SetDtMl(op, a[8], a[7]);
-                sound.SetTl(op, a[5]);
-                sound.SetKsAr(op, a[6], a[0]);
-                sound.SetDr(op, a[1]);
-                //			sound.SetSr(op, a[2]);
-                sound.SetSr(op, a[4]); // music.comでSrとしてSlが使われるバグ！？
-                sound.SetSlRr(op, a[4], a[3]);
-                sound.SetDt2(op, a[9]);
-                state.pMusicData->SetFMSound(state.SoundNumber, state.Sound);
+            SkipBlank();
+            const char* first = cur;
+            if (cur != last && (*cur == '+' || *cur == '-'))
+                ++cur;
+            PushArg(first, cur);
+
+            SkipCommas(); // 引数の前にカンマを置くMML対策
+            const char* save = cur;
+            if (!ParseArg())
+            {
+                cur = save;
+                SkipBlank();
+                PushArg(cur, cur);
             }
+            SkipCommas(); // 引数の後にカンマを置くMML対策
+            // '&' はコマンドとして扱う
+        }
 
-            MMLParserState& state;
-        };
+        void ParseCtrl()
+        {
+            BeginCommand(ToLower(*cur++));
 
-        // SSGEnv
-        struct ProcessSSGEnv
+            SkipCommas(); // 第1引数の前にカンマを置くMML対策
+            const char* save = cur;
+            if (!ParseArgs())
+                cur = save;
+        }
+
+        bool ParseCall()
         {
-            ProcessSSGEnv(MMLParserState& s) : state(s) {}
+            BeginCommand(*cur++);
+            SkipBlank();
+            const char* first = cur;
+            if (!MatchRun(IsMacroNameChar))
+                return false;
+            PushArg(first, cur);
+            if (!MatchChar('$'))
+                return false;
+            MatchOptionalChar(','); // なぜかマクロ呼び出しを','で区切るMML対策
+            return true;
+        }
 
-            template<typename IteratorT>
-            void operator()(IteratorT first, IteratorT last) const
+        // 数値と '.' の間には空白を置ける (その場合は音長の変換で失敗する)
+        bool ParseArg()
+        {
+            SkipBlank();
+            const char* first = cur;
+            int value;
+            if (MatchInt(value))
+            {
+                MatchOptionalChar('.');
+            }
+            else
             {
-                SSGEnv env;
+                cur = first;
+                if (!MatchChar('.'))
+                    return false;
+            }
+            PushArg(first, cur);
+            return true;
+        }
 
-                if (state.args.size() < 3)
+        bool ParseArgs()
+        {
+            if (!ParseArg())
+                return false;
+            for (;;)
+            {
+                const char* save = cur;
+                SkipCommas(); // スペースで区切るMML対策
+                if (!ParseArg())
                 {
-                    //throw std::runtime_error("SSGEnvの引数が足りない");
-                    return;
+                    cur = save;
+                    break;
                 }
-
-                int no = StringToInt(state.args[0]);
-                env.Unit = StringToInt(state.args[1]);
-                env.Env.clear();
-                transform(state.args.begin() + 2, state.args.end(), back_inserter(env.Env), StringToInt);
-                state.pMusicData->SetSSGEnv(no, env);
             }
+            SkipCommas();
+            return true;
+        }
 
-            MMLParserState& state;
-        };
-
-        // MML コマンド
-        struct BeginCommand
+        // 解析結果の処理
+        void AddCommand(const Command& command)
         {
-            BeginCommand(MMLParserState& s) : state(s) {}
+            if (pOperations)
+            {
+                pOperations->emplace_back(AddCommandOperation{LineType, ChNumber, MacroName, command});
+                return;
+            }
+            switch (LineType)
+            {
+            case CH:
+                pMusicData->AddCommandToChannel(ChNumber, command);
+                break;
+            case RHYTHM:
+                pMusicData->AddCommandToRhythmPart(command);
+                break;
+            case STR:
+                pMusicData->AddCommandToMacro(MacroName, command);
+                break;
+            default:
+                assert(0);
+                break;
+            }
+        }
 
-            void operator()(char c) const
+        void ChangeLine()
+        {
+            // パート解析の場合は一時停止コマンドを追加
+            if (LineType == CH || LineType == RHYTHM)
             {
-                state.args.clear();
-                state.CommandType = static_cast<CommandType>(toupper(c));
+                AddCommand(CommandType::TYPE_PAUSE);
+                AddSourceLine();
             }
 
-            MMLParserState& state;
-        };
+            LineNumber++;
+            LineType = UNDEFINED;
+        }
 
-        struct ProcessNote
+        void Finish()
         {
-            ProcessNote(MMLParserState& s) : state(s) {}
-
-            template<typename IteratorT>
-            void operator()(IteratorT first, IteratorT last) const
+            // パート解析の場合は一時停止コマンドを追加
+            if (LineType == CH || LineType == RHYTHM)
             {
-                static const int note_numbers[] = {
-                    // A,  B, C, D, E, F, G
-                    9,
-                    11,
-                    0,
-                    2,
-                    4,
-                    5,
-                    7,
-                };
+                AddCommand(CommandType::TYPE_PAUSE);
+                AddSourceLine();
+            }
 
-                vector<string>& a = state.args;
+            Finished = true;
+        }
 
-                int note = note_numbers[static_cast<char>(state.CommandType) - 'A'];
-                if (!a[0].empty())
-                {
-                    switch (a[0][0])
-                    {
-                    case '+':
-                        note++;
-                        break;
-                    case '-':
-                        note--;
-                        break;
-                    }
-                }
-                int len = ParseLength(state.args[1]);
+        // 一時停止コマンドに対応する行 (行の先頭の位置) を記録する
+        // 差分解析では MMLIncrementalParser::Build で各単位の位置から求める
+        void AddSourceLine()
+        {
+            if (pOperations)
+                return;
+            SourceLine += CountLines(CountedPosition, LineStart);
+            CountedPosition = LineStart;
+            if (LineType == CH)
+                pMusicData->AddChannelLine(ChNumber, SourceLine);
+            else
+                pMusicData->AddRhythmPartLine(SourceLine);
+        }
 
-                AddCommand(state, Command(CommandType::TYPE_NOTE, note, len));
-            }
+        void BeginLine(MMLLineType t)
+        {
+            args.clear();
+            LineType = t;
+            LastLineType = t;
+        }
 
-            MMLParserState& state;
-        };
+        // Sound
+        void ProcessLFO()
+        {
+            auto a = ParseSoundArgs(args, 5);
+
+            // LFO:	WF,SPEED,DEPTH,ALG,FB
+            FMSound& sound = Sound;
+            sound.SetLFO(a[0], a[1], a[2]);
+            sound.SetAlgFb(a[3], a[4]);
+            SetFMSound(SoundNumber, sound);
+        }
 
-        struct ProcessCtrl
+        void ProcessOP()
         {
-            ProcessCtrl(MMLParserState& s) : state(s) {}
+            int op = ChNumber;
+            auto a = ParseSoundArgs(args, 10);
+
+            // OP1:	AR,DR,SR,RR,SL,TL,KS,ML,DT,DT2
+            FMSound& sound = Sound;
+            sound.SetDtMl(op, a[8], a[7]);
+            sound.SetTl(op, a[5]);
+            sound.SetKsAr(op, a[6], a[0]);
+            sound.SetDr(op, a[1]);
+            //			sound.SetSr(op, a[2]);
+            sound.SetSr(op, a[4]); // music.comでSrとしてSlが使われるバグ！？
+            sound.SetSlRr(op, a[4], a[3]);
+            sound.SetDt2(op, a[9]);
+            SetFMSound(SoundNumber, Sound);
+        }
+
+        // SSGEnv
+        void ProcessSSGEnv()
+        {
+            SSGEnv env;
 
-            template<typename IteratorT>
-            void operator()(IteratorT first, IteratorT last) const
+            if (args.size() < 3)
             {
-                const static struct CtrlDef
-                {
-                    CommandType Type;
-                    bool IsNoteLength;
-                    int MinArgs;
-                    int MaxArgs;
-                    int Defaults[3];
-                } ctrl_defs[] = {
-                    {CommandType::TYPE_TIE, false, 0, 0, {}},
-                    {CommandType::TYPE_TEMPO, false, 1, 1, {}},
-                    {CommandType::TYPE_REST, true, 0, 1, {0}},
-                    {CommandType::TYPE_WAIT, true, 0, 1, {0}},
-                    {CommandType::TYPE_LENGTH, true, 1, 1, {}},
-                    {CommandType::TYPE_OCTAVE, false, 1, 1, {}},
-                    {CommandType::TYPE_OCTAVE_DOWN, false, 0, 0, {}},
-                    {CommandType::TYPE_OCTAVE_UP, false, 0, 0, {}},
-                    {CommandType::TYPE_VOLUME, false, 1, 1, {}},
-                    {CommandType::TYPE_TONE, false, 1, 1, {}},
-                    {CommandType::TYPE_GATE_TIME, false, 1, 1, {}},
-                    {CommandType::TYPE_DETUNE, false, 1, 1, {}},
-                    {CommandType::TYPE_PORTAMENTO, false, 1, 1, {}},
-                    {CommandType::TYPE_TREMOLO, false, 1, 3, {0, 0, 0}},
-                    {CommandType::TYPE_VIBRATO, false, 1, 3, {0, 0, 0}},
-                    {CommandType::TYPE_ENV_FORM, false, 1, 1, {}},
-                    {CommandType::TYPE_ENV_PERIOD, false, 1, 1, {}},
-                    {CommandType::TYPE_DIRECT, false, 2, 2, {}},
-                    {CommandType::TYPE_LOOP, false, 0, 1, {0}},
-                    {CommandType::TYPE_EXIT, false, 0, 0, {}},
-                };
-
-                const CtrlDef* pctrldef = NULL;
-                for (int i = 0; i < sizeof(ctrl_defs) / sizeof(ctrl_defs[0]); i++)
-                {
-                    if (ctrl_defs[i].Type == state.CommandType)
-                    {
-                        pctrldef = &ctrl_defs[i];
-                        break;
-                    }
-                }
+                //throw std::runtime_error("SSGEnvの引数が足りない");
+                return;
+            }
 
-                if (pctrldef == NULL)
-                {
-                    //ostringstream ss;
-                    //ss << "unknown command '" << state.CommandType << "'";
-                    //throw runtime_error(ss.str());
-                    return;
-                }
+            int no = StringToInt(args[0]);
+            env.Unit = StringToInt(args[1]);
+            env.Env.clear();
+            transform(args.begin() + 2, args.end(), back_inserter(env.Env), StringToInt);
+            if (pOperations)
+            {
+                pOperations->emplace_back(SetSSGEnvOperation{no, env});
+                return;
+            }
+            pMusicData->SetSSGEnv(no, env);
+        }
 
-                int args_supplied = (int)state.args.size();
-                if (args_supplied < pctrldef->MinArgs || pctrldef->MaxArgs < args_supplied)
-                {
-                    //ostringstream ss;
-                    //ss << "illegal number of argument (" << args_supplied << ") for command '" << state.CommandType << "'";
-                    //throw runtime_error(ss.str());
-                    return;
-                }
+        void SetFMSound(int no, const FMSound& sound)
+        {
+            if (pOperations)
+            {
+                pOperations->emplace_back(SetFMSoundOperation{no, sound});
+                return;
+            }
+            pMusicData->SetFMSound(no, sound);
+        }
 
-                // 引数を取得
-                vector<int> a;
-                // とりあえずintに変換
-                transform(state.args.begin(), state.args.end(), back_inserter(a), StringToInt);
-                // 引数が足りなければデフォルト引数を補充
-                for (int i = args_supplied; i < pctrldef->MaxArgs; i++)
-                {
-                    a.push_back(pctrldef->Defaults[i]);
-                }
-                // 音長指定なら音長で変換し直す
-                if (pctrldef->IsNoteLength && state.args.size() > 0)
-                {
-                    a[0] = ParseLength(state.args[0]);
-                }
+        // MML コマンド
+        void BeginCommand(char c)
+        {
+            args.clear();
+            CommandType = static_cast<MusicCom::CommandType>(('a' <= c && c <= 'z') ? c - 'a' + 'A' : c);
+        }
 
-                // Tのみ特別処理
-                if (state.CommandType == CommandType::TYPE_TEMPO)
-                {
-                    state.pMusicData->SetTempo(a[0]);
-                }
-                else
+        void ProcessNote()
+        {
+            static const int note_numbers[] = {
+                // A,  B, C, D, E, F, G
+                9,
+                11,
+                0,
+                2,
+                4,
+                5,
+                7,
+            };
+
+            vector<string_view>& a = args;
+
+            int note = note_numbers[static_cast<char>(CommandType) - 'A'];
+            if (!a[0].empty())
+            {
+                switch (a[0][0])
                 {
-                    AddCommand(state, Command(state.CommandType, a.begin(), a.end()));
+                case '+':
+                    note++;
+                    break;
+                case '-':
+                    note--;
+                    break;
                 }
-                //cout << state.CommandType << "(";
-                //copy(state.args.begin(), state.args.end(), ostream_iterator<string>(cout, ","));
-                //cout << ");";
             }
+            int len = ParseLength(args[1]);
 
-            MMLParserState& state;
-        };
+            AddCommand(Command(CommandType::TYPE_NOTE, note, len));
+        }
 
-        struct ProcessCall
+        void ProcessCtrl()
         {
-            ProcessCall(MMLParserState& s) : state(s) {}
-
-            template<typename IteratorT>
-            void operator()(IteratorT first, IteratorT last) const
+            const static struct CtrlDef
             {
-                AddCommand(state, Command(CommandType::TYPE_MACRO, state.args[0]));
+                MusicCom::CommandType Type;
+                bool IsNoteLength;
+                int MinArgs;
+                int MaxArgs;
+                int Defaults[3];
+            } ctrl_defs[] = {
+                {CommandType::TYPE_TIE, false, 0, 0, {}},
+                {CommandType::TYPE_TEMPO, false, 1, 1, {}},
+                {CommandType::TYPE_REST, true, 0, 1, {0}},
+                {CommandType::TYPE_WAIT, true, 0, 1, {0}},
+                {CommandType::TYPE_LENGTH, true, 1, 1, {}},
+                {CommandType::TYPE_OCTAVE, false, 1, 1, {}},
+                {CommandType::TYPE_OCTAVE_DOWN, false, 0, 0, {}},
+                {CommandType::TYPE_OCTAVE_UP, false, 0, 0, {}},
+                {CommandType::TYPE_VOLUME, false, 1, 1, {}},
+                {CommandType::TYPE_TONE, false, 1, 1, {}},
+                {CommandType::TYPE_GATE_TIME, false, 1, 1, {}},
+                {CommandType::TYPE_DETUNE, false, 1, 1, {}},
+                {CommandType::TYPE_PORTAMENTO, false, 1, 1, {}},
+                {CommandType::TYPE_TREMOLO, false, 1, 3, {0, 0, 0}},
+                {CommandType::TYPE_VIBRATO, false, 1, 3, {0, 0, 0}},
+                {CommandType::TYPE_ENV_FORM, false, 1, 1, {}},
+                {CommandType::TYPE_ENV_PERIOD, false, 1, 1, {}},
+                {CommandType::TYPE_DIRECT, false, 2, 2, {}},
+                {CommandType::TYPE_LOOP, false, 0, 1, {0}},
+                {CommandType::TYPE_EXIT, false, 0, 0, {}},
+            };
+
+            const CtrlDef* pctrldef = NULL;
+            for (int i = 0; i < sizeof(ctrl_defs) / sizeof(ctrl_defs[0]); i++)
+            {
+                if (ctrl_defs[i].Type == CommandType)
+                {
+                    pctrldef = &ctrl_defs[i];
+                    break;
+                }
             }
 
-            MMLParserState& state;
-        };
+            if (pctrldef == NULL)
+            {
+                //ostringstream ss;
+                //ss << "unknown command '" << CommandType << "'";
+                //throw runtime_error(ss.str());
+                return;
+            }
 
-    public:
-        template<typename ScannerT>
-        struct definition
-        {
-            definition(MMLParser const& self)
-            {
-                MMLParserState& s = self.state;
-
-                // 0x1a = [EOF]
-                line =
-                    (ch_line | drum_line | sound_line | lfo_line | op_line | ssgenv_line | str_line | arrow_line | blank_line)
-                    >> !comment
-                    >> (eol_p[ChangeLine(s)] | end_p[Finish(s)] | ch_p(0x1a));
-
-                args =
-                    arg % *ch_p(',') // !: スペースで区切るMML対策
-                    >> *ch_p(',');
-                arg =
-                    (int_p || ch_p('.'))[PushArg(s)];
-                // LFO/OP用
-                sound_args =
-                    sound_arg % *ch_p(',') // !: スペースで区切るMML対策
-                    >> *ch_p(',');
-                sound_arg =
-                    ((sound_invalid_arg | int_p) >> eps_p)[PushArg(s)]
-                    >> *sound_invalid_arg[PushArg(s)];
-                sound_invalid_arg =
-                    lexeme_d[+(~digit_p - sign_p - blank_p - cntrl_p - ch_p(','))];
-
-                macro_name =
-                    lexeme_d[+(~chset<>("$,=") - blank_p - cntrl_p)];
-                mml_Command =
-                    mml_note[ProcessNote(s)] | mml_ctrl[ProcessCtrl(s)] | mml_call[ProcessCall(s)];
-                mml_note =
-                    as_lower_d[range_p('a', 'g')][BeginCommand(s)]
-                    >> (ch_p('+') | ch_p('-') | eps_p)[PushArg(s)]
-                    >> *ch_p(',') // 引数の前にカンマを置くMML対策
-                    >> (arg | eps_p[PushArg(s)])
-                    >> *ch_p(','); // 引数の後にカンマを置くMML対策
-                // '&' はコマンドとして扱う
-                //				>> (ch_p('&') | eps_p)[PushArg(s)];
-                mml_ctrl =
-                    as_lower_d[chset<>("h-z@{}<>&")][BeginCommand(s)]
-                    >> *ch_p(',') // 第1引数の前にカンマを置くMML対策
-                    >> !args;
-                //				>> !ch_p('&');	// 変なところに&を置くMML対策
-                mml_call =
-                    ch_p('$')[BeginCommand(s)]
-                    >> macro_name[PushArg(s)]
-                    >> ch_p('$')
-                    >> !ch_p(','); // なぜかマクロ呼び出しを','で区切るMML対策
-
-                // 空行
-                blank_line = eps_p;
-
-                // コメント
-                comment =
-                    ch_p(';')
-                    >> *(anychar_p - eol_p);
-
-                // チャンネル定義 1:, ...
-                ch_line =
-                    (range_p('1', '6')[SetChNumber(s)] >> ch_p(':'))[BeginLine<CH>(s)]
-                    >> *mml_Command;
-
-                // D: パート (SOUND.DATのリズム音)
-                drum_line =
-                    (as_lower_d[str_p("d:")])[BeginLine<RHYTHM>(s)]
-                    >> *mml_Command;
-
-                sound_line =
-                    (as_lower_d[str_p("sound")] >> ch_p(':'))[BeginLine<SOUND>(s)]
-                    >> !ch_p('@')
-                    >> int_p[assign(s.SoundNumber)];
-                lfo_line =
-                    (as_lower_d[str_p("lfo")] >> ch_p(':'))[BeginLine<LFO>(s)]
-                    >> sound_args[ProcessLFO(s)];
-                op_line =
-                    (as_lower_d[str_p("op")]
-                     >> range_p('1', '4')[SetChNumber(s)] >> ch_p(':'))[BeginLine<OP>(s)]
-                    >> sound_args[ProcessOP(s)];
-                ssgenv_line =
-                    (as_lower_d[str_p("ssgenv")] >> ch_p(':'))[BeginLine<SSGENV>(s)]
-                    >> !ch_p('@')
-                    >> ((int_p | eps_p)[PushArg(s)] % (((eol_p[ChangeLine(s)] % !(comment | blank_line)) >> str_p("->") | ch_p(','))))[ProcessSSGEnv(s)];
-                str_line =
-                    (as_lower_d[str_p("str")] >> ch_p(':'))[BeginLine<STR>(s)]
-                    >> macro_name[SetMacroName(s)]
-                    >> !ch_p('$') >> ch_p('=')
-                    >> *mml_Command;
-                // SSGENV外の -> は無視する
-                arrow_line =
-                    str_p("->")
-                    >> *(anychar_p - eol_p);
-            }
-
-            rule<ScannerT> line;
-            rule<ScannerT> blank_line, ch_line, drum_line, sound_line, lfo_line, op_line, ssgenv_line, str_line, arrow_line;
-            rule<ScannerT> mml_Command, mml_note, mml_ctrl, mml_call;
-            rule<ScannerT> args, arg, sound_args, sound_arg, sound_invalid_arg, macro_name, comment;
-
-            rule<ScannerT> const&
-            start() const { return line; }
-        };
-    };
+            int args_supplied = (int)args.size();
+            if (args_supplied < pctrldef->MinArgs || pctrldef->MaxArgs < args_supplied)
+            {
+                //ostringstream ss;
+                //ss << "illegal number of argument (" << args_supplied << ") for command '" << CommandType << "'";
+                //throw runtime_error(ss.str());
+                return;
+            }
 
-    MusicData* ParseMML(const char* filename)
-    {
-        auto pMusicData = std::make_unique<MusicData>();
-        MMLParser::MMLParserState state;
-        state.pMusicData = pMusicData.get();
-        MMLParser mmlparser(state);
+            // 引数を取得 (MaxArgs は 3 以下)
+            int a[3];
+            // とりあえずintに変換
+            transform(args.begin(), args.end(), a, StringToInt);
+            // 引数が足りなければデフォルト引数を補充
+            for (int i = args_supplied; i < pctrldef->MaxArgs; i++)
+            {
+                a[i] = pctrldef->Defaults[i];
+            }
+            // 音長指定なら音長で変換し直す
+            if (pctrldef->IsNoteLength && args.size() > 0)
+            {
+                a[0] = ParseLength(args[0]);
+            }
 
-        typedef file_iterator<char> iterator_t;
+            // Tのみ特別処理
+            if (CommandType == CommandType::TYPE_TEMPO)
+            {
+                if (pOperations)
+                    pOperations->emplace_back(SetTempoOperation{a[0]});
+                else
+                    pMusicData->SetTempo(a[0]);
+            }
+            else
+            {
+                AddCommand(Command(CommandType, a, a + pctrldef->MaxArgs));
+            }
+        }
 
-        // ファイルを開いて、その先頭を指すイテレータを生成
-        iterator_t begin(filename);
-        if (!begin)
+        void ProcessCall()
         {
-            return nullptr;
+            AddCommand(Command(CommandType::TYPE_MACRO, string(args[0])));
         }
+    };
 
-        iterator_t first = begin;
-        iterator_t last = first.make_end();
+    static MusicData* ParseMMLImpl(const char* first, const char* last, const char* name)
+    {
+        auto pMusicData = std::make_unique<MusicData>(MusicData::EstimateArenaSize(last - first));
+        MMLParser mmlparser(first, last, pMusicData.get());
 
         vector<string> error_list = {};
 
-        while (!state.Finished)
+        while (!mmlparser.IsFinished())
         {
-            parse_info<iterator_t> info;
             try
             {
-                info = parse(first, last, mmlparser, blank_p);
-                if (!info.hit)
+                if (!mmlparser.ParseLine())
                 {
-                    iterator_t i = find_if(
-                        info.stop,
+                    const char* stop = mmlparser.GetPosition();
+                    const char* i = find_if(
+                        stop,
                         last,
                         [](char c)
                         {
                             return c == '\r' || c == '\n';
                         });
-                    error_list.push_back(format("({:d}): parse error at \"{}\"", state.LineNumber, string(info.stop, i)));
-                    first = i;
-                }
-                else
-                {
-                    first = info.stop;
+                    error_list.push_back(format("({:d}): parse error at \"{}\"", mmlparser.GetLineNumber(), string(stop, i)));
+                    mmlparser.SetPosition(i);
                 }
             }
             catch (exception& e)
             {
-                error_list.push_back(format("({:d}): {}", state.LineNumber, e.what()));
+                error_list.push_back(format("({:d}): {}", mmlparser.GetLineNumber(), e.what()));
                 break;
             }
         }
@@ -643,7 +1171,7 @@ namespace MusicCom
             auto msg = accumulate(
                 error_list.begin(),
                 error_list.end(),
-                string(filename),
+                string(name),
                 [](const string& acc, const string& str)
                 {
                     return format("{}\n{}", acc, str);
@@ -656,4 +1184,373 @@ namespace MusicCom
         return pMusicData.release();
     }
 
+    MusicData* ParseMML(const char* filename)
+    {
+        // ファイル全体を読み込んでから走査する
+        ifstream file(filename, ios::binary | ios::ate);
+        if (!file)
+        {
+            return nullptr;
+        }
+        streamoff size = file.tellg();
+        // 空のファイルは従来 (file_iterator) と同様に開けなかったものとして扱う
+        if (size <= 0)
+        {
+            return nullptr;
+        }
+        vector<char> data(static_cast<size_t>(size));
+        file.seekg(0);
+        if (!file.read(data.data(), size))
+        {
+            return nullptr;
+        }
+
+        return ParseMMLImpl(data.data(), data.data() + data.size(), filename);
+    }
+
+    MusicData* ParseMML(const char* data, size_t size, const char* name)
+    {
+        // バッファを直接走査する (コピーしない)
+        return ParseMMLImpl(data, data + size, name);
+    }
+
+    // 差分解析の単位 (MMLParser::ParseLine 1 回分、通常は 1 行)
+    struct MMLIncrementalParser::Unit
+    {
+        size_t Offset;
+        size_t Length;
+        int LineNumber;
+        MMLParser::State StateAfter; // 次の行に引き継ぐ解析状態
+        bool SoundLine;
+        vector<MMLParser::Operation> Operations;
+        int CommandCount[PART_COUNT];
+    };
+
+    namespace
+    {
+        // コマンドの追加先のパート番号 (パート以外は -1)
+        int GetOperationPart(const MMLParser::Operation& operation)
+        {
+            auto p = get_if<MMLParser::AddCommandOperation>(&operation);
+            if (!p)
+                return -1;
+            switch (p->LineType)
+            {
+            case MMLParser::CH:
+                return p->ChNumber;
+            case MMLParser::RHYTHM:
+                return MMLIncrementalParser::RHYTHM_PART;
+            default:
+                return -1;
+            }
+        }
+
+        bool IsPauseOperation(const MMLParser::Operation& operation)
+        {
+            auto p = get_if<MMLParser::AddCommandOperation>(&operation);
+            return p && p->Cmd.GetType() == CommandType::TYPE_PAUSE;
+        }
+    } // namespace
+
+    MMLIncrementalParser::MMLIncrementalParser()
+        : parsedLineCount(0),
+          mapping()
+    {
+    }
+
+    MMLIncrementalParser::~MMLIncrementalParser()
+    {
+    }
+
+    bool MMLIncrementalParser::ParseUnit(MMLParser& parser, const char* first, vector<Unit>& units)
+    {
+        const char* start = parser.GetPosition();
+        Unit unit{static_cast<size_t>(start - first), 0, parser.GetLineNumber()};
+        parser.SetOperations(&unit.Operations);
+        try
+        {
+            if (!parser.ParseLine())
+                return false;
+        }
+        catch (exception&)
+        {
+            return false;
+        }
+        unit.Length = parser.GetPosition() - start;
+        unit.StateAfter = parser.GetState();
+        unit.SoundLine = parser.IsSoundLine();
+        for (const auto& operation : unit.Operations)
+        {
+            int part = GetOperationPart(operation);
+            if (part >= 0)
+                unit.CommandCount[part]++;
+        }
+        units.push_back(move(unit));
+        return true;
+    }
+
+    MusicData* MMLIncrementalParser::Parse(const char* data, size_t size, const char* name)
+    {
+        MMLParser parser(data, data + size, nullptr);
+        vector<Unit> new_units;
+        while (!parser.IsFinished())
+        {
+            if (!ParseUnit(parser, data, new_units))
+            {
+                // エラーメッセージは通常の解析で作成する (ここで例外が送出される)
+                unique_ptr<MusicData> music_data(ParseMMLImpl(data, data + size, name));
+                text.clear();
+                units.clear();
+                return music_data.release();
+            }
+        }
+
+        text.assign(data, size);
+        units = move(new_units);
+        parsedLineCount = static_cast<int>(units.size());
+        for (auto& part : mapping)
+        {
+            part = PartMapping();
+        }
+        return Build(size);
+    }
+
+    MusicData* MMLIncrementalParser::Reparse(const char* data, size_t size, const char* name)
+    {
+        if (units.empty())
+        {
+            return Parse(data, size, name);
+        }
+
+        string_view old_text(text);
+        string_view new_text(data, size);
+        if (old_text == new_text)
+        {
+            parsedLineCount = 0;
+            return nullptr;
+        }
+
+        // 先頭と末尾の変更されていない部分
+        size_t common = min(old_text.size(), new_text.size());
+        size_t prefix = mismatch(old_text.begin(), old_text.begin() + common, new_text.begin()).first - old_text.begin();
+        size_t suffix = 0;
+        while (suffix < common - prefix && old_text[old_text.size() - 1 - suffix] == new_text[new_text.size() - 1 - suffix])
+        {
+            suffix++;
+        }
+
+        // 変更位置を含む行の 1 つ前の行 (空行/コメント行は除く) から解析し直す
+        // 直前の行の改行 (\r\n) や、SSGENV 行の後続行の先読みが変更の影響を受けるため
+        size_t changed = prefix > 0 ? prefix - 1 : 0;
+        size_t first_unit = upper_bound(
+                                units.begin(),
+                                units.end(),
+                                changed,
+                                [](size_t offset, const Unit& unit)
+                                {
+                                    return offset < unit.Offset;
+                                }) -
+                            units.begin() - 1;
+        if (first_unit > 0)
+        {
+            first_unit--;
+            while (first_unit > 0 && units[first_unit].Operations.empty())
+            {
+                first_unit--;
+            }
+        }
+
+        MMLParser parser(data, data + size, nullptr);
+        if (first_unit > 0)
+        {
+            parser.Restart(data + units[first_unit].Offset, units[first_unit].LineNumber, units[first_unit - 1].StateAfter);
+        }
+
+        // 変更されていない末尾部分で、前回と同じ行の先頭・同じ解析状態に戻ったら以降は前回の結果を使う
+        // 音色の状態だけが異なる場合は、以降の SOUND/LFO/OP 行だけを解析し直す
+        ptrdiff_t delta = static_cast<ptrdiff_t>(new_text.size()) - static_cast<ptrdiff_t>(old_text.size());
+        size_t new_suffix_start = new_text.size() - suffix;
+        vector<Unit> changed_units;
+        size_t resume_unit = units.size();
+        while (!parser.IsFinished())
+        {
+            if (!ParseUnit(parser, data, changed_units))
+            {
+                // エラーメッセージは通常の解析で作成する (ここで例外が送出される)
+                // 送出されなかった場合は全体を解析し直す
+                delete ParseMMLImpl(data, data + size, name);
+                return Parse(data, size, name);
+            }
+
+            size_t end = parser.GetPosition() - data;
+            if (parser.IsFinished() || end < new_suffix_start)
+                continue;
+            size_t old_end = end - delta;
+            auto it = lower_bound(
+                units.begin() + first_unit,
+                units.end(),
+                old_end,
+                [](const Unit& unit, size_t offset)
+                {
+                    return unit.Offset < offset;
+                });
+            if (it != units.end() && it->Offset == old_end && it != units.begin() &&
+                parser.GetState().IsSameExceptSound((it - 1)->StateAfter))
+            {
+                resume_unit = it - units.begin();
+                break;
+            }
+        }
+        int line_delta = resume_unit < units.size() ? parser.GetLineNumber() - units[resume_unit].LineNumber : 0;
+
+        vector<Unit> sound_units;
+        size_t sound_end = resume_unit;
+        MMLParser::State state = parser.GetState();
+        for (; sound_end < units.size() && !(state == units[sound_end - 1].StateAfter); sound_end++)
+        {
+            const Unit& unit = units[sound_end];
+            if (unit.SoundLine)
+            {
+                parser.Restart(data + unit.Offset + delta, unit.LineNumber + line_delta, state);
+                if (!ParseUnit(parser, data, sound_units))
+                {
+                    delete ParseMMLImpl(data, data + size, name);
+                    return Parse(data, size, name);
+                }
+                state = parser.GetState();
+            }
+            else
+            {
+                MMLParser::State next = unit.StateAfter;
+                next.Sound = state.Sound;
+                next.SoundNumber = state.SoundNumber;
+                state = move(next);
+            }
+        }
+
+        UpdateMapping(changed_units, first_unit, resume_unit);
+
+        // 前回の結果と解析し直した結果をつなぎ合わせる
+        parsedLineCount = static_cast<int>(changed_units.size() + sound_units.size());
+        vector<Unit> new_units;
+        new_units.reserve(first_unit + changed_units.size() + (units.size() - resume_unit));
+        move(units.begin(), units.begin() + first_unit, back_inserter(new_units));
+        move(changed_units.begin(), changed_units.end(), back_inserter(new_units));
+        auto sound_unit = sound_units.begin();
+        for (size_t i = resume_unit; i < units.size(); i++)
+        {
+            if (i < sound_end && units[i].SoundLine)
+            {
+                new_units.push_back(move(*sound_unit++));
+                continue;
+            }
+            Unit& unit = units[i];
+            unit.Offset += delta;
+            unit.LineNumber += line_delta;
+            if (i < sound_end)
+            {
+                const MMLParser::State& previous = new_units.back().StateAfter;
+                unit.StateAfter.Sound = previous.Sound;
+                unit.StateAfter.SoundNumber = previous.SoundNumber;
+            }
+            new_units.push_back(move(unit));
+        }
+
+        text.assign(data, size);
+        units = move(new_units);
+        return Build(size);
+    }
+
+    int MMLIncrementalParser::GetParsedLineCount() const
+    {
+        return parsedLineCount;
+    }
+
+    int MMLIncrementalParser::MapCommandIndex(int part, int index) const
+    {
+        assert(0 <= part && part < PART_COUNT);
+        const PartMapping& m = mapping[part];
+        if (index < m.Prefix)
+        {
+            return index;
+        }
+        if (index >= m.OldEnd)
+        {
+            return index - m.OldEnd + m.NewEnd;
+        }
+
+        // 変更された行の中では、何行目の一時停止コマンドかで対応付ける
+        auto it = find(m.OldPauses.begin(), m.OldPauses.end(), index);
+        if (it == m.OldPauses.end())
+        {
+            return -1;
+        }
+        if (m.NewPauses.empty())
+        {
+            // 変更された行がなくなった場合は直前の行末 (なければ -1)
+            return m.Prefix - 1;
+        }
+        size_t n = min(static_cast<size_t>(it - m.OldPauses.begin()), m.NewPauses.size() - 1);
+        return m.NewPauses[n];
+    }
+
+    void MMLIncrementalParser::UpdateMapping(const vector<Unit>& changed_units, size_t first_unit, size_t resume_unit)
+    {
+        for (int part = 0; part < PART_COUNT; part++)
+        {
+            PartMapping& m = mapping[part];
+            m = PartMapping();
+            for (size_t i = 0; i < first_unit; i++)
+            {
+                m.Prefix += units[i].CommandCount[part];
+            }
+
+            auto collect = [part, &m](auto first, auto last, int& end, vector<int>& pauses)
+            {
+                end = m.Prefix;
+                for (; first != last; ++first)
+                {
+                    for (const auto& operation : first->Operations)
+                    {
+                        if (GetOperationPart(operation) != part)
+                            continue;
+                        if (IsPauseOperation(operation))
+                            pauses.push_back(end);
+                        end++;
+                    }
+                }
+            };
+            collect(units.begin() + first_unit, units.begin() + resume_unit, m.OldEnd, m.OldPauses);
+            collect(changed_units.begin(), changed_units.end(), m.NewEnd, m.NewPauses);
+        }
+    }
+
+    MusicData* MMLIncrementalParser::Build(size_t size) const
+    {
+        auto music_data = make_unique<MusicData>(MusicData::EstimateArenaSize(size));
+        int line = 1;
+        size_t counted = 0;
+        for (const auto& unit : units)
+        {
+            for (const auto& operation : unit.Operations)
+            {
+                MMLParser::ApplyOperation(operation, *music_data);
+                if (!IsPauseOperation(operation))
+                    continue;
+
+                // 一時停止コマンドに対応する行は単位の先頭の行
+                line += CountLines(text.data() + counted, text.data() + unit.Offset);
+                counted = unit.Offset;
+                int part = GetOperationPart(operation);
+                if (part == RHYTHM_PART)
+                    music_data->AddRhythmPartLine(line);
+                else
+                    music_data->AddChannelLine(part, line);
+            }
+        }
+        // 差し替え時の演奏位置の対応付けは演奏のスレッドで行うため、対応表をここで作っておく
+        music_data->BuildCommandIndex();
+        return music_data.release();
+    }
+
 } // namespace MusicCom
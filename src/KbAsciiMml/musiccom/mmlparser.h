@@ -1,8 +1,67 @@
 ﻿#pragma once
 
+#include <cstddef>
+#include <string>
+#include <vector>
+
 namespace MusicCom
 {
     class MusicData;
+    class MMLParser;
     MusicData* ParseMML(const char* filename);
+    // name はエラーメッセージに使用する
+    MusicData* ParseMML(const char* data, size_t size, const char* name);
+
+    // 編集中の MML を再読み込みするための差分解析
+    // 前回解析した内容と比較して変更された行 (CH/D/STR/SOUND/LFO/OP/SSGENV) だけを解析し直し、
+    // それ以外の行は前回の解析結果を使い回して MusicData を組み立てる
+    class MMLIncrementalParser
+    {
+    public:
+        // パート番号 (0-5: チャンネル, 6: D パート)
+        static const int PART_COUNT = 7;
+        static const int RHYTHM_PART = 6;
+
+        MMLIncrementalParser();
+        ~MMLIncrementalParser();
+        MMLIncrementalParser(const MMLIncrementalParser&) = delete;
+        MMLIncrementalParser& operator=(const MMLIncrementalParser&) = delete;
+
+        // 全体を解析する (エラーの場合は ParseMML と同じ例外を送出する)
+        MusicData* Parse(const char* data, size_t size, const char* name);
+        // 前回解析した内容との差分を解析する
+        // 内容が同じ場合は nullptr を返す
+        // エラーの場合は ParseMML と同じ例外を送出し、前回の解析結果を保持する
+        MusicData* Reparse(const char* data, size_t size, const char* name);
+
+        // 直前の Parse/Reparse で解析した行数
+        int GetParsedLineCount() const;
+
+        // 直前の Reparse の前後で、パート内のコマンド位置 (先頭からの番号) を対応付ける
+        // 一時停止コマンド (行末) の位置は、変更された行の中でも何行目かで対応付ける
+        // 対応する位置がない場合は -1 を返す
+        int MapCommandIndex(int part, int index) const;
+
+    private:
+        struct Unit;
+        struct PartMapping
+        {
+            int Prefix;    // 変更されていない先頭部分のコマンド数
+            int OldEnd;    // 変更前の、変更部分の終端までのコマンド数
+            int NewEnd;    // 変更後の、変更部分の終端までのコマンド数
+            std::vector<int> OldPauses; // 変更部分の一時停止コマンドの位置
+            std::vector<int> NewPauses;
+        };
+
+        // 1 単位 (通常は 1 行) を解析して units に追加する (解析エラーの場合は false)
+        static bool ParseUnit(MMLParser& parser, const char* first, std::vector<Unit>& units);
+        void UpdateMapping(const std::vector<Unit>& changed_units, size_t first_unit, size_t resume_unit);
+        MusicData* Build(size_t size) const;
+
+        std::string text;
+        std::vector<Unit> units;
+        int parsedLineCount;
+        PartMapping mapping[PART_COUNT];
+    };
 
 } // namespace MusicCom
@@ -1,15 +1,41 @@
 ﻿#include "musdata.h"
+#include <algorithm>
 
 using namespace std;
 
 namespace MusicCom
 {
-    MusicData::MusicData()
+    namespace
+    {
+        const size_t DEFAULT_ARENA_SIZE = 16 * 1024;
+        // コマンド 1 つあたりの MML の平均的な文字数 (音長や空白を含む)
+        const size_t MML_BYTES_PER_COMMAND = 4;
+    } // namespace
+
+    MusicData::MusicData(size_t arena_size)
+        : arena(arena_size > 0 ? arena_size : DEFAULT_ARENA_SIZE),
+          fmsounds(&arena),
+          ssgenvs(&arena),
+          macros(&arena),
+          channels(channel_count, &arena),
+          rhythm_part(&arena),
+          channel_lines(channel_count, &arena),
+          rhythm_part_lines(&arena),
+          command_positions(&arena),
+          command_indices(&arena)
     {
         fill_n(channel_present, channel_count, false);
+        rhythm_part_present = false;
         tempo = 120;
     }
 
+    size_t MusicData::EstimateArenaSize(size_t mml_size)
+    {
+        // リストの要素 1 つあたり Command と前後へのポインタを確保する
+        size_t node_size = sizeof(Command) + 2 * sizeof(void*);
+        return max(mml_size / MML_BYTES_PER_COMMAND * node_size, DEFAULT_ARENA_SIZE);
+    }
+
     CommandIterator MusicData::GetChannelHead(int channel) const
     {
         assert(IsChannelPresent(channel));
@@ -80,4 +106,69 @@ namespace MusicCom
         cl.insert(--cl.end(), command);
     }
 
+    void MusicData::AddChannelLine(int channel, int line)
+    {
+        channel_lines[channel].push_back(line);
+    }
+
+    void MusicData::AddRhythmPartLine(int line)
+    {
+        rhythm_part_lines.push_back(line);
+    }
+
+    const std::pmr::vector<int>& MusicData::GetChannelLines(int channel) const
+    {
+        assert(0 <= channel && channel < channel_count);
+
+        return channel_lines[channel];
+    }
+
+    const std::pmr::vector<int>& MusicData::GetRhythmPartLines() const
+    {
+        return rhythm_part_lines;
+    }
+
+    void MusicData::BuildCommandIndex()
+    {
+        command_positions.assign(channel_count + 1, {});
+        command_indices.assign(channel_count + 1, {});
+        for (int part = 0; part <= channel_count; part++)
+        {
+            const CommandList& cl = (part < channel_count) ? channels[part] : rhythm_part;
+            auto& positions = command_positions[part];
+            auto& indices = command_indices[part];
+            positions.reserve(cl.size());
+            indices.reserve(cl.size());
+            int index = 0;
+            for (auto ptr = cl.begin(); ptr != cl.end(); ++ptr, ++index)
+            {
+                positions.push_back(ptr);
+                indices.emplace_back(&*ptr, index);
+            }
+            sort(indices.begin(), indices.end());
+        }
+    }
+
+    int MusicData::FindCommandIndex(int part, CommandIterator ptr) const
+    {
+        assert(0 <= part && part <= channel_count);
+
+        if (command_indices.empty())
+        {
+            return -1;
+        }
+        // 別のリスト (マクロ) の位置とも比較できるよう、要素のアドレスで探す
+        const auto& indices = command_indices[part];
+        auto it = lower_bound(indices.begin(), indices.end(), pair<const Command*, int>(&*ptr, -1));
+        return (it != indices.end() && it->first == &*ptr) ? it->second : -1;
+    }
+
+    CommandIterator MusicData::GetCommandAt(int part, int index) const
+    {
+        assert(0 <= part && part <= channel_count);
+        assert(0 <= index && index < static_cast<int>(command_positions[part].size()));
+
+        return command_positions[part][index];
+    }
+
 } // namespace MusicCom
@@ -4,7 +4,9 @@
 #include <cassert>
 #include <list>
 #include <map>
+#include <memory_resource>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace MusicCom
@@ -89,22 +91,37 @@ namespace MusicCom
 
     struct SSGEnv
     {
-        SSGEnv()
+        // MusicData に格納する際は MusicData の領域から確保する
+        using allocator_type = std::pmr::polymorphic_allocator<>;
+
+        SSGEnv() : SSGEnv(allocator_type())
+        {
+        }
+        explicit SSGEnv(const allocator_type& alloc) : Unit(64), Env(1, 15, alloc)
         {
-            Unit = 64;
-            Env.push_back(15);
         }
         SSGEnv(unsigned char initial_value) : Unit(64), Env(1, initial_value)
         {
         }
+        SSGEnv(const SSGEnv& other, const allocator_type& alloc) : Unit(other.Unit), Env(other.Env, alloc)
+        {
+        }
         int Unit;
-        std::vector<unsigned char> Env;
+        std::pmr::vector<unsigned char> Env;
     };
 
     class MusicData
     {
     public:
-        MusicData();
+        // 解析したデータはすべて曲ごとの領域から確保し、破棄時にまとめて解放する
+        // arena_size は最初に確保する領域の大きさ (0 なら既定値)
+        explicit MusicData(size_t arena_size = 0);
+        MusicData(const MusicData&) = delete;
+        MusicData& operator=(const MusicData&) = delete;
+
+        // MMLファイルの大きさから最初に確保する領域の大きさを見積もる
+        static size_t EstimateArenaSize(size_t mml_size);
+
         void SetFMSound(int no, const FMSound& sound)
         {
             fmsounds[no] = sound;
@@ -113,19 +130,27 @@ namespace MusicCom
         {
             ssgenvs[no] = env;
         }
+        // 演奏中に索引の作成などで別のスレッドからも参照するため、存在しない no でも追加しない
         const FMSound& GetFMSound(int no) const
         {
-            return fmsounds[no];
+            auto it = fmsounds.find(no);
+            if (it == fmsounds.end())
+            {
+                static const FMSound empty = FMSound();
+                return empty;
+            }
+            return it->second;
         }
         const SSGEnv& GetSSGEnv(int no) const
         {
             // 存在しないnoが指定された場合は無音とする
-            if (ssgenvs.find(no) == ssgenvs.end())
+            auto it = ssgenvs.find(no);
+            if (it == ssgenvs.end())
             {
-                SSGEnv ssgenv(0);
-                ssgenvs[no] = ssgenv;
+                static const SSGEnv silent(0);
+                return silent;
             }
-            return ssgenvs[no];
+            return it->second;
         }
         void SetTempo(int t) { tempo = t; }
         int GetTempo() const { return tempo; }
@@ -153,16 +178,40 @@ namespace MusicCom
         CommandIterator GetRhythmPartTail() const;
         CommandIterator GetMacroHead(const std::string& name) const;
 
+        // CH/D 行の MML ファイル上の行番号 (1-origin) を、パート内の行の順 (一時停止コマンドの順) に記録する
+        void AddChannelLine(int channel, int line);
+        void AddRhythmPartLine(int line);
+        const std::pmr::vector<int>& GetChannelLines(int channel) const;
+        const std::pmr::vector<int>& GetRhythmPartLines() const;
+
+        // データの差し替えで演奏位置を対応付けるため、パート内のコマンドの番号と位置の対応表を作る
+        // 演奏のスレッドでリストをたどらないよう、解析したスレッドで全パートのコマンドを追加した後に呼ぶ
+        void BuildCommandIndex();
+        // パート (0-5: チャンネル, 6: D パート) 内での先頭からの番号 (パート内の位置でないか、対応表がなければ -1)
+        // ptr はマクロを含むいずれかのコマンドを指すこと (リストの終端は不可)
+        int FindCommandIndex(int part, CommandIterator ptr) const;
+        // パート内の index 番目のコマンドの位置 (BuildCommandIndex の後に呼ぶ)
+        CommandIterator GetCommandAt(int part, int index) const;
+
     private:
+        friend class SongCache;
         static const int channel_count = 6;
 
-        mutable std::map<int, FMSound> fmsounds;
-        mutable std::map<int, SSGEnv> ssgenvs;
-        std::map<std::string, CommandList> macros;
-        CommandList channels[channel_count];
+        // 他のメンバより先に構築し、最後に破棄する
+        std::pmr::monotonic_buffer_resource arena;
+
+        std::pmr::map<int, FMSound> fmsounds;
+        std::pmr::map<int, SSGEnv> ssgenvs;
+        std::pmr::map<std::string, CommandList> macros;
+        std::pmr::vector<CommandList> channels;
         bool channel_present[channel_count];
         CommandList rhythm_part;
         bool rhythm_part_present;
+        std::pmr::vector<std::pmr::vector<int>> channel_lines;
+        std::pmr::vector<int> rhythm_part_lines;
+        // パート番号ごとの対応表 (BuildCommandIndex を呼ぶまでは空)
+        std::pmr::vector<std::pmr::vector<CommandIterator>> command_positions;              // 番号からコマンドの位置
+        std::pmr::vector<std::pmr::vector<std::pair<const Command*, int>>> command_indices; // コマンドのアドレス順の番号
         int tempo;
     };
 
@@ -1,29 +1,170 @@
 ﻿#include "musiccom.h"
+#include "lineindex.h"
+#include "mixstatistics.h"
 #include "mmlparser.h"
 #include "musdata.h"
+#include "opnpool.h"
+#include "overview.h"
+#include "resampler.h"
 #include "sequencer.h"
 #include "sounddata.h"
 #include "soundparser.h"
+#include "songcache.h"
 #include "soundsequencer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <vector>
 
 namespace MusicCom
 {
+    namespace
+    {
+        bool ReadFile(const char* filename, std::vector<char>& data)
+        {
+            std::ifstream file(filename, std::ios::binary | std::ios::ate);
+            if (!file)
+            {
+                return false;
+            }
+            std::streamoff size = file.tellg();
+            // 空のファイルは ParseMML と同様に開けなかったものとして扱う
+            if (size <= 0)
+            {
+                return false;
+            }
+            data.resize(static_cast<size_t>(size));
+            file.seekg(0);
+            return static_cast<bool>(file.read(data.data(), size));
+        }
+
+        bool HasSameParts(const MusicData& a, const MusicData& b)
+        {
+            for (int ch = 0; ch < 6; ch++)
+            {
+                if (a.IsChannelPresent(ch) != b.IsChannelPresent(ch))
+                {
+                    return false;
+                }
+            }
+            return a.IsRhythmPartPresent() == b.IsRhythmPartPresent();
+        }
+
+        // 出力全体の音量を掛けて、出力の型の範囲で飽和させる (float はクリッピングしない)
+        __int16 ScaleSample(__int16 sample, float gain)
+        {
+            return static_cast<__int16>(std::clamp(std::lround(sample * gain), -32768L, 32767L));
+        }
+
+        int32_t ScaleSample(int32_t sample, float gain)
+        {
+            return static_cast<int32_t>(std::clamp(std::llround(static_cast<double>(sample) * gain), static_cast<long long>(INT32_MIN), static_cast<long long>(INT32_MAX)));
+        }
+
+        float ScaleSample(float sample, float gain)
+        {
+            return sample * gain;
+        }
+    } // namespace
+
     const int MusicCom::SOUND_EFFECT_DEFAULT_TEMPO = 195;
 
     MusicCom::MusicCom()
-        : pseq(nullptr),
+        : opnRate(0),
+          pseq(nullptr),
           pmusicdata(nullptr),
           psounddata(nullptr),
-          soundTempo(SOUND_EFFECT_DEFAULT_TEMPO)
+          reloadState(ReloadState::Idle),
+          preloadedRestart(false),
+          sequencerSettings(),
+          preparedOpnRate(0),
+          retiredOpnRate(0),
+          lineIndexBuilt(false),
+          hotReload(false),
+          lineIndex(false),
+          loopCacheSize(0),
+          nativeRate(false),
+          quality(Quality::Standard),
+          mixRate(0),
+          mixSettingsChanged(true),
+          synthRate(0),
+          outputChannels(2),
+          liveParameters(SOUND_EFFECT_DEFAULT_TEMPO),
+          masterGainVersion(0),
+          masterGain(1.0f)
+#ifdef MUSICCOM_ENABLE_TRACE
+          ,
+          registerTrace(nullptr)
+#endif
     {
     }
 
     MusicCom::~MusicCom()
     {
+        // 索引を作成中のスレッドは、このオブジェクトに結果を書き込むため先に止める
+        if (lineIndexBuilder.joinable())
+        {
+            lineIndexBuilder.request_stop();
+            lineIndexBuilder.join();
+        }
+        // シーケンサが音源を参照しているため、先に破棄してから音源を返す
+        pseq.reset();
+        OPNPool::Release(opnRate, std::move(popn));
+        DiscardPreparedSequencer();
+        ReleaseRetired();
     }
 
     bool MusicCom::Load(const char* filename)
     {
+        mixSettingsChanged = true;
+        preloadedmusicdata.reset();
+        pnextmusicdata.reset();
+        DiscardPreparedSequencer();
+        ReleaseRetired();
+        reloadState = ReloadState::Idle;
+        pincrementalparser.reset();
+        loadedFilename = filename;
+        if (hotReload)
+        {
+            // 再読み込み時の差分解析のため、解析結果を保持しておく
+            // 差分解析には行ごとの解析結果が必要なため、曲のキャッシュ (songCacheDirectory) は読み込みにも保存にも使わない
+            std::vector<char> data;
+            // ParseMML と同様に、空のファイルは開けなかったものとして扱う
+            if (!ReadFile(filename, data) || data.empty())
+            {
+                return false;
+            }
+            pincrementalparser = std::make_unique<MMLIncrementalParser>();
+            pmusicdata.reset(pincrementalparser->Parse(data.data(), data.size(), filename));
+            if (!pmusicdata)
+                return false;
+
+            // SOUND.datを解析
+            psounddata.reset(ParseSound(filename));
+            if (!psounddata)
+                return false;
+
+            return true;
+        }
+
+        // MML・SOUND.datが変更されていなければキャッシュから読み込む
+        std::optional<uint64_t> cacheKey;
+        if (!songCacheDirectory.empty())
+        {
+            SongCache cache(songCacheDirectory);
+            cacheKey = cache.ComputeKey(filename);
+            std::unique_ptr<MusicData> music;
+            std::unique_ptr<SoundData> sound;
+            if (cacheKey && cache.Load(*cacheKey, music, sound))
+            {
+                pmusicdata = std::move(music);
+                psounddata = std::move(sound);
+                return true;
+            }
+        }
+
         pmusicdata.reset(ParseMML(filename));
         if (!pmusicdata)
             return false;
@@ -33,40 +174,597 @@ namespace MusicCom
         if (!psounddata)
             return false;
 
+        if (cacheKey)
+        {
+            SongCache(songCacheDirectory).Store(*cacheKey, *pmusicdata, *psounddata);
+        }
+
+        return true;
+    }
+
+    bool MusicCom::Load(const char* data, size_t size, const char* sound_data, size_t sound_size)
+    {
+        mixSettingsChanged = true;
+        preloadedmusicdata.reset();
+        pnextmusicdata.reset();
+        DiscardPreparedSequencer();
+        ReleaseRetired();
+        reloadState = ReloadState::Idle;
+        pincrementalparser.reset();
+        loadedFilename.clear();
+        pmusicdata.reset(ParseMML(data, size, "(memory)"));
+        if (!pmusicdata)
+            return false;
+
+        psounddata.reset(ParseSound(sound_data, sound_size));
+        if (!psounddata)
+            return false;
+
         return true;
     }
 
     bool MusicCom::PrepareMix(uint rate)
     {
-        pseq = std::make_unique<Sequencer>(opn, pmusicdata.get(), psounddata.get(), soundTempo);
-        if (!pseq->Init(rate))
+        // Reload のスレッドがシーケンサを作成している間は待つ (作成中の設定を変えないため)
+        std::lock_guard lock(sequencerMutex);
+
+        // 差し替え待ちのデータがあれば、それを先頭から演奏する
+        // 解析済みで受け取っていないデータは、次回の Mix で受け取る
+        if (pnextmusicdata)
+        {
+            pmusicdata = std::move(pnextmusicdata);
+            reloadState = ReloadState::Idle;
+            mixSettingsChanged = true;
+        }
+        // パートの構成が変わったデータを受け取っていなければ、ここで受け取って先頭から演奏する
+        // (作成済みのシーケンサは以前の設定のものかもしれないため、使わずに作り直す)
+        if (reloadState.load(std::memory_order_acquire) == ReloadState::Parsed && preloadedRestart)
+        {
+            pmusicdata = std::move(preloadedmusicdata);
+            DiscardPreparedSequencer();
+            DiscardLineIndex();
+            reloadState = ReloadState::Idle;
+            mixSettingsChanged = true;
+        }
+        // 同じ曲・設定で開き直す場合 (シークなど) は、シーケンサと音源を作り直さずに最初の状態に戻す
+        if (pseq && !mixSettingsChanged && rate == mixRate && pseq->Restart())
+        {
+            if (presampler)
+            {
+                presampler->Reset();
+            }
+            return true;
+        }
+
+        mixRate = rate;
+        mixSettingsChanged = true;
+        // 音源を入れ替える場合があるため、参照しているシーケンサを先に破棄する
+        pseq.reset();
+
+        // 音源本来のレートや下書き用の 1/4 のレートで合成する場合は、モノラルで合成してから出力のレートに変換する
+        synthRate = nativeRate ? Sequencer::GetNativeRate() : rate;
+        if (quality == Quality::Draft)
+        {
+            synthRate /= 4;
+        }
+        presampler.reset();
+        if (synthRate != static_cast<int>(rate))
+        {
+            int taps = (quality == Quality::Draft) ? 8 : Resampler::DEFAULT_TAPS;
+            presampler = std::make_unique<Resampler>(synthRate, rate, outputChannels, taps);
+        }
+
+        // 同じレートで使っていた音源を再利用する
+        if (popn && opnRate != synthRate)
+        {
+            OPNPool::Release(opnRate, std::move(popn));
+        }
+        if (!popn)
+        {
+            popn = OPNPool::Acquire(synthRate);
+            opnRate = synthRate;
+        }
+
+        // Reload のスレッドでも、パートの構成が変わった場合はこの設定でシーケンサを作成する
+        sequencerSettings.Rate = synthRate;
+        sequencerSettings.Channels = presampler ? 1 : outputChannels;
+        sequencerSettings.SynthQuality = quality;
+        sequencerSettings.Observer = registerWriteObserver;
+        sequencerSettings.Statistics = pstatistics.get();
+        sequencerSettings.Events = peventqueue.get();
+        // キャッシュから再生する間はレジスタに書き込まず、イベントも発生しない
+        sequencerSettings.LoopCacheSize = (registerWriteObserver || peventqueue) ? 0 : loopCacheSize;
+#ifdef MUSICCOM_ENABLE_TRACE
+        sequencerSettings.Trace = registerTrace;
+        if (registerTrace)
+        {
+            sequencerSettings.LoopCacheSize = 0;
+        }
+#endif
+        if (pstatistics)
+        {
+            pstatistics->SetRate(rate);
+        }
+
+        pseq = CreateSequencer(*popn, pmusicdata.get(), sequencerSettings);
+        if (!pseq)
         {
             return false;
         }
-        opn.SetVolumeFM(fmVolume);
-        opn.SetVolumePSG(psgVolume);
 
+        DiscardLineIndex();
+        if (lineIndex)
+        {
+            PollLineIndex();
+        }
+
+        mixSettingsChanged = false;
         return true;
     }
 
-    void MusicCom::Mix(FM_SAMPLETYPE* dest, int nsamples)
+    std::unique_ptr<Sequencer> MusicCom::CreateSequencer(FM::OPN& opn, MusicData* music, const SequencerSettings& settings) const
+    {
+        Sequencer::ChipQuality chipQuality;
+        switch (settings.SynthQuality)
+        {
+        case Quality::Draft:
+            chipQuality.PSGOversampling = 0;
+            chipQuality.EGShift = 2;
+            break;
+        case Quality::High:
+            chipQuality.PSGOversampling = 3;
+            chipQuality.Interpolation = true;
+            break;
+        default:
+            break;
+        }
+
+        auto sequencer = std::make_unique<Sequencer>(opn, music, psounddata.get(), liveParameters.GetValues().SoundTempo);
+        // 音量と効果音のテンポは最初のフレームで反映される
+        sequencer->SetLiveParameters(&liveParameters);
+        sequencer->SetRegisterWriteObserver(settings.Observer);
+        sequencer->SetStatistics(settings.Statistics);
+        sequencer->SetEventQueue(settings.Events);
+#ifdef MUSICCOM_ENABLE_TRACE
+        sequencer->SetRegisterTrace(settings.Trace);
+#endif
+        sequencer->EnableLoopCache(settings.LoopCacheSize);
+
+        if (!sequencer->Init(settings.Rate, settings.Channels, chipQuality))
+        {
+            return nullptr;
+        }
+        return sequencer;
+    }
+
+    void MusicCom::DiscardPreparedSequencer()
+    {
+        // シーケンサが音源を参照しているため、先に破棄してから音源を返す
+        preparedsequencer.reset();
+        OPNPool::Release(preparedOpnRate, std::move(preparedopn));
+    }
+
+    void MusicCom::ReleaseRetired()
+    {
+        // シーケンサが音源とデータを参照しているため、先に破棄する
+        retiredsequencer.reset();
+        OPNPool::Release(retiredOpnRate, std::move(retiredopn));
+        retiredmusicdata.reset();
+        retiredlineindex.reset();
+    }
+
+    template<typename T>
+    void MusicCom::Mix(T* dest, int nsamples)
+    {
+        // 別のスレッドで解析済みの再読み込みのデータがあれば受け取る
+        ApplyReload();
+
+        if (!pstatistics)
+        {
+            Synthesize(dest, nsamples);
+            ApplyMasterGain(dest, nsamples);
+        }
+        else
+        {
+            auto start = std::chrono::steady_clock::now();
+            Synthesize(dest, nsamples);
+            ApplyMasterGain(dest, nsamples);
+            pstatistics->RecordRender(std::chrono::steady_clock::now() - start, nsamples);
+        }
+
+        // 差し替えが済んだら変更前のデータを解放する
+        if (pnextmusicdata && !pseq->IsMusicDataPending())
+        {
+            // 変更前のデータと索引は、演奏のスレッドで解放しないよう次の Reload で解放する
+            retiredmusicdata = std::move(pmusicdata);
+            pmusicdata = std::move(pnextmusicdata);
+            // 索引は変更前のデータを指しているため、次の SeekToLine で作り直す
+            retiredlineindex = std::move(plineindex);
+            DiscardLineIndex();
+            reloadState.store(ReloadState::Idle, std::memory_order_release);
+        }
+    }
+
+    void MusicCom::ApplyReload()
+    {
+        if (reloadState.load(std::memory_order_acquire) != ReloadState::Parsed || !pseq)
+        {
+            return;
+        }
+
+        if (preloadedRestart)
+        {
+            // Reload のスレッドで作成済みのシーケンサに入れ替えて先頭から演奏する
+            // 作成も変更前のものの解放も Reload のスレッドで行い、ここではポインタを入れ替えるだけにする
+            // (作成できなかった場合は、次の PrepareMix で受け取る)
+            if (!preparedsequencer)
+            {
+                return;
+            }
+            retiredsequencer = std::move(pseq);
+            retiredopn = std::move(popn);
+            retiredOpnRate = opnRate;
+            retiredmusicdata = std::move(pmusicdata);
+            pseq = std::move(preparedsequencer);
+            popn = std::move(preparedopn);
+            opnRate = preparedOpnRate;
+            pmusicdata = std::move(preloadedmusicdata);
+            if (presampler)
+            {
+                presampler->Reset();
+            }
+            // 索引は変更前のデータを指しているため、次の SeekToLine で作り直す
+            retiredlineindex = std::move(plineindex);
+            DiscardLineIndex();
+            reloadState.store(ReloadState::Idle, std::memory_order_release);
+            return;
+        }
+
+        pnextmusicdata = std::move(preloadedmusicdata);
+        reloadState.store(ReloadState::Scheduled, std::memory_order_relaxed);
+        MMLIncrementalParser* parser = pincrementalparser.get();
+        pseq->ScheduleMusicData(
+            pnextmusicdata.get(),
+            [parser](int part, int index)
+            {
+                return parser->MapCommandIndex(part, index);
+            });
+    }
+
+    template<typename T>
+    void MusicCom::Synthesize(T* dest, int nsamples)
+    {
+        if (!presampler)
+        {
+            pseq->Mix(dest, nsamples);
+            return;
+        }
+
+        int required = presampler->GetRequiredInput(nsamples);
+        if (required > 0)
+        {
+            pseq->Mix(presampler->PrepareInput(required), required);
+        }
+        presampler->Process(dest, nsamples);
+    }
+
+    template<typename T>
+    void MusicCom::ApplyMasterGain(T* dest, int nsamples)
+    {
+        auto version = liveParameters.GetVersion();
+        float target = masterGain;
+        if (version != masterGainVersion)
+        {
+            masterGainVersion = version;
+            target = liveParameters.GetValues().MasterGainScale;
+        }
+        if (target == 1.0f && masterGain == 1.0f)
+        {
+            return;
+        }
+
+        // 音量の急な変化で雑音が出ないよう、変更後の最初の 10ms で直線的に変化させる
+        int ramp = (target != masterGain) ? std::min(nsamples, std::max(static_cast<int>(mixRate / 100), 1)) : 0;
+        float step = (target - masterGain) / std::max(ramp, 1);
+        for (int i = 0; i < nsamples; i++)
+        {
+            float gain = (i < ramp) ? masterGain + step * (i + 1) : target;
+            for (int ch = 0; ch < outputChannels; ch++, dest++)
+            {
+                *dest = ScaleSample(*dest, gain);
+            }
+        }
+        masterGain = target;
+    }
+
+    template void MusicCom::Mix<__int16>(__int16* dest, int nsamples);
+    template void MusicCom::Mix<int32_t>(int32_t* dest, int nsamples);
+    template void MusicCom::Mix<float>(float* dest, int nsamples);
+
+    void MusicCom::EnableNativeRate(bool enable)
+    {
+        nativeRate = enable;
+        mixSettingsChanged = true;
+    }
+
+    void MusicCom::SetQuality(Quality q)
+    {
+        quality = q;
+        mixSettingsChanged = true;
+    }
+
+    void MusicCom::SetChannels(int channels)
     {
-        pseq->Mix(dest, nsamples);
+        outputChannels = (channels == 1) ? 1 : 2;
+        mixSettingsChanged = true;
     }
 
     void MusicCom::SetFMVolume(int vol)
     {
-        fmVolume = std::min(std::max(vol, -192), 20);
+        liveParameters.SetFMVolume(vol);
     }
 
     void MusicCom::SetPSGVolume(int vol)
     {
-        psgVolume = std::min(std::max(vol, -192), 20);
+        liveParameters.SetPSGVolume(vol);
     }
 
     void MusicCom::SetSoundTempo(int tempo)
     {
-        soundTempo = std::min(std::max(tempo, 128), 255);
+        liveParameters.SetSoundTempo(tempo);
+    }
+
+    void MusicCom::SetMasterGain(int gain)
+    {
+        liveParameters.SetMasterGain(gain);
+    }
+
+    void MusicCom::SetPartMute(int part, bool mute)
+    {
+        liveParameters.SetPartMute(part, mute);
+    }
+
+    void MusicCom::SetPartSolo(int part, bool solo)
+    {
+        liveParameters.SetPartSolo(part, solo);
+    }
+
+    void MusicCom::SetRegisterWriteObserver(RegisterWriteObserver observer)
+    {
+        // 次回の PrepareMix から有効
+        registerWriteObserver = observer;
+        mixSettingsChanged = true;
+    }
+
+    void MusicCom::SetSongCacheDirectory(const std::string& directory)
+    {
+        songCacheDirectory = directory;
+    }
+
+    void MusicCom::EnableHotReload(bool enable)
+    {
+        hotReload = enable;
+    }
+
+    bool MusicCom::Reload(const char* filename)
+    {
+        // 差し替えが済むまでは、演奏のスレッドが解析器の対応付けを使う
+        if (!pincrementalparser || IsReloadPending())
+        {
+            return false;
+        }
+
+        std::vector<char> data;
+        if (!ReadFile(filename, data))
+        {
+            return false;
+        }
+        std::shared_ptr<MusicData> next(pincrementalparser->Reparse(data.data(), data.size(), filename));
+        if (!next)
+        {
+            // 変更なし
+            return true;
+        }
+
+        // 前回の差し替えで演奏のスレッドが外したシーケンサやデータは、ここで解放する
+        ReleaseRetired();
+
+        // パートの構成が変わった場合は、先頭から演奏するシーケンサを演奏中と同じ設定でこのスレッドで作成しておく
+        // 演奏のスレッドは次回の Mix でポインタを入れ替えるだけにする (作成中の PrepareMix は待たせる)
+        std::lock_guard lock(sequencerMutex);
+        preloadedRestart = !HasSameParts(*pmusicdata, *next);
+        if (preloadedRestart && pseq)
+        {
+            preparedOpnRate = sequencerSettings.Rate;
+            preparedopn = OPNPool::Acquire(preparedOpnRate);
+            preparedsequencer = CreateSequencer(*preparedopn, next.get(), sequencerSettings);
+            if (!preparedsequencer)
+            {
+                // 次の PrepareMix で受け取る
+                DiscardPreparedSequencer();
+            }
+        }
+        preloadedmusicdata = std::move(next);
+        reloadState.store(ReloadState::Parsed, std::memory_order_release);
+        return true;
+    }
+
+    bool MusicCom::IsReloadPending() const
+    {
+        return reloadState.load(std::memory_order_acquire) != ReloadState::Idle;
+    }
+
+    bool MusicCom::SeekToLine(int line)
+    {
+        if (!pseq || IsReloadPending())
+        {
+            return false;
+        }
+
+        // 索引は先頭から最長 30 分ぶんシーケンス処理を進めて作るため、演奏のスレッドでは作らない
+        if (!PollLineIndex())
+        {
+            return false;
+        }
+        const LineIndex::Entry* entry = plineindex->Find(line);
+        if (!entry)
+        {
+            return false;
+        }
+        pseq->RestoreState(entry->State);
+        if (presampler)
+        {
+            presampler->Reset();
+        }
+        return true;
+    }
+
+    bool MusicCom::IsLineIndexPending() const
+    {
+        return !plineindex && lineIndexBuilder.joinable();
+    }
+
+    void MusicCom::EnableLineIndex(bool enable)
+    {
+        lineIndex = enable;
+    }
+
+    bool MusicCom::PollLineIndex()
+    {
+        if (plineindex)
+        {
+            return true;
+        }
+        if (lineIndexBuilder.joinable())
+        {
+            if (!lineIndexBuilt.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            // 作成を終えたスレッドなので待たない。破棄を要求したものは作り直す
+            bool discarded = lineIndexBuilder.get_stop_token().stop_requested();
+            lineIndexBuilder.join();
+            std::unique_ptr<LineIndex> built = std::move(pbuiltlineindex);
+            if (!discarded)
+            {
+                plineindex = std::move(built);
+                return true;
+            }
+        }
+
+        lineIndexBuilt.store(false, std::memory_order_relaxed);
+        lineIndexBuilder = std::jthread(
+            [this, music = pmusicdata, sound = psounddata, tempo = liveParameters.GetValues().SoundTempo, rate = synthRate](std::stop_token stop)
+            {
+                auto index = std::make_unique<LineIndex>(*music, *sound, tempo, rate, stop);
+                // 打ち切った索引は使わない (解放もこのスレッドで行う)
+                if (!stop.stop_requested())
+                {
+                    pbuiltlineindex = std::move(index);
+                }
+                lineIndexBuilt.store(true, std::memory_order_release);
+            });
+        return false;
+    }
+
+    void MusicCom::DiscardLineIndex()
+    {
+        plineindex.reset();
+        if (lineIndexBuilder.joinable())
+        {
+            lineIndexBuilder.request_stop();
+        }
+    }
+
+    void MusicCom::SetLoopCacheSize(size_t size)
+    {
+        loopCacheSize = size;
+        mixSettingsChanged = true;
+    }
+
+    void MusicCom::EnableEventQueue(size_t capacity)
+    {
+        mixSettingsChanged = true;
+        if (capacity == 0)
+        {
+            peventqueue.reset();
+            return;
+        }
+        peventqueue = std::make_unique<EventQueue>(capacity);
+    }
+
+    EventQueue* MusicCom::GetEventQueue()
+    {
+        return peventqueue.get();
+    }
+
+    std::optional<Overview> MusicCom::GetOverview(int window_ms)
+    {
+        if (!pmusicdata || !psounddata)
+        {
+            return std::nullopt;
+        }
+        window_ms = std::max(window_ms, 1);
+
+        // MML・SOUND.datが変更されていなければ前回の解析結果を使う
+        std::optional<uint64_t> key;
+        std::string path;
+        if (!loadedFilename.empty())
+        {
+            key = SongCache::ComputeKey(loadedFilename.c_str());
+            path = loadedFilename + ".overview";
+        }
+        if (key)
+        {
+            if (auto cached = LoadOverview(path, *key, window_ms))
+            {
+                return cached;
+            }
+        }
+
+        auto overview = AnalyzeOverview(*pmusicdata, *psounddata, liveParameters.GetValues().SoundTempo, window_ms);
+        if (key)
+        {
+            StoreOverview(path, *key, overview);
+        }
+        return overview;
+    }
+
+    void MusicCom::EnableStatistics(bool enable)
+    {
+        // 次回の PrepareMix から有効
+        mixSettingsChanged = true;
+        if (!enable)
+        {
+            pstatistics.reset();
+        }
+        else if (!pstatistics)
+        {
+            pstatistics = std::make_unique<MixStatistics>();
+        }
+    }
+
+    bool MusicCom::IsStatisticsEnabled() const
+    {
+        return static_cast<bool>(pstatistics);
+    }
+
+    bool MusicCom::PublishStatistics()
+    {
+        return pstatistics && pstatistics->Publish();
+    }
+
+    bool MusicCom::WriteStatistics(std::ostream& stream)
+    {
+        return pstatistics && pstatistics->WriteReport(stream);
+    }
+
+#ifdef MUSICCOM_ENABLE_TRACE
+    void MusicCom::SetRegisterTrace(RegisterTrace* trace)
+    {
+        registerTrace = trace;
+        mixSettingsChanged = true;
     }
+#endif
 
 } // namespace MusicCom
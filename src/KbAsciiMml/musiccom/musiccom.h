@@ -1,25 +1,132 @@
 ﻿#pragma once
 
+#include "eventqueue.h"
+#include "liveparameters.h"
+#include <atomic>
+#include <cstdint>
 #include <fmgen/opna.h>
+#include <functional>
+#include <iosfwd>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
 
 namespace MusicCom
 {
     class Sequencer;
+    class MixStatistics;
+    class RegisterTrace;
     class MusicData;
     class SoundData;
+    class MMLIncrementalParser;
+    class LineIndex;
+    class Resampler;
+    struct Overview;
 
     class MusicCom
     {
     public:
+        // 引数は先頭からの出力サンプル位置, レジスタ番号, 値
+        using RegisterWriteObserver = std::function<void(uint64_t sample, uint addr, uint data)>;
+
+        // 合成の品質
+        enum class Quality
+        {
+            Draft,    // 試聴・波形の概観用: 1/4 のレートで合成し、PSG のオーバーサンプリングなし、FM 音源の EG の更新は 4 回分ずつ
+            Standard, // 標準: PSG は 4 倍オーバーサンプリング
+            High,     // 保存用: FM 音源を本来のレートで合成して補間し、PSG は 8 倍オーバーサンプリング
+        };
+
         MusicCom();
         ~MusicCom();
         bool Load(const char* filename);
+        // 呼び出し側のバッファから読み込む (Load の間のみ参照し、コピーしない)
+        // sound_data が nullptr の場合は組み込みの SOUND.DAT を使用する
+        bool Load(const char* data, size_t size, const char* sound_data = nullptr, size_t sound_size = 0);
         bool PrepareMix(uint rate);
-        void Mix(FM_SAMPLETYPE* dest, int nsamples);
+        // T: 出力サンプルの型 (__int16, int32_t, float)
+        // int32_t は 16bit の値を 32bit に拡大し、float は ±1.0 に正規化する (float はクリッピングしない)
+        template<typename T>
+        void Mix(T* dest, int nsamples);
+        // 出力のチャンネル数 (1:モノラル 2:ステレオ、次回の PrepareMix から有効)
+        void SetChannels(int channels);
+        // 出力のレートによらず音源本来のレート (55466Hz) で合成し、出力のレートに変換する (次回の PrepareMix から有効)
+        // レジスタ書き込みの通知などのサンプル位置は合成したレートでの値になる
+        void EnableNativeRate(bool enable);
+        // 合成の品質 (次回の PrepareMix から有効)
+        // Draft ではレジスタ書き込みの通知などのサンプル位置は合成したレートでの値になる
+        void SetQuality(Quality quality);
+        // 音量 (0.5dB 単位、-192 以下で無音、最大 20) と効果音のテンポ (128-255)
+        // 演奏中も他のスレッドから呼んでよく、次のフレームの区切り (出力全体の音量は次回の Mix) から反映する
         void SetFMVolume(int vol);
         void SetPSGVolume(int vol);
         void SetSoundTempo(int tempo);
+        void SetMasterGain(int gain);
+        // パート (0-5: チャンネル, 6: D パート) のミュートとソロ (ソロのパートがあれば、それ以外はミュート)
+        // 音量と同じく演奏中も他のスレッドから呼んでよい。ミュートしたパートもシーケンス処理は続ける
+        void SetPartMute(int part, bool mute);
+        void SetPartSolo(int part, bool solo);
+        void SetRegisterWriteObserver(RegisterWriteObserver observer);
+        // 解析済みデータのキャッシュの保存先 (空の場合はキャッシュしない)
+        void SetSongCacheDirectory(const std::string& directory);
+
+        // 編集中の MML の再読み込み (次回の Load から有効、有効な間はキャッシュを使用しない)
+        void EnableHotReload(bool enable);
+        // 変更された行だけを解析し直し、次回以降の Mix で演奏位置を保ったまま次の行の区切りで差し替える
+        // パートの構成 (使用するチャンネルと D パートの有無) が変わった場合は、次回の Mix (その前に PrepareMix を呼んだ場合はそこ) で先頭から演奏し直す
+        // 演奏中に別の 1 スレッドから呼んでよく、ファイルの読み込みと解析、先頭から演奏し直すシーケンサの作成は呼び出したスレッドで行う
+        // (演奏のスレッドには解析済みのデータだけを渡す。Load とは同時に呼ばないこと)
+        // 差し替え待ちのデータがある間や、ファイルを読めない場合は false (内容が同じ場合は何もせずに true)
+        // 解析エラーの場合は例外を送出し、変更前の曲の演奏を続ける
+        bool Reload(const char* filename);
+        // 差し替え待ちのデータがあるかどうか (ある間は Reload できない、演奏中も別のスレッドから呼んでよい)
+        bool IsReloadPending() const;
+
+        // MML ファイルの line 行目 (1-origin) の CH/D 行から演奏する
+        // line が CH/D 行でなければ、それより前で最も近い CH/D 行から演奏する
+        // 行の区切り (全パートの一時停止) ごとに保存したシーケンサとレジスタの状態を復元するため、先頭から早送りする必要はない
+        // PrepareMix の後に、Mix と同じスレッドから呼ぶこと (差し替え待ちのデータがある間は false)
+        // 状態は各パートの確保済みの領域に復元するため、索引を作成し終えた後の呼び出しではメモリを確保しない
+        // 索引は別のスレッドで作成し、作成中は待たずに false を返す (IsLineIndexPending で区別して呼び直す)
+        bool SeekToLine(int line);
+        // SeekToLine 用の索引を作成中かどうか
+        bool IsLineIndexPending() const;
+        // PrepareMix で SeekToLine 用の索引の作成を始めておく (無効の場合は最初の SeekToLine で始める)
+        // 再読み込みでデータを差し替えた後は、次の SeekToLine で作り直す
+        void EnableLineIndex(bool enable);
+
+        // 繰り返しのループ本体を最大 size バイトまで PCM でキャッシュし、音源の内部状態まで同じ状態に戻ったら合成せずに再生する (0 で無効)
+        // 次回の PrepareMix から有効 (レジスタ書き込みの通知・トレース中は使用しない)
+        void SetLoopCacheSize(size_t size);
+
+        // 表示用のイベント (音符の開始・終了、音色・音量の変更、効果音の開始) を最大 capacity 個まで
+        // 保持するキューに記録する (次回の PrepareMix から有効、0 で無効、有効な間はループ本体のキャッシュを使用しない)
+        // 時刻は先頭からの出力サンプル位置 (合成したレートでの値) で、その位置を出力する Mix の中で記録される
+        // 取り出し中のキューを破棄しないよう、演奏していない間に呼ぶこと
+        void EnableEventQueue(size_t capacity);
+        // 記録したイベントの取り出し用 (演奏とは別の 1 スレッドから Pop する、無効の場合は nullptr)
+        EventQueue* GetEventQueue();
+
+        // 曲全体 (前奏 + ループ 1 周) の波形の概観 (window_ms ごとのピーク・RMS) とラウドネス
+        // 演奏とは別に、通常の 1/20 のレートで簡易に合成して求める (Load の後に呼ぶ、演奏位置には影響しない)
+        // ファイルから Load した場合は、MML ファイルの隣 (ファイル名 + ".overview") に結果をキャッシュする
+        std::optional<Overview> GetOverview(int window_ms = 100);
+
+        // 処理時間の統計
+        void EnableStatistics(bool enable);
+        bool IsStatisticsEnabled() const;
+        // 演奏のスレッドから呼び、前回以降の統計を書き出し待ちにする (前回の分が書き出されていなければ false)
+        bool PublishStatistics();
+        // 書き出し待ちの統計を書き出す (書き出し待ちがなければ false)
+        // 演奏中は別の 1 スレッドから呼んでよい。ファイルへの書き込みなどで演奏を待たせないよう、演奏のスレッドでは呼ばないこと
+        bool WriteStatistics(std::ostream& stream);
+
+#ifdef MUSICCOM_ENABLE_TRACE
+        // レジスタ書き込みのトレース (次回の PrepareMix から有効)
+        void SetRegisterTrace(RegisterTrace* trace);
+#endif
 
         static const int SOUND_EFFECT_DEFAULT_TEMPO;
 
@@ -29,13 +136,97 @@ namespace MusicCom
         MusicCom& operator=(const MusicCom&) = delete;
 
     private:
-        FM::OPN opn;
+        // PrepareMix で決めたシーケンサの設定 (Reload のスレッドでも、演奏中と同じ設定でシーケンサを作成する)
+        struct SequencerSettings
+        {
+            int Rate;     // 音源で合成するレート
+            int Channels; // 音源で合成するチャンネル数
+            Quality SynthQuality;
+            size_t LoopCacheSize;
+            RegisterWriteObserver Observer;
+            MixStatistics* Statistics;
+            EventQueue* Events;
+#ifdef MUSICCOM_ENABLE_TRACE
+            RegisterTrace* Trace;
+#endif
+        };
+
+        // music を先頭から演奏するシーケンサを作成して Init する (失敗した場合は nullptr)
+        std::unique_ptr<Sequencer> CreateSequencer(FM::OPN& opn, MusicData* music, const SequencerSettings& settings) const;
+        // Reload のスレッドで作成したシーケンサを使わずに破棄する
+        void DiscardPreparedSequencer();
+        // 演奏のスレッドで入れ替えた変更前のシーケンサなどを解放する (演奏のスレッド以外で呼ぶ)
+        void ReleaseRetired();
+        template<typename T>
+        void Synthesize(T* dest, int nsamples);
+        template<typename T>
+        void ApplyMasterGain(T* dest, int nsamples);
+        // Reload で解析したデータを演奏のスレッドで受け取り、シーケンサに渡す
+        void ApplyReload();
+        // 作成済みの索引があれば true を返す
+        // なければ、作成を終えたスレッドから受け取るか、演奏中のデータで作成を始める (作成中のスレッドは待たない)
+        bool PollLineIndex();
+        // データが変わったため、作成済み・作成中の索引を破棄する (作成中のスレッドの終了は待たない)
+        void DiscardLineIndex();
+
+        // 再読み込みの段階 (Reload を呼ぶスレッドと演奏のスレッドで受け渡す)
+        enum class ReloadState
+        {
+            Idle,      // 差し替え待ちのデータはない (Reload を呼ぶスレッドが解析器を使う)
+            Parsed,    // 解析済みのデータを preloadedmusicdata に置いた
+            Scheduled, // シーケンサが次の同期点で pnextmusicdata に差し替える (演奏のスレッドが解析器を使う)
+        };
+
+        std::unique_ptr<FM::OPN> popn; // OPNPool から取り出した音源
+        int opnRate;                   // popn を初期化したレート
         std::unique_ptr<Sequencer> pseq;
-        std::unique_ptr<MusicData> pmusicdata;
-        std::unique_ptr<SoundData> psounddata;
-        int fmVolume;
-        int psgVolume;
-        int soundTempo;
+        // 索引を作成するスレッドと共有する (差し替えた後も、作成中のスレッドが終わるまで解放しない)
+        std::shared_ptr<MusicData> pmusicdata;
+        std::shared_ptr<SoundData> psounddata;
+        // 演奏のスレッドで shared_ptr の管理領域を確保しないよう、Reload のスレッドで shared_ptr にしておく
+        std::shared_ptr<MusicData> preloadedmusicdata; // Reload で解析し、演奏のスレッドが受け取るのを待つ
+        std::shared_ptr<MusicData> pnextmusicdata;     // 差し替え待ち
+        std::atomic<ReloadState> reloadState;
+        bool preloadedRestart; // preloadedmusicdata はパートの構成が変わったため、先頭から演奏し直す
+        // PrepareMix と Reload のスレッドで、以下のシーケンサの設定と作成したシーケンサを受け渡す
+        std::mutex sequencerMutex;
+        SequencerSettings sequencerSettings;
+        // パートの構成が変わった場合に Reload のスレッドで作成した、preloadedmusicdata を先頭から演奏するシーケンサと音源
+        std::unique_ptr<Sequencer> preparedsequencer;
+        std::unique_ptr<FM::OPN> preparedopn;
+        int preparedOpnRate;
+        // 演奏のスレッドで外した変更前のシーケンサ・音源・データ・索引 (次の Reload で解放する)
+        std::unique_ptr<Sequencer> retiredsequencer;
+        std::unique_ptr<FM::OPN> retiredopn;
+        int retiredOpnRate;
+        std::shared_ptr<MusicData> retiredmusicdata;
+        std::unique_ptr<LineIndex> retiredlineindex;
+        std::unique_ptr<MMLIncrementalParser> pincrementalparser;
+        std::unique_ptr<LineIndex> plineindex;
+        std::unique_ptr<LineIndex> pbuiltlineindex; // lineIndexBuilder が作成した索引 (lineIndexBuilt の後に受け取る)
+        std::atomic<bool> lineIndexBuilt;
+        std::jthread lineIndexBuilder;
+        std::unique_ptr<Resampler> presampler;
+        bool hotReload;
+        bool lineIndex;
+        size_t loopCacheSize;
+        bool nativeRate;
+        Quality quality;
+        uint mixRate;
+        bool mixSettingsChanged; // 前回の PrepareMix の後に設定やデータが変わった (シーケンサを作り直す)
+        int synthRate; // 音源で合成するレート
+        int outputChannels;
+        LiveParameters liveParameters;
+        uint32_t masterGainVersion; // 反映済みの liveParameters の版数
+        float masterGain;           // 反映済みの出力全体の音量 (倍率)
+        RegisterWriteObserver registerWriteObserver;
+        std::unique_ptr<EventQueue> peventqueue;
+        std::string songCacheDirectory;
+        std::string loadedFilename; // ファイルから Load した場合のみ
+        std::unique_ptr<MixStatistics> pstatistics;
+#ifdef MUSICCOM_ENABLE_TRACE
+        RegisterTrace* registerTrace;
+#endif
     };
 
 } // namespace MusicCom
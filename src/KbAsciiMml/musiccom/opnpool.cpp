@@ -0,0 +1,79 @@
+﻿#include "opnpool.h"
+#include <fmgen/opna.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace MusicCom
+{
+    namespace
+    {
+        // レートごとに保持する数 (同時に開いている曲の数程度)
+        const size_t MAX_POOLED_PER_RATE = 4;
+
+        struct Pool
+        {
+            std::mutex Mutex;
+            std::map<int, std::vector<std::unique_ptr<FM::OPN>>> Instances;
+        };
+
+        Pool& GetPool()
+        {
+            static Pool pool;
+            return pool;
+        }
+    } // namespace
+
+    std::unique_ptr<FM::OPN> OPNPool::Acquire(int rate)
+    {
+        auto& pool = GetPool();
+        {
+            std::lock_guard lock(pool.Mutex);
+            auto found = pool.Instances.find(rate);
+            if (found != pool.Instances.end() && !found->second.empty())
+            {
+                auto opn = std::move(found->second.back());
+                found->second.pop_back();
+                return opn;
+            }
+        }
+        return std::make_unique<FM::OPN>();
+    }
+
+    void OPNPool::Release(int rate, std::unique_ptr<FM::OPN> opn)
+    {
+        if (!opn)
+        {
+            return;
+        }
+        auto& pool = GetPool();
+        std::lock_guard lock(pool.Mutex);
+        auto& instances = pool.Instances[rate];
+        if (instances.size() < MAX_POOLED_PER_RATE)
+        {
+            instances.push_back(std::move(opn));
+        }
+    }
+
+    PooledOPN::PooledOPN(int rate)
+        : rate_(rate),
+          opn_(OPNPool::Acquire(rate))
+    {
+    }
+
+    PooledOPN::~PooledOPN()
+    {
+        OPNPool::Release(rate_, std::move(opn_));
+    }
+
+    FM::OPN& PooledOPN::operator*() const
+    {
+        return *opn_;
+    }
+
+    FM::OPN* PooledOPN::operator->() const
+    {
+        return opn_.get();
+    }
+
+} // namespace MusicCom
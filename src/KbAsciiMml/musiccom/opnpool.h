@@ -0,0 +1,46 @@
+﻿#pragma once
+
+#include <memory>
+
+namespace FM
+{
+    class OPN;
+}
+
+namespace MusicCom
+{
+    // 初期化済みの音源 (FM::OPN) をサンプリングレートごとにプロセス全体で再利用する
+    // 曲を開き直すたびに音源を作り直さず、同じレートで Init し直す場合は FM 音源のレートに依存するテーブルも作り直されない
+    // (Init は PSG の音量を 0 に戻すため、PSG の音量テーブルは 0 以外の音量で使っていた場合のみ作り直す)
+    // どのスレッドから呼んでもよい
+    class OPNPool
+    {
+    public:
+        // rate で初期化した音源があれば取り出し、なければ作成する (どちらの場合も呼び出し側で Init すること)
+        static std::unique_ptr<FM::OPN> Acquire(int rate);
+        // 使い終わった音源を返す (rate: 最後に Init したレート)
+        static void Release(int rate, std::unique_ptr<FM::OPN> opn);
+    };
+
+    // OPNPool から借りた音源 (破棄するときに返す)
+    // 解析用などで一時的に使う場合に、参照するシーケンサより先に宣言して後で返す
+    class PooledOPN
+    {
+    public:
+        // rate: 呼び出し側で Init するレート
+        explicit PooledOPN(int rate);
+        ~PooledOPN();
+        FM::OPN& operator*() const;
+        FM::OPN* operator->() const;
+
+    protected:
+        // non-copyable
+        PooledOPN(const PooledOPN&) = delete;
+        PooledOPN& operator=(const PooledOPN&) = delete;
+
+    private:
+        int rate_;
+        std::unique_ptr<FM::OPN> opn_;
+    };
+
+} // namespace MusicCom
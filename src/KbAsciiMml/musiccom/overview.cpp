@@ -0,0 +1,407 @@
+﻿#include "overview.h"
+#include "opnpool.h"
+#include "sequencer.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <filesystem>
+#include <fmgen/opna.h>
+#include <format>
+#include <fstream>
+#include <numbers>
+#include <thread>
+#include <unordered_map>
+
+namespace MusicCom
+{
+    namespace
+    {
+        // シーケンス処理のレート (フレームの長さの丸め誤差を通常の演奏と同程度に抑える)
+        const int SEQUENCE_RATE = 44100;
+        // 音源は合成せずに EG などを進め、この間隔 (約 33ms) ごとに音量を見積もる
+        // テンポ 120 前後の 1 フレームが 1 回で済む長さで、これより短くしても精度はほとんど変わらない
+        const int LEVEL_STEP = SEQUENCE_RATE / 30;
+        // 合成しないため EG は細かく更新する必要がなく、16 回分ずつまとめて進める
+        const int EG_SHIFT = 4;
+        // 無限ループなどでループが見つからなくても、この時間で打ち切る
+        const uint64_t MAX_OVERVIEW_SECONDS = 30 * 60;
+
+        // ラウドネスのゲーティング (ITU-R BS.1770)
+        const int LOUDNESS_STEP_MS = 100; // 400ms のブロックを 100ms ずつずらす
+        const double ABSOLUTE_GATE = -70.0;
+        const double RELATIVE_GATE = -10.0;
+
+        const char OVERVIEW_MAGIC[4] = {'K', 'A', 'O', 'V'};
+        // Overview の構造や解析の方法を変更した場合は更新すること
+        const uint32_t OVERVIEW_VERSION = 2;
+
+        // K 特性 (ITU-R BS.1770) の周波数 frequency (Hz) での電力利得
+        // 規格の 48kHz での高域のシェルビングと低域のカット (RLB) の 2 段のフィルタの周波数特性による
+        double KWeightingGain(double frequency)
+        {
+            // |b0 + b1 z^-1 + b2 z^-2|^2 / |1 + a1 z^-1 + a2 z^-2|^2 (z = e^jw)
+            double w = 2.0 * std::numbers::pi * std::min(frequency, 20000.0) / 48000.0;
+            double c1 = std::cos(w);
+            double c2 = std::cos(2.0 * w);
+            auto biquad = [c1, c2](double b0, double b1, double b2, double a1, double a2)
+            {
+                double numerator = b0 * b0 + b1 * b1 + b2 * b2 + 2.0 * (b0 * b1 + b1 * b2) * c1 + 2.0 * b0 * b2 * c2;
+                double denominator = 1.0 + a1 * a1 + a2 * a2 + 2.0 * (a1 + a1 * a2) * c1 + 2.0 * a2 * c2;
+                return numerator / denominator;
+            };
+            return biquad(1.53512485958697, -2.69169618940638, 1.19839281085285, -1.69065929318241, 0.73248077421585) *
+                   biquad(1.0, -2.0, 1.0, -1.99004745483398, 0.99007225036621);
+        }
+
+        // 周波数 frequency (Hz) の矩形波の K 特性の電力利得
+        // 奇数次の倍音 k の電力は 1/k^2 に比例する (総和は pi^2/8)
+        // 15 次までは個別に求め、残りは高域のシェルビングでほぼ一定になるため 17 次の利得で代表する
+        double SquareWaveWeightingGain(double frequency)
+        {
+            const int HARMONICS = 15;
+            double sum = 0.0;
+            double rest = std::numbers::pi * std::numbers::pi / 8.0;
+            for (int k = 1; k <= HARMONICS; k += 2)
+            {
+                double power = 1.0 / (k * k);
+                sum += power * KWeightingGain(k * frequency);
+                rest -= power;
+            }
+            sum += rest * KWeightingGain((HARMONICS + 2) * frequency);
+            return sum * 8.0 / (std::numbers::pi * std::numbers::pi);
+        }
+
+        // 見積もった音量 (±1.0 基準、左右に同じ信号を出力する場合の片チャンネル分)
+        struct LevelEstimate
+        {
+            double Peak;          // 各音源の振幅の和
+            double Power;         // 平均二乗 (音源どうしは無相関とみなして電力を加える)
+            double WeightedPower; // K 特性をかけた平均二乗
+        };
+
+        // 音源の内部状態から、合成せずに出力の音量を見積もる
+        // 位相変調の波形の平均二乗は振幅だけで決まるため、FM はキャリアの振幅から求める (正弦波と同じ a^2/2)
+        // SSG は矩形波 (ノイズも 2 値) のため、平均二乗は振幅の 2 乗になる
+        // K 特性はキャリアの周波数と矩形波の倍音での利得で近似し、変調による倍音は考慮しない (ノイズは 0dB とする)
+        class LevelEstimator
+        {
+        public:
+            LevelEstimator()
+                : frequencies_(),
+                  gains_()
+            {
+            }
+
+            LevelEstimate Estimate(FM::OPN& opn)
+            {
+                float amplitude[FM::OPN::levelsources];
+                float frequency[FM::OPN::levelsources];
+                opn.GetLevels(amplitude, frequency);
+
+                LevelEstimate level{0.0, 0.0, 0.0};
+                for (int i = 0; i < FM::OPN::levelsources; i++)
+                {
+                    if (amplitude[i] <= 0.0f)
+                    {
+                        continue;
+                    }
+                    bool psg = i >= FM::OPN::psglevelsource;
+                    // 周波数が変わるのは音の高さが変わったときだけのため、前回の利得を使い回す
+                    if (frequency[i] != frequencies_[i])
+                    {
+                        frequencies_[i] = frequency[i];
+                        gains_[i] = (frequency[i] <= 0.0f) ? 1.0 : psg ? SquareWaveWeightingGain(frequency[i]) : KWeightingGain(frequency[i]);
+                    }
+                    double power = (psg ? 1.0 : 0.5) * amplitude[i] * amplitude[i];
+                    level.Peak += amplitude[i];
+                    level.Power += power;
+                    level.WeightedPower += power * gains_[i];
+                }
+                return level;
+            }
+
+        private:
+            float frequencies_[FM::OPN::levelsources];
+            double gains_[FM::OPN::levelsources];
+        };
+
+        // 窓ごとのピーク・RMS と、ラウドネス用の 100ms ごとの K 特性をかけた平均二乗を集計する
+        class OverviewAccumulator
+        {
+        public:
+            OverviewAccumulator(int rate, int window_ms, std::vector<Overview::Window>& windows)
+                : rate_(rate),
+                  window_ms_(window_ms),
+                  windows_(windows),
+                  position_(0),
+                  window_start_(0),
+                  window_end_(WindowEnd(0)),
+                  window_peak_(0.0),
+                  window_sum_(0.0),
+                  step_start_(0),
+                  step_end_(StepEnd(0)),
+                  step_sum_(0.0),
+                  step_powers_()
+            {
+            }
+
+            // count サンプルの間 level の音量が続いたものとして加える
+            void Add(const LevelEstimate& level, uint64_t count)
+            {
+                while (count > 0)
+                {
+                    // 窓と 100ms の区切りで分ける
+                    auto n = std::min({count, window_end_ - position_, step_end_ - position_});
+                    window_peak_ = std::max(window_peak_, level.Peak);
+                    window_sum_ += level.Power * n;
+                    step_sum_ += level.WeightedPower * n;
+                    position_ += n;
+                    count -= n;
+
+                    if (position_ == window_end_)
+                    {
+                        FlushWindow();
+                    }
+                    if (position_ == step_end_)
+                    {
+                        step_powers_.push_back(step_sum_ / (step_end_ - step_start_));
+                        step_sum_ = 0.0;
+                        step_start_ = step_end_;
+                        step_end_ = StepEnd(step_powers_.size());
+                    }
+                }
+            }
+
+            // 最後の途中までの窓を出力し、統合ラウドネスを返す
+            double Finish()
+            {
+                if (position_ > window_start_)
+                {
+                    FlushWindow();
+                }
+                return IntegrateLoudness();
+            }
+
+        private:
+            uint64_t WindowEnd(size_t index) const
+            {
+                return (index + 1) * rate_ * window_ms_ / 1000;
+            }
+
+            uint64_t StepEnd(size_t index) const
+            {
+                return (index + 1) * rate_ * LOUDNESS_STEP_MS / 1000;
+            }
+
+            void FlushWindow()
+            {
+                auto length = position_ - window_start_;
+                windows_.push_back(Overview::Window{
+                    static_cast<float>(window_peak_),
+                    static_cast<float>(std::sqrt(window_sum_ / length))});
+                window_peak_ = 0.0;
+                window_sum_ = 0.0;
+                window_start_ = position_;
+                window_end_ = WindowEnd(windows_.size());
+            }
+
+            double IntegrateLoudness() const
+            {
+                // 400ms のブロックごとのラウドネス (左右に同じ信号を出力するため 2 チャンネル分の和)
+                std::vector<double> blocks;
+                for (size_t i = 0; i + 4 <= step_powers_.size(); i++)
+                {
+                    double power = 2.0 * (step_powers_[i] + step_powers_[i + 1] + step_powers_[i + 2] + step_powers_[i + 3]) / 4.0;
+                    blocks.push_back(power);
+                }
+
+                auto gated_mean = [&blocks](double gate)
+                {
+                    double sum = 0.0;
+                    size_t count = 0;
+                    for (auto power : blocks)
+                    {
+                        if (ToLoudness(power) > gate)
+                        {
+                            sum += power;
+                            count++;
+                        }
+                    }
+                    return (count > 0) ? sum / count : 0.0;
+                };
+                double mean = gated_mean(ABSOLUTE_GATE);
+                if (mean <= 0.0)
+                {
+                    return -HUGE_VAL;
+                }
+                mean = gated_mean(std::max(ABSOLUTE_GATE, ToLoudness(mean) + RELATIVE_GATE));
+                return (mean > 0.0) ? ToLoudness(mean) : -HUGE_VAL;
+            }
+
+            static double ToLoudness(double power)
+            {
+                return -0.691 + 10.0 * std::log10(power);
+            }
+
+            const uint64_t rate_;
+            const uint64_t window_ms_;
+            std::vector<Overview::Window>& windows_;
+            uint64_t position_;
+
+            uint64_t window_start_;
+            uint64_t window_end_;
+            double window_peak_;
+            double window_sum_;
+
+            uint64_t step_start_;
+            uint64_t step_end_;
+            double step_sum_;
+            std::vector<double> step_powers_; // 100ms ごとの K 特性をかけた平均二乗
+        };
+    } // namespace
+
+    Overview AnalyzeOverview(MusicData& music, SoundData& sound, int soundtempo, int window_ms)
+    {
+        Overview overview{std::max(window_ms, 1)};
+        OverviewAccumulator accumulator(SEQUENCE_RATE, overview.WindowMilliseconds, overview.Windows);
+
+        // 演奏用とは別の OPN で、合成せずに PG・EG とカウンタだけを進めて音量を見積もる
+        // 曲ごとに解析する場合もテーブルを作り直さないよう、同じレートの音源を使い回す
+        PooledOPN opn(SEQUENCE_RATE);
+        Sequencer sequencer(*opn, &music, &sound, soundtempo);
+        Sequencer::ChipQuality quality;
+        quality.PSGOversampling = 0;
+        quality.EGShift = EG_SHIFT;
+        if (!sequencer.Init(SEQUENCE_RATE, 1, quality))
+        {
+            return overview;
+        }
+
+        LevelEstimator estimator;
+        auto synthesize = [&](int frame_size)
+        {
+            // フレームの区切りでレジスタが変わるため、先頭で反映して見積もり直す
+            // 発音中の変化を追えるよう LEVEL_STEP ごとに区切り、区切りの先頭での見積もりをその間の音量とする
+            opn->PrepareLevels();
+            while (frame_size > 0)
+            {
+                int n = std::min(frame_size, LEVEL_STEP);
+                accumulator.Add(estimator.Estimate(*opn), n);
+                opn->Skip(n);
+                frame_size -= n;
+            }
+        };
+
+        // 同期点で以前と同じ演奏状態になったら、そこからがループ
+        std::unordered_map<uint64_t, uint64_t> sync_points;
+        uint64_t loop_start = 0;
+        bool looped = false;
+        uint64_t limit = MAX_OVERVIEW_SECONDS * SEQUENCE_RATE;
+        while (sequencer.GetMixedSamples() < limit)
+        {
+            std::optional<uint64_t> hash;
+            sequencer.StepFrame(static_cast<int>(std::min<uint64_t>(limit - sequencer.GetMixedSamples(), INT_MAX)), synthesize, hash);
+            if (hash)
+            {
+                auto [found, inserted] = sync_points.emplace(*hash, sequencer.GetMixedSamples());
+                if (!inserted)
+                {
+                    loop_start = found->second;
+                    looped = true;
+                    break;
+                }
+            }
+        }
+
+        uint64_t end = sequencer.GetMixedSamples();
+        overview.IntroSeconds = static_cast<double>(looped ? loop_start : end) / SEQUENCE_RATE;
+        overview.LoopSeconds = looped ? static_cast<double>(end - loop_start) / SEQUENCE_RATE : 0.0;
+        overview.Loudness = accumulator.Finish();
+        return overview;
+    }
+
+    std::optional<Overview> LoadOverview(const std::string& path, uint64_t key, int window_ms)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream)
+        {
+            return std::nullopt;
+        }
+
+        auto read = [&stream](auto& value)
+        {
+            stream.read(reinterpret_cast<char*>(&value), sizeof(value));
+            return static_cast<bool>(stream);
+        };
+        char magic[4];
+        uint32_t version;
+        uint64_t stored_key;
+        int32_t stored_window_ms;
+        uint32_t count;
+        if (!read(magic) || !std::equal(std::begin(magic), std::end(magic), OVERVIEW_MAGIC) ||
+            !read(version) || version != OVERVIEW_VERSION ||
+            !read(stored_key) || stored_key != key ||
+            !read(stored_window_ms) || stored_window_ms != window_ms)
+        {
+            return std::nullopt;
+        }
+
+        Overview overview{window_ms};
+        if (!read(overview.IntroSeconds) || !read(overview.LoopSeconds) || !read(overview.Loudness) || !read(count))
+        {
+            return std::nullopt;
+        }
+        overview.Windows.resize(count);
+        for (auto& window : overview.Windows)
+        {
+            if (!read(window.Peak) || !read(window.RMS))
+            {
+                return std::nullopt;
+            }
+        }
+        return overview;
+    }
+
+    void StoreOverview(const std::string& path, uint64_t key, const Overview& overview)
+    {
+        // 他のインスタンスが読み込み中でも壊れたファイルが見えないよう、一時ファイルに書いてから置き換える
+        std::error_code ec;
+        auto temp_path = path + std::format(".{:x}.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()));
+        {
+            std::ofstream stream(temp_path, std::ios::binary);
+            if (!stream)
+            {
+                return;
+            }
+            auto write = [&stream](const auto& value)
+            {
+                stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+            };
+            write(OVERVIEW_MAGIC);
+            write(OVERVIEW_VERSION);
+            write(key);
+            write(static_cast<int32_t>(overview.WindowMilliseconds));
+            write(overview.IntroSeconds);
+            write(overview.LoopSeconds);
+            write(overview.Loudness);
+            write(static_cast<uint32_t>(overview.Windows.size()));
+            for (const auto& window : overview.Windows)
+            {
+                write(window.Peak);
+                write(window.RMS);
+            }
+            if (!stream)
+            {
+                stream.close();
+                std::filesystem::remove(temp_path, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(temp_path, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(temp_path, ec);
+        }
+    }
+
+} // namespace MusicCom
@@ -0,0 +1,39 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace MusicCom
+{
+    class MusicData;
+    class SoundData;
+
+    // 曲全体 (前奏 + ループ 1 周) の波形の概観とラウドネス
+    struct Overview
+    {
+        struct Window
+        {
+            float Peak; // 絶対値の最大 (±1.0 基準、各音源の振幅の和による見積もり)
+            float RMS;  // 音源ごとの振幅から見積もった値 (一定の出力 (直流) は含まない)
+        };
+
+        int WindowMilliseconds;
+        std::vector<Window> Windows;
+        double IntroSeconds; // ループが始まるまでの時間 (ループが見つからない場合は解析した時間)
+        double LoopSeconds;  // ループ 1 周の時間 (ループが見つからない場合は 0)
+        double Loudness;     // 前奏とループ 1 周の統合ラウドネス (LUFS、ステレオで再生した場合の値)
+    };
+
+    // 演奏用とは別の OPN で、合成せずに音源の内部状態から音量を見積もって曲全体を解析する
+    // シーケンス処理は通常のレートで行うため、時間の精度は通常の演奏と同じ
+    // ラウドネスは ITU-R BS.1770 の K 特性 (音源ごとの周波数での利得で近似) とゲーティングによる
+    Overview AnalyzeOverview(MusicData& music, SoundData& sound, int soundtempo, int window_ms);
+
+    // 解析結果のキャッシュ (key: SongCache::ComputeKey、窓の長さが違う場合も読み込まない)
+    std::optional<Overview> LoadOverview(const std::string& path, uint64_t key, int window_ms);
+    // 保存に失敗しても解析結果には影響しないため結果は返さない
+    void StoreOverview(const std::string& path, uint64_t key, const Overview& overview);
+
+} // namespace MusicCom
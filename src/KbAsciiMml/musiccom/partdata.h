@@ -4,6 +4,7 @@
 #include <optional>
 #include <stack>
 #include <utility>
+#include <vector>
 
 namespace MusicCom
 {
@@ -40,8 +41,9 @@ namespace MusicCom
         {
         }
 
-        std::stack<CommandIterator> CallStack;
-        std::stack<std::pair<CommandIterator, int>> LoopStack;
+        // 同期点の状態として保存するため、コピーの軽い vector を使用する
+        std::stack<CommandIterator, std::vector<CommandIterator>> CallStack;
+        std::stack<std::pair<CommandIterator, int>, std::vector<std::pair<CommandIterator, int>>> LoopStack;
         CommandIterator CommandPtr;
 
         int NoteBeginFrame;
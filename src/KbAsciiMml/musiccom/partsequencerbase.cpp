@@ -1,31 +1,63 @@
 ﻿#include "partsequencerbase.h"
+#include "fmsequencer.h"
+#include "fmwrap.h"
 #include "musdata.h"
+#include "psgsequencer.h"
+#include "soundsequencer.h"
+#include "statehash.h"
 #include <algorithm>
+#include <cassert>
 #include <cmath>
-#include <fmgen/opna.h>
 
 namespace MusicCom
 {
     const int TONE_KEY_OFF = -1;
     const int MAX_MACRO_COUNT = 100;
+    const int MAX_LOOP_COUNT = 100;
 
-    PartSequencerBase::PartSequencerBase(FM::OPN& opn, const MusicData& music, CommandIterator command_tail, int rate)
+    // 入れ子の上限まで確保したスタックを作る (上限を超えた時点で強制終了するため、1 つ多く確保する)
+    template<typename Stack>
+    Stack MakeReservedStack(int max_count)
+    {
+        typename Stack::container_type container;
+        container.reserve(max_count + 1);
+        return Stack(std::move(container));
+    }
+
+    template<typename Derived>
+    PartSequencerBase<Derived>::PartSequencerBase(OPNWrap& opn, const MusicData& music, CommandIterator command_tail, int rate)
         : opn_(opn),
           part_data_(),
-          music_data_(music),
+          music_data_(&music),
           command_tail_(command_tail),
           rate_(rate),
           samples_per_frame_(0),
           samples_left_(0),
-          current_frame_(0)
+          current_frame_(0),
+          command_count_(),
+          event_queue_(nullptr),
+          event_part_(-1),
+          event_clock_(nullptr),
+          note_sounding_(false),
+          lookahead_call_stack_(MakeReservedStack<decltype(PartData::CallStack)>(MAX_MACRO_COUNT)),
+          lookahead_loop_stack_(MakeReservedStack<decltype(PartData::LoopStack)>(MAX_LOOP_COUNT))
+#ifdef MUSICCOM_ENABLE_TRACE
+          ,
+          trace_part_(-1)
+#endif
     {
+        // 同期点の状態を演奏のスレッドで復元しても確保し直さないよう、入れ子の上限まで確保しておく
+        part_data_.CallStack = MakeReservedStack<decltype(PartData::CallStack)>(MAX_MACRO_COUNT);
+        part_data_.LoopStack = MakeReservedStack<decltype(PartData::LoopStack)>(MAX_LOOP_COUNT);
     }
 
-    PartSequencerBase::~PartSequencerBase()
+    template<typename Derived>
+    PartSequencerBase<Derived>::~PartSequencerBase()
     {
     }
 
-    void PartSequencerBase::Initialize()
+    template<typename Derived>
+    void PartSequencerBase<Derived>::Initialize()
     {
         part_data_.Playing = true;
         ReturnToHead();
@@ -36,15 +68,17 @@ namespace MusicCom
         current_frame_ = 0;
 
         // サブクラス固有の設定
-        InitializeImpl(part_data_);
+        GetDerived().InitializeImpl(part_data_);
     }
 
-    bool PartSequencerBase::IsPlaying() const
+    template<typename Derived>
+    bool PartSequencerBase<Derived>::IsPlaying() const
     {
         return part_data_.Playing;
     }
 
-    void PartSequencerBase::Resume()
+    template<typename Derived>
+    void PartSequencerBase<Derived>::Resume()
     {
         // 再生中は何もしない
         if (IsPlaying())
@@ -62,27 +96,84 @@ namespace MusicCom
         }
     }
 
-    int PartSequencerBase::GetRemainFrameSize()
+    template<typename Derived>
+    void PartSequencerBase<Derived>::SwapMusicData(const MusicData& music, int part, CommandIterator command_tail, const CommandIndexMapper& map)
+    {
+        // 一時停止コマンドは CH/D 行の行末にしかなく、マクロ (STR 行) の中で一時停止することはない
+        // そのため現在位置は常にパート内にあり、呼び出し中のマクロもない
+        assert(part_data_.CallStack.empty());
+
+        // 変更前のデータで現在位置をパート先頭からの番号に変換し、変更後の番号に対応付ける
+        const MusicData& old_music = GetMusicData();
+        int index = old_music.FindCommandIndex(part, part_data_.CommandPtr);
+        index = (index >= 0) ? map(index) : -1;
+
+        music_data_ = &music;
+        command_tail_ = command_tail;
+        // テンポの変更を反映
+        samples_per_frame_ = CalculatePerFrame(GetMusicData().GetTempo());
+
+        if (index < 0)
+        {
+            // 対応する位置がなければパートの先頭から再開
+            ReturnToHead();
+            part_data_.Playing = true;
+            return;
+        }
+
+        part_data_.CommandPtr = music.GetCommandAt(part, index);
+        RemapLoopStack(old_music, part, map);
+        Resume();
+    }
+
+    template<typename Derived>
+    void PartSequencerBase<Derived>::RemapLoopStack(const MusicData& old_music, int part, const CommandIndexMapper& map)
+    {
+        if (part_data_.LoopStack.empty())
+        {
+            return;
+        }
+        auto loop = part_data_.LoopStack.top();
+        part_data_.LoopStack.pop();
+        RemapLoopStack(old_music, part, map);
+
+        // マクロの中で始まったループは対応付けられないため除く
+        int index = old_music.FindCommandIndex(part, loop.first);
+        index = (index >= 0) ? map(index) : -1;
+        if (index >= 0)
+        {
+            part_data_.LoopStack.push(std::pair<CommandIterator, int>(GetMusicData().GetCommandAt(part, index), loop.second));
+        }
+    }
+
+    template<typename Derived>
+    int PartSequencerBase<Derived>::GetRemainFrameSize() const
     {
         // NVI pattern
-        return GetRemainFrameSizeImpl();
+        return GetDerived().GetRemainFrameSizeImpl();
     }
-    int PartSequencerBase::GetRemainFrameSizeImpl()
+    template<typename Derived>
+    int PartSequencerBase<Derived>::GetRemainFrameSizeImpl() const
     {
         return samples_left_;
     }
 
-    void PartSequencerBase::IncreaseFrame(int frame_size)
+    template<typename Derived>
+    void PartSequencerBase<Derived>::IncreaseFrame(int frame_size)
     {
         if (!part_data_.Playing)
         {
             return;
         }
 
+        MUSICCOM_TRACE_SCOPE(opn_, trace_part_, current_frame_);
+        MUSICCOM_TRACE_SCOPE(opn_, TraceSource::FRAME);
+
         // NVI pattern
-        IncreaseFrameImpl(frame_size);
+        GetDerived().IncreaseFrameImpl(frame_size);
     }
-    void PartSequencerBase::IncreaseFrameImpl(int frame_size)
+    template<typename Derived>
+    void PartSequencerBase<Derived>::IncreaseFrameImpl(int frame_size)
     {
         samples_left_ -= frame_size;
         if (samples_left_ <= 0)
@@ -92,33 +183,191 @@ namespace MusicCom
         }
     }
 
-    void PartSequencerBase::NextCommandFrame()
+    template<typename Derived>
+    void PartSequencerBase<Derived>::NextCommandFrame()
     {
-        PreProcess(current_frame_);
+        int commands = command_count_.Commands;
+
+        {
+            MUSICCOM_TRACE_SCOPE(opn_, TraceSource::PRE_PROCESS);
+            GetDerived().PreProcess(current_frame_);
+        }
         ProcessCommand(current_frame_);
-        ProcessEffect(current_frame_);
+        {
+            MUSICCOM_TRACE_SCOPE(opn_, TraceSource::EFFECT);
+            GetDerived().ProcessEffect(current_frame_);
+        }
 
         current_frame_++;
+
+        command_count_.Frames++;
+        command_count_.MaxCommandsPerFrame = std::max(command_count_.MaxCommandsPerFrame, command_count_.Commands - commands);
     }
 
-    const MusicData& PartSequencerBase::GetMusicData() const
+    template<typename Derived>
+    PartState PartSequencerBase<Derived>::SaveState() const
     {
-        return music_data_;
+        return State{part_data_, samples_left_, current_frame_, GetDerived().SaveStateImpl()};
     }
 
-    int PartSequencerBase::CalculatePerFrame(int tempo)
+    template<typename Derived>
+    void PartSequencerBase<Derived>::RestoreState(const State& state)
+    {
+        // スタックは上限まで確保済みのため、コピーしても確保し直さない (Extra はコピーせずに参照する)
+        assert(state.Data.CallStack.size() <= MAX_MACRO_COUNT + 1 && state.Data.LoopStack.size() <= MAX_LOOP_COUNT + 1);
+        part_data_ = state.Data;
+        samples_left_ = state.SamplesLeft;
+        current_frame_ = state.CurrentFrame;
+        GetDerived().RestoreStateImpl(state.Extra);
+        // 復元前の音符の NOTE_OFF は記録しない
+        note_sounding_ = false;
+    }
+
+    template<typename Derived>
+    CommandIterator PartSequencerBase<Derived>::GetCommandPtr() const
+    {
+        return part_data_.CommandPtr;
+    }
+
+    template<typename Derived>
+    bool PartSequencerBase<Derived>::HashState(StateHash& hash) const
+    {
+        const PartData& d = part_data_;
+        hash.Add(&*d.CommandPtr);
+        for (auto stack = d.CallStack; !stack.empty(); stack.pop())
+        {
+            hash.Add(&*stack.top());
+        }
+        hash.Add(d.CallStack.size());
+        for (auto stack = d.LoopStack; !stack.empty(); stack.pop())
+        {
+            hash.Add(&*stack.top().first);
+            hash.Add(stack.top().second);
+        }
+        hash.Add(d.LoopStack.size());
+
+        for (int frame : {d.NoteBeginFrame, d.NoteEndFrame, d.KeyOnFrame, d.KeyOffFrame})
+        {
+            hash.Add(frame - current_frame_);
+        }
+        for (int value : {d.Octave, d.LastOctave, d.ReservedOctave, d.Volume, d.Tone, d.LastTone, d.SoundNo, d.DefaultNoteLength, d.Detune, d.GateTime})
+        {
+            hash.Add(value);
+        }
+        for (int value : {d.PLength, d.ILength, d.IDepth, d.IDelay, d.ULength, d.UDepth, d.UDelay})
+        {
+            hash.Add(value);
+        }
+        hash.Add(d.SSGEnvOn);
+        hash.Add(d.LinkedItem.has_value());
+        hash.Add(d.LinkedItem.value_or(CommandType::TYPE_UNKNOWN));
+        hash.Add(d.Playing);
+        hash.Add(d.InfiniteLooping);
+
+        hash.Add(samples_per_frame_);
+        hash.Add(samples_left_);
+        return GetDerived().HashStateImpl(hash);
+    }
+
+    template<typename Derived>
+    bool PartSequencerBase<Derived>::HashStateImpl(StateHash& hash) const
+    {
+        // デフォルト実装は固有の状態なし
+        return true;
+    }
+
+    template<typename Derived>
+    std::any PartSequencerBase<Derived>::SaveStateImpl() const
+    {
+        // デフォルト実装は固有の状態なし
+        return std::any();
+    }
+
+    template<typename Derived>
+    void PartSequencerBase<Derived>::RestoreStateImpl(const std::any& extra)
+    {
+    }
+
+    template<typename Derived>
+    PartCommandCount PartSequencerBase<Derived>::TakeCommandCount()
+    {
+        auto result = command_count_;
+        command_count_ = CommandCount();
+        return result;
+    }
+
+    template<typename Derived>
+    void PartSequencerBase<Derived>::SetEventQueue(EventQueue* queue, int part, const uint64_t* clock)
+    {
+        event_queue_ = queue;
+        event_part_ = part;
+        event_clock_ = clock;
+    }
+
+    template<typename Derived>
+    void PartSequencerBase<Derived>::PublishEvent(EventType type, int value)
+    {
+        if (event_queue_)
+        {
+            event_queue_->Push(SequencerEvent{*event_clock_, static_cast<int8_t>(event_part_), type, static_cast<int16_t>(value)});
+        }
+    }
+
+    template<typename Derived>
+    void PartSequencerBase<Derived>::ReleaseNote()
+    {
+        GetDerived().KeyOff();
+        // ゲートタイム後は毎フレームキーオフするため、最初の 1 回だけ記録する
+        if (note_sounding_)
+        {
+            note_sounding_ = false;
+            PublishEvent(EventType::NOTE_OFF, 0);
+        }
+    }
+
+#ifdef MUSICCOM_ENABLE_TRACE
+    template<typename Derived>
+    void PartSequencerBase<Derived>::SetTracePart(int part)
+    {
+        trace_part_ = part;
+    }
+
+    template<typename Derived>
+    OPNWrap& PartSequencerBase<Derived>::GetTraceOPN()
+    {
+        return opn_;
+    }
+#endif
+
+    template<typename Derived>
+    const MusicData& PartSequencerBase<Derived>::GetMusicData() const
+    {
+        return *music_data_;
+    }
+
+    template<typename Derived>
+    int PartSequencerBase<Derived>::CalculatePerFrame(int tempo)
     {
         return static_cast<int>(rate_ * (60.0 / (tempo * 16.0)) / 1.1 + 0.5); // 1.1: music.comの演奏は速いので補正
     }
 
-    void PartSequencerBase::ReturnToHead()
+    template<typename Derived>
+    void PartSequencerBase<Derived>::ReturnToHead()
     {
-        part_data_.CommandPtr = GetHead();
-        part_data_.CallStack = {};
-        part_data_.LoopStack = {};
+        part_data_.CommandPtr = GetDerived().GetHead();
+        // 確保済みの領域は残しておく
+        while (!part_data_.CallStack.empty())
+        {
+            part_data_.CallStack.pop();
+        }
+        while (!part_data_.LoopStack.empty())
+        {
+            part_data_.LoopStack.pop();
+        }
     }
 
-    void PartSequencerBase::PreProcess(int current_frame)
+    template<typename Derived>
+    void PartSequencerBase<Derived>::PreProcess(int current_frame)
     {
         if (part_data_.NoteEndFrame <= current_frame)
         {
@@ -127,12 +376,13 @@ namespace MusicCom
             // 前回のコマンド先読みで & や W が検出された場合はキーオフせず継続
             if (!part_data_.LinkedItem)
             {
-                KeyOff();
+                ReleaseNote();
             }
         }
     }
 
-    std::optional<CommandIterator> PartSequencerBase::ProcessLoop(CommandIterator ptr)
+    template<typename Derived>
+    std::optional<CommandIterator> PartSequencerBase<Derived>::ProcessLoop(CommandIterator ptr)
     {
         while (1)
         {
@@ -145,7 +395,7 @@ namespace MusicCom
                 part_data_.CommandPtr = ptr;
                 return std::nullopt;
             case CommandType::TYPE_MACRO:
-                if (!music_data_.IsMacroPresent(command.GetStrArg()))
+                if (!music_data_->IsMacroPresent(command.GetStrArg()))
                 {
                     ptr++;
                     continue;
@@ -157,7 +407,7 @@ namespace MusicCom
                     part_data_.Playing = false;
                     return std::nullopt;
                 }
-                ptr = music_data_.GetMacroHead(command.GetStrArg());
+                ptr = music_data_->GetMacroHead(command.GetStrArg());
                 continue;
             case CommandType::TYPE_RETURN:
                 if (part_data_.CallStack.empty())
@@ -170,6 +420,12 @@ namespace MusicCom
                 continue;
             case CommandType::TYPE_LOOP:
                 part_data_.LoopStack.push(std::pair<CommandIterator, int>(++CommandIterator(ptr), command.GetArg(0)));
+                // 入れ子の数がMAX_LOOP_COUNTを超えたら強制終了
+                if (part_data_.LoopStack.size() > MAX_LOOP_COUNT)
+                {
+                    part_data_.Playing = false;
+                    return std::nullopt;
+                }
                 ptr++;
                 continue;
             case CommandType::TYPE_EXIT:
@@ -214,13 +470,17 @@ namespace MusicCom
         }
     }
 
-    std::optional<CommandType> PartSequencerBase::FindLinkedItem(CommandIterator ptr) const
+    template<typename Derived>
+    std::optional<CommandType> PartSequencerBase<Derived>::FindLinkedItem(CommandIterator ptr) const
     {
         // 後方にタイ(&)やキーオフなし休符(W)が存在するかどうかを先読みして確認
         // ProcessLoop同様にマクロ/ループは展開するが、本体に影響しないようコピーで処理する
+        // (コピー先は確保済みの領域を使い回す)
         bool infinite_looping = false;
-        auto macro_call_stack(part_data_.CallStack);
-        auto loop_stack(part_data_.LoopStack);
+        auto& macro_call_stack = lookahead_call_stack_;
+        auto& loop_stack = lookahead_loop_stack_;
+        macro_call_stack = part_data_.CallStack;
+        loop_stack = part_data_.LoopStack;
 
         while (1)
         {
@@ -231,7 +491,7 @@ namespace MusicCom
             case CommandType::TYPE_PAUSE:
                 return std::nullopt;
             case CommandType::TYPE_MACRO:
-                if (!music_data_.IsMacroPresent(command.GetStrArg()))
+                if (!music_data_->IsMacroPresent(command.GetStrArg()))
                 {
                     continue;
                 }
@@ -241,7 +501,7 @@ namespace MusicCom
                 {
                     return std::nullopt;
                 }
-                ptr = music_data_.GetMacroHead(command.GetStrArg());
+                ptr = music_data_->GetMacroHead(command.GetStrArg());
                 break;
             case CommandType::TYPE_RETURN:
                 if (macro_call_stack.empty())
@@ -253,6 +513,11 @@ namespace MusicCom
                 break;
             case CommandType::TYPE_LOOP:
                 loop_stack.push(std::pair<CommandIterator, int>(CommandIterator(ptr), command.GetArg(0)));
+                // 入れ子の数がMAX_LOOP_COUNTを超えたら強制終了
+                if (loop_stack.size() > MAX_LOOP_COUNT)
+                {
+                    return std::nullopt;
+                }
                 break;
             case CommandType::TYPE_EXIT:
             {
@@ -294,13 +559,17 @@ namespace MusicCom
             case CommandType::TYPE_NOTE:
             case CommandType::TYPE_REST:
                 return std::nullopt;
+            default:
+                // 音長を持たないコマンドは読み飛ばす
+                break;
             }
         }
 
         return std::nullopt;
     }
 
-    void PartSequencerBase::ProcessCommand(int current_frame)
+    template<typename Derived>
+    void PartSequencerBase<Derived>::ProcessCommand(int current_frame)
     {
         part_data_.InfiniteLooping = false;
         auto ptr = part_data_.CommandPtr;
@@ -317,12 +586,17 @@ namespace MusicCom
                 ptr = *result;
             }
 
-            ptr = ProcessCommandImpl(ptr, current_frame, part_data_);
+            {
+                MUSICCOM_TRACE_SCOPE(opn_, TraceSource::COMMAND, ptr->GetType());
+                ptr = GetDerived().ProcessCommandImpl(ptr, current_frame, part_data_);
+            }
+            command_count_.Commands++;
         }
         part_data_.CommandPtr = ptr;
     }
 
-    CommandIterator PartSequencerBase::ProcessCommandImpl(CommandIterator ptr, int current_frame, PartData& part_data)
+    template<typename Derived>
+    CommandIterator PartSequencerBase<Derived>::ProcessCommandImpl(CommandIterator ptr, int current_frame, PartData& part_data)
     {
         static auto get_length = [](const PartData& part_data, int base_length)
         {
@@ -360,8 +634,18 @@ namespace MusicCom
             // オクターブの変更を反映
             part_data.Octave = part_data.ReservedOctave;
 
-            UpdateTone(command.GetArg(0), part_data);
-            KeyOn();
+            GetDerived().UpdateTone(command.GetArg(0), part_data);
+            GetDerived().KeyOn();
+            // タイでつないだ場合も、音程ごとに別の音符として記録する
+            if (event_queue_)
+            {
+                if (note_sounding_)
+                {
+                    PublishEvent(EventType::NOTE_OFF, 0);
+                }
+                PublishEvent(EventType::NOTE_ON, part_data.Octave * 12 + command.GetArg(0));
+                note_sounding_ = true;
+            }
 
             if (part_data.LastTone == TONE_KEY_OFF)
             {
@@ -383,7 +667,7 @@ namespace MusicCom
             if (part_data.LinkedItem != CommandType::TYPE_TIE)
             {
                 // &R でなければキーオフ
-                KeyOff();
+                ReleaseNote();
 
                 // 休符後のトーンエフェクトを無効にするためキーオフ状態を設定
                 part_data.Tone = TONE_KEY_OFF;
@@ -427,7 +711,8 @@ namespace MusicCom
             break;
         case CommandType::TYPE_VOLUME:
             part_data.Volume = std::min(std::max(command.GetArg(0), 0), 15);
-            SetVolume(part_data.Volume);
+            GetDerived().SetVolume(part_data.Volume);
+            PublishEvent(EventType::VOLUME, part_data.Volume);
             break;
         //case CommandType::TYPE_TONE:
         case CommandType::TYPE_GATE_TIME:
@@ -463,12 +748,16 @@ namespace MusicCom
         case CommandType::TYPE_DIRECT:
             opn_.SetReg(command.GetArg(0), command.GetArg(1));
             break;
+        default:
+            // ループ・マクロは ProcessLoop で、音色・エンベロープは派生クラスの ProcessCommandImpl で処理する
+            break;
         }
 
         return ptr;
     }
 
-    void PartSequencerBase::ProcessEffect(int current_frame)
+    template<typename Derived>
+    void PartSequencerBase<Derived>::ProcessEffect(int current_frame)
     {
         // エフェクト等の処理
         // ディレイはKeyOnFrameを基準とする
@@ -476,10 +765,10 @@ namespace MusicCom
         // ビブラート用サブ関数
         static auto set_vibrato = [](PartSequencerBase& sequencer, int keyon_length, int base_tone)
         {
-            auto part_data = sequencer.part_data_;
+            const auto& part_data = sequencer.part_data_;
             int depth = (((keyon_length - part_data.IDelay) / part_data.ILength) & 1) ? -part_data.IDepth : part_data.IDepth;
             int tone = static_cast<int>(base_tone * pow(2.0, depth / (255.0 * 12.0)) + 0.5);
-            sequencer.SetTone(part_data.Octave, tone);
+            sequencer.GetDerived().SetTone(part_data.Octave, tone);
         };
 
         // 一時停止中の場合は何もしない
@@ -491,7 +780,7 @@ namespace MusicCom
         // ゲートタイム(Q)でのキーオフ
         if (part_data_.KeyOffFrame <= current_frame)
         {
-            KeyOff();
+            ReleaseNote();
         }
 
         // Volume
@@ -504,10 +793,10 @@ namespace MusicCom
                 final_volume -= part_data_.UDepth;
         }
 
-        final_volume = AdjustVolume(final_volume, keyon_length, part_data_);
+        final_volume = GetDerived().AdjustVolume(final_volume, keyon_length, part_data_);
 
         final_volume = std::min(std::max(final_volume, 0), 15);
-        SetVolume(final_volume);
+        GetDerived().SetVolume(final_volume);
 
         // Tone
         if (part_data_.PLength != 0 && part_data_.Tone != TONE_KEY_OFF)
@@ -518,7 +807,7 @@ namespace MusicCom
             if (diff <= part_data_.PLength)
             {
                 double coefficient = diff / static_cast<double>(part_data_.PLength);
-                ApplyPortamentoEffect(part_data_.Octave, part_data_.Tone, part_data_.LastOctave, part_data_.LastTone, coefficient);
+                GetDerived().ApplyPortamentoEffect(part_data_.Octave, part_data_.Tone, part_data_.LastOctave, part_data_.LastTone, coefficient);
             }
         }
         else if (part_data_.ILength != 0 && keyon_length >= part_data_.IDelay)
@@ -535,10 +824,27 @@ namespace MusicCom
         }
     }
 
-    int PartSequencerBase::AdjustVolume(int volume, int length, const PartData& part_data)
+    template<typename Derived>
+    int PartSequencerBase<Derived>::AdjustVolume(int volume, int length, const PartData& part_data)
     {
         // デフォルト実装は何もしない
         return volume;
     }
 
+    template<typename Derived>
+    Derived& PartSequencerBase<Derived>::GetDerived()
+    {
+        return static_cast<Derived&>(*this);
+    }
+
+    template<typename Derived>
+    const Derived& PartSequencerBase<Derived>::GetDerived() const
+    {
+        return static_cast<const Derived&>(*this);
+    }
+
+    template class PartSequencerBase<FmSequencer>;
+    template class PartSequencerBase<PsgSequencer>;
+    template class PartSequencerBase<SoundSequencer>;
+
 } // namespace MusicCom
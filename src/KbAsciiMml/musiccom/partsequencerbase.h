@@ -1,64 +1,142 @@
 ﻿#pragma once
 
+#include "eventqueue.h"
 #include "partdata.h"
-
-namespace FM
-{
-    class OPN;
-}
+#include <any>
+#include <cstdint>
+#include <functional>
 
 namespace MusicCom
 {
     class MusicData;
+    class OPNWrap;
+    class StateHash;
+
+    // 統計用のコマンド処理数
+    struct PartCommandCount
+    {
+        int Commands;
+        int Frames;
+        int MaxCommandsPerFrame;
+    };
+
+    // 同期点 (全パートの一時停止から再開した直後) でのパートの状態
+    struct PartState
+    {
+        PartData Data;
+        int SamplesLeft;
+        int CurrentFrame;
+        std::any Extra; // サブクラス固有の状態
+    };
+
+    // パートのシーケンサの共通部分 (Derived: FmSequencer, PsgSequencer, SoundSequencer)
+    // パートの種類ごとの処理は仮想関数ではなく Derived の同名の関数を静的に呼び出す
+    // Derived は InitializeImpl, KeyOn, KeyOff, UpdateTone, ApplyPortamentoEffect, SetTone, SetVolume, GetHead を定義し、
+    // 必要に応じて ProcessCommandImpl などのデフォルト実装 (protected) を同名の関数で置き換える
+    // 定義は partsequencerbase.cpp にあり、3 種類のパートについて明示的にインスタンス化する
+    template<typename Derived>
     class PartSequencerBase
     {
     public:
-        PartSequencerBase(FM::OPN& opn, const MusicData& music, CommandIterator command_tail, int rate);
-        virtual ~PartSequencerBase();
+        using CommandCount = PartCommandCount;
+        using State = PartState;
+
+        PartSequencerBase(OPNWrap& opn, const MusicData& music, CommandIterator command_tail, int rate);
+        ~PartSequencerBase();
 
         void Initialize();
         bool IsPlaying() const;
         void Resume();
 
-        int GetRemainFrameSize();
+        // 変更前のコマンド位置 (パート先頭からの番号) を変更後の位置に対応付ける (対応しなければ -1)
+        using CommandIndexMapper = std::function<int(int index)>;
+        // 一時停止中に MusicData を差し替えて再開する (Resume の代わりに呼ぶ)
+        // part: パート番号 (0-5: チャンネル, 6: D パート)
+        // 変更前と変更後のデータはどちらも MusicData::BuildCommandIndex で対応表を作っておくこと
+        void SwapMusicData(const MusicData& music, int part, CommandIterator command_tail, const CommandIndexMapper& map);
+
+        int GetRemainFrameSize() const;
         void IncreaseFrame(int frame_size);
 
+        State SaveState() const;
+        // 同じ MusicData で保存した状態を復元する
+        void RestoreState(const State& state);
+        // 一時停止中の位置 (TYPE_PAUSE)
+        CommandIterator GetCommandPtr() const;
+        // 以降の演奏を決める状態のハッシュ値を追加する (フレーム番号は現在のフレームからの相対値とする)
+        // 比較できない状態の場合は false
+        bool HashState(StateHash& hash) const;
+
+        // 前回の取得以降のコマンド処理数を返してリセットする
+        CommandCount TakeCommandCount();
+
+        // 表示用のイベントを queue に記録する (nullptr で無効)
+        // part: 記録するパート番号, clock: イベントの時刻とする出力サンプル位置
+        void SetEventQueue(EventQueue* queue, int part, const uint64_t* clock);
+
+#ifdef MUSICCOM_ENABLE_TRACE
+        // トレースに記録するパート番号
+        void SetTracePart(int part);
+#endif
+
     protected:
         const MusicData& GetMusicData() const;
+#ifdef MUSICCOM_ENABLE_TRACE
+        OPNWrap& GetTraceOPN();
+#endif
         int CalculatePerFrame(int tempo);
+        // 表示用のイベントを記録する (キューが設定されていなければ何もしない)
+        void PublishEvent(EventType type, int value);
 
-        virtual int GetRemainFrameSizeImpl();
-        virtual void IncreaseFrameImpl(int frame_size);
-        virtual CommandIterator ProcessCommandImpl(CommandIterator ptr, int current_frame, PartData& part_data);
-        virtual void ProcessEffect(int current_frame);
+        // Derived で置き換えられるデフォルト実装
+        int GetRemainFrameSizeImpl() const;
+        void IncreaseFrameImpl(int frame_size);
+        CommandIterator ProcessCommandImpl(CommandIterator ptr, int current_frame, PartData& part_data);
+        void ProcessEffect(int current_frame);
+        std::any SaveStateImpl() const;
+        void RestoreStateImpl(const std::any& extra);
+        bool HashStateImpl(StateHash& hash) const;
+        void PreProcess(int current_frame);
+        int AdjustVolume(int volume, int length, const PartData& part_data);
 
     private:
+        Derived& GetDerived();
+        const Derived& GetDerived() const;
+
         void ReturnToHead();
+        // ループの開始位置を変更後のデータに対応付ける (対応しないループは除く)
+        // 確保済みの領域を使い回すため、下から順に取り出して積み直す
+        void RemapLoopStack(const MusicData& old_music, int part, const CommandIndexMapper& map);
         void NextCommandFrame();
         std::optional<CommandIterator> ProcessLoop(CommandIterator ptr);
         std::optional<CommandType> FindLinkedItem(CommandIterator ptr) const;
         void ProcessCommand(int current_frame);
+        // キーオフし、発音中の音符があれば NOTE_OFF を記録する
+        void ReleaseNote();
 
-        virtual void InitializeImpl(PartData& part_data) = 0;
-        virtual void PreProcess(int current_frame);
-        virtual void KeyOn() = 0;
-        virtual void KeyOff() = 0;
-        virtual void UpdateTone(int base_tone, PartData& part_data) = 0;
-        virtual int AdjustVolume(int volume, int length, const PartData& part_data);
-        virtual void ApplyPortamentoEffect(int octave, int tone, int last_octave, int last_tone, double coefficient) = 0;
-        virtual void SetTone(int octave, int tone) = 0;
-        virtual void SetVolume(int volume) = 0;
-        virtual const CommandIterator GetHead() const = 0;
-
-        FM::OPN& opn_;
+        OPNWrap& opn_;
         PartData part_data_;
-        const MusicData& music_data_;
-        const CommandIterator command_tail_;
+        const MusicData* music_data_;
+        CommandIterator command_tail_;
 
         const int rate_;
         // コマンドフレーム
         int samples_per_frame_;
         int samples_left_; // このフレーム(64分音符)でmixすべき残りのサンプル数
         int current_frame_;
+
+        CommandCount command_count_;
+
+        EventQueue* event_queue_;
+        int event_part_;
+        const uint64_t* event_clock_;
+        bool note_sounding_; // NOTE_ON を記録してから NOTE_OFF を記録していない
+        // FindLinkedItem の先読みで本体のスタックをコピーする先 (演奏中に確保しないよう使い回す)
+        mutable decltype(PartData::CallStack) lookahead_call_stack_;
+        mutable decltype(PartData::LoopStack) lookahead_loop_stack_;
+
+#ifdef MUSICCOM_ENABLE_TRACE
+        int trace_part_;
+#endif
     };
 } // namespace MusicCom
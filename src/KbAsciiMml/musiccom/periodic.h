@@ -0,0 +1,28 @@
+﻿#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stop_token>
+
+namespace MusicCom
+{
+    // 停止を要求されるまで、interval ごとに func() を呼ぶ (待っている間に停止を要求されたらすぐに抜ける)
+    // ファイルの監視や書き出しなど、std::jthread で定期的に行う処理に使う
+    template<typename Rep, typename Period, typename Func>
+    void RunPeriodically(std::stop_token stop, std::chrono::duration<Rep, Period> interval, Func func)
+    {
+        std::mutex mutex;
+        std::condition_variable_any cv;
+        std::unique_lock lock(mutex);
+        auto stopped = [&stop]()
+        {
+            return stop.stop_requested();
+        };
+        while (!cv.wait_for(lock, stop, interval, stopped))
+        {
+            func();
+        }
+    }
+
+} // namespace MusicCom
@@ -0,0 +1,86 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace MusicCom
+{
+    // 次に演奏する曲の読み込みと演奏の準備を、別のスレッドで先に済ませておく
+    // T は準備したもの (曲を読み込んで PrepareMix した MusicCom や、それを持つプレイヤー)
+    template<typename T>
+    class Prefetcher
+    {
+    public:
+        // 失敗した場合は nullptr を返すか例外を送出する
+        using Prepare = std::function<std::unique_ptr<T>()>;
+
+        Prefetcher() = default;
+        // 実行中の準備は終わるまで待つ
+        ~Prefetcher() = default;
+
+        Prefetcher(const Prefetcher&) = delete;
+        Prefetcher& operator=(const Prefetcher&) = delete;
+
+        // key (ファイル名と更新時刻など、準備したものを使える条件) で準備を始める
+        // 前回の準備は使わずに破棄する (実行中の場合も待たない)
+        void Start(const std::string& key, Prepare prepare)
+        {
+            std::lock_guard lock(mutex_);
+            Discard();
+            key_ = key;
+            result_ = std::async(std::launch::async, std::move(prepare));
+        }
+
+        // key が一致すれば準備したものを返す (実行中の場合は終わるまで待つ)
+        // 一致しない場合や準備に失敗した場合は nullptr を返し、呼び出し側で通常どおり準備する
+        std::unique_ptr<T> Take(const std::string& key)
+        {
+            std::lock_guard lock(mutex_);
+            if (!result_.valid() || key != key_)
+            {
+                return nullptr;
+            }
+            try
+            {
+                return result_.get();
+            }
+            catch (...)
+            {
+                return nullptr;
+            }
+        }
+
+    private:
+        void Discard()
+        {
+            // std::async の future は破棄時に完了を待つため、終わるまで別に保持しておく
+            auto running = [](const std::future<std::unique_ptr<T>>& result)
+            {
+                return result.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+            };
+            std::erase_if(
+                discarded_,
+                [&running](const std::future<std::unique_ptr<T>>& result)
+                {
+                    return !running(result);
+                });
+            if (result_.valid() && running(result_))
+            {
+                discarded_.push_back(std::move(result_));
+            }
+            result_ = {};
+        }
+
+        std::mutex mutex_;
+        std::string key_;
+        std::future<std::unique_ptr<T>> result_;
+        std::vector<std::future<std::unique_ptr<T>>> discarded_; // 破棄したが実行中の準備
+    };
+
+} // namespace MusicCom
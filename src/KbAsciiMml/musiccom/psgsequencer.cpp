@@ -20,15 +20,11 @@ namespace MusicCom
     };
     // clang-format on
 
-    PsgSequencer::PsgSequencer(FM::OPN& opn, SSGWrap& ssgwrap, const MusicData& music, int channel, int rate)
+    PsgSequencer::PsgSequencer(OPNWrap& opn, SSGWrap& ssgwrap, const MusicData& music, int channel, int rate)
         : PartSequencerBase(opn, music, music.GetChannelTail(channel), rate),
           channel_(channel - 3),
           ssgwrap_(ssgwrap),
-          ring_deterrence_(false),
-          GetSSGEnv([this](int no) -> const SSGEnv&
-                    { return GetMusicData().GetSSGEnv(no); }),
-          GetHeadImpl([this, channel]()
-                      { return GetMusicData().GetChannelHead(channel); })
+          ring_deterrence_(false)
     {
     }
 
@@ -56,6 +52,7 @@ namespace MusicCom
         case CommandType::TYPE_TONE:
             part_data.SoundNo = command.GetArg(0);
             part_data.SSGEnvOn = true;
+            PublishEvent(EventType::TONE, part_data.SoundNo);
             break;
         case CommandType::TYPE_ENV_FORM:
             part_data.SSGEnvOn = false;
@@ -109,7 +106,7 @@ namespace MusicCom
         int adjust_volume = volume;
         if (part_data.SSGEnvOn)
         {
-            auto env = GetSSGEnv(part_data.SoundNo);
+            const auto& env = GetMusicData().GetSSGEnv(part_data.SoundNo);
             size_t pos = length / env.Unit;
             if (pos >= env.Env.size())
             {
@@ -140,7 +137,8 @@ namespace MusicCom
 
     const CommandIterator PsgSequencer::GetHead() const
     {
-        return GetHeadImpl();
+        // channel_ は SSG のチャンネル (パート番号 - 3)
+        return GetMusicData().GetChannelHead(channel_ + 3);
     }
 
     int PsgSequencer::CalculateTone(int base_octave, int base_tone, int detune) const
@@ -2,35 +2,35 @@
 
 #include "partsequencerbase.h"
 #include "soundsequencer.h"
-#include <functional>
 
 namespace MusicCom
 {
+    class OPNWrap;
     class SSGWrap;
     class MusicData;
     struct SSGEnv;
-    class PsgSequencer : public PartSequencerBase
+    class PsgSequencer : public PartSequencerBase<PsgSequencer>
     {
+        friend class PartSequencerBase<PsgSequencer>;
+
     public:
-        PsgSequencer(FM::OPN& opn, SSGWrap& ssgwrap, const MusicData& music, int channel, int rate);
+        PsgSequencer(OPNWrap& opn, SSGWrap& ssgwrap, const MusicData& music, int channel, int rate);
         ~PsgSequencer();
 
         void UpdateDeterrence(SoundSequencer::PlayStatus status);
 
-    protected: // for PartSequencerBase
-        virtual CommandIterator ProcessCommandImpl(CommandIterator ptr, int current_frame, PartData& part_data);
-        virtual void ProcessEffect(int current_frame);
-
     private: // for PartSequencerBase
-        virtual void InitializeImpl(PartData& part_data);
-        virtual void KeyOn();
-        virtual void KeyOff();
-        virtual void UpdateTone(int base_tone, PartData& part_data);
-        virtual int AdjustVolume(int volume, int length, const PartData& part_data);
-        virtual void ApplyPortamentoEffect(int octave, int tone, int last_octave, int last_tone, double coefficient);
-        virtual void SetTone(int octave, int tone);
-        virtual void SetVolume(int volume);
-        virtual const CommandIterator GetHead() const;
+        CommandIterator ProcessCommandImpl(CommandIterator ptr, int current_frame, PartData& part_data);
+        void ProcessEffect(int current_frame);
+        void InitializeImpl(PartData& part_data);
+        void KeyOn();
+        void KeyOff();
+        void UpdateTone(int base_tone, PartData& part_data);
+        int AdjustVolume(int volume, int length, const PartData& part_data);
+        void ApplyPortamentoEffect(int octave, int tone, int last_octave, int last_tone, double coefficient);
+        void SetTone(int octave, int tone);
+        void SetVolume(int volume);
+        const CommandIterator GetHead() const;
 
     private:
         int CalculateTone(int base_octave, int base_tone, int detune) const;
@@ -38,8 +38,5 @@ namespace MusicCom
         int channel_;
         SSGWrap& ssgwrap_;
         bool ring_deterrence_;
-
-        std::function<const SSGEnv&(int)> GetSSGEnv;
-        std::function<CommandIterator()> GetHeadImpl;
     };
 } // namespace MusicCom
@@ -0,0 +1,229 @@
+﻿#include "regtrace.h"
+#include <algorithm>
+#include <format>
+#include <limits>
+
+namespace MusicCom
+{
+    namespace
+    {
+        const int PART_COUNT = 7;
+
+        const char* GetCommandName(CommandType command)
+        {
+            switch (command)
+            {
+            case CommandType::TYPE_NOTE:
+                return "note";
+            case CommandType::TYPE_REST:
+                return "rest";
+            case CommandType::TYPE_WAIT:
+                return "wait";
+            case CommandType::TYPE_TIE:
+                return "tie";
+            case CommandType::TYPE_LENGTH:
+                return "length";
+            case CommandType::TYPE_OCTAVE:
+            case CommandType::TYPE_OCTAVE_DOWN:
+            case CommandType::TYPE_OCTAVE_UP:
+                return "octave";
+            case CommandType::TYPE_TEMPO:
+                return "tempo";
+            case CommandType::TYPE_VOLUME:
+                return "volume";
+            case CommandType::TYPE_TONE:
+                return "tone";
+            case CommandType::TYPE_GATE_TIME:
+                return "gate time";
+            case CommandType::TYPE_DETUNE:
+                return "detune";
+            case CommandType::TYPE_PORTAMENTO:
+                return "portamento";
+            case CommandType::TYPE_TREMOLO:
+                return "tremolo";
+            case CommandType::TYPE_VIBRATO:
+                return "vibrato";
+            case CommandType::TYPE_ENV_FORM:
+                return "envelope form";
+            case CommandType::TYPE_ENV_PERIOD:
+                return "envelope period";
+            case CommandType::TYPE_DIRECT:
+                return "direct";
+            case CommandType::TYPE_PAUSE:
+                return "pause";
+            default:
+                return "unknown";
+            }
+        }
+    } // namespace
+
+    RegisterTrace::RegisterTrace()
+    {
+        register_counts_.fill(0);
+    }
+
+    void RegisterTrace::Record(uint64_t sample, const TraceContext& context, uint32_t addr, uint32_t data)
+    {
+        entries_.push_back({sample, context, static_cast<uint8_t>(addr), static_cast<uint8_t>(data)});
+
+        register_counts_[addr & 0xff]++;
+        frame_counts_[{context.Part, context.Frame}]++;
+        source_counts_[{context.Source, (context.Source == TraceSource::COMMAND) ? context.Command : CommandType::TYPE_UNKNOWN}]++;
+    }
+
+    const std::vector<RegisterTrace::Entry>& RegisterTrace::GetEntries() const
+    {
+        return entries_;
+    }
+
+    void RegisterTrace::WriteSummary(std::ostream& stream) const
+    {
+        stream << std::format("writes: {}\n", entries_.size());
+
+        // パートごと (コマンドフレームあたりの書き込み数)
+        stream << "parts:\n";
+        for (int part = -1; part < PART_COUNT; part++)
+        {
+            uint64_t writes = 0;
+            int frames = 0;
+            int max_writes = 0;
+            int max_frame = 0;
+            for (auto it = frame_counts_.lower_bound({part, std::numeric_limits<int>::min()}); it != frame_counts_.end() && it->first.first == part; ++it)
+            {
+                writes += it->second;
+                frames++;
+                if (it->second > max_writes)
+                {
+                    max_writes = it->second;
+                    max_frame = it->first.second;
+                }
+            }
+            if (writes == 0)
+            {
+                continue;
+            }
+            stream << std::format(
+                "  {:<5} writes={} frames={} avg/frame={:.2f} max/frame={} (frame {})\n",
+                GetPartName(part),
+                writes,
+                frames,
+                writes / static_cast<double>(frames),
+                max_writes,
+                max_frame);
+        }
+
+        stream << "sources:\n";
+        std::vector<std::pair<uint64_t, std::string>> sources;
+        for (const auto& [key, count] : source_counts_)
+        {
+            sources.emplace_back(count, GetSourceName(key.first, key.second));
+        }
+        std::sort(sources.rbegin(), sources.rend());
+        for (const auto& [count, name] : sources)
+        {
+            stream << std::format("  {:<24} {}\n", name, count);
+        }
+
+        stream << "registers:\n";
+        std::vector<std::pair<uint64_t, int>> registers;
+        for (int addr = 0; addr < 256; addr++)
+        {
+            if (register_counts_[addr] > 0)
+            {
+                registers.emplace_back(register_counts_[addr], addr);
+            }
+        }
+        std::sort(registers.rbegin(), registers.rend());
+        for (const auto& [count, addr] : registers)
+        {
+            stream << std::format("  [{:02X}] {}\n", addr, count);
+        }
+    }
+
+    void RegisterTrace::WriteChromeTrace(std::ostream& stream, int rate) const
+    {
+        auto timestamp = [rate](uint64_t sample)
+        {
+            return sample * 1.0e6 / rate;
+        };
+
+        stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+        // スレッド名 = パート名
+        for (int part = -1; part < PART_COUNT; part++)
+        {
+            stream << std::format(
+                "{{\"ph\":\"M\",\"pid\":1,\"tid\":{},\"name\":\"thread_name\",\"args\":{{\"name\":\"{}\"}}}},\n",
+                part + 1,
+                GetPartName(part));
+        }
+
+        // 書き込み1回ごとのインスタントイベントと、コマンドフレームごとの書き込み数のカウンタ
+        std::pair<int, int> last_frame(-2, 0);
+        for (const auto& entry : entries_)
+        {
+            const auto& context = entry.Context;
+            std::pair<int, int> frame(context.Part, context.Frame);
+            if (frame != last_frame && context.Part >= 0)
+            {
+                stream << std::format(
+                    "{{\"ph\":\"C\",\"pid\":1,\"ts\":{:.3f},\"name\":\"writes/frame {}\",\"args\":{{\"writes\":{}}}}},\n",
+                    timestamp(entry.Sample),
+                    GetPartName(context.Part),
+                    frame_counts_.at(frame));
+                last_frame = frame;
+            }
+
+            stream << std::format(
+                "{{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"name\":\"{}\",\"args\":{{\"reg\":\"{:02X}\",\"data\":\"{:02X}\",\"frame\":{}}}}},\n",
+                context.Part + 1,
+                timestamp(entry.Sample),
+                GetSourceName(context.Source, context.Command),
+                static_cast<unsigned int>(entry.Addr),
+                static_cast<unsigned int>(entry.Data),
+                context.Frame);
+        }
+
+        // 末尾のカンマ対策の終端イベント
+        stream << "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"OPN\"}}\n]}\n";
+    }
+
+    std::string RegisterTrace::GetPartName(int part)
+    {
+        if (part < 0)
+        {
+            return "init";
+        }
+        if (part < 3)
+        {
+            return std::format("FM{}", part + 1);
+        }
+        if (part < 6)
+        {
+            return std::format("SSG{}", part - 2);
+        }
+        return "D";
+    }
+
+    std::string RegisterTrace::GetSourceName(TraceSource source, CommandType command)
+    {
+        switch (source)
+        {
+        case TraceSource::INITIALIZE:
+            return "initialize";
+        case TraceSource::FRAME:
+            return "frame";
+        case TraceSource::PRE_PROCESS:
+            return "pre-process";
+        case TraceSource::COMMAND:
+            return std::format("{} ({})", GetCommandName(command), static_cast<char>(command));
+        case TraceSource::EFFECT:
+            return "effect";
+        case TraceSource::SOUND_EFFECT:
+            return "sound effect";
+        default:
+            return "unknown";
+        }
+    }
+
+} // namespace MusicCom
@@ -0,0 +1,77 @@
+﻿#pragma once
+
+#include "command.h"
+#include <array>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// レジスタ書き込みのトレース
+// MUSICCOM_ENABLE_TRACE を定義してビルドした場合のみ書き込み元の情報が記録される
+// (定義しない場合、シーケンサ側のトレース処理はコンパイル時に除去される)
+
+namespace MusicCom
+{
+    // 書き込みの発生元
+    enum class TraceSource : char
+    {
+        INITIALIZE,  // 初期化
+        FRAME,       // フレーム処理 (以下に分類されないもの)
+        PRE_PROCESS, // コマンド処理前 (キーオフなど)
+        COMMAND,     // コマンド
+        EFFECT,      // ビブラート・トレモロ・ポルタメント
+        SOUND_EFFECT // 効果音フレーム
+    };
+
+    struct TraceContext
+    {
+        TraceContext()
+            : Part(-1),
+              Frame(0),
+              Source(TraceSource::INITIALIZE),
+              Command(CommandType::TYPE_UNKNOWN)
+        {
+        }
+
+        int Part;            // 0-5: チャンネル, 6: D パート, -1: パート外
+        int Frame;           // パートのコマンドフレーム (初期化時は -1)
+        TraceSource Source;
+        CommandType Command; // Source == COMMAND の場合のみ有効
+    };
+
+    // トレースの記録と集計・出力
+    class RegisterTrace
+    {
+    public:
+        struct Entry
+        {
+            uint64_t Sample;
+            TraceContext Context;
+            uint8_t Addr;
+            uint8_t Data;
+        };
+
+        RegisterTrace();
+        void Record(uint64_t sample, const TraceContext& context, uint32_t addr, uint32_t data);
+        const std::vector<Entry>& GetEntries() const;
+
+        // パート・発生元・レジスタごとの書き込み数
+        void WriteSummary(std::ostream& stream) const;
+        // Chrome のトレース形式 (chrome://tracing, Perfetto で表示可能)
+        void WriteChromeTrace(std::ostream& stream, int rate) const;
+
+        static std::string GetPartName(int part);
+        static std::string GetSourceName(TraceSource source, CommandType command);
+
+    private:
+        std::vector<Entry> entries_;
+        std::array<uint64_t, 256> register_counts_;
+        // (パート, コマンドフレーム) ごとの書き込み数
+        std::map<std::pair<int, int>, int> frame_counts_;
+        std::map<std::pair<TraceSource, CommandType>, uint64_t> source_counts_;
+    };
+
+} // namespace MusicCom
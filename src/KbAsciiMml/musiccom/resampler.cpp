@@ -0,0 +1,207 @@
+﻿#include "resampler.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numbers>
+
+// x64 と SSE 有効の x86 では 4 サンプルずつ畳み込む
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1) || defined(__SSE__)
+#include <xmmintrin.h>
+#define MUSICCOM_RESAMPLER_SSE
+#endif
+
+namespace MusicCom
+{
+    namespace
+    {
+        // 通過帯域の上限 (ナイキスト周波数に対する比)
+        const double PASSBAND = 0.9;
+        // Kaiser 窓のパラメータ (阻止域減衰 約 80dB)
+        const double KAISER_BETA = 8.0;
+
+        // 第 1 種変形ベッセル関数 (0 次)
+        double BesselI0(double x)
+        {
+            double sum = 1.0;
+            double term = 1.0;
+            for (int k = 1; k < 32; k++)
+            {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+            }
+            return sum;
+        }
+
+        template<typename T>
+        T ToOutput(float value);
+
+        template<>
+        __int16 ToOutput<__int16>(float value)
+        {
+            float scaled = std::clamp(value * 32768.0f, -32768.0f, 32767.0f);
+#ifdef MUSICCOM_RESAMPLER_SSE
+            return static_cast<__int16>(_mm_cvtss_si32(_mm_set_ss(scaled)));
+#else
+            return static_cast<__int16>(std::lround(scaled));
+#endif
+        }
+
+        template<>
+        int32_t ToOutput<int32_t>(float value)
+        {
+            return static_cast<int32_t>(std::clamp(std::llround(value * 2147483648.0), -2147483648LL, 2147483647LL));
+        }
+
+        template<>
+        float ToOutput<float>(float value)
+        {
+            return value;
+        }
+    } // namespace
+
+    Resampler::Resampler(int input_rate, int output_rate, int channels, int taps)
+        : input_rate_(input_rate),
+          output_rate_(output_rate),
+          channels_((channels == 1) ? 1 : 2),
+          taps_(std::max(taps / 4, 1) * 4),
+          coefficients_((PHASES + 1) * taps_),
+          input_(),
+          position_(0),
+          remainder_(0)
+    {
+        // 縮小時は出力のナイキスト周波数で帯域を制限する
+        double cutoff = 0.5 * PASSBAND * std::min(1.0, static_cast<double>(output_rate) / input_rate);
+        double radius = taps_ / 2;
+        for (int phase = 0; phase <= PHASES; phase++)
+        {
+            float* coefficient = &coefficients_[phase * taps_];
+            double sum = 0.0;
+            for (int k = 0; k < taps_; k++)
+            {
+                // 出力位置から入力サンプルまでの距離
+                double distance = (k - taps_ / 2 + 1) - static_cast<double>(phase) / PHASES;
+                double x = 2.0 * cutoff * distance;
+                double sinc = (x == 0.0) ? 1.0 : std::sin(std::numbers::pi * x) / (std::numbers::pi * x);
+                double ratio = distance / radius;
+                double window = (std::abs(ratio) < 1.0) ? BesselI0(KAISER_BETA * std::sqrt(1.0 - ratio * ratio)) / BesselI0(KAISER_BETA) : 0.0;
+                coefficient[k] = static_cast<float>(sinc * window);
+                sum += coefficient[k];
+            }
+            // 直流の利得を 1 にそろえる
+            for (int k = 0; k < taps_; k++)
+            {
+                coefficient[k] = static_cast<float>(coefficient[k] / sum);
+            }
+        }
+
+        Reset();
+    }
+
+    void Resampler::Reset()
+    {
+        // 先頭の出力の前半分は無音とする
+        input_.assign(taps_ / 2 - 1, 0.0f);
+        position_ = taps_ / 2 - 1;
+        remainder_ = 0;
+    }
+
+    int Resampler::GetRequiredInput(int nsamples) const
+    {
+        if (nsamples <= 0)
+        {
+            return 0;
+        }
+        // 最後の出力の位置から後ろ半分のタップまで必要
+        int64_t last = position_ + (remainder_ + static_cast<int64_t>(nsamples - 1) * input_rate_) / output_rate_;
+        int64_t required = last + taps_ / 2 + 1 - static_cast<int64_t>(input_.size());
+        return static_cast<int>(std::max<int64_t>(required, 0));
+    }
+
+    float* Resampler::PrepareInput(int size)
+    {
+        auto offset = input_.size();
+        input_.resize(offset + size);
+        return input_.data() + offset;
+    }
+
+    template<typename T>
+    void Resampler::Process(T* dest, int nsamples)
+    {
+        if (channels_ == 1)
+        {
+            ProcessImpl<T, 1>(dest, nsamples);
+        }
+        else
+        {
+            ProcessImpl<T, 2>(dest, nsamples);
+        }
+    }
+
+    template<typename T, int Channels>
+    void Resampler::ProcessImpl(T* dest, int nsamples)
+    {
+        assert(GetRequiredInput(nsamples) == 0);
+
+        const double phase_scale = static_cast<double>(PHASES) / output_rate_;
+        for (int i = 0; i < nsamples; i++)
+        {
+            // 位相と、隣の位相との間の端数
+            double scaled = remainder_ * phase_scale;
+            int phase = static_cast<int>(scaled);
+            float fraction = static_cast<float>(scaled - phase);
+
+            T value = ToOutput<T>(Convolve(&input_[position_ - taps_ / 2 + 1], phase, fraction));
+            for (int c = 0; c < Channels; c++)
+            {
+                *dest++ = value;
+            }
+
+            remainder_ += input_rate_;
+            while (remainder_ >= output_rate_)
+            {
+                remainder_ -= output_rate_;
+                position_++;
+            }
+        }
+
+        // 次の出力に必要な履歴だけを残す
+        auto consumed = static_cast<size_t>(std::min<int64_t>(position_ - (taps_ / 2 - 1), input_.size()));
+        input_.erase(input_.begin(), input_.begin() + consumed);
+        position_ -= consumed;
+    }
+
+    float Resampler::Convolve(const float* input, int phase, float fraction) const
+    {
+        const float* c0 = &coefficients_[phase * taps_];
+        const float* c1 = c0 + taps_;
+#ifdef MUSICCOM_RESAMPLER_SSE
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        for (int k = 0; k < taps_; k += 4)
+        {
+            __m128 x = _mm_loadu_ps(input + k);
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(x, _mm_loadu_ps(c0 + k)));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(x, _mm_loadu_ps(c1 + k)));
+        }
+        // 2 つの位相の結果の間を補間してから、4 要素を足し合わせる
+        __m128 sum = _mm_add_ps(sum0, _mm_mul_ps(_mm_sub_ps(sum1, sum0), _mm_set1_ps(fraction)));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+        return _mm_cvtss_f32(sum);
+#else
+        float sum0 = 0.0f;
+        float sum1 = 0.0f;
+        for (int k = 0; k < taps_; k++)
+        {
+            sum0 += input[k] * c0[k];
+            sum1 += input[k] * c1[k];
+        }
+        return sum0 + (sum1 - sum0) * fraction;
+#endif
+    }
+
+    template void Resampler::Process<__int16>(__int16* dest, int nsamples);
+    template void Resampler::Process<int32_t>(int32_t* dest, int nsamples);
+    template void Resampler::Process<float>(float* dest, int nsamples);
+
+} // namespace MusicCom
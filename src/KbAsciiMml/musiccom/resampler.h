@@ -0,0 +1,51 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace MusicCom
+{
+    // ポリフェーズ FIR (Kaiser 窓付き sinc) によるサンプリングレート変換
+    // 入力はモノラルの float (±1.0 に正規化した値) で、出力の形式・チャンネル数に合わせて書き込む
+    // 出力 1 サンプルごとに隣接する 2 つの位相の係数で畳み込み、その間を線形補間する
+    class Resampler
+    {
+    public:
+        static const int DEFAULT_TAPS = 48;
+
+        // channels: 出力のチャンネル数 (1:モノラル 2:ステレオ)
+        // taps: 1 位相あたりのタップ数 (4 の倍数、少ないほど速いが帯域の制限が甘くなる)
+        Resampler(int input_rate, int output_rate, int channels, int taps = DEFAULT_TAPS);
+        // 入力の履歴を破棄する (演奏位置を変えたとき)
+        void Reset();
+
+        // 出力 nsamples 分に不足している入力サンプル数
+        int GetRequiredInput(int nsamples) const;
+        // 入力 size サンプルを書き込む領域を返す (書き込んでから Process を呼ぶこと)
+        float* PrepareInput(int size);
+        // T: 出力サンプルの型 (__int16, int32_t, float)
+        template<typename T>
+        void Process(T* dest, int nsamples);
+
+    private:
+        static const int PHASES = 128; // 入力サンプル間の位相の分割数
+
+        template<typename T, int Channels>
+        void ProcessImpl(T* dest, int nsamples);
+        float Convolve(const float* input, int phase, float fraction) const;
+
+        const int input_rate_;
+        const int output_rate_;
+        const int channels_;
+        const int taps_;
+        // 位相ごとの係数 ((PHASES + 1) * taps_)
+        std::vector<float> coefficients_;
+
+        // 入力の履歴と未処理の入力
+        std::vector<float> input_;
+        // 次の出力の位置 (input_ の添字と、output_rate_ 分の 1 単位の端数)
+        int64_t position_;
+        int64_t remainder_;
+    };
+
+} // namespace MusicCom
@@ -0,0 +1,318 @@
+﻿#include "s98.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace MusicCom
+{
+    namespace
+    {
+        const unsigned int OPN_CLOCKFREQ = 3993600; // OPNのクロック周波数
+
+        // ヘッダ (リトルエンディアン)
+        //   0x00 "S98" + バージョン('3')
+        //   0x04 同期単位の分子, 0x08 分母 (秒)
+        //   0x0C 圧縮 (0), 0x10 タグ位置, 0x14 データ位置, 0x18 ループ位置
+        //   0x1C デバイス数, 0x20 以降デバイス情報 (種類, クロック, パン, 予約) * デバイス数
+        const size_t HEADER_SIZE = 0x20;
+        const size_t DEVICE_INFO_SIZE = 0x10;
+        const uint32_t DEVICE_OPN = 2;
+
+        // データ
+        const uint8_t COMMAND_SYNC = 0xff;   // 1同期待ち
+        const uint8_t COMMAND_NSYNC = 0xfe;  // n同期待ち (n-2 を可変長で格納)
+        const uint8_t COMMAND_END = 0xfd;    // 終端 (ループ位置があればそこへ)
+
+        void PutUInt32(std::vector<uint8_t>& buffer, uint32_t value)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                buffer.push_back(static_cast<uint8_t>(value >> (i * 8)));
+            }
+        }
+
+        uint32_t GetUInt32(const std::vector<uint8_t>& buffer, size_t offset)
+        {
+            uint32_t value = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                value |= static_cast<uint32_t>(buffer[offset + i]) << (i * 8);
+            }
+            return value;
+        }
+    } // namespace
+
+    S98Writer::S98Writer(uint rate)
+        : rate_(rate),
+          position_(0),
+          finished_(false)
+    {
+    }
+
+    void S98Writer::Write(uint64_t sample, uint addr, uint data)
+    {
+        if (finished_)
+        {
+            return;
+        }
+
+        AppendWait(sample - position_);
+        position_ = sample;
+
+        dump_.push_back(0x00); // デバイス0
+        dump_.push_back(static_cast<uint8_t>(addr));
+        dump_.push_back(static_cast<uint8_t>(data));
+    }
+
+    void S98Writer::Finish(uint64_t end_sample)
+    {
+        if (finished_)
+        {
+            return;
+        }
+
+        if (end_sample > position_)
+        {
+            AppendWait(end_sample - position_);
+            position_ = end_sample;
+        }
+        dump_.push_back(COMMAND_END);
+        finished_ = true;
+    }
+
+    void S98Writer::Save(std::ostream& stream) const
+    {
+        std::vector<uint8_t> header{'S', '9', '8', '3'};
+        PutUInt32(header, 1);     // 1同期 = 1/rate 秒
+        PutUInt32(header, rate_);
+        PutUInt32(header, 0);     // 圧縮なし
+        PutUInt32(header, 0);     // タグなし
+        PutUInt32(header, static_cast<uint32_t>(HEADER_SIZE + DEVICE_INFO_SIZE));
+        PutUInt32(header, 0);     // ループなし
+        PutUInt32(header, 1);     // デバイス数
+        PutUInt32(header, DEVICE_OPN);
+        PutUInt32(header, OPN_CLOCKFREQ);
+        PutUInt32(header, 0);
+        PutUInt32(header, 0);
+
+        stream.write(reinterpret_cast<const char*>(header.data()), header.size());
+        stream.write(reinterpret_cast<const char*>(dump_.data()), dump_.size());
+        if (!finished_)
+        {
+            stream.put(static_cast<char>(COMMAND_END));
+        }
+    }
+
+    void S98Writer::AppendWait(uint64_t syncs)
+    {
+        if (syncs == 0)
+        {
+            return;
+        }
+        if (syncs == 1)
+        {
+            dump_.push_back(COMMAND_SYNC);
+            return;
+        }
+
+        // 7ビットずつ下位から、継続する場合は最上位ビットを立てる
+        dump_.push_back(COMMAND_NSYNC);
+        uint64_t value = syncs - 2;
+        while (value >= 0x80)
+        {
+            dump_.push_back(static_cast<uint8_t>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        dump_.push_back(static_cast<uint8_t>(value));
+    }
+
+    S98Player::S98Player()
+        : clock(OPN_CLOCKFREQ),
+          timerNumerator(10),
+          timerDenominator(1000),
+          dumpOffset(0),
+          loopOffset(0),
+          rate(0),
+          position(0),
+          samplesToNext(0),
+          waitRemainder(0),
+          finished(true),
+          waitedSinceLoop(false),
+          fmVolume(0),
+          psgVolume(0)
+    {
+    }
+
+    bool S98Player::Load(const char* filename)
+    {
+        std::ifstream stream(filename, std::ios::binary);
+        if (!stream)
+        {
+            return false;
+        }
+        data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+
+        if (data.size() < HEADER_SIZE || data[0] != 'S' || data[1] != '9' || data[2] != '8' || data[3] != '3')
+        {
+            return false;
+        }
+
+        // 0 の場合は既定値 (10/1000 秒)
+        timerNumerator = GetUInt32(data, 0x04);
+        timerDenominator = GetUInt32(data, 0x08);
+        if (timerNumerator == 0)
+        {
+            timerNumerator = 10;
+        }
+        if (timerDenominator == 0)
+        {
+            timerDenominator = 1000;
+        }
+        if (GetUInt32(data, 0x0c) != 0)
+        {
+            return false;
+        }
+        dumpOffset = GetUInt32(data, 0x14);
+        loopOffset = GetUInt32(data, 0x18);
+
+        // デバイス数 0 は OPNA 1つを意味するため非対応
+        if (GetUInt32(data, 0x1c) != 1 || data.size() < HEADER_SIZE + DEVICE_INFO_SIZE)
+        {
+            return false;
+        }
+        if (GetUInt32(data, HEADER_SIZE) != DEVICE_OPN)
+        {
+            return false;
+        }
+        clock = GetUInt32(data, HEADER_SIZE + 0x04);
+
+        return dumpOffset < data.size() && loopOffset < data.size();
+    }
+
+    bool S98Player::PrepareMix(uint r)
+    {
+        if (!opn.Init(clock, r))
+        {
+            return false;
+        }
+        opn.SetVolumeFM(fmVolume);
+        opn.SetVolumePSG(psgVolume);
+
+        rate = r;
+        position = dumpOffset;
+        samplesToNext = 0;
+        waitRemainder = 0;
+        finished = false;
+        waitedSinceLoop = false;
+        return true;
+    }
+
+    void S98Player::Mix(FM_SAMPLETYPE* dest, int nsamples)
+    {
+        memset(dest, 0, nsamples * sizeof(FM_SAMPLETYPE) * 2);
+        while (nsamples > 0)
+        {
+            // 次の待ちまでのコマンドを処理
+            while (samplesToNext == 0 && !finished)
+            {
+                ProcessCommand();
+            }
+
+            // 終端後は書き込みなしで鳴らし続ける
+            auto frame_size = finished ? nsamples : std::min(nsamples, samplesToNext);
+            opn.Mix(dest, frame_size);
+
+            dest += frame_size * 2;
+            nsamples -= frame_size;
+            if (!finished)
+            {
+                samplesToNext -= frame_size;
+            }
+        }
+    }
+
+    void S98Player::SetFMVolume(int vol)
+    {
+        fmVolume = std::min(std::max(vol, -192), 20);
+    }
+
+    void S98Player::SetPSGVolume(int vol)
+    {
+        psgVolume = std::min(std::max(vol, -192), 20);
+    }
+
+    bool S98Player::IsFinished() const
+    {
+        return finished;
+    }
+
+    void S98Player::ProcessCommand()
+    {
+        if (position >= data.size())
+        {
+            finished = true;
+            return;
+        }
+
+        auto command = data[position++];
+        switch (command)
+        {
+        case COMMAND_SYNC:
+            Wait(1);
+            break;
+        case COMMAND_NSYNC:
+        {
+            uint64_t value = 0;
+            int shift = 0;
+            while (position < data.size())
+            {
+                auto byte = data[position++];
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                shift += 7;
+                if ((byte & 0x80) == 0 || shift >= 64)
+                {
+                    break;
+                }
+            }
+            Wait(value + 2);
+            break;
+        }
+        case COMMAND_END:
+            // ループ区間に待ちがない場合は無限ループになるため終了扱い
+            if (loopOffset != 0 && waitedSinceLoop)
+            {
+                position = loopOffset;
+                waitedSinceLoop = false;
+            }
+            else
+            {
+                finished = true;
+            }
+            break;
+        default:
+            // デバイス0以外 (デバイス0の拡張ポートを含む) は読み飛ばす
+            if (position + 2 > data.size())
+            {
+                finished = true;
+                break;
+            }
+            if (command == 0x00)
+            {
+                opn.SetReg(data[position], data[position + 1]);
+            }
+            position += 2;
+            break;
+        }
+    }
+
+    void S98Player::Wait(uint64_t syncs)
+    {
+        // 同期単位 -> 出力サンプル数 (端数は次回に繰り越す)
+        waitRemainder += syncs * timerNumerator * rate;
+        samplesToNext = static_cast<int>(waitRemainder / timerDenominator);
+        waitRemainder %= timerDenominator;
+        waitedSinceLoop = true;
+    }
+
+} // namespace MusicCom
@@ -0,0 +1,75 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <fmgen/opna.h>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// S98 (version 3) 形式のレジスタログ
+// 同期単位を1出力サンプルとし、シーケンサの書き込みをサンプル単位の位置で記録する
+
+namespace MusicCom
+{
+    // シーケンサのレジスタ書き込みを S98 形式に変換する
+    // MusicCom::SetRegisterWriteObserver で Write を呼び出すよう設定して使用する
+    class S98Writer
+    {
+    public:
+        S98Writer(uint rate);
+        void Write(uint64_t sample, uint addr, uint data);
+        // end_sample までの待ちを追加して終端する
+        void Finish(uint64_t end_sample);
+        void Save(std::ostream& stream) const;
+
+    private:
+        void AppendWait(uint64_t syncs);
+
+        uint rate_;
+        uint64_t position_;
+        bool finished_;
+        std::vector<uint8_t> dump_;
+    };
+
+    // S98 形式のレジスタログを FM::OPN で直接再生する (パース・シーケンス処理なし)
+    // デバイスが OPN (YM2203) 1つのログのみ対応
+    class S98Player
+    {
+    public:
+        S98Player();
+        bool Load(const char* filename);
+        bool PrepareMix(uint rate);
+        void Mix(FM_SAMPLETYPE* dest, int nsamples);
+        void SetFMVolume(int vol);
+        void SetPSGVolume(int vol);
+        // ループなしのログを最後まで再生した
+        bool IsFinished() const;
+
+    protected:
+        // non-copyable
+        S98Player(const S98Player&) = delete;
+        S98Player& operator=(const S98Player&) = delete;
+
+    private:
+        void ProcessCommand();
+        void Wait(uint64_t syncs);
+
+        FM::OPN opn;
+        std::vector<uint8_t> data;
+        uint clock;
+        uint timerNumerator;
+        uint timerDenominator;
+        size_t dumpOffset;
+        size_t loopOffset; // 0: ループなし
+
+        uint rate;
+        size_t position;
+        int samplesToNext;
+        uint64_t waitRemainder;
+        bool finished;
+        bool waitedSinceLoop;
+        int fmVolume;
+        int psgVolume;
+    };
+
+} // namespace MusicCom
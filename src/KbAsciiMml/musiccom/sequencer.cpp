@@ -1,13 +1,13 @@
 ﻿#include "sequencer.h"
-#include "fmsequencer.h"
+#include "loopcache.h"
+#include "mixstatistics.h"
 #include "musdata.h"
-#include "partsequencerbase.h"
-#include "psgsequencer.h"
 #include "sounddata.h"
-#include "soundsequencer.h"
+#include "statehash.h"
 #include <algorithm>
+#include <cassert>
+#include <climits>
 #include <fmgen/opna.h>
-#include <numeric>
 
 // KeyOff したあと、音量レベルが低下するまでMixしてからOnしないとタイになってしまう
 // fmgen の問題？
@@ -20,113 +20,636 @@ namespace MusicCom
 
     Sequencer::Sequencer(FM::OPN& o, MusicData* pmd, SoundData* psd, int stempo)
         : opn(o),
-          fmwrap(o),
-          ssgwrap(o),
-          musicdata(*pmd),
+          opnwrap(o),
+          fmwrap(opnwrap),
+          ssgwrap(opnwrap),
+          musicdata(pmd),
           sounddata(*psd),
-          soundtempo(stempo)
+          pendingMusicData(nullptr),
+          soundtempo(stempo),
+          mixed_samples(0),
+          output_channels(2),
+          statistics(nullptr),
+          loopcache(),
+          loopCacheFrameBytes(0),
+          psgCounterUsage(0),
+          liveParameters(nullptr),
+          appliedParametersVersion(0),
+          appliedParameters(),
+          eventQueue(nullptr),
+          mutedParts(0),
+          channelMask(0),
+          chipRate(0),
+          chipInterpolation(false),
+          initialState(),
+          fmSequencer(),
+          psgSequencer(),
+          soundSequencer()
     {
     }
 
-    bool Sequencer::Init(int rate)
+    Sequencer::~Sequencer() = default;
+
+    template<typename Func>
+    void Sequencer::ForEachPart(Func&& func)
+    {
+        ForEachPartImpl(*this, func);
+    }
+
+    template<typename Func>
+    void Sequencer::ForEachPart(Func&& func) const
+    {
+        ForEachPartImpl(*this, func);
+    }
+
+    template<typename Self, typename Func>
+    void Sequencer::ForEachPartImpl(Self& self, Func&& func)
+    {
+        // パートの種類ごとに型が決まるため、仮想関数を介さずに呼び出せる
+        for (int ch = 0; ch < 3; ch++)
+        {
+            if (self.fmSequencer[ch])
+            {
+                func(ch, *self.fmSequencer[ch]);
+            }
+        }
+        for (int ch = 0; ch < 3; ch++)
+        {
+            if (self.psgSequencer[ch])
+            {
+                func(3 + ch, *self.psgSequencer[ch]);
+            }
+        }
+        if (self.soundSequencer)
+        {
+            func(6, *self.soundSequencer);
+        }
+    }
+
+    void Sequencer::SetRegisterWriteObserver(RegisterWriteObserver observer)
+    {
+        if (!observer)
+        {
+            opnwrap.SetWriteObserver(nullptr);
+            return;
+        }
+
+        // 書き込み時点の出力サンプル位置を付加して通知
+        opnwrap.SetWriteObserver(
+            [this, observer](uint addr, uint data)
+            {
+                observer(mixed_samples, addr, data);
+            });
+    }
+
+    void Sequencer::SetStatistics(MixStatistics* stats)
+    {
+        statistics = stats;
+    }
+
+    void Sequencer::SetLiveParameters(const LiveParameters* params)
+    {
+        liveParameters = params;
+        appliedParameters.reset();
+    }
+
+    void Sequencer::SetEventQueue(EventQueue* queue)
+    {
+        eventQueue = queue;
+        ForEachPart(
+            [this, queue](int part, auto& sequencer)
+            {
+                sequencer.SetEventQueue(queue, part, &mixed_samples);
+            });
+    }
+
+    void Sequencer::EnableLoopCache(size_t budget)
+    {
+        if (budget == 0)
+        {
+            loopcache.reset();
+            return;
+        }
+        loopcache = std::make_unique<LoopCache>(budget);
+        psgCounterUsage = 0;
+    }
+
+    bool Sequencer::IsReplayingLoopCache() const
+    {
+        return loopcache && loopcache->IsReplaying();
+    }
+
+#ifdef MUSICCOM_ENABLE_TRACE
+    void Sequencer::SetRegisterTrace(RegisterTrace* trace)
+    {
+        if (!trace)
+        {
+            opnwrap.SetTraceObserver(nullptr);
+            return;
+        }
+
+        opnwrap.SetTraceObserver(
+            [this, trace](const TraceContext& context, uint addr, uint data)
+            {
+                trace->Record(mixed_samples, context, addr, data);
+            });
+    }
+#endif
+
+    int Sequencer::GetNativeRate()
+    {
+        return OPN_CLOCKFREQ / 72;
+    }
+
+    bool Sequencer::Init(int rate, int channels, const ChipQuality& quality)
     {
-        if (!opn.Init(OPN_CLOCKFREQ, rate))
+        // 本来のレートで合成する場合は補間の必要がない
+        chipRate = rate;
+        chipInterpolation = quality.Interpolation && rate != GetNativeRate();
+        if (!opn.Init(OPN_CLOCKFREQ, chipRate, chipInterpolation))
         {
             return false;
         }
+        opn.SetPSGOversampling(quality.PSGOversampling);
+        opn.SetEGShift(quality.EGShift);
+        output_channels = (channels == 1) ? 1 : 2;
+        channelMask = 0;
 
         InitializeSequencer(rate);
 
         // 効果音モード on
-        opn.SetReg(0x27, 0x40);
+        opnwrap.SetReg(0x27, 0x40);
 
+        initialState = SaveState();
+        return true;
+    }
+
+    bool Sequencer::Restart()
+    {
+        if (!initialState || pendingMusicData)
+        {
+            return false;
+        }
+
+        // 同じレートのためテーブルは作り直されず、補間の位置などだけが初期化される
+        opn.SetRate(OPN_CLOCKFREQ, chipRate, chipInterpolation);
+        opn.SetChannelMask(0);
+        channelMask = 0;
+        // 音源をリセットして Init の直後のレジスタを書き直し、各パートを最初の状態に戻す
+        RestoreState(*initialState);
+        mixed_samples = 0;
+        // 音量などは最初のフレームで反映し直す
+        appliedParameters.reset();
         return true;
     }
 
     void Sequencer::InitializeSequencer(int rate)
     {
-        std::vector<PsgSequencer*> observer_list;
         for (int ch = 0; ch < 6; ch++)
         {
-            if (musicdata.IsChannelPresent(ch))
+            if (musicdata->IsChannelPresent(ch))
             {
-                std::unique_ptr<PartSequencerBase> ptr;
                 if (ch < 3)
                 {
-                    ptr = std::make_unique<FmSequencer>(opn, fmwrap, musicdata, ch, rate);
+                    fmSequencer[ch].emplace(opnwrap, fmwrap, *musicdata, ch, rate);
                 }
                 else
                 {
-                    auto psg = std::make_unique<PsgSequencer>(opn, ssgwrap, musicdata, ch, rate);
-                    // チャンネル4,5(プログラム上は3,4)は効果音再生状態通知を受け取る
-                    // D:パートの初期化時に設定するためここではポインタのみ保持
-                    if (ch == 3 || ch == 4)
-                    {
-                        observer_list.push_back(psg.get());
-                    }
-                    ptr = std::move(psg);
+                    psgSequencer[ch - 3].emplace(opnwrap, ssgwrap, *musicdata, ch, rate);
                 }
-                ptr->Initialize();
-                partSequencer.emplace_back(std::move(ptr));
             }
         }
-        if (musicdata.IsRhythmPartPresent())
+        if (musicdata->IsRhythmPartPresent())
         {
-            auto ptr = std::make_unique<SoundSequencer>(opn, ssgwrap, musicdata, sounddata, soundtempo, rate);
-            ptr->Initialize();
+            soundSequencer.emplace(opnwrap, ssgwrap, *musicdata, sounddata, soundtempo, rate);
             // 効果音再生状態通知(効果音フレームの更新およびチャンネル4,5の抑止のため)
-            for (auto item : observer_list)
+            // チャンネル4,5(プログラム上は3,4)は効果音再生状態通知を受け取る
+            for (int ch = 3; ch < 5; ch++)
+            {
+                if (auto& psg = psgSequencer[ch - 3])
+                {
+                    soundSequencer->AppendPlayStatusObserver(
+                        [item = &*psg](SoundSequencer::PlayStatus status)
+                        {
+                            item->UpdateDeterrence(status);
+                        });
+                }
+            }
+        }
+
+        ForEachPart(
+            [this](int part, auto& sequencer)
+            {
+#ifdef MUSICCOM_ENABLE_TRACE
+                sequencer.SetTracePart(part);
+#endif
+                sequencer.SetEventQueue(eventQueue, part, &mixed_samples);
+                MUSICCOM_TRACE_SCOPE(opnwrap, part, -1);
+                sequencer.Initialize();
+            });
+    }
+
+    void Sequencer::ApplyLiveParameters()
+    {
+        // 変更がなければ版数の比較だけで済ませる
+        if (!liveParameters)
+        {
+            return;
+        }
+        auto version = liveParameters->GetVersion();
+        if (appliedParameters && version == appliedParametersVersion)
+        {
+            return;
+        }
+        appliedParametersVersion = version;
+        auto values = liveParameters->GetValues();
+
+        bool fm_changed = !appliedParameters || values.FMVolume != appliedParameters->FMVolume;
+        bool psg_changed = !appliedParameters || values.PSGVolume != appliedParameters->PSGVolume;
+        bool tempo_changed = !appliedParameters || values.SoundTempo != appliedParameters->SoundTempo;
+        // ソロのパートがあれば、それ以外のパートもミュートする
+        uint32_t muted = values.MuteParts;
+        if (values.SoloParts != 0)
+        {
+            muted |= ~values.SoloParts & ((1u << LiveParameters::PART_COUNT) - 1);
+        }
+        bool mute_changed = muted != mutedParts;
+        appliedParameters = values;
+        if (!fm_changed && !psg_changed && !tempo_changed && !mute_changed)
+        {
+            return;
+        }
+
+        // 記録済みの出力とは音量やテンポ・ミュートが異なる
+        StopLoopCacheReplay();
+
+        if (fm_changed)
+        {
+            opn.SetVolumeFM(values.FMVolume);
+        }
+        if (psg_changed)
+        {
+            opn.SetVolumePSG(values.PSGVolume);
+        }
+        if (tempo_changed)
+        {
+            soundtempo = values.SoundTempo;
+            if (soundSequencer)
+            {
+                soundSequencer->SetSoundTempo(soundtempo);
+            }
+        }
+        mutedParts = muted;
+    }
+
+    void Sequencer::UpdateChannelMask()
+    {
+        if (mutedParts == 0 && channelMask == 0)
+        {
+            return;
+        }
+
+        // FM はパート 0-2 がチャンネル 0-2 (ビット 0-2)、SSG はパート 3-5 が音源の A-C (ビット 6-8)
+        // 効果音の再生中は SSG の A,B を D パートが使い、チャンネル4,5は抑止されている
+        uint mask = mutedParts & 7;
+        bool sound_playing = IsSoundEffectPlaying();
+        for (int voice = 0; voice < 3; voice++)
+        {
+            int part = (sound_playing && voice < 2) ? 6 : 3 + voice;
+            if (mutedParts & (1u << part))
+            {
+                mask |= 1u << (6 + voice);
+            }
+        }
+        if (mask != channelMask)
+        {
+            opn.SetChannelMask(mask);
+            channelMask = mask;
+        }
+    }
+
+    void Sequencer::AdvanceWithoutSynthesis(uint64_t samples)
+    {
+        // 音源のエンベロープの途中経過は再現されず、発音中の音はレジスタの値から鳴り直す
+        while (samples > 0)
+        {
+            auto frame_size = GetFrameSize(static_cast<int>(std::min<uint64_t>(samples, INT_MAX)));
+            ForEachPart(
+                [frame_size](int, auto& sequencer)
+                {
+                    sequencer.IncreaseFrame(frame_size);
+                });
+            SynchronizeParts(frame_size);
+            samples -= frame_size;
+        }
+    }
+
+    void Sequencer::StopLoopCacheReplay()
+    {
+        if (!loopcache)
+        {
+            return;
+        }
+        uint64_t replayed = loopcache->IsReplaying() ? loopcache->GetReplayPosition() / loopCacheFrameBytes : 0;
+        ResetLoopCache();
+        AdvanceWithoutSynthesis(replayed);
+    }
+
+    void Sequencer::ResetLoopCache()
+    {
+        if (loopcache)
+        {
+            loopcache->Reset();
+        }
+        psgCounterUsage = 0;
+    }
+
+    void Sequencer::ScheduleMusicData(MusicData* pmd, CommandIndexMapper map)
+    {
+        // キャッシュから再生している間は同期点に達しないため、合成に戻しておく
+        // 差し替え前のデータのまま進めるよう、予約より先に行う
+        StopLoopCacheReplay();
+        pendingMusicData = pmd;
+        pendingMapper = map;
+    }
+
+    bool Sequencer::IsMusicDataPending() const
+    {
+        return pendingMusicData != nullptr;
+    }
+
+    void Sequencer::SwapMusicData()
+    {
+        ForEachPart(
+            [this](int part, auto& sequencer)
             {
-                ptr->AppendPlayStatusObserver(
-                    [item](SoundSequencer::PlayStatus status)
+                auto tail = (part < 6) ? pendingMusicData->GetChannelTail(part) : pendingMusicData->GetRhythmPartTail();
+                sequencer.SwapMusicData(
+                    *pendingMusicData,
+                    part,
+                    tail,
+                    [this, part](int index)
                     {
-                        item->UpdateDeterrence(status);
+                        return pendingMapper(part, index);
                     });
+            });
+        musicdata = pendingMusicData;
+        pendingMusicData = nullptr;
+        pendingMapper = nullptr;
+        // 最初の状態は変更前のデータを指しているため、Restart できない
+        initialState.reset();
+
+        // コマンドの位置が変わるため、記録済みの同期点は使えない
+        ResetLoopCache();
+    }
+
+    Sequencer::State Sequencer::SaveState() const
+    {
+        State state{opnwrap.GetState(), fmwrap.GetState(), ssgwrap.GetState(), {}};
+        ForEachPart(
+            [&state](int, const auto& sequencer)
+            {
+                state.Parts.push_back(sequencer.SaveState());
+            });
+        return state;
+    }
+
+    void Sequencer::RestoreState(const State& state)
+    {
+        assert(!pendingMusicData);
+
+        // 記録済みの出力とはつながらなくなる
+        ResetLoopCache();
+
+        opnwrap.RestoreState(state.OPN);
+        fmwrap.RestoreState(state.FM);
+        ssgwrap.RestoreState(state.SSG);
+        size_t index = 0;
+        ForEachPart(
+            [&state, &index](int, auto& sequencer)
+            {
+                sequencer.RestoreState(state.Parts[index++]);
+            });
+        assert(index == state.Parts.size());
+    }
+
+    bool Sequencer::SkipToSync(uint64_t max_samples, std::vector<std::pair<int, CommandIterator>>& paused)
+    {
+        paused.clear();
+        uint64_t skipped = 0;
+        while (skipped < max_samples)
+        {
+            auto frame_size = GetFrameSize(static_cast<int>(std::min<uint64_t>(max_samples - skipped, INT_MAX)));
+            skipped += frame_size;
+            mixed_samples += frame_size;
+
+            ForEachPart(
+                [frame_size](int, auto& sequencer)
+                {
+                    sequencer.IncreaseFrame(frame_size);
+                });
+
+            // 再開すると位置が進むため、先に一時停止位置を取得しておく
+            paused.clear();
+            ForEachPart(
+                [&paused](int part, const auto& sequencer)
+                {
+                    paused.emplace_back(part, sequencer.GetCommandPtr());
+                });
+            if (SynchronizeParts(frame_size))
+            {
+                return true;
             }
-            partSequencer.emplace_back(std::move(ptr));
         }
+        paused.clear();
+        return false;
     }
 
-    void Sequencer::Mix(__int16* dest, int nsamples)
+    int Sequencer::StepFrame(int max_samples, const std::function<void(int)>& synthesize, std::optional<uint64_t>& sync_hash)
     {
-        memset(dest, 0, nsamples * sizeof(__int16) * 2);
+        auto frame_size = GetFrameSize(max_samples);
+        synthesize(frame_size);
+        mixed_samples += frame_size;
+
+        ForEachPart(
+            [frame_size](int, auto& sequencer)
+            {
+                sequencer.IncreaseFrame(frame_size);
+            });
+        sync_hash.reset();
+        StateHash hash;
+        if (SynchronizeParts(frame_size) && HashState(hash))
+        {
+            sync_hash = hash.Get();
+        }
+        return frame_size;
+    }
+
+    uint64_t Sequencer::GetMixedSamples() const
+    {
+        return mixed_samples;
+    }
+
+    bool Sequencer::IsSoundEffectPlaying() const
+    {
+        return soundSequencer && soundSequencer->IsSoundEffectPlaying();
+    }
+
+    int Sequencer::GetFrameSize(int nsamples) const
+    {
+        // 各パートから次フレームまでの残時間が最小のものを抽出
+        int frame_size = nsamples;
+        ForEachPart(
+            [&frame_size](int, const auto& sequencer)
+            {
+                frame_size = std::min(frame_size, sequencer.GetRemainFrameSize());
+            });
+        return frame_size;
+    }
+
+    bool Sequencer::SynchronizeParts(int frame_size)
+    {
+        // 全パートが一時停止していた場合、再開させる
+        bool playing = false;
+        ForEachPart(
+            [&playing](int, const auto& sequencer)
+            {
+                playing = playing || sequencer.IsPlaying();
+            });
+        if (playing)
+        {
+            return false;
+        }
+
+        // 差し替え待ちのデータがあれば、ここで差し替えて再開する
+        if (pendingMusicData)
+        {
+            SwapMusicData();
+        }
+        ForEachPart(
+            [frame_size](int, auto& sequencer)
+            {
+                sequencer.Resume();
+                sequencer.IncreaseFrame(frame_size);
+            });
+        return true;
+    }
+
+    bool Sequencer::HashState(StateHash& hash) const
+    {
+        opnwrap.HashState(hash);
+        fmwrap.HashState(hash);
+        ssgwrap.HashState(hash);
+        bool comparable = true;
+        ForEachPart(
+            [&hash, &comparable](int, const auto& sequencer)
+            {
+                comparable = comparable && sequencer.HashState(hash);
+            });
+        return comparable;
+    }
+
+    template<typename T>
+    void Sequencer::Mix(T* dest, int nsamples)
+    {
+        if (output_channels == 1)
+        {
+            MixImpl<T, 1>(dest, nsamples);
+        }
+        else
+        {
+            MixImpl<T, 2>(dest, nsamples);
+        }
+    }
+
+    template<typename T, int Channels>
+    void Sequencer::MixImpl(T* dest, int nsamples)
+    {
+        const size_t frame_bytes = sizeof(T) * Channels;
+        loopCacheFrameBytes = frame_bytes;
+
+        // ループ本体をキャッシュ済みであれば合成しない
+        ApplyLiveParameters();
+        if (loopcache && loopcache->IsReplaying())
+        {
+            loopcache->Replay(dest, nsamples * frame_bytes);
+            mixed_samples += nsamples;
+            return;
+        }
+
+        std::fill_n(dest, nsamples * Channels, T(0));
         while (nsamples > 0)
         {
-            // 各パートから次フレームまでの残時間が最小のものを抽出
-            auto frame_size = std::reduce(
-                partSequencer.begin(),
-                partSequencer.end(),
-                nsamples,
-                [](auto acc, const auto& sequencer)
-                {
-                    return std::min(acc, sequencer->GetRemainFrameSize());
-                });
+            // 最初の回は上で反映済みのため、版数の比較だけで済む
+            ApplyLiveParameters();
+            UpdateChannelMask();
+            auto frame_size = GetFrameSize(nsamples);
+            if (loopcache)
+            {
+                psgCounterUsage |= opn.GetPSGCounterUsage();
+            }
 
-            opn.Mix(dest, frame_size);
+            // レジスタへの書き込みはフレームの区切りで済んでいるため、全チャンネルが発音していない間は合成しない
+            bool silent = opn.IsIdle();
+            if (silent)
+            {
+                opn.MixIdle<T, Channels>(dest, frame_size);
+            }
+            else
+            {
+                ScopedMixTimer timer(statistics, MixStatistics::Section::SYNTHESIS);
+                opn.Mix<T, Channels>(dest, frame_size);
+            }
 
-            dest += frame_size * 2;
+            if (loopcache)
+            {
+                loopcache->Record(dest, frame_size * frame_bytes);
+            }
+
+            dest += frame_size * Channels;
             nsamples -= frame_size;
+            mixed_samples += frame_size;
 
-            for (const auto& part : partSequencer)
+            ScopedMixTimer timer(statistics, MixStatistics::Section::SEQUENCING);
+            ForEachPart(
+                [frame_size](int, auto& sequencer)
+                {
+                    sequencer.IncreaseFrame(frame_size);
+                });
+            bool synchronized = SynchronizeParts(frame_size);
+
+            if (statistics)
             {
-                part->IncreaseFrame(frame_size);
+                statistics->RecordSynthesisCall(silent, frame_size);
             }
 
-            // 全パートが一時停止していた場合、再開させる
-            if (std::none_of(
-                    partSequencer.begin(),
-                    partSequencer.end(),
-                    [](const auto& part)
-                    {
-                        return part->IsPlaying();
-                    }))
+            StateHash hash;
+            if (synchronized && loopcache && HashState(hash))
             {
-                for (const auto& part : partSequencer)
+                // レジスタが同じでも位相やエンベロープが異なれば出力は異なるため、音源の内部状態も比較する
+                // 出力に使っていない PSG のカウンタは、同じ値の 2 点の間でも使われないため比較しない
+                opn.HashState(hash, psgCounterUsage);
+                if (loopcache->Synchronize(hash.Get()))
                 {
-                    part->Resume();
-                    part->IncreaseFrame(frame_size);
+                    loopcache->Replay(dest, nsamples * frame_bytes);
+                    mixed_samples += nsamples;
+                    break;
                 }
             }
         }
+
+        if (statistics)
+        {
+            ForEachPart(
+                [this](int, auto& sequencer)
+                {
+                    auto count = sequencer.TakeCommandCount();
+                    statistics->RecordCommands(count.Commands, count.Frames, count.MaxCommandsPerFrame);
+                });
+        }
     }
+
+    template void Sequencer::Mix<__int16>(__int16* dest, int nsamples);
+    template void Sequencer::Mix<int32_t>(int32_t* dest, int nsamples);
+    template void Sequencer::Mix<float>(float* dest, int nsamples);
 } // namespace MusicCom
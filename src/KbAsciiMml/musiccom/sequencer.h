@@ -1,9 +1,18 @@
 ﻿#pragma once
 
+#include "fmsequencer.h"
 #include "fmwrap.h"
+#include "liveparameters.h"
 #include "partdata.h"
 #include "partsequencerbase.h"
+#include "psgsequencer.h"
+#include "soundsequencer.h"
+#include <array>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <optional>
+#include <utility>
 #include <vector>
 
 namespace FM
@@ -13,29 +22,157 @@ namespace FM
 
 namespace MusicCom
 {
+    class EventQueue;
+    class LoopCache;
+    class MixStatistics;
     class MusicData;
     class SoundData;
-    class SoundSequencer;
+    class StateHash;
 
     // 適当すぎ
     class Sequencer
     {
     public:
+        // 引数は先頭からの出力サンプル位置, レジスタ番号, 値
+        using RegisterWriteObserver = std::function<void(uint64_t sample, uint addr, uint data)>;
+
         Sequencer(FM::OPN& o, MusicData* pmd, SoundData* psd, int stempo);
-        bool Init(int rate);
-        void Mix(__int16* dest, int nsamples);
+        ~Sequencer();
+        void SetRegisterWriteObserver(RegisterWriteObserver observer);
+        // 処理時間の統計を記録する (nullptr で無効)
+        void SetStatistics(MixStatistics* stats);
+        // 演奏中に変更できるパラメータ (FM/PSG の音量・効果音のテンポ・パートのミュート) をフレームの区切りごとに反映する
+        // 最初のフレームで全ての値を反映する (nullptr で無効)
+        void SetLiveParameters(const LiveParameters* params);
+        // 表示用のイベント (音符の開始・終了など) を queue に記録する (nullptr で無効)
+        // 時刻は先頭からの出力サンプル位置で、イベントが発生したフレームの区切りの位置とする
+        void SetEventQueue(EventQueue* queue);
+        // 繰り返しのループ本体を budget バイトまで PCM でキャッシュして再生する (0 で無効)
+        // レジスタ書き込みの通知やイベントの記録とは併用しないこと
+        void EnableLoopCache(size_t budget);
+        // ループ本体のキャッシュから再生しているかどうか
+        bool IsReplayingLoopCache() const;
+#ifdef MUSICCOM_ENABLE_TRACE
+        // レジスタ書き込みのトレースを記録する (nullptr で無効)
+        void SetRegisterTrace(RegisterTrace* trace);
+#endif
+        // 音源の合成の品質 (速度とのかねあい)
+        struct ChipQuality
+        {
+            ChipQuality()
+                : PSGOversampling(2),
+                  Interpolation(false),
+                  EGShift(0)
+            {
+            }
+
+            int PSGOversampling; // PSG の 1 サンプルあたりの合成回数 (2^n 回、0-3)
+            bool Interpolation;  // FM 音源を本来のレートで合成し、出力のレートに補間する
+            int EGShift;         // FM 音源の EG を 2^n 回分ずつまとめて更新する
+        };
+
+        // 音源本来のサンプリングレート (クロック周波数 / 72)
+        static int GetNativeRate();
+        // channels: 出力のチャンネル数 (1:モノラル 2:ステレオ)
+        bool Init(int rate, int channels = 2, const ChipQuality& quality = ChipQuality());
+        // T: 出力サンプルの型 (__int16, int32_t, float)
+        // 同じ Init の間は同じ型で呼ぶこと
+        template<typename T>
+        void Mix(T* dest, int nsamples);
+        // Init した直後の状態 (レジスタと各パートの状態) に戻し、シーケンサと音源を作り直さずに先頭から演奏し直す
+        // データを差し替えた場合や Init の前は false (作り直すこと)
+        bool Restart();
+
+        // パート番号 (0-5: チャンネル, 6: D パート) と変更前のコマンド位置から、変更後の位置を返す
+        using CommandIndexMapper = std::function<int(int part, int index)>;
+        // 解析し直した MusicData を次の同期点 (全パートの一時停止) で差し替える
+        // パートの構成 (使用するチャンネルと D パートの有無) は変えないこと
+        void ScheduleMusicData(MusicData* pmd, CommandIndexMapper map);
+        bool IsMusicDataPending() const;
+
+        // 同期点 (全パートの一時停止から再開した直後) でのシーケンサの状態
+        struct State
+        {
+            OPNWrap::State OPN;
+            FMWrap::State FM;
+            SSGWrap::State SSG;
+            std::vector<PartState> Parts;
+        };
+        State SaveState() const;
+        // 同じ MusicData・サンプリングレートで保存した状態から演奏を続ける (差し替え待ちのデータがないこと)
+        void RestoreState(const State& state);
+
+        // 音を合成せずに次の同期点まで進める (max_samples 進めても同期点がなければ false)
+        // 同期点の直前に各パートが一時停止していた位置を、パート番号 (0-5: チャンネル, 6: D パート) とともに paused に返す
+        bool SkipToSync(uint64_t max_samples, std::vector<std::pair<int, CommandIterator>>& paused);
+        // 次のフレームの区切りまで (最大 max_samples) 進め、進めたサンプル数を返す
+        // 進める前に、その間の音源の合成を synthesize(サンプル数) で呼び出し側に任せる (解析用)
+        // 同期点に達して演奏状態を比較できる場合は、そのハッシュ値を sync_hash に返す
+        int StepFrame(int max_samples, const std::function<void(int)>& synthesize, std::optional<uint64_t>& sync_hash);
+        // 先頭からの出力サンプル位置
+        uint64_t GetMixedSamples() const;
+        // D パートの効果音を再生中 (SSG のチャンネル A,B を使用中) かどうか
+        bool IsSoundEffectPlaying() const;
 
     private:
         void InitializeSequencer(int rate);
+        // 存在するパートについて、パート番号 (0-5: チャンネル, 6: D パート) の順に func(パート番号, シーケンサ) を呼ぶ
+        // シーケンサはパートの種類ごとの型で渡すため、func はジェネリックラムダとすること
+        template<typename Func>
+        void ForEachPart(Func&& func);
+        template<typename Func>
+        void ForEachPart(Func&& func) const;
+        template<typename Self, typename Func>
+        static void ForEachPartImpl(Self& self, Func&& func);
+        template<typename T, int Channels>
+        void MixImpl(T* dest, int nsamples);
+        void SwapMusicData();
+        void ApplyLiveParameters();
+        // キャッシュからの再生をやめて合成に戻る
+        // シーケンサはループ区間の先頭で止まっているので、再生した位置まで進めておく
+        void StopLoopCacheReplay();
+        // 記録済みの出力を捨てる (PSG のカウンタの使用状況も記録し直す)
+        void ResetLoopCache();
+        // ミュートするパートから音源のチャンネルマスクを決めて設定する
+        // D パートはチャンネル4,5と同じ SSG を使うため、効果音の再生状態が変わるたびに呼ぶこと
+        void UpdateChannelMask();
+        // 音を合成せずにシーケンサだけを進める
+        void AdvanceWithoutSynthesis(uint64_t samples);
+        int GetFrameSize(int nsamples) const;
+        // 全パートが一時停止していた場合は再開させて true を返す
+        bool SynchronizeParts(int frame_size);
+        // 同期点での演奏状態のハッシュ値 (比較できない状態の場合は false)
+        bool HashState(StateHash& hash) const;
 
         FM::OPN& opn;
+        OPNWrap opnwrap;
         FMWrap fmwrap;
         SSGWrap ssgwrap;
-        MusicData& musicdata;
+        MusicData* musicdata;
         SoundData& sounddata;
+        MusicData* pendingMusicData;
+        CommandIndexMapper pendingMapper;
         int soundtempo;
+        uint64_t mixed_samples;
+        int output_channels;
+        MixStatistics* statistics;
+        std::unique_ptr<LoopCache> loopcache;
+        size_t loopCacheFrameBytes; // 再生した位置をサンプル数に換算するための出力 1 サンプルのバイト数
+        uint psgCounterUsage;       // キャッシュを記録し始めてから出力に使った PSG のカウンタ (PSG::GetCounterUsage の値の OR)
+        const LiveParameters* liveParameters;
+        uint32_t appliedParametersVersion;
+        std::optional<LiveParameters::Values> appliedParameters; // 未反映の場合は空
+        EventQueue* eventQueue;
+        uint32_t mutedParts;  // ビット 0-5: チャンネル, ビット 6: D パート
+        uint channelMask;     // 音源に設定済みのマスク (OPN::SetChannelMask の値)
+        int chipRate;         // 音源を初期化したレート
+        bool chipInterpolation;
+        std::optional<State> initialState; // Restart 用の Init した直後の状態
 
-        std::vector<std::unique_ptr<PartSequencerBase>> partSequencer;
+        // パートの種類はパート番号で決まるため、種類ごとに直接保持する (使用しないパートは空)
+        std::array<std::optional<FmSequencer>, 3> fmSequencer;   // パート 0-2
+        std::array<std::optional<PsgSequencer>, 3> psgSequencer; // パート 3-5
+        std::optional<SoundSequencer> soundSequencer;            // パート 6 (D パート)
     };
 
 } // namespace MusicCom
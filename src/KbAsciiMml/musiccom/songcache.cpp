@@ -0,0 +1,450 @@
+﻿#include "songcache.h"
+#include "musdata.h"
+#include "sounddata.h"
+#include "soundparser.h"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace MusicCom
+{
+    namespace
+    {
+        const char CACHE_MAGIC[4] = {'K', 'A', 'M', 'C'};
+        // MusicData / SoundData / Command の構造を変更した場合は更新すること
+        const uint32_t CACHE_VERSION = 2;
+
+        // FNV-1a (64bit)
+        const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+        const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+        uint64_t HashBytes(uint64_t hash, const char* data, size_t size)
+        {
+            for (size_t i = 0; i < size; i++)
+            {
+                hash ^= static_cast<uint8_t>(data[i]);
+                hash *= FNV_PRIME;
+            }
+            return hash;
+        }
+
+        std::optional<std::vector<char>> ReadFile(const std::string& filename)
+        {
+            std::ifstream stream(filename, std::ios::binary);
+            if (!stream)
+            {
+                return std::nullopt;
+            }
+            return std::vector<char>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        }
+    } // namespace
+
+    // キャッシュファイルの読み込み (範囲外の読み込みは例外)
+    class SongCache::Reader
+    {
+    public:
+        Reader(const uint8_t* data, size_t size)
+            : data_(data),
+              size_(size),
+              position_(0)
+        {
+        }
+
+        const uint8_t* Read(size_t size)
+        {
+            if (size > size_ - position_)
+            {
+                throw std::runtime_error("song cache: unexpected end of file");
+            }
+            auto ptr = data_ + position_;
+            position_ += size;
+            return ptr;
+        }
+        template<typename T>
+        T Read()
+        {
+            T value;
+            std::memcpy(&value, Read(sizeof(T)), sizeof(T));
+            return value;
+        }
+        std::string ReadString()
+        {
+            auto length = Read<uint32_t>();
+            auto ptr = reinterpret_cast<const char*>(Read(length));
+            return std::string(ptr, length);
+        }
+
+    private:
+        const uint8_t* data_;
+        size_t size_;
+        size_t position_;
+    };
+
+    class SongCache::Writer
+    {
+    public:
+        void Write(const void* data, size_t size)
+        {
+            auto ptr = static_cast<const uint8_t*>(data);
+            buffer_.insert(buffer_.end(), ptr, ptr + size);
+        }
+        template<typename T>
+        void Write(T value)
+        {
+            Write(&value, sizeof(T));
+        }
+        void WriteString(const std::string& value)
+        {
+            Write(static_cast<uint32_t>(value.size()));
+            Write(value.data(), value.size());
+        }
+        const std::vector<uint8_t>& GetBuffer() const
+        {
+            return buffer_;
+        }
+
+    private:
+        std::vector<uint8_t> buffer_;
+    };
+
+    SongCache::SongCache(const std::string& directory)
+        : directory_(directory)
+    {
+    }
+
+    std::optional<uint64_t> SongCache::ComputeKey(const char* mml_filename)
+    {
+        auto mml = ReadFile(mml_filename);
+        if (!mml)
+        {
+            return std::nullopt;
+        }
+
+        // SOUND.DAT がない場合は組み込みデータを使用するため、存在しないことをキーに含める
+        auto sound = ReadFile(GetSoundFilePath(mml_filename));
+        uint64_t hash = HashBytes(FNV_OFFSET_BASIS, reinterpret_cast<const char*>(&CACHE_VERSION), sizeof(CACHE_VERSION));
+        hash = HashBytes(hash, mml->data(), mml->size());
+        hash = HashBytes(hash, sound ? "\1" : "\0", 1);
+        if (sound)
+        {
+            hash = HashBytes(hash, sound->data(), sound->size());
+        }
+        return hash;
+    }
+
+    bool SongCache::Load(uint64_t key, std::unique_ptr<MusicData>& music, std::unique_ptr<SoundData>& sound) const
+    {
+        namespace bip = boost::interprocess;
+
+        auto path = GetCachePath(key);
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(path, ec))
+        {
+            return false;
+        }
+
+        try
+        {
+            bip::file_mapping mapping(path.c_str(), bip::read_only);
+            bip::mapped_region region(mapping, bip::read_only);
+            Reader reader(static_cast<const uint8_t*>(region.get_address()), region.get_size());
+
+            auto magic = reader.Read(sizeof(CACHE_MAGIC));
+            if (std::memcmp(magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || reader.Read<uint32_t>() != CACHE_VERSION || reader.Read<uint64_t>() != key)
+            {
+                return false;
+            }
+
+            // キャッシュ上のコマンド (17 バイト) は展開するとおよそ 4 倍の大きさになる
+            auto music_data = std::make_unique<MusicData>(region.get_size() * 4);
+            auto sound_data = std::make_unique<SoundData>();
+            ReadMusicData(reader, *music_data);
+            ReadSoundData(reader, *sound_data);
+
+            music = std::move(music_data);
+            sound = std::move(sound_data);
+            return true;
+        }
+        catch (...)
+        {
+            // 読み込めない場合は通常通り解析する
+            return false;
+        }
+    }
+
+    void SongCache::Store(uint64_t key, const MusicData& music, const SoundData& sound) const
+    {
+        Writer writer;
+        writer.Write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        writer.Write(CACHE_VERSION);
+        writer.Write(key);
+        WriteMusicData(writer, music);
+        WriteSoundData(writer, sound);
+
+        // 他のインスタンスが読み込み中でも壊れたファイルが見えないよう、一時ファイルに書いてから置き換える
+        std::error_code ec;
+        std::filesystem::create_directories(directory_, ec);
+        auto path = GetCachePath(key);
+        auto temp_path = path + std::format(".{:x}.tmp", std::hash<std::thread::id>()(std::this_thread::get_id()));
+        {
+            std::ofstream stream(temp_path, std::ios::binary);
+            if (!stream)
+            {
+                return;
+            }
+            const auto& buffer = writer.GetBuffer();
+            stream.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+            if (!stream)
+            {
+                stream.close();
+                std::filesystem::remove(temp_path, ec);
+                return;
+            }
+        }
+        std::filesystem::rename(temp_path, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(temp_path, ec);
+        }
+    }
+
+    std::string SongCache::GetCachePath(uint64_t key) const
+    {
+        return (std::filesystem::path(directory_) / std::format("{:016x}.kac", key)).string();
+    }
+
+    void SongCache::WriteCommandList(Writer& writer, const CommandList& commands)
+    {
+        writer.Write(static_cast<uint32_t>(commands.size()));
+        for (const auto& command : commands)
+        {
+            writer.Write(static_cast<int8_t>(command.GetType()));
+            for (int i = 0; i < 3; i++)
+            {
+                writer.Write(static_cast<int32_t>(command.GetArg(i)));
+            }
+            writer.WriteString(command.GetStrArg());
+        }
+    }
+
+    void SongCache::ReadCommandList(Reader& reader, CommandList& commands)
+    {
+        auto count = reader.Read<uint32_t>();
+        for (uint32_t n = 0; n < count; n++)
+        {
+            auto type = static_cast<CommandType>(reader.Read<int8_t>());
+            int args[3];
+            for (auto& arg : args)
+            {
+                arg = reader.Read<int32_t>();
+            }
+            Command command(type, args[0], args[1], args[2]);
+            command.SetStrArg(reader.ReadString());
+            commands.push_back(command);
+        }
+    }
+
+    void SongCache::WriteLines(Writer& writer, const std::pmr::vector<int>& lines)
+    {
+        writer.Write(static_cast<uint32_t>(lines.size()));
+        for (int line : lines)
+        {
+            writer.Write(static_cast<int32_t>(line));
+        }
+    }
+
+    void SongCache::ReadLines(Reader& reader, std::pmr::vector<int>& lines)
+    {
+        auto count = reader.Read<uint32_t>();
+        for (uint32_t n = 0; n < count; n++)
+        {
+            lines.push_back(reader.Read<int32_t>());
+        }
+    }
+
+    void SongCache::WriteMusicData(Writer& writer, const MusicData& music)
+    {
+        writer.Write(static_cast<int32_t>(music.tempo));
+
+        writer.Write(static_cast<uint32_t>(music.fmsounds.size()));
+        for (const auto& [no, sound] : music.fmsounds)
+        {
+            writer.Write(static_cast<int32_t>(no));
+            writer.Write(static_cast<int32_t>(sound.LFOForm));
+            writer.Write(static_cast<int32_t>(sound.LFOSpeed));
+            writer.Write(static_cast<int32_t>(sound.LFODepth));
+            writer.Write(sound.AlgFb);
+            for (const auto& op : sound.Op)
+            {
+                writer.Write(op.DtMl);
+                writer.Write(op.Tl);
+                writer.Write(op.KsAr);
+                writer.Write(op.Dr);
+                writer.Write(op.Sr);
+                writer.Write(op.SlRr);
+                writer.Write(op.Dt2);
+            }
+        }
+
+        writer.Write(static_cast<uint32_t>(music.ssgenvs.size()));
+        for (const auto& [no, env] : music.ssgenvs)
+        {
+            writer.Write(static_cast<int32_t>(no));
+            writer.Write(static_cast<int32_t>(env.Unit));
+            writer.Write(static_cast<uint32_t>(env.Env.size()));
+            writer.Write(env.Env.data(), env.Env.size());
+        }
+
+        writer.Write(static_cast<uint32_t>(music.macros.size()));
+        for (const auto& [name, commands] : music.macros)
+        {
+            writer.WriteString(name);
+            WriteCommandList(writer, commands);
+        }
+
+        for (int ch = 0; ch < MusicData::channel_count; ch++)
+        {
+            writer.Write(static_cast<uint8_t>(music.channel_present[ch]));
+            WriteCommandList(writer, music.channels[ch]);
+            WriteLines(writer, music.channel_lines[ch]);
+        }
+        writer.Write(static_cast<uint8_t>(music.rhythm_part_present));
+        WriteCommandList(writer, music.rhythm_part);
+        WriteLines(writer, music.rhythm_part_lines);
+    }
+
+    void SongCache::ReadMusicData(Reader& reader, MusicData& music)
+    {
+        music.tempo = reader.Read<int32_t>();
+
+        auto sound_count = reader.Read<uint32_t>();
+        for (uint32_t n = 0; n < sound_count; n++)
+        {
+            int no = reader.Read<int32_t>();
+            FMSound sound;
+            sound.LFOForm = reader.Read<int32_t>();
+            sound.LFOSpeed = reader.Read<int32_t>();
+            sound.LFODepth = reader.Read<int32_t>();
+            sound.AlgFb = reader.Read<unsigned char>();
+            for (auto& op : sound.Op)
+            {
+                op.DtMl = reader.Read<unsigned char>();
+                op.Tl = reader.Read<unsigned char>();
+                op.KsAr = reader.Read<unsigned char>();
+                op.Dr = reader.Read<unsigned char>();
+                op.Sr = reader.Read<unsigned char>();
+                op.SlRr = reader.Read<unsigned char>();
+                op.Dt2 = reader.Read<unsigned char>();
+            }
+            music.fmsounds[no] = sound;
+        }
+
+        auto env_count = reader.Read<uint32_t>();
+        for (uint32_t n = 0; n < env_count; n++)
+        {
+            int no = reader.Read<int32_t>();
+            SSGEnv env;
+            env.Unit = reader.Read<int32_t>();
+            auto length = reader.Read<uint32_t>();
+            auto ptr = reader.Read(length);
+            env.Env.assign(ptr, ptr + length);
+            music.ssgenvs[no] = env;
+        }
+
+        auto macro_count = reader.Read<uint32_t>();
+        for (uint32_t n = 0; n < macro_count; n++)
+        {
+            auto name = reader.ReadString();
+            ReadCommandList(reader, music.macros[name]);
+        }
+
+        for (int ch = 0; ch < MusicData::channel_count; ch++)
+        {
+            music.channel_present[ch] = reader.Read<uint8_t>() != 0;
+            ReadCommandList(reader, music.channels[ch]);
+            ReadLines(reader, music.channel_lines[ch]);
+        }
+        music.rhythm_part_present = reader.Read<uint8_t>() != 0;
+        ReadCommandList(reader, music.rhythm_part);
+        ReadLines(reader, music.rhythm_part_lines);
+    }
+
+    void SongCache::WriteSoundData(Writer& writer, const SoundData& sound)
+    {
+        writer.Write(static_cast<uint32_t>(sound.rhythms.size()));
+        for (const auto& [no, rhythm] : sound.rhythms)
+        {
+            writer.Write(static_cast<int32_t>(no));
+            writer.Write(static_cast<uint32_t>(rhythm.blocks_.size()));
+            for (const auto& block : rhythm.blocks_)
+            {
+                writer.Write(static_cast<int32_t>(block.length));
+                for (const auto& tone : block.tone)
+                {
+                    writer.Write(static_cast<uint8_t>(tone.enabled));
+                    writer.Write(static_cast<int32_t>(tone.initial_value));
+                    writer.Write(static_cast<int32_t>(tone.final_value));
+                    writer.Write(static_cast<int32_t>(tone.period));
+                    writer.Write(static_cast<uint8_t>(tone.loop));
+                }
+                for (const auto& volume : block.volume)
+                {
+                    writer.Write(static_cast<int32_t>(volume.initial_value));
+                    writer.Write(static_cast<int32_t>(volume.final_value));
+                    writer.Write(static_cast<int32_t>(volume.period));
+                    writer.Write(static_cast<uint8_t>(volume.loop));
+                }
+                writer.Write(static_cast<int32_t>(block.noise.channel_type));
+                writer.Write(static_cast<int32_t>(block.noise.initial_value));
+                writer.Write(static_cast<int32_t>(block.noise.final_value));
+                writer.Write(static_cast<int32_t>(block.noise.period));
+                writer.Write(static_cast<uint8_t>(block.noise.loop));
+            }
+        }
+    }
+
+    void SongCache::ReadSoundData(Reader& reader, SoundData& sound)
+    {
+        auto rhythm_count = reader.Read<uint32_t>();
+        for (uint32_t n = 0; n < rhythm_count; n++)
+        {
+            int no = reader.Read<int32_t>();
+            auto& rhythm = sound.rhythms[no];
+            auto block_count = reader.Read<uint32_t>();
+            for (uint32_t m = 0; m < block_count; m++)
+            {
+                Block block;
+                block.length = reader.Read<int32_t>();
+                for (auto& tone : block.tone)
+                {
+                    tone.enabled = reader.Read<uint8_t>() != 0;
+                    tone.initial_value = reader.Read<int32_t>();
+                    tone.final_value = reader.Read<int32_t>();
+                    tone.period = reader.Read<int32_t>();
+                    tone.loop = reader.Read<uint8_t>() != 0;
+                }
+                for (auto& volume : block.volume)
+                {
+                    volume.initial_value = reader.Read<int32_t>();
+                    volume.final_value = reader.Read<int32_t>();
+                    volume.period = reader.Read<int32_t>();
+                    volume.loop = reader.Read<uint8_t>() != 0;
+                }
+                block.noise.channel_type = reader.Read<int32_t>();
+                block.noise.initial_value = reader.Read<int32_t>();
+                block.noise.final_value = reader.Read<int32_t>();
+                block.noise.period = reader.Read<int32_t>();
+                block.noise.loop = reader.Read<uint8_t>() != 0;
+                rhythm.blocks_.push_back(block);
+            }
+        }
+    }
+
+} // namespace MusicCom
@@ -0,0 +1,48 @@
+﻿#pragma once
+
+#include "command.h"
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace MusicCom
+{
+    class MusicData;
+    class SoundData;
+
+    // 解析済みの MusicData / SoundData のキャッシュ
+    // MMLファイルと SOUND.DAT の内容のハッシュをキーとして、directory 以下にバイナリ形式で保存する
+    class SongCache
+    {
+    public:
+        SongCache(const std::string& directory);
+
+        // MMLファイルが読み込めない場合は nullopt
+        static std::optional<uint64_t> ComputeKey(const char* mml_filename);
+
+        // キャッシュが存在しない・壊れている場合は false
+        bool Load(uint64_t key, std::unique_ptr<MusicData>& music, std::unique_ptr<SoundData>& sound) const;
+        // 保存に失敗しても再生には影響しないため結果は返さない
+        void Store(uint64_t key, const MusicData& music, const SoundData& sound) const;
+
+    private:
+        class Reader;
+        class Writer;
+
+        std::string GetCachePath(uint64_t key) const;
+        static void ReadMusicData(Reader& reader, MusicData& music);
+        static void ReadSoundData(Reader& reader, SoundData& sound);
+        static void WriteMusicData(Writer& writer, const MusicData& music);
+        static void WriteSoundData(Writer& writer, const SoundData& sound);
+        static void ReadCommandList(Reader& reader, CommandList& commands);
+        static void WriteCommandList(Writer& writer, const CommandList& commands);
+        static void ReadLines(Reader& reader, std::pmr::vector<int>& lines);
+        static void WriteLines(Writer& writer, const std::pmr::vector<int>& lines);
+
+        std::string directory_;
+    };
+
+} // namespace MusicCom
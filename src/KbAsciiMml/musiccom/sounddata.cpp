@@ -8,6 +8,16 @@ namespace MusicCom
     {
     }
 
+    RhythmData::RhythmData(const allocator_type& alloc)
+        : blocks_(alloc)
+    {
+    }
+
+    RhythmData::RhythmData(const RhythmData& other, const allocator_type& alloc)
+        : blocks_(other.blocks_, alloc)
+    {
+    }
+
     template<typename ReturnType, typename Part>
     ReturnType get_incremental(Part part)
     {
@@ -141,6 +151,7 @@ namespace MusicCom
     }
 
     SoundData::SoundData()
+        : rhythms(&arena)
     {
     }
 
@@ -151,6 +162,13 @@ namespace MusicCom
 
     const RhythmData& SoundData::GetRhythm(int no) const
     {
-        return rhythms[no];
+        // 演奏中に索引の作成などで別のスレッドからも参照するため、存在しない no でも追加しない
+        auto it = rhythms.find(no);
+        if (it == rhythms.end())
+        {
+            static const RhythmData empty;
+            return empty;
+        }
+        return it->second;
     }
 } // namespace MusicCom
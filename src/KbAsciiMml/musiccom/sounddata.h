@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include <map>
+#include <memory_resource>
 #include <tuple>
 #include <vector>
 
@@ -41,7 +42,13 @@ namespace MusicCom
     class RhythmData
     {
     public:
+        // SoundData に格納する際は SoundData の領域から確保する
+        using allocator_type = std::pmr::polymorphic_allocator<>;
+        using BlockList = std::pmr::vector<Block>;
+
         RhythmData();
+        explicit RhythmData(const allocator_type& alloc);
+        RhythmData(const RhythmData& other, const allocator_type& alloc);
 
         // Element
         struct Element
@@ -57,7 +64,7 @@ namespace MusicCom
         class const_iterator
         {
         public:
-            using BlockIterator = std::vector<Block>::const_iterator;
+            using BlockIterator = BlockList::const_iterator;
             const_iterator(BlockIterator block_ptr, BlockIterator sentinel, int part_index);
 
             const_iterator& operator++();
@@ -91,18 +98,25 @@ namespace MusicCom
 
     private:
         friend struct SoundParserState;
-        std::vector<Block> blocks_;
+        friend class SongCache;
+        BlockList blocks_;
     };
 
     class SoundData
     {
     public:
+        // リズムデータは曲ごとの領域から確保し、破棄時にまとめて解放する
         SoundData();
+        SoundData(const SoundData&) = delete;
+        SoundData& operator=(const SoundData&) = delete;
 
         void SetRhythm(int no, const RhythmData& rhythm);
         const RhythmData& GetRhythm(int no) const;
 
     private:
-        mutable std::map<int, RhythmData> rhythms;
+        friend class SongCache;
+        // 他のメンバより先に構築し、最後に破棄する
+        std::pmr::monotonic_buffer_resource arena;
+        std::pmr::map<int, RhythmData> rhythms;
     };
 } // namespace MusicCom
@@ -64,7 +64,7 @@ Noise:	3, 20 ,-5 ,4,0
         {
         }
 
-        std::vector<Block>& GetEditingBlocks() const
+        RhythmData::BlockList& GetEditingBlocks() const
         {
             return editing_data->blocks_;
         }
@@ -338,18 +338,20 @@ Noise:	3, 20 ,-5 ,4,0
         return ParseSoundImpl(begin, end);
     }
 
+    std::string GetSoundFilePath(const std::string& mml_filename)
+    {
+        std::filesystem::path mml_path(mml_filename);
+        return (mml_path.parent_path() / "SOUND.DAT").string();
+    }
+
     SoundData* ParseSound(const std::string& mml_filename)
     {
-        using path = std::filesystem::path;
         using file_iterator = boost::spirit::classic::file_iterator<char>;
 
         try
         {
             // MMLファイルと同ディレクトリにあるSOUND.DATを読み込む
-            path mml_path(mml_filename);
-            auto dir_path = mml_path.parent_path();
-            auto sound_dat_path = dir_path / "SOUND.DAT";
-            file_iterator begin(sound_dat_path.string());
+            file_iterator begin(GetSoundFilePath(mml_filename));
             if (!begin)
             {
                 // 読み込めない場合は組み込みのサンプルデータ(Dante98ベース)を読み込む
@@ -364,4 +366,22 @@ Noise:	3, 20 ,-5 ,4,0
             return ParseDefaultSound();
         }
     }
+
+    SoundData* ParseSound(const char* data, size_t size)
+    {
+        if (!data)
+        {
+            return ParseDefaultSound();
+        }
+
+        try
+        {
+            return ParseSoundImpl(data, data + size);
+        }
+        catch (...)
+        {
+            // 失敗した場合は組み込みのサンプルデータ(Dante98ベース)を読み込む
+            return ParseDefaultSound();
+        }
+    }
 } // namespace MusicCom
@@ -1,10 +1,15 @@
 ﻿#pragma once
 
+#include <cstddef>
 #include <string>
 
 namespace MusicCom
 {
     class SoundData;
     SoundData* ParseSound(const std::string& mml_filename);
+    // data が nullptr の場合は組み込みのデータを使用する
+    SoundData* ParseSound(const char* data, size_t size);
+    // MMLファイルと同ディレクトリにある SOUND.DAT のパス
+    std::string GetSoundFilePath(const std::string& mml_filename);
 
 } // namespace MusicCom
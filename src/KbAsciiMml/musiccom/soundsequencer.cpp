@@ -1,5 +1,6 @@
 ﻿#include "soundsequencer.h"
 #include "fmwrap.h"
+#include "statehash.h"
 #include <algorithm>
 #include <cmath>
 
@@ -22,13 +23,11 @@ namespace MusicCom
     };
     // clang-format on
 
-    SoundSequencer::SoundSequencer(FM::OPN& opn, SSGWrap& ssgwrap, const MusicData& music, const SoundData& sound, int soundtempo, int rate)
+    SoundSequencer::SoundSequencer(OPNWrap& opn, SSGWrap& ssgwrap, const MusicData& music, const SoundData& sound, int soundtempo, int rate)
         : PartSequencerBase(opn, music, music.GetRhythmPartTail(), rate),
           ssgwrap_(ssgwrap),
           sound_(sound),
           current_sound_data_(std::nullopt),
-          GetHeadImpl([this]()
-                      { return GetMusicData().GetRhythmPartHead(); }),
           sound_interrupt_enabled_(false),
           sound_interrupt_per_frame_(CalculatePerFrame(soundtempo)),
           sound_interrupt_left_(0)
@@ -47,7 +46,7 @@ namespace MusicCom
         sound_interrupt_left_ = 0;
     }
 
-    int SoundSequencer::GetRemainFrameSizeImpl()
+    int SoundSequencer::GetRemainFrameSizeImpl() const
     {
         // SoundSequencerでは効果音フレームとコマンドフレームを同時に扱う
         // 効果音再生中は効果音フレームの残時間とコマンドフレームの残時間のうち小さい方を返す
@@ -61,6 +60,13 @@ namespace MusicCom
         return command_frame_size;
     }
 
+    void SoundSequencer::SetSoundTempo(int soundtempo)
+    {
+        sound_interrupt_per_frame_ = CalculatePerFrame(soundtempo);
+        // 再生中の効果音フレームが新しい長さより長く残らないようにする
+        sound_interrupt_left_ = std::min(sound_interrupt_left_, sound_interrupt_per_frame_);
+    }
+
     void SoundSequencer::IncreaseFrameImpl(int frame_size)
     {
         // コマンドフレームの処理
@@ -97,6 +103,7 @@ namespace MusicCom
         }
 
         // 効果音の設定
+        MUSICCOM_TRACE_SCOPE(GetTraceOPN(), TraceSource::SOUND_EFFECT);
         const auto& data = *current_sound.ptr;
         ssgwrap_.SetNoisePeriod(data.noise_period);
         for (int ch = 0; ch < 2; ch++)
@@ -116,6 +123,37 @@ namespace MusicCom
         observer_list_.push_back(observer);
     }
 
+    std::any SoundSequencer::SaveStateImpl() const
+    {
+        return SoundState{current_sound_data_, sound_interrupt_enabled_, sound_interrupt_left_};
+    }
+
+    void SoundSequencer::RestoreStateImpl(const std::any& extra)
+    {
+        const auto& state = std::any_cast<const SoundState&>(extra);
+        current_sound_data_ = state.Current;
+        sound_interrupt_enabled_ = state.SoundInterruptEnabled;
+        sound_interrupt_left_ = state.SoundInterruptLeft;
+
+        // チャンネル4,5の抑止状態も合わせる
+        for (auto item : observer_list_)
+        {
+            item((sound_interrupt_enabled_) ? PlayStatus::PLAYING : PlayStatus::STOP);
+        }
+    }
+
+    bool SoundSequencer::HashStateImpl(StateHash& hash) const
+    {
+        // 効果音の再生中は比較しない
+        if (current_sound_data_)
+        {
+            return false;
+        }
+        hash.Add(sound_interrupt_enabled_);
+        hash.Add(sound_interrupt_left_);
+        return true;
+    }
+
     void SoundSequencer::PreProcess(int current_frame)
     {
         // nothing todo.
@@ -151,6 +189,7 @@ namespace MusicCom
                 current_sound_data_ = {sound_data.begin(), sound_data.end()};
                 NextSoundFrame();
                 KeyOn();
+                PublishEvent(EventType::SOUND_EFFECT, sound_no);
             }
 
             int length = get_length(part_data, command.GetArg(1));
@@ -173,6 +212,9 @@ namespace MusicCom
         case CommandType::TYPE_LENGTH:
             part_data.DefaultNoteLength = command.GetArg(0);
             break;
+        default:
+            // 効果音パートではその他のコマンドを無視する
+            break;
         }
         return return_ptr;
     }
@@ -239,7 +281,7 @@ namespace MusicCom
 
     const CommandIterator SoundSequencer::GetHead() const
     {
-        return GetHeadImpl();
+        return GetMusicData().GetRhythmPartHead();
     }
 
 } // namespace MusicCom
@@ -6,20 +6,18 @@
 #include <optional>
 #include <vector>
 
-namespace FM
-{
-    class OPN;
-}
-
 namespace MusicCom
 {
+    class OPNWrap;
     class SSGWrap;
     class MusicData;
     struct FMSound;
-    class SoundSequencer : public PartSequencerBase
+    class SoundSequencer : public PartSequencerBase<SoundSequencer>
     {
+        friend class PartSequencerBase<SoundSequencer>;
+
     public:
-        SoundSequencer(FM::OPN& opn, SSGWrap& ssgwrap, const MusicData& music, const SoundData& sound, int soundtempo, int rate);
+        SoundSequencer(OPNWrap& opn, SSGWrap& ssgwrap, const MusicData& music, const SoundData& sound, int soundtempo, int rate);
         ~SoundSequencer();
 
         enum class PlayStatus : int
@@ -29,26 +27,35 @@ namespace MusicCom
         };
         using PlayStatusObserver = std::function<void(PlayStatus)>;
         void AppendPlayStatusObserver(PlayStatusObserver observer);
-
-    protected: // for PartSequencerBase
-        virtual int GetRemainFrameSizeImpl();
-        virtual void IncreaseFrameImpl(int frame_size);
-        virtual CommandIterator ProcessCommandImpl(CommandIterator ptr, int current_frame, PartData& part_data);
+        // 効果音のテンポを変更する (次の効果音フレームから反映)
+        void SetSoundTempo(int soundtempo);
+        // 効果音を再生中 (チャンネル4,5の音源を使用中) かどうか
+        // (IsPlaying はパートが一時停止していないかどうか)
+        bool IsSoundEffectPlaying() const
+        {
+            return sound_interrupt_enabled_;
+        }
 
     private:
         void NextSoundFrame();
 
     private: // for PartSequencerBase
-        virtual void InitializeImpl(PartData& part_data);
-        virtual void PreProcess(int current_frame);
-        virtual void ProcessEffect(int current_frame);
-        virtual void KeyOn();
-        virtual void KeyOff();
-        virtual void UpdateTone(int base_tone, PartData& part_data);
-        virtual void ApplyPortamentoEffect(int octave, int tone, int last_octave, int last_tone, double coefficient);
-        virtual void SetTone(int octave, int tone);
-        virtual void SetVolume(int volume);
-        virtual const CommandIterator GetHead() const;
+        int GetRemainFrameSizeImpl() const;
+        void IncreaseFrameImpl(int frame_size);
+        CommandIterator ProcessCommandImpl(CommandIterator ptr, int current_frame, PartData& part_data);
+        std::any SaveStateImpl() const;
+        void RestoreStateImpl(const std::any& extra);
+        bool HashStateImpl(StateHash& hash) const;
+        void InitializeImpl(PartData& part_data);
+        void PreProcess(int current_frame);
+        void ProcessEffect(int current_frame);
+        void KeyOn();
+        void KeyOff();
+        void UpdateTone(int base_tone, PartData& part_data);
+        void ApplyPortamentoEffect(int octave, int tone, int last_octave, int last_tone, double coefficient);
+        void SetTone(int octave, int tone);
+        void SetVolume(int volume);
+        const CommandIterator GetHead() const;
 
         void KeyOnOffImpl(bool on);
 
@@ -65,7 +72,13 @@ namespace MusicCom
         };
         std::optional<CurrentSoundData> current_sound_data_;
 
-        std::function<CommandIterator()> GetHeadImpl;
+        // 同期点で保存する効果音の再生状態
+        struct SoundState
+        {
+            std::optional<CurrentSoundData> Current;
+            bool SoundInterruptEnabled;
+            int SoundInterruptLeft;
+        };
 
         // 効果音フレーム
         bool sound_interrupt_enabled_;
@@ -0,0 +1,44 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace MusicCom
+{
+    // 演奏状態の比較に使用するハッシュ値 (FNV-1a 64bit)
+    // 構造体の詰め物を含めないよう、値は 1 つずつ追加する
+    class StateHash
+    {
+    public:
+        StateHash()
+            : hash_(0xcbf29ce484222325ULL)
+        {
+        }
+
+        void Add(const void* data, size_t size)
+        {
+            auto ptr = static_cast<const uint8_t*>(data);
+            for (size_t i = 0; i < size; i++)
+            {
+                hash_ ^= ptr[i];
+                hash_ *= 0x100000001b3ULL;
+            }
+        }
+        template<typename T>
+        void Add(T value)
+        {
+            static_assert(std::is_scalar_v<T>);
+            Add(&value, sizeof(value));
+        }
+
+        uint64_t Get() const
+        {
+            return hash_;
+        }
+
+    private:
+        uint64_t hash_;
+    };
+
+} // namespace MusicCom
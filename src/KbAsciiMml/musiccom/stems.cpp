@@ -0,0 +1,77 @@
+﻿#include "stems.h"
+#include "sequencer.h"
+#include <algorithm>
+#include <climits>
+#include <fmgen/opna.h>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace MusicCom
+{
+    namespace
+    {
+        const int BLOCK_SIZE = 4096;
+    }
+
+    void RenderStems(MusicData& music, SoundData& sound, int soundtempo, int rate, uint64_t samples, const StemWriter& writer)
+    {
+        // チャンネルごとの合成は補間に対応しないため、既定の品質 (補間なし) で合成する
+        auto opn = std::make_unique<FM::OPN>();
+        Sequencer sequencer(*opn, &music, &sound, soundtempo);
+        if (!sequencer.Init(rate, 1))
+        {
+            throw std::runtime_error("cannot initialize OPN");
+        }
+
+        std::vector<int16_t> buffer(STEM_COUNT * BLOCK_SIZE, 0);
+        int16_t* stems[STEM_COUNT];
+        for (int part = 0; part < STEM_COUNT; part++)
+        {
+            stems[part] = buffer.data() + part * BLOCK_SIZE;
+        }
+
+        // 短いフレームごとに書き出さないよう、BLOCK_SIZE までためてから渡す
+        int filled = 0;
+        auto flush = [&]()
+        {
+            if (filled > 0)
+            {
+                writer(stems, filled);
+                std::fill(buffer.begin(), buffer.end(), int16_t(0));
+                filled = 0;
+            }
+        };
+        auto synthesize = [&](int frame_size)
+        {
+            // 効果音の再生状態はフレームの区切りでしか変わらない
+            bool sound_playing = sequencer.IsSoundEffectPlaying();
+            while (frame_size > 0)
+            {
+                int n = std::min(frame_size, BLOCK_SIZE - filled);
+                int16_t* const channels[6] = {
+                    stems[0] + filled,
+                    stems[1] + filled,
+                    stems[2] + filled,
+                    (sound_playing ? stems[6] : stems[3]) + filled,
+                    (sound_playing ? stems[6] : stems[4]) + filled,
+                    stems[5] + filled};
+                opn->MixChannels(channels, n);
+                filled += n;
+                frame_size -= n;
+                if (filled == BLOCK_SIZE)
+                {
+                    flush();
+                }
+            }
+        };
+
+        while (sequencer.GetMixedSamples() < samples)
+        {
+            std::optional<uint64_t> hash;
+            sequencer.StepFrame(static_cast<int>(std::min<uint64_t>(samples - sequencer.GetMixedSamples(), INT_MAX)), synthesize, hash);
+        }
+        flush();
+    }
+
+} // namespace MusicCom
@@ -0,0 +1,21 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <functional>
+
+namespace MusicCom
+{
+    class MusicData;
+    class SoundData;
+
+    // パート (0-5: チャンネル, 6: D パート) の数
+    const int STEM_COUNT = 7;
+    // stems[パート番号] に nsamples 分の出力 (16bit モノラル) を渡す (使用していないパートは無音)
+    using StemWriter = std::function<void(const int16_t* const stems[STEM_COUNT], int nsamples)>;
+
+    // 1 回のシーケンス処理で、パートごとの出力を rate で samples 分合成する
+    // 音源のチャンネルごとに合成し、効果音の再生中は SSG のチャンネル A,B の出力を D パートのものとする
+    // 全パートの和は通常の演奏の出力とほぼ等しい (チャンネルごとの飽和と丸めの差を除く)
+    void RenderStems(MusicData& music, SoundData& sound, int soundtempo, int rate, uint64_t samples, const StemWriter& writer);
+
+} // namespace MusicCom
@@ -0,0 +1,480 @@
+﻿#include "bench.h"
+#include "golden.h"
+#include "overviewreport.h"
+#include "renderserver.h"
+#include "s98export.h"
+#include "seek.h"
+#include "selftest.h"
+#include "stemexport.h"
+#include "trace.h"
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace KbAsciiMmlTool;
+
+namespace
+{
+    const int EXIT_MISMATCH = 1;
+    const int EXIT_ERROR = 2;
+
+    void PrintUsage()
+    {
+        std::cerr
+            << "usage:\n"
+            << "  KbAsciiMmlTool golden record [-s seconds] [-r rate] [--pcm] <golden_dir> <file.mml>...\n"
+            << "  KbAsciiMmlTool golden verify <golden_dir> <file.mml>...\n"
+            << "  KbAsciiMmlTool trace [-s seconds] [-r rate] [--chrome trace.json] <file.mml>\n"
+            << "  KbAsciiMmlTool s98 export [-s seconds] [-r rate] <file.mml> <out.s98>\n"
+            << "  KbAsciiMmlTool s98 render [-s seconds] [-r rate] <file.s98> <out.raw>\n"
+            << "  KbAsciiMmlTool seek [-s seconds] [-r rate] [-q draft|standard|high] <file.mml> <line> <out.raw>\n"
+            << "  KbAsciiMmlTool bench [-s seconds] [-r rate] <file.mml>...\n"
+            << "  KbAsciiMmlTool overview [-w window_ms] [--csv out.csv] <file.mml>...\n"
+            << "  KbAsciiMmlTool stems [-s seconds] [-r rate] <file.mml> <out_prefix>\n"
+            << "  KbAsciiMmlTool serve [-j threads] [-c cached_songs] <socket>\n"
+            << "  KbAsciiMmlTool client <socket> render [-s seconds] [-r rate] [-q draft|standard|high] <file.mml> <out.raw>\n"
+            << "  KbAsciiMmlTool client <socket> length <file.mml>\n"
+            << "  KbAsciiMmlTool client <socket> analyze [-w window_ms] <file.mml>\n"
+            << "  KbAsciiMmlTool client <socket> shutdown\n"
+            << "  KbAsciiMmlTool selftest\n";
+    }
+
+    MusicCom::MusicCom::Quality ParseQuality(const std::string& name)
+    {
+        if (name == "draft")
+        {
+            return MusicCom::MusicCom::Quality::Draft;
+        }
+        if (name == "standard")
+        {
+            return MusicCom::MusicCom::Quality::Standard;
+        }
+        if (name == "high")
+        {
+            return MusicCom::MusicCom::Quality::High;
+        }
+        throw std::invalid_argument("unknown quality: " + name);
+    }
+
+    int RunGolden(const std::vector<std::string>& args)
+    {
+        if (args.empty())
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+
+        const auto& mode = args[0];
+        GoldenOptions options;
+        std::vector<std::string> positional;
+        for (size_t i = 1; i < args.size(); i++)
+        {
+            const auto& arg = args[i];
+            if (arg == "-s" && i + 1 < args.size())
+            {
+                options.Seconds = std::stoul(args[++i]);
+            }
+            else if (arg == "-r" && i + 1 < args.size())
+            {
+                options.Rate = std::stoul(args[++i]);
+            }
+            else if (arg == "--pcm")
+            {
+                options.KeepPCM = true;
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (positional.size() < 2)
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+        const auto& golden_dir = positional[0];
+        std::vector<std::string> mml_files(positional.begin() + 1, positional.end());
+
+        if (mode == "record")
+        {
+            return RecordGolden(golden_dir, mml_files, options) ? EXIT_SUCCESS : EXIT_ERROR;
+        }
+        if (mode == "verify")
+        {
+            return VerifyGolden(golden_dir, mml_files) ? EXIT_SUCCESS : EXIT_MISMATCH;
+        }
+
+        PrintUsage();
+        return EXIT_ERROR;
+    }
+
+    int RunTrace(const std::vector<std::string>& args)
+    {
+        TraceOptions options;
+        std::vector<std::string> positional;
+        for (size_t i = 0; i < args.size(); i++)
+        {
+            const auto& arg = args[i];
+            if (arg == "-s" && i + 1 < args.size())
+            {
+                options.Seconds = std::stoul(args[++i]);
+            }
+            else if (arg == "-r" && i + 1 < args.size())
+            {
+                options.Rate = std::stoul(args[++i]);
+            }
+            else if (arg == "--chrome" && i + 1 < args.size())
+            {
+                options.ChromeTracePath = args[++i];
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (positional.size() != 1)
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+
+        return TraceRegisterWrites(positional[0], options) ? EXIT_SUCCESS : EXIT_ERROR;
+    }
+
+    int RunS98(const std::vector<std::string>& args)
+    {
+        if (args.empty())
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+
+        const auto& mode = args[0];
+        S98Options options;
+        std::vector<std::string> positional;
+        for (size_t i = 1; i < args.size(); i++)
+        {
+            const auto& arg = args[i];
+            if (arg == "-s" && i + 1 < args.size())
+            {
+                options.Seconds = std::stoul(args[++i]);
+            }
+            else if (arg == "-r" && i + 1 < args.size())
+            {
+                options.Rate = std::stoul(args[++i]);
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (positional.size() != 2)
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+
+        if (mode == "export")
+        {
+            return ExportS98(positional[0], positional[1], options) ? EXIT_SUCCESS : EXIT_ERROR;
+        }
+        if (mode == "render")
+        {
+            return RenderS98(positional[0], positional[1], options) ? EXIT_SUCCESS : EXIT_ERROR;
+        }
+
+        PrintUsage();
+        return EXIT_ERROR;
+    }
+
+    int RunSeek(const std::vector<std::string>& args)
+    {
+        SeekOptions options;
+        std::vector<std::string> positional;
+        for (size_t i = 0; i < args.size(); i++)
+        {
+            const auto& arg = args[i];
+            if (arg == "-s" && i + 1 < args.size())
+            {
+                options.Seconds = std::stoul(args[++i]);
+            }
+            else if (arg == "-r" && i + 1 < args.size())
+            {
+                options.Rate = std::stoul(args[++i]);
+            }
+            else if (arg == "-q" && i + 1 < args.size())
+            {
+                options.Quality = ParseQuality(args[++i]);
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (positional.size() != 3)
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+
+        return RenderFromLine(positional[0], std::stoi(positional[1]), positional[2], options) ? EXIT_SUCCESS : EXIT_ERROR;
+    }
+
+    int RunBench(const std::vector<std::string>& args)
+    {
+        BenchOptions options;
+        std::vector<std::string> positional;
+        for (size_t i = 0; i < args.size(); i++)
+        {
+            const auto& arg = args[i];
+            if (arg == "-s" && i + 1 < args.size())
+            {
+                options.Seconds = std::stoul(args[++i]);
+            }
+            else if (arg == "-r" && i + 1 < args.size())
+            {
+                options.Rate = std::stoul(args[++i]);
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (positional.empty())
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+
+        return RunBenchmark(positional, options) ? EXIT_SUCCESS : EXIT_ERROR;
+    }
+
+    int RunOverview(const std::vector<std::string>& args)
+    {
+        OverviewOptions options;
+        std::vector<std::string> positional;
+        for (size_t i = 0; i < args.size(); i++)
+        {
+            const auto& arg = args[i];
+            if (arg == "-w" && i + 1 < args.size())
+            {
+                options.WindowMilliseconds = std::stoi(args[++i]);
+            }
+            else if (arg == "--csv" && i + 1 < args.size())
+            {
+                options.CsvPath = args[++i];
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (positional.empty())
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+
+        return PrintOverview(positional, options) ? EXIT_SUCCESS : EXIT_ERROR;
+    }
+
+    int RunStems(const std::vector<std::string>& args)
+    {
+        StemOptions options;
+        std::vector<std::string> positional;
+        for (size_t i = 0; i < args.size(); i++)
+        {
+            const auto& arg = args[i];
+            if (arg == "-s" && i + 1 < args.size())
+            {
+                options.Seconds = std::stoul(args[++i]);
+            }
+            else if (arg == "-r" && i + 1 < args.size())
+            {
+                options.Rate = std::stoul(args[++i]);
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (positional.size() != 2)
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+
+        return ExportStems(positional[0], positional[1], options) ? EXIT_SUCCESS : EXIT_ERROR;
+    }
+
+    int RunServe(const std::vector<std::string>& args)
+    {
+        ServerOptions options;
+        std::vector<std::string> positional;
+        for (size_t i = 0; i < args.size(); i++)
+        {
+            const auto& arg = args[i];
+            if (arg == "-j" && i + 1 < args.size())
+            {
+                options.Threads = std::stoul(args[++i]);
+            }
+            else if (arg == "-c" && i + 1 < args.size())
+            {
+                options.CachedSongs = std::stoul(args[++i]);
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (positional.size() != 1)
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+
+        return RunRenderServer(positional[0], options) ? EXIT_SUCCESS : EXIT_ERROR;
+    }
+
+    int RunClient(const std::vector<std::string>& args)
+    {
+        if (args.size() < 2)
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+
+        const auto& socket_path = args[0];
+        const auto& mode = args[1];
+        unsigned int seconds = 60;
+        unsigned int rate = 55466;
+        auto quality = MusicCom::MusicCom::Quality::Standard;
+        int window_ms = 100;
+        std::vector<std::string> positional;
+        for (size_t i = 2; i < args.size(); i++)
+        {
+            const auto& arg = args[i];
+            if (arg == "-s" && i + 1 < args.size())
+            {
+                seconds = std::stoul(args[++i]);
+            }
+            else if (arg == "-r" && i + 1 < args.size())
+            {
+                rate = std::stoul(args[++i]);
+            }
+            else if (arg == "-q" && i + 1 < args.size())
+            {
+                quality = ParseQuality(args[++i]);
+            }
+            else if (arg == "-w" && i + 1 < args.size())
+            {
+                window_ms = std::stoi(args[++i]);
+            }
+            else
+            {
+                // サーバーの作業ディレクトリによらないよう絶対パスで送る
+                positional.push_back(std::filesystem::absolute(arg).string());
+            }
+        }
+
+        std::vector<std::string> fields;
+        if (mode == "render" && positional.size() == 2)
+        {
+            fields = {mode, std::to_string(rate), std::to_string(seconds), std::to_string(static_cast<int>(quality)), positional[0], positional[1]};
+        }
+        else if (mode == "length" && positional.size() == 1)
+        {
+            fields = {mode, positional[0]};
+        }
+        else if (mode == "analyze" && positional.size() == 1)
+        {
+            fields = {mode, std::to_string(window_ms), positional[0]};
+        }
+        else if (mode == "shutdown" && positional.empty())
+        {
+            fields = {mode};
+        }
+        else
+        {
+            PrintUsage();
+            return EXIT_ERROR;
+        }
+
+        return SendRenderRequest(socket_path, fields) ? EXIT_SUCCESS : EXIT_ERROR;
+    }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return EXIT_ERROR;
+    }
+
+    std::string command(argv[1]);
+    std::vector<std::string> args(argv + 2, argv + argc);
+
+    try
+    {
+        if (command == "golden")
+        {
+            return RunGolden(args);
+        }
+        if (command == "trace")
+        {
+            return RunTrace(args);
+        }
+        if (command == "s98")
+        {
+            return RunS98(args);
+        }
+        if (command == "seek")
+        {
+            return RunSeek(args);
+        }
+        if (command == "bench")
+        {
+            return RunBench(args);
+        }
+        if (command == "overview")
+        {
+            return RunOverview(args);
+        }
+        if (command == "stems")
+        {
+            return RunStems(args);
+        }
+        if (command == "serve")
+        {
+            return RunServe(args);
+        }
+        if (command == "client")
+        {
+            return RunClient(args);
+        }
+        if (command == "selftest")
+        {
+            return RunSelfTests() ? EXIT_SUCCESS : EXIT_MISMATCH;
+        }
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_ERROR;
+    }
+
+    PrintUsage();
+    return EXIT_ERROR;
+}
@@ -0,0 +1,111 @@
+﻿#include "bench.h"
+#include "../KbAsciiMml/musiccom/mmlparser.h"
+#include "../KbAsciiMml/musiccom/musdata.h"
+#include "../KbAsciiMml/musiccom/musiccom.h"
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace KbAsciiMmlTool
+{
+    namespace
+    {
+        const int BLOCK_SIZE = 1024;
+        // 解析時間は短いため、この時間以上かつ最低回数まで繰り返して平均する
+        const double PARSE_MIN_SECONDS = 0.5;
+        const int PARSE_MIN_ITERATIONS = 5;
+
+        // 1 回あたりの解析にかかった時間 (秒)
+        template<typename Parse>
+        double MeasureParse(Parse parse)
+        {
+            int iterations = 0;
+            auto start = std::chrono::steady_clock::now();
+            double elapsed = 0.0;
+            do
+            {
+                std::unique_ptr<MusicCom::MusicData> music_data(parse());
+                iterations++;
+                elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while (iterations < PARSE_MIN_ITERATIONS || elapsed < PARSE_MIN_SECONDS);
+            return elapsed / iterations;
+        }
+
+        // レンダリングにかかった時間 (秒)
+        double Render(const std::string& mml_file, MusicCom::MusicCom::Quality quality, bool native_rate, const BenchOptions& options)
+        {
+            MusicCom::MusicCom music_com;
+            music_com.SetQuality(quality);
+            music_com.EnableNativeRate(native_rate);
+            if (!music_com.Load(mml_file.c_str()))
+            {
+                throw std::runtime_error(std::format("{}: cannot open", mml_file));
+            }
+            if (!music_com.PrepareMix(options.Rate))
+            {
+                throw std::runtime_error(std::format("{}: cannot initialize OPN", mml_file));
+            }
+
+            std::vector<int16_t> buffer(BLOCK_SIZE * 2);
+            uint64_t samples = static_cast<uint64_t>(options.Seconds) * options.Rate;
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t pos = 0; pos < samples; pos += BLOCK_SIZE)
+            {
+                music_com.Mix(buffer.data(), static_cast<int>(std::min<uint64_t>(BLOCK_SIZE, samples - pos)));
+            }
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    } // namespace
+
+    bool RunBenchmark(const std::vector<std::string>& mml_files, const BenchOptions& options)
+    {
+        using Quality = MusicCom::MusicCom::Quality;
+        const struct
+        {
+            const char* Name;
+            Quality Quality;
+            bool NativeRate;
+        } cases[] = {
+            { "draft", Quality::Draft, false },
+            { "standard", Quality::Standard, false },
+            { "high", Quality::High, false },
+            { "native", Quality::Standard, true },
+        };
+
+        for (const auto& mml_file : mml_files)
+        {
+            std::ifstream stream(mml_file, std::ios::binary);
+            if (!stream)
+            {
+                throw std::runtime_error(std::format("{}: cannot open", mml_file));
+            }
+            std::vector<char> data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+            double parse_file = MeasureParse(
+                [&mml_file]()
+                {
+                    return MusicCom::ParseMML(mml_file.c_str());
+                });
+            double parse_buffer = MeasureParse(
+                [&mml_file, &data]()
+                {
+                    return MusicCom::ParseMML(data.data(), data.size(), mml_file.c_str());
+                });
+
+            std::cout << std::format("{} ({} bytes, {} Hz, {} s)\n", mml_file, data.size(), options.Rate, options.Seconds);
+            std::cout << std::format("  {:<8} {:9.2f} ms  (from memory {:.2f} ms)\n", "parse", parse_file * 1000.0, parse_buffer * 1000.0);
+            for (const auto& c : cases)
+            {
+                double seconds = Render(mml_file, c.Quality, c.NativeRate, options);
+                std::cout << std::format("  {:<8} {:9.1f} ms  {:7.1f}x realtime\n", c.Name, seconds * 1000.0, options.Seconds / seconds);
+            }
+        }
+        return true;
+    }
+
+} // namespace KbAsciiMmlTool
@@ -0,0 +1,24 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+namespace KbAsciiMmlTool
+{
+    struct BenchOptions
+    {
+        BenchOptions()
+            : Rate(44100),
+              Seconds(60)
+        {
+        }
+
+        unsigned int Rate;
+        unsigned int Seconds;
+    };
+
+    // MMLファイルの解析 (ファイルから・メモリ上のバッファから) にかかる時間と、規定時間レンダリングして
+    // 合成の品質ごとに出力レートで直接合成した場合と音源本来のレートで合成してリサンプルした場合の処理時間を標準出力に表示する
+    bool RunBenchmark(const std::vector<std::string>& mml_files, const BenchOptions& options);
+
+} // namespace KbAsciiMmlTool
@@ -0,0 +1,281 @@
+﻿#include "golden.h"
+#include "../KbAsciiMml/musiccom/musiccom.h"
+#include <boost/crc.hpp>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+
+namespace KbAsciiMmlTool
+{
+    namespace
+    {
+        const char GOLDEN_MAGIC[4] = {'K', 'A', 'M', 'G'};
+        const uint32_t GOLDEN_VERSION = 1;
+
+        // ファイル形式 (リトルエンディアン)
+        //   GoldenHeader
+        //   uint32_t     crc[BlockCount]   ... BlockSize サンプル(ステレオ)ごとのCRC32
+        //   RegisterWrite write[WriteCount]
+        struct GoldenHeader
+        {
+            char Magic[4];
+            uint32_t Version;
+            uint32_t Rate;
+            uint32_t Samples;
+            uint32_t BlockSize;
+            uint32_t BlockCount;
+            uint32_t WriteCount;
+        };
+
+        struct RegisterWrite
+        {
+            uint32_t Sample;
+            uint8_t Addr;
+            uint8_t Data;
+            uint16_t Reserved;
+        };
+
+        struct RenderResult
+        {
+            std::vector<uint32_t> BlockCrcs;
+            std::vector<RegisterWrite> Writes;
+            std::vector<int16_t> PCM;
+        };
+
+        RenderResult Render(const std::string& mml_file, uint32_t rate, uint32_t samples, uint32_t block_size, bool keep_pcm)
+        {
+            RenderResult result;
+
+            MusicCom::MusicCom music_com;
+            music_com.SetRegisterWriteObserver(
+                [&result](uint64_t sample, uint addr, uint data)
+                {
+                    result.Writes.push_back({static_cast<uint32_t>(sample), static_cast<uint8_t>(addr), static_cast<uint8_t>(data), 0});
+                });
+
+            if (!music_com.Load(mml_file.c_str()))
+            {
+                throw std::runtime_error(std::format("{}: cannot open", mml_file));
+            }
+            if (!music_com.PrepareMix(rate))
+            {
+                throw std::runtime_error(std::format("{}: cannot initialize OPN", mml_file));
+            }
+
+            std::vector<int16_t> buffer(block_size * 2);
+            for (uint32_t pos = 0; pos < samples; pos += block_size)
+            {
+                int count = static_cast<int>(std::min(block_size, samples - pos));
+                music_com.Mix(buffer.data(), count);
+
+                boost::crc_32_type crc;
+                crc.process_bytes(buffer.data(), count * 2 * sizeof(int16_t));
+                result.BlockCrcs.push_back(crc.checksum());
+
+                if (keep_pcm)
+                {
+                    result.PCM.insert(result.PCM.end(), buffer.begin(), buffer.begin() + count * 2);
+                }
+            }
+
+            // 規定時間外の書き込みは比較対象外
+            std::erase_if(
+                result.Writes,
+                [samples](const RegisterWrite& write)
+                {
+                    return write.Sample >= samples;
+                });
+
+            return result;
+        }
+
+        // 別のディレクトリにある同名のファイルを区別するため、作業ディレクトリからの相対パスで保存する
+        // (作業ディレクトリの外のファイルはルートを除いた絶対パス)
+        std::filesystem::path GoldenPath(const std::string& golden_dir, const std::string& mml_file, const char* extension)
+        {
+            auto path = std::filesystem::absolute(mml_file).lexically_normal();
+            auto name = path.lexically_relative(std::filesystem::current_path());
+            if (name.empty() || *name.begin() == "..")
+            {
+                name = path.relative_path();
+            }
+            return std::filesystem::path(golden_dir) / name.replace_extension(extension);
+        }
+
+        template<typename T>
+        void WriteVector(std::ofstream& stream, const std::vector<T>& data)
+        {
+            stream.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(T));
+        }
+
+        template<typename T>
+        std::vector<T> ReadVector(std::ifstream& stream, size_t count)
+        {
+            std::vector<T> data(count);
+            stream.read(reinterpret_cast<char*>(data.data()), count * sizeof(T));
+            return data;
+        }
+
+        std::string FormatWrite(const RegisterWrite& write)
+        {
+            return std::format("[{:02X}]={:02X} at sample {}", static_cast<unsigned int>(write.Addr), static_cast<unsigned int>(write.Data), write.Sample);
+        }
+
+        std::string FormatSample(uint32_t sample, uint32_t rate)
+        {
+            return std::format("{} ({:.3f}s)", sample, static_cast<double>(sample) / rate);
+        }
+
+        // 最初に相違したサンプル位置を探す (生PCMが保存されている場合のみ)
+        std::optional<uint32_t> FindDivergentSample(const std::filesystem::path& pcm_path, const std::vector<int16_t>& pcm)
+        {
+            std::ifstream stream(pcm_path, std::ios::binary);
+            if (!stream)
+            {
+                return std::nullopt;
+            }
+            auto expected = ReadVector<int16_t>(stream, pcm.size());
+            for (size_t i = 0; i < pcm.size(); i++)
+            {
+                if (expected[i] != pcm[i])
+                {
+                    return static_cast<uint32_t>(i / 2);
+                }
+            }
+            return std::nullopt;
+        }
+
+        bool VerifyOne(const std::string& golden_dir, const std::string& mml_file)
+        {
+            auto golden_path = GoldenPath(golden_dir, mml_file, ".golden");
+            std::ifstream stream(golden_path, std::ios::binary);
+            if (!stream)
+            {
+                throw std::runtime_error(std::format("{}: golden data not found", golden_path.string()));
+            }
+
+            GoldenHeader header;
+            stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+            if (!stream || !std::equal(std::begin(GOLDEN_MAGIC), std::end(GOLDEN_MAGIC), header.Magic) || header.Version != GOLDEN_VERSION)
+            {
+                throw std::runtime_error(std::format("{}: invalid golden data", golden_path.string()));
+            }
+            auto expected_crcs = ReadVector<uint32_t>(stream, header.BlockCount);
+            auto expected_writes = ReadVector<RegisterWrite>(stream, header.WriteCount);
+            if (!stream)
+            {
+                throw std::runtime_error(std::format("{}: truncated golden data", golden_path.string()));
+            }
+
+            auto pcm_path = GoldenPath(golden_dir, mml_file, ".raw");
+            bool has_pcm = std::filesystem::exists(pcm_path);
+            auto actual = Render(mml_file, header.Rate, header.Samples, header.BlockSize, has_pcm);
+
+            std::vector<std::string> report;
+
+            // PCM
+            auto crc_mismatch = std::mismatch(expected_crcs.begin(), expected_crcs.end(), actual.BlockCrcs.begin());
+            if (crc_mismatch.first != expected_crcs.end())
+            {
+                uint32_t block = static_cast<uint32_t>(crc_mismatch.first - expected_crcs.begin());
+                uint32_t begin = block * header.BlockSize;
+                uint32_t end = std::min(begin + header.BlockSize, header.Samples);
+                auto sample = has_pcm ? FindDivergentSample(pcm_path, actual.PCM) : std::nullopt;
+                if (sample)
+                {
+                    report.push_back(std::format("  pcm: first divergent sample {}", FormatSample(*sample, header.Rate)));
+                }
+                else
+                {
+                    report.push_back(std::format("  pcm: first divergent block #{} (samples {} - {})", block, FormatSample(begin, header.Rate), FormatSample(end - 1, header.Rate)));
+                }
+            }
+
+            // レジスタ書き込み
+            auto write_mismatch = std::mismatch(
+                expected_writes.begin(),
+                expected_writes.end(),
+                actual.Writes.begin(),
+                actual.Writes.end(),
+                [](const RegisterWrite& lhs, const RegisterWrite& rhs)
+                {
+                    return lhs.Sample == rhs.Sample && lhs.Addr == rhs.Addr && lhs.Data == rhs.Data;
+                });
+            if (write_mismatch.first != expected_writes.end() || write_mismatch.second != actual.Writes.end())
+            {
+                auto index = write_mismatch.first - expected_writes.begin();
+                auto expected = (write_mismatch.first != expected_writes.end()) ? FormatWrite(*write_mismatch.first) : std::string("(none)");
+                auto found = (write_mismatch.second != actual.Writes.end()) ? FormatWrite(*write_mismatch.second) : std::string("(none)");
+                report.push_back(std::format("  reg: first divergent write #{}: expected {}, actual {}", index, expected, found));
+            }
+
+            if (report.empty())
+            {
+                std::cout << "OK " << mml_file << std::endl;
+                return true;
+            }
+
+            std::cout << "NG " << mml_file << std::endl;
+            for (const auto& line : report)
+            {
+                std::cout << line << std::endl;
+            }
+            return false;
+        }
+    } // namespace
+
+    bool RecordGolden(const std::string& golden_dir, const std::vector<std::string>& mml_files, const GoldenOptions& options)
+    {
+        std::filesystem::create_directories(golden_dir);
+
+        uint32_t samples = options.Rate * options.Seconds;
+        for (const auto& mml_file : mml_files)
+        {
+            auto result = Render(mml_file, options.Rate, samples, options.BlockSize, options.KeepPCM);
+
+            GoldenHeader header = {
+                {GOLDEN_MAGIC[0], GOLDEN_MAGIC[1], GOLDEN_MAGIC[2], GOLDEN_MAGIC[3]},
+                GOLDEN_VERSION,
+                options.Rate,
+                samples,
+                options.BlockSize,
+                static_cast<uint32_t>(result.BlockCrcs.size()),
+                static_cast<uint32_t>(result.Writes.size())};
+
+            auto golden_path = GoldenPath(golden_dir, mml_file, ".golden");
+            std::filesystem::create_directories(golden_path.parent_path());
+            std::ofstream stream(golden_path, std::ios::binary);
+            stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            WriteVector(stream, result.BlockCrcs);
+            WriteVector(stream, result.Writes);
+            if (!stream)
+            {
+                throw std::runtime_error(std::format("{}: cannot write golden data", golden_dir));
+            }
+
+            if (options.KeepPCM)
+            {
+                std::ofstream pcm_stream(GoldenPath(golden_dir, mml_file, ".raw"), std::ios::binary);
+                WriteVector(pcm_stream, result.PCM);
+            }
+
+            std::cout << "recorded " << mml_file << " (" << result.Writes.size() << " writes)" << std::endl;
+        }
+        return true;
+    }
+
+    bool VerifyGolden(const std::string& golden_dir, const std::vector<std::string>& mml_files)
+    {
+        bool all_passed = true;
+        for (const auto& mml_file : mml_files)
+        {
+            all_passed = VerifyOne(golden_dir, mml_file) && all_passed;
+        }
+        return all_passed;
+    }
+
+} // namespace KbAsciiMmlTool
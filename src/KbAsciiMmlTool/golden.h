@@ -0,0 +1,32 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+namespace KbAsciiMmlTool
+{
+    struct GoldenOptions
+    {
+        GoldenOptions()
+            : Rate(55466),
+              Seconds(60),
+              BlockSize(1024),
+              KeepPCM(false)
+        {
+        }
+
+        unsigned int Rate;
+        unsigned int Seconds;
+        // PCMハッシュの単位 (サンプル数)
+        unsigned int BlockSize;
+        // 比較時に先頭の相違サンプルを特定できるよう生のPCMも保存する
+        bool KeepPCM;
+    };
+
+    // MMLファイルを規定時間レンダリングし、比較用のデータを golden_dir に保存する
+    bool RecordGolden(const std::string& golden_dir, const std::vector<std::string>& mml_files, const GoldenOptions& options);
+
+    // 保存済みのデータと比較し、すべて一致した場合のみ true を返す
+    bool VerifyGolden(const std::string& golden_dir, const std::vector<std::string>& mml_files);
+
+} // namespace KbAsciiMmlTool
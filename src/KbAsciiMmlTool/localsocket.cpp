@@ -0,0 +1,196 @@
+﻿#include "localsocket.h"
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace KbAsciiMmlTool
+{
+    namespace
+    {
+        // 1 行の上限 (ファイル名を含む要求には十分な長さ)
+        const size_t MAX_LINE_LENGTH = 64 * 1024;
+
+#ifdef _WIN32
+        const LocalSocket::Handle INVALID_HANDLE = INVALID_SOCKET;
+        const int SEND_FLAGS = 0;
+
+        void CloseSocketHandle(LocalSocket::Handle handle)
+        {
+            closesocket(handle);
+        }
+
+        void InitializeSockets()
+        {
+            static std::once_flag once;
+            std::call_once(
+                once,
+                []()
+                {
+                    WSADATA data;
+                    WSAStartup(MAKEWORD(2, 2), &data);
+                });
+        }
+#else
+        const LocalSocket::Handle INVALID_HANDLE = -1;
+        // 相手が切断していてもシグナルで終了しないようにする
+        const int SEND_FLAGS = MSG_NOSIGNAL;
+
+        void CloseSocketHandle(LocalSocket::Handle handle)
+        {
+            close(handle);
+        }
+
+        void InitializeSockets()
+        {
+        }
+#endif
+
+        sockaddr_un MakeAddress(const std::string& path)
+        {
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path))
+            {
+                throw std::runtime_error(std::format("{}: socket path too long", path));
+            }
+            std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+            return address;
+        }
+    } // namespace
+
+    LocalSocket::LocalSocket()
+        : handle_(INVALID_HANDLE)
+    {
+    }
+
+    LocalSocket::LocalSocket(Handle handle)
+        : handle_(handle)
+    {
+    }
+
+    LocalSocket::~LocalSocket()
+    {
+        Close();
+    }
+
+    LocalSocket::LocalSocket(LocalSocket&& other) noexcept
+        : handle_(std::exchange(other.handle_, INVALID_HANDLE)),
+          received_(std::move(other.received_))
+    {
+    }
+
+    LocalSocket& LocalSocket::operator=(LocalSocket&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Close();
+            handle_ = std::exchange(other.handle_, INVALID_HANDLE);
+            received_ = std::move(other.received_);
+        }
+        return *this;
+    }
+
+    LocalSocket LocalSocket::Listen(const std::string& path)
+    {
+        InitializeSockets();
+        auto address = MakeAddress(path);
+        LocalSocket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if (!socket.IsValid())
+        {
+            throw std::runtime_error("cannot create socket");
+        }
+
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        if (bind(socket.handle_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(socket.handle_, SOMAXCONN) != 0)
+        {
+            throw std::runtime_error(std::format("{}: cannot listen", path));
+        }
+        return socket;
+    }
+
+    LocalSocket LocalSocket::Connect(const std::string& path)
+    {
+        InitializeSockets();
+        auto address = MakeAddress(path);
+        LocalSocket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if (!socket.IsValid() ||
+            connect(socket.handle_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+        {
+            throw std::runtime_error(std::format("{}: cannot connect", path));
+        }
+        return socket;
+    }
+
+    LocalSocket LocalSocket::Accept()
+    {
+        return LocalSocket(accept(handle_, nullptr, nullptr));
+    }
+
+    bool LocalSocket::IsValid() const
+    {
+        return handle_ != INVALID_HANDLE;
+    }
+
+    bool LocalSocket::ReadLine(std::string& line)
+    {
+        size_t end;
+        while ((end = received_.find('\n')) == std::string::npos)
+        {
+            if (received_.size() > MAX_LINE_LENGTH)
+            {
+                return false;
+            }
+            char buffer[4096];
+            auto size = recv(handle_, buffer, sizeof(buffer), 0);
+            if (size <= 0)
+            {
+                return false;
+            }
+            received_.append(buffer, size);
+        }
+        line.assign(received_, 0, end);
+        received_.erase(0, end + 1);
+        return true;
+    }
+
+    bool LocalSocket::WriteLine(const std::string& line)
+    {
+        auto data = line + '\n';
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            auto size = send(handle_, data.data() + sent, static_cast<int>(data.size() - sent), SEND_FLAGS);
+            if (size <= 0)
+            {
+                return false;
+            }
+            sent += size;
+        }
+        return true;
+    }
+
+    void LocalSocket::Close()
+    {
+        if (IsValid())
+        {
+            CloseSocketHandle(handle_);
+            handle_ = INVALID_HANDLE;
+        }
+    }
+
+} // namespace KbAsciiMmlTool
@@ -0,0 +1,46 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace KbAsciiMmlTool
+{
+    // 同じマシン内のプロセス間通信用の Unix ドメインソケット (Windows 10 以降の AF_UNIX にも対応)
+    // 要求・応答は改行で終わる 1 行のテキスト
+    class LocalSocket
+    {
+    public:
+#ifdef _WIN32
+        using Handle = uintptr_t; // SOCKET
+#else
+        using Handle = int;
+#endif
+
+        LocalSocket();
+        ~LocalSocket();
+        LocalSocket(LocalSocket&& other) noexcept;
+        LocalSocket& operator=(LocalSocket&& other) noexcept;
+
+        LocalSocket(const LocalSocket&) = delete;
+        LocalSocket& operator=(const LocalSocket&) = delete;
+
+        // path に残っている前回のソケットのファイルは削除してから作成する (失敗した場合は例外を送出する)
+        static LocalSocket Listen(const std::string& path);
+        static LocalSocket Connect(const std::string& path);
+        // 失敗した場合は無効なソケットを返す
+        LocalSocket Accept();
+
+        bool IsValid() const;
+        // 改行までを読み込む (改行は含めない、切断された場合は false)
+        bool ReadLine(std::string& line);
+        bool WriteLine(const std::string& line);
+
+    private:
+        explicit LocalSocket(Handle handle);
+        void Close();
+
+        Handle handle_;
+        std::string received_; // 読み込んだが、まだ返していない部分
+    };
+
+} // namespace KbAsciiMmlTool
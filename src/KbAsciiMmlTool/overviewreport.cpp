@@ -0,0 +1,81 @@
+﻿#include "overviewreport.h"
+#include "../KbAsciiMml/musiccom/mmlparser.h"
+#include "../KbAsciiMml/musiccom/musiccom.h"
+#include "../KbAsciiMml/musiccom/musdata.h"
+#include "../KbAsciiMml/musiccom/overview.h"
+#include "../KbAsciiMml/musiccom/sounddata.h"
+#include "../KbAsciiMml/musiccom/soundparser.h"
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+namespace KbAsciiMmlTool
+{
+    namespace
+    {
+        void WriteCsv(const std::string& path, const MusicCom::Overview& overview)
+        {
+            std::ofstream stream(path);
+            if (!stream)
+            {
+                throw std::runtime_error(std::format("{}: cannot open", path));
+            }
+            stream << "seconds,peak,rms\n";
+            for (size_t i = 0; i < overview.Windows.size(); i++)
+            {
+                const auto& window = overview.Windows[i];
+                stream << std::format("{:.3f},{:.6f},{:.6f}\n", i * overview.WindowMilliseconds / 1000.0, window.Peak, window.RMS);
+            }
+        }
+    } // namespace
+
+    bool PrintOverview(const std::vector<std::string>& mml_files, const OverviewOptions& options)
+    {
+        for (const auto& mml_file : mml_files)
+        {
+            std::unique_ptr<MusicCom::MusicData> music(MusicCom::ParseMML(mml_file.c_str()));
+            std::unique_ptr<MusicCom::SoundData> sound(MusicCom::ParseSound(mml_file));
+            if (!music || !sound)
+            {
+                throw std::runtime_error(std::format("{}: cannot open", mml_file));
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            auto overview = MusicCom::AnalyzeOverview(*music, *sound, MusicCom::MusicCom::SOUND_EFFECT_DEFAULT_TEMPO, options.WindowMilliseconds);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            double length = overview.IntroSeconds + overview.LoopSeconds;
+            std::cout << std::format("{}\n", mml_file);
+            std::cout << std::format("  intro     {:9.2f} s\n", overview.IntroSeconds);
+            if (overview.LoopSeconds > 0.0)
+            {
+                std::cout << std::format("  loop      {:9.2f} s\n", overview.LoopSeconds);
+            }
+            else
+            {
+                std::cout << "  loop            none\n";
+            }
+            if (std::isfinite(overview.Loudness))
+            {
+                std::cout << std::format("  loudness  {:9.1f} LUFS\n", overview.Loudness);
+            }
+            else
+            {
+                std::cout << "  loudness      silent\n";
+            }
+            std::cout << std::format("  windows   {:9} x {} ms\n", overview.Windows.size(), overview.WindowMilliseconds);
+            std::cout << std::format("  analysis  {:9.1f} ms  {:7.1f}x realtime\n", seconds * 1000.0, length / seconds);
+
+            if (!options.CsvPath.empty())
+            {
+                WriteCsv(options.CsvPath, overview);
+            }
+        }
+        return true;
+    }
+
+} // namespace KbAsciiMmlTool
@@ -0,0 +1,23 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+namespace KbAsciiMmlTool
+{
+    struct OverviewOptions
+    {
+        OverviewOptions()
+            : WindowMilliseconds(100)
+        {
+        }
+
+        int WindowMilliseconds;
+        std::string CsvPath; // 空でなければ窓ごとのピーク・RMS を書き出す (ファイルが複数の場合は最後のもの)
+    };
+
+    // MMLファイルの波形の概観とラウドネスを解析し、結果と処理時間を標準出力に表示する
+    // (MMLファイルの隣のキャッシュは使わず、毎回解析する)
+    bool PrintOverview(const std::vector<std::string>& mml_files, const OverviewOptions& options);
+
+} // namespace KbAsciiMmlTool
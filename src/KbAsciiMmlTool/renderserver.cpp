@@ -0,0 +1,339 @@
+﻿#include "renderserver.h"
+#include "localsocket.h"
+#include "../KbAsciiMml/musiccom/musiccom.h"
+#include "../KbAsciiMml/musiccom/overview.h"
+#include "../KbAsciiMml/musiccom/songcache.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+
+namespace KbAsciiMmlTool
+{
+    namespace
+    {
+        const unsigned int OPN_CLOCKFREQ = 3993600; // OPNのクロック周波数
+        const int BLOCK_SIZE = 4096;
+        const int OUTPUT_CHANNELS = 2;
+
+        std::vector<std::string> SplitFields(const std::string& line)
+        {
+            std::vector<std::string> fields;
+            std::istringstream stream(line);
+            std::string field;
+            while (std::getline(stream, field, '\t'))
+            {
+                fields.push_back(field);
+            }
+            return fields;
+        }
+
+        std::string JoinFields(const std::vector<std::string>& fields)
+        {
+            std::string line;
+            for (const auto& field : fields)
+            {
+                if (!line.empty())
+                {
+                    line += '\t';
+                }
+                line += field;
+            }
+            return line;
+        }
+
+        // 解析済みの曲 (MML と SOUND.DAT を読み込んだ MusicCom) を保持する
+        // 同じ曲の要求が重なった場合は、それぞれが別の MusicCom を使う
+        class SongPool
+        {
+        public:
+            explicit SongPool(size_t capacity)
+                : capacity_(capacity)
+            {
+            }
+
+            // 内容が同じ曲を保持していれば取り出し、なければ読み込む
+            std::unique_ptr<MusicCom::MusicCom> Acquire(const std::string& path, uint64_t& key)
+            {
+                auto computed = MusicCom::SongCache::ComputeKey(path.c_str());
+                if (!computed)
+                {
+                    throw std::runtime_error(std::format("{}: cannot open", path));
+                }
+                key = *computed;
+                {
+                    std::lock_guard lock(mutex_);
+                    auto found = std::find_if(
+                        songs_.begin(),
+                        songs_.end(),
+                        [&](const Song& song)
+                        {
+                            return song.Path == path && song.Key == key;
+                        });
+                    if (found != songs_.end())
+                    {
+                        auto music = std::move(found->Music);
+                        songs_.erase(found);
+                        return music;
+                    }
+                }
+
+                auto music = std::make_unique<MusicCom::MusicCom>();
+                if (!music->Load(path.c_str()))
+                {
+                    throw std::runtime_error(std::format("{}: cannot open", path));
+                }
+                return music;
+            }
+
+            void Release(const std::string& path, uint64_t key, std::unique_ptr<MusicCom::MusicCom> music)
+            {
+                std::lock_guard lock(mutex_);
+                // 変更前の内容の曲はもう使わない
+                songs_.remove_if(
+                    [&](const Song& song)
+                    {
+                        return song.Path == path && song.Key != key;
+                    });
+                songs_.push_front(Song{path, key, std::move(music)});
+                if (songs_.size() > capacity_)
+                {
+                    songs_.pop_back();
+                }
+            }
+
+        private:
+            struct Song
+            {
+                std::string Path;
+                uint64_t Key; // SongCache::ComputeKey
+                std::unique_ptr<MusicCom::MusicCom> Music;
+            };
+
+            const size_t capacity_;
+            std::mutex mutex_;
+            std::list<Song> songs_; // 最近返却した順
+        };
+
+        class RenderServer
+        {
+        public:
+            RenderServer(const std::string& socket_path, const ServerOptions& options)
+                : socketPath_(socket_path),
+                  songs_(options.CachedSongs),
+                  stopping_(false)
+            {
+                // 音源のテーブルはプロセスで共有し、最初の初期化で作成されるため、
+                // スレッドで同時に作成しないよう先に作成しておく
+                // (PSG の音量のテーブルも共有のため、要求ごとに音量は変更しない)
+                FM::OPN opn;
+                opn.Init(OPN_CLOCKFREQ, 55466, false);
+
+                listener_ = LocalSocket::Listen(socket_path);
+                unsigned int threads = (options.Threads > 0) ? options.Threads : std::max(1u, std::thread::hardware_concurrency());
+                for (unsigned int i = 0; i < threads; i++)
+                {
+                    workers_.emplace_back(
+                        [this](std::stop_token stop)
+                        {
+                            Work(stop);
+                        });
+                }
+            }
+
+            ~RenderServer()
+            {
+                std::error_code ec;
+                std::filesystem::remove(socketPath_, ec);
+            }
+
+            void Run()
+            {
+                std::cout << std::format("listening on {} ({} threads)\n", socketPath_, workers_.size()) << std::flush;
+                while (!stopping_)
+                {
+                    auto connection = listener_.Accept();
+                    if (!connection.IsValid() || stopping_)
+                    {
+                        continue;
+                    }
+                    std::lock_guard lock(mutex_);
+                    connections_.push_back(std::move(connection));
+                    cv_.notify_one();
+                }
+            }
+
+        private:
+            void Work(std::stop_token stop)
+            {
+                while (true)
+                {
+                    LocalSocket connection;
+                    {
+                        std::unique_lock lock(mutex_);
+                        if (!cv_.wait(lock, stop, [this]() { return !connections_.empty(); }))
+                        {
+                            return;
+                        }
+                        connection = std::move(connections_.front());
+                        connections_.pop_front();
+                    }
+
+                    std::string line;
+                    if (connection.ReadLine(line))
+                    {
+                        connection.WriteLine(HandleRequest(SplitFields(line)));
+                    }
+                }
+            }
+
+            std::string HandleRequest(const std::vector<std::string>& fields)
+            {
+                auto start = std::chrono::steady_clock::now();
+                std::string response;
+                try
+                {
+                    response = Dispatch(fields);
+                }
+                catch (std::exception& e)
+                {
+                    response = JoinFields({"error", e.what()});
+                }
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                Log(std::format("{} -> {} ({:.3f} s)", JoinFields(fields), response, seconds));
+                return response;
+            }
+
+            std::string Dispatch(const std::vector<std::string>& fields)
+            {
+                const auto& command = fields.empty() ? std::string() : fields[0];
+                if (command == "render" && fields.size() == 6)
+                {
+                    return Render(std::stoul(fields[1]), std::stoul(fields[2]), std::stoi(fields[3]), fields[4], fields[5]);
+                }
+                if (command == "length" && fields.size() == 2)
+                {
+                    auto overview = Analyze(fields[1], 100);
+                    return JoinFields({"ok", std::format("{:.3f}", overview.IntroSeconds), std::format("{:.3f}", overview.LoopSeconds)});
+                }
+                if (command == "analyze" && fields.size() == 3)
+                {
+                    auto overview = Analyze(fields[2], std::stoi(fields[1]));
+                    float peak = 0.0f;
+                    for (const auto& window : overview.Windows)
+                    {
+                        peak = std::max(peak, window.Peak);
+                    }
+                    return JoinFields({"ok", std::format("{:.2f}", overview.Loudness), std::format("{:.4f}", peak), std::to_string(overview.Windows.size())});
+                }
+                if (command == "shutdown" && fields.size() == 1)
+                {
+                    // 受け付けのスレッドを Accept から戻すため、自分に接続する
+                    stopping_ = true;
+                    LocalSocket::Connect(socketPath_);
+                    return "ok";
+                }
+                throw std::invalid_argument("invalid request");
+            }
+
+            std::string Render(unsigned int rate, unsigned int seconds, int quality, const std::string& mml_file, const std::string& out_file)
+            {
+                if (rate == 0 || quality < 0 || quality > static_cast<int>(MusicCom::MusicCom::Quality::High))
+                {
+                    throw std::invalid_argument("invalid render parameters");
+                }
+                uint64_t key;
+                auto music = songs_.Acquire(mml_file, key);
+                std::ofstream stream(out_file, std::ios::binary);
+                if (!stream)
+                {
+                    throw std::runtime_error(std::format("{}: cannot create", out_file));
+                }
+                music->SetQuality(static_cast<MusicCom::MusicCom::Quality>(quality));
+                if (!music->PrepareMix(rate))
+                {
+                    throw std::runtime_error(std::format("{}: cannot prepare", mml_file));
+                }
+                uint64_t total = static_cast<uint64_t>(seconds) * rate;
+                std::vector<int16_t> buffer(BLOCK_SIZE * OUTPUT_CHANNELS);
+                for (uint64_t done = 0; done < total;)
+                {
+                    int n = static_cast<int>(std::min<uint64_t>(BLOCK_SIZE, total - done));
+                    music->Mix(buffer.data(), n);
+                    stream.write(reinterpret_cast<const char*>(buffer.data()), n * OUTPUT_CHANNELS * sizeof(int16_t));
+                    done += n;
+                }
+                songs_.Release(mml_file, key, std::move(music));
+                if (!stream)
+                {
+                    throw std::runtime_error(std::format("{}: write error", out_file));
+                }
+                return JoinFields({"ok", std::to_string(total)});
+            }
+
+            MusicCom::Overview Analyze(const std::string& mml_file, int window_ms)
+            {
+                uint64_t key;
+                auto music = songs_.Acquire(mml_file, key);
+                auto overview = music->GetOverview(window_ms);
+                songs_.Release(mml_file, key, std::move(music));
+                if (!overview)
+                {
+                    throw std::runtime_error(std::format("{}: cannot analyze", mml_file));
+                }
+                return *overview;
+            }
+
+            void Log(const std::string& message)
+            {
+                std::lock_guard lock(logMutex_);
+                std::cout << message << std::endl;
+            }
+
+            const std::string socketPath_;
+            SongPool songs_;
+            LocalSocket listener_;
+            std::atomic<bool> stopping_;
+
+            std::mutex mutex_;
+            std::condition_variable_any cv_;
+            std::deque<LocalSocket> connections_;
+            std::mutex logMutex_;
+            // 最初に破棄して、処理中の要求を終えてからスレッドを止めるため最後に宣言する
+            std::vector<std::jthread> workers_;
+        };
+    } // namespace
+
+    bool RunRenderServer(const std::string& socket_path, const ServerOptions& options)
+    {
+        RenderServer server(socket_path, options);
+        server.Run();
+        return true;
+    }
+
+    bool SendRenderRequest(const std::string& socket_path, const std::vector<std::string>& fields)
+    {
+        auto socket = LocalSocket::Connect(socket_path);
+        std::string response;
+        if (!socket.WriteLine(JoinFields(fields)) || !socket.ReadLine(response))
+        {
+            throw std::runtime_error(std::format("{}: no response", socket_path));
+        }
+        auto result = SplitFields(response);
+        std::cout << response << '\n';
+        return !result.empty() && result[0] == "ok";
+    }
+
+} // namespace KbAsciiMmlTool
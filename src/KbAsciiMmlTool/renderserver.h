@@ -0,0 +1,37 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+namespace KbAsciiMmlTool
+{
+    struct ServerOptions
+    {
+        ServerOptions()
+            : Threads(0),
+              CachedSongs(16)
+        {
+        }
+
+        // 要求を処理するスレッド数 (0: CPU のスレッド数)
+        unsigned int Threads;
+        // 解析済みの曲を保持しておく数
+        unsigned int CachedSongs;
+    };
+
+    // 要求と応答は 1 接続につき 1 行ずつで、フィールドをタブで区切る
+    // (ファイル名は絶対パスで指定する、応答の先頭は ok または error)
+    //   render <rate> <seconds> <quality> <file.mml> <out.raw> -> ok <samples>      (16bit ステレオ)
+    //   length <file.mml>                                      -> ok <intro> <loop> (秒)
+    //   analyze <window_ms> <file.mml>                         -> ok <loudness> <peak> <windows>
+    //   shutdown                                               -> ok
+    // quality は MusicCom::MusicCom::Quality の値
+
+    // socket_path で要求を受け付け、shutdown の要求を受けるまで処理を続ける
+    // 起動時に音源のテーブルを作成しておき、解析済みの曲を再利用するため、要求ごとに起動するより速い
+    bool RunRenderServer(const std::string& socket_path, const ServerOptions& options);
+
+    // 要求を送って応答を標準出力に表示する (応答が ok の場合のみ true)
+    bool SendRenderRequest(const std::string& socket_path, const std::vector<std::string>& fields);
+
+} // namespace KbAsciiMmlTool
@@ -0,0 +1,82 @@
+﻿#include "s98export.h"
+#include "../KbAsciiMml/musiccom/musiccom.h"
+#include "../KbAsciiMml/musiccom/s98.h"
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace KbAsciiMmlTool
+{
+    namespace
+    {
+        const int BLOCK_SIZE = 1024;
+    }
+
+    bool ExportS98(const std::string& mml_file, const std::string& s98_file, const S98Options& options)
+    {
+        MusicCom::S98Writer writer(options.Rate);
+        MusicCom::MusicCom music_com;
+        music_com.SetRegisterWriteObserver(
+            [&writer](uint64_t sample, uint addr, uint data)
+            {
+                writer.Write(sample, addr, data);
+            });
+
+        if (!music_com.Load(mml_file.c_str()))
+        {
+            throw std::runtime_error(std::format("{}: cannot open", mml_file));
+        }
+        if (!music_com.PrepareMix(options.Rate))
+        {
+            throw std::runtime_error(std::format("{}: cannot initialize OPN", mml_file));
+        }
+
+        std::vector<int16_t> buffer(BLOCK_SIZE * 2);
+        uint64_t samples = static_cast<uint64_t>(options.Seconds) * options.Rate;
+        for (uint64_t pos = 0; pos < samples; pos += BLOCK_SIZE)
+        {
+            music_com.Mix(buffer.data(), static_cast<int>(std::min<uint64_t>(BLOCK_SIZE, samples - pos)));
+        }
+        writer.Finish(samples);
+
+        std::ofstream stream(s98_file, std::ios::binary);
+        if (!stream)
+        {
+            throw std::runtime_error(std::format("{}: cannot create", s98_file));
+        }
+        writer.Save(stream);
+        return static_cast<bool>(stream);
+    }
+
+    bool RenderS98(const std::string& s98_file, const std::string& pcm_file, const S98Options& options)
+    {
+        MusicCom::S98Player player;
+        if (!player.Load(s98_file.c_str()))
+        {
+            throw std::runtime_error(std::format("{}: cannot open or unsupported format", s98_file));
+        }
+        if (!player.PrepareMix(options.Rate))
+        {
+            throw std::runtime_error(std::format("{}: cannot initialize OPN", s98_file));
+        }
+
+        std::ofstream stream(pcm_file, std::ios::binary);
+        if (!stream)
+        {
+            throw std::runtime_error(std::format("{}: cannot create", pcm_file));
+        }
+
+        std::vector<int16_t> buffer(BLOCK_SIZE * 2);
+        uint64_t samples = static_cast<uint64_t>(options.Seconds) * options.Rate;
+        for (uint64_t pos = 0; pos < samples; pos += BLOCK_SIZE)
+        {
+            int count = static_cast<int>(std::min<uint64_t>(BLOCK_SIZE, samples - pos));
+            player.Mix(buffer.data(), count);
+            stream.write(reinterpret_cast<const char*>(buffer.data()), count * 2 * sizeof(int16_t));
+        }
+        return static_cast<bool>(stream);
+    }
+
+} // namespace KbAsciiMmlTool
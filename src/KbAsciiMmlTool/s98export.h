@@ -0,0 +1,25 @@
+﻿#pragma once
+
+#include <string>
+
+namespace KbAsciiMmlTool
+{
+    struct S98Options
+    {
+        S98Options()
+            : Rate(55466),
+              Seconds(60)
+        {
+        }
+
+        unsigned int Rate;
+        unsigned int Seconds;
+    };
+
+    // MMLファイルを規定時間シーケンスし、レジスタ書き込みを S98 形式で保存する
+    bool ExportS98(const std::string& mml_file, const std::string& s98_file, const S98Options& options);
+
+    // S98 ファイルを規定時間再生し、PCM (16bit ステレオ) を保存する
+    bool RenderS98(const std::string& s98_file, const std::string& pcm_file, const S98Options& options);
+
+} // namespace KbAsciiMmlTool
@@ -0,0 +1,71 @@
+﻿#include "seek.h"
+#include "../KbAsciiMml/musiccom/musiccom.h"
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace KbAsciiMmlTool
+{
+    namespace
+    {
+        const int BLOCK_SIZE = 1024;
+        // 索引の作成を待つ間に SeekToLine を呼び直す間隔
+        const std::chrono::milliseconds INDEX_POLL_INTERVAL(1);
+    }
+
+    bool RenderFromLine(const std::string& mml_file, int line, const std::string& pcm_file, const SeekOptions& options)
+    {
+        MusicCom::MusicCom music_com;
+        music_com.SetQuality(options.Quality);
+        if (!music_com.Load(mml_file.c_str()))
+        {
+            throw std::runtime_error(std::format("{}: cannot open", mml_file));
+        }
+        if (!music_com.PrepareMix(options.Rate))
+        {
+            throw std::runtime_error(std::format("{}: cannot initialize OPN", mml_file));
+        }
+
+        // 索引の作成 (別のスレッドで作成し終えて最初の SeekToLine が成功するまで) と 2 回目以降の移動にかかる時間をそれぞれ表示する
+        auto start = std::chrono::steady_clock::now();
+        while (!music_com.SeekToLine(line))
+        {
+            if (!music_com.IsLineIndexPending())
+            {
+                throw std::runtime_error(std::format("{}: no CH/D line", mml_file));
+            }
+            std::this_thread::sleep_for(INDEX_POLL_INTERVAL);
+        }
+        auto indexed = std::chrono::steady_clock::now();
+        music_com.SeekToLine(line);
+        auto seeked = std::chrono::steady_clock::now();
+        std::cout << std::format(
+            "{}({:d}): index {:.3f} ms, seek {:.3f} ms\n",
+            mml_file,
+            line,
+            std::chrono::duration<double, std::milli>(indexed - start).count(),
+            std::chrono::duration<double, std::milli>(seeked - indexed).count());
+
+        std::ofstream stream(pcm_file, std::ios::binary);
+        if (!stream)
+        {
+            throw std::runtime_error(std::format("{}: cannot create", pcm_file));
+        }
+
+        std::vector<int16_t> buffer(BLOCK_SIZE * 2);
+        uint64_t samples = static_cast<uint64_t>(options.Seconds) * options.Rate;
+        for (uint64_t pos = 0; pos < samples; pos += BLOCK_SIZE)
+        {
+            int count = static_cast<int>(std::min<uint64_t>(BLOCK_SIZE, samples - pos));
+            music_com.Mix(buffer.data(), count);
+            stream.write(reinterpret_cast<const char*>(buffer.data()), count * 2 * sizeof(int16_t));
+        }
+        return static_cast<bool>(stream);
+    }
+
+} // namespace KbAsciiMmlTool
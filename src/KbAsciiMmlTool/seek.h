@@ -0,0 +1,26 @@
+﻿#pragma once
+
+#include "../KbAsciiMml/musiccom/musiccom.h"
+#include <string>
+
+namespace KbAsciiMmlTool
+{
+    struct SeekOptions
+    {
+        SeekOptions()
+            : Rate(55466),
+              Seconds(10),
+              Quality(MusicCom::MusicCom::Quality::Standard)
+        {
+        }
+
+        unsigned int Rate;
+        unsigned int Seconds;
+        MusicCom::MusicCom::Quality Quality;
+    };
+
+    // MMLファイルの指定した行 (1-origin) から規定時間レンダリングし、PCM (16bit ステレオ) を保存する
+    // 行の位置に移動するまでの時間を表示する
+    bool RenderFromLine(const std::string& mml_file, int line, const std::string& pcm_file, const SeekOptions& options);
+
+} // namespace KbAsciiMmlTool
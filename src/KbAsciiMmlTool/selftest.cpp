@@ -0,0 +1,235 @@
+﻿#include "selftest.h"
+#include "../KbAsciiMml/musiccom/mmlparser.h"
+#include "../KbAsciiMml/musiccom/musdata.h"
+#include "../KbAsciiMml/musiccom/sequencer.h"
+#include "../KbAsciiMml/musiccom/sounddata.h"
+#include <fmgen/opna.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace KbAsciiMmlTool
+{
+    namespace
+    {
+        const unsigned int OPN_CLOCKFREQ = 3993600;
+        const unsigned int RATE = 55466;
+        const int BLOCK_SIZE = 1024;
+
+        // PSG の A チャンネルだけを最大音量の矩形波で鳴らす
+        void InitPSGTone(FM::OPN& opn)
+        {
+            opn.Init(OPN_CLOCKFREQ, RATE);
+            opn.SetReg(0x00, 0x00);
+            opn.SetReg(0x01, 0x01);
+            opn.SetReg(0x07, 0x3e);
+            opn.SetReg(0x08, 0x0f);
+        }
+
+        int MixPeak(FM::OPN& opn)
+        {
+            std::vector<int16> buffer(BLOCK_SIZE * 2, 0);
+            opn.Mix(buffer.data(), BLOCK_SIZE);
+            int peak = 0;
+            for (auto sample : buffer)
+            {
+                peak = std::max(peak, std::abs(static_cast<int>(sample)));
+            }
+            return peak;
+        }
+
+        // 別の音源を作成・初期化しても、設定済みの PSG の音量が変わらないこと
+        bool PSGVolumeIsPerInstance()
+        {
+            FM::OPN opn;
+            InitPSGTone(opn);
+            opn.SetVolumePSG(10);
+            int before = MixPeak(opn);
+
+            FM::OPN other;
+            InitPSGTone(other);
+            int other_peak = MixPeak(other);
+
+            // 出力レベルは音量の書き込み時にテーブルから引かれるので、次の音符と同様に書き直す
+            opn.SetReg(0x08, 0x0f);
+            int after = MixPeak(opn);
+            if (before != after || before == other_peak)
+            {
+                std::cout << "  peak: before " << before << ", after " << after << ", other (0dB) " << other_peak << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        // 解析エラーのメッセージと行番号 (Spirit の文法で解析していた時と同じもの)
+        // Expected が空の場合はエラーにならないこと
+        struct ParseErrorCase
+        {
+            const char* Name;
+            const char* Mml;
+            const char* Expected;
+        };
+
+        const ParseErrorCase PARSE_ERROR_CASES[] = {
+            {"ch number", "1: cde\n7: cde\n", "ch number\n(2): parse error at \"7: cde\""},
+            {"ch colon", "1 cde\n", "ch colon\n(1): parse error at \"1 cde\""},
+            {"ch command", "1: c d e % f\n", "ch command\n(1): parse error at \"% f\""},
+            {"d colon", "d cde\n", "d colon\n(1): parse error at \"d cde\""},
+            {"d command", "d: c r ? c\n", "d command\n(1): parse error at \"? c\""},
+            {"sound number", "sound: @\n", "sound number\n(1): parse error at \"sound: @\""},
+            {"sound syntax", "sound: x1\n", "sound syntax\n(1): parse error at \"sound: x1\""},
+            {"lfo args", "sound: 1\nlfo:\n", "lfo args\n(2): parse error at \"lfo:\""},
+            {"op index", "sound: 1\nop5: 1,2,3\n", "op index\n(2): parse error at \"op5: 1,2,3\""},
+            {"ssgenv separator", "ssgenv: 1, 2 -> x\n", "ssgenv separator\n(1): parse error at \"-> x\""},
+            {"number overflow", "1: v99999999999 c\n", "number overflow\n(1): parse error at \"99999999999 c\""},
+            {"length dots", "1: c4.. l3. c\n", "length dots\n(1): parse error at \". l3. c\""},
+            {"length space", "1: c4 . d\n", "length space\n(1): bad lexical cast: source type value could not be interpreted as target"},
+            {"macro unknown", "1: $FOO$ c\n", ""},
+            {"macro unterminated", "1: $FOO c\n", "macro unterminated\n(1): parse error at \"$FOO c\""},
+            {"macro definition", "str: A$ cde\n", "macro definition\n(1): parse error at \"str: A$ cde\""},
+            {"several lines", "1: c\nzz\n2: d\n??\n", "several lines\n(2): parse error at \"zz\"\n(4): parse error at \"??\""},
+            {"crlf", "1: c\r\nzz\r\n2: d\r\n", "crlf\n(2): parse error at \"zz\""},
+        };
+
+        template<typename Parse>
+        std::string ParseErrorMessage(const ParseErrorCase& c, Parse parse)
+        {
+            try
+            {
+                std::unique_ptr<MusicCom::MusicData> music_data(parse(c.Mml, std::char_traits<char>::length(c.Mml), c.Name));
+            }
+            catch (const std::runtime_error& e)
+            {
+                return e.what();
+            }
+            return std::string();
+        }
+
+        // ParseMML と差分解析の全体の解析が、同じエラーメッセージと行番号を返すこと
+        bool ParseErrorsMatchGrammar()
+        {
+            bool passed = true;
+            for (const auto& c : PARSE_ERROR_CASES)
+            {
+                std::string whole = ParseErrorMessage(
+                    c,
+                    [](const char* data, size_t size, const char* name)
+                    {
+                        return MusicCom::ParseMML(data, size, name);
+                    });
+                MusicCom::MMLIncrementalParser incremental_parser;
+                std::string incremental = ParseErrorMessage(
+                    c,
+                    [&incremental_parser](const char* data, size_t size, const char* name)
+                    {
+                        return incremental_parser.Parse(data, size, name);
+                    });
+                if (whole != c.Expected || incremental != c.Expected)
+                {
+                    std::cout << "  " << c.Name << ": expected \"" << c.Expected << "\", ParseMML \"" << whole << "\", incremental \"" << incremental << "\"" << std::endl;
+                    passed = false;
+                }
+            }
+            return passed;
+        }
+
+        // ループ本体のキャッシュの確認に使う曲 (曲の終わりで先頭に戻って繰り返す)
+        // Replays: キャッシュからの再生に切り替わること
+        // 音源の内部状態が同期点で完全に一致しなければ切り替わらない
+        // FM は休符で全オペレータが止まる曲なら、エンベロープのカウンタが一巡した後に一致する
+        // 鳴り続ける FM と PSG のトーンは、カウンタの位相がそろわないため切り替わらない
+        struct LoopCacheCase
+        {
+            const char* Name;
+            const char* Mml;
+            bool Replays;
+        };
+
+        const LoopCacheCase LOOP_CACHE_CASES[] = {
+            {"fm rest", "1: t150 @0 v13 o4 c4 r1\n", true},
+            {"fm phrase rest", "1: t150 @0 v13 o4 l8 cdefgab>c< r1 r1\n", true},
+            {"fm", "1: t150 @0 v13 o4 l8 cdefgab>c< l4 c<gec\n2: t150 @0 v12 o3 l4 c e g e\n2: l2 c r\n", false},
+            {"fm tie", "1: t150 @0 v13 o4 l8 c&c d e2 f&f g4 r4\n2: @0 v12 o3 l2 c g\n", false},
+            {"psg", "4: t150 v13 o5 l8 cdefgab>c<\n5: v12 o4 l4 c e g e\n", false},
+            {"fm + psg", "1: t150 @0 v13 o4 l8 cdefgab>c<\n4: v12 o5 l4 c e g e\n6: v10 o3 l2 c g\n", false},
+        };
+        const unsigned int LOOP_CACHE_SECONDS = 120;
+        const size_t LOOP_CACHE_BUDGET = 16 << 20;
+
+        // LOOP_CACHE_SECONDS 秒合成する (cached: ループ本体のキャッシュを使う)
+        std::vector<int16> RenderLoops(MusicCom::MusicData& music_data, bool cached, bool& replayed)
+        {
+            FM::OPN opn;
+            MusicCom::SoundData sound_data;
+            MusicCom::Sequencer sequencer(opn, &music_data, &sound_data, 200);
+            sequencer.EnableLoopCache(cached ? LOOP_CACHE_BUDGET : 0);
+            std::vector<int16> output;
+            if (!sequencer.Init(RATE, 2, MusicCom::Sequencer::ChipQuality()))
+            {
+                return output;
+            }
+            std::vector<int16> buffer(BLOCK_SIZE * 2);
+            replayed = false;
+            for (unsigned int i = 0; i < RATE * LOOP_CACHE_SECONDS / BLOCK_SIZE; i++)
+            {
+                sequencer.Mix(buffer.data(), BLOCK_SIZE);
+                output.insert(output.end(), buffer.begin(), buffer.end());
+                replayed = replayed || sequencer.IsReplayingLoopCache();
+            }
+            return output;
+        }
+
+        // ループ本体のキャッシュから再生しても、毎回合成した場合と 1 サンプルも違わないこと
+        bool LoopCacheMatchesSynthesis()
+        {
+            bool passed = true;
+            for (const auto& c : LOOP_CACHE_CASES)
+            {
+                std::unique_ptr<MusicCom::MusicData> music_data(MusicCom::ParseMML(c.Mml, std::char_traits<char>::length(c.Mml), c.Name));
+                bool replayed = false;
+                bool unused = false;
+                auto cached = RenderLoops(*music_data, true, replayed);
+                auto synthesized = RenderLoops(*music_data, false, unused);
+                auto mismatch = std::mismatch(cached.begin(), cached.end(), synthesized.begin(), synthesized.end());
+                if (cached.empty() || mismatch.first != cached.end() || mismatch.second != synthesized.end() || replayed != c.Replays)
+                {
+                    std::cout << "  " << c.Name << ": replayed " << replayed << ", first difference at sample "
+                              << (mismatch.first - cached.begin()) / 2 << " of " << cached.size() / 2 << std::endl;
+                    passed = false;
+                }
+            }
+            return passed;
+        }
+
+        struct SelfTest
+        {
+            const char* Name;
+            std::function<bool()> Run;
+        };
+    } // namespace
+
+    bool RunSelfTests()
+    {
+        const SelfTest tests[] = {
+            {"psg volume is per instance", PSGVolumeIsPerInstance},
+            {"parse errors match the grammar", ParseErrorsMatchGrammar},
+            {"loop cache matches synthesis", LoopCacheMatchesSynthesis},
+        };
+
+        bool all_passed = true;
+        for (const auto& test : tests)
+        {
+            bool passed = test.Run();
+            std::cout << (passed ? "OK " : "NG ") << test.Name << std::endl;
+            all_passed = passed && all_passed;
+        }
+        return all_passed;
+    }
+
+} // namespace KbAsciiMmlTool
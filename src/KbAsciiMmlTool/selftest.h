@@ -0,0 +1,8 @@
+﻿#pragma once
+
+namespace KbAsciiMmlTool
+{
+    // MMLファイルを使わない単体の確認を実行し、すべて成功した場合のみ true を返す
+    bool RunSelfTests();
+
+} // namespace KbAsciiMmlTool
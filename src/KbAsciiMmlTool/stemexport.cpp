@@ -0,0 +1,82 @@
+﻿#include "stemexport.h"
+#include "../KbAsciiMml/musiccom/mmlparser.h"
+#include "../KbAsciiMml/musiccom/musiccom.h"
+#include "../KbAsciiMml/musiccom/musdata.h"
+#include "../KbAsciiMml/musiccom/sounddata.h"
+#include "../KbAsciiMml/musiccom/soundparser.h"
+#include "../KbAsciiMml/musiccom/stems.h"
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+
+namespace KbAsciiMmlTool
+{
+    namespace
+    {
+        const char* const PART_NAMES[MusicCom::STEM_COUNT] = {"1", "2", "3", "4", "5", "6", "D"};
+    }
+
+    bool ExportStems(const std::string& mml_file, const std::string& out_prefix, const StemOptions& options)
+    {
+        std::unique_ptr<MusicCom::MusicData> music(MusicCom::ParseMML(mml_file.c_str()));
+        std::unique_ptr<MusicCom::SoundData> sound(MusicCom::ParseSound(mml_file));
+        if (!music || !sound)
+        {
+            throw std::runtime_error(std::format("{}: cannot open", mml_file));
+        }
+
+        std::optional<std::ofstream> streams[MusicCom::STEM_COUNT];
+        for (int part = 0; part < MusicCom::STEM_COUNT; part++)
+        {
+            bool present = (part < 6) ? music->IsChannelPresent(part) : music->IsRhythmPartPresent();
+            if (!present)
+            {
+                continue;
+            }
+            auto path = std::format("{}.{}.raw", out_prefix, PART_NAMES[part]);
+            streams[part].emplace(path, std::ios::binary);
+            if (!*streams[part])
+            {
+                throw std::runtime_error(std::format("{}: cannot create", path));
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        uint64_t samples = static_cast<uint64_t>(options.Seconds) * options.Rate;
+        MusicCom::RenderStems(
+            *music,
+            *sound,
+            MusicCom::MusicCom::SOUND_EFFECT_DEFAULT_TEMPO,
+            options.Rate,
+            samples,
+            [&streams](const int16_t* const stems[MusicCom::STEM_COUNT], int nsamples)
+            {
+                for (int part = 0; part < MusicCom::STEM_COUNT; part++)
+                {
+                    if (streams[part])
+                    {
+                        streams[part]->write(reinterpret_cast<const char*>(stems[part]), nsamples * sizeof(int16_t));
+                    }
+                }
+            });
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        int count = 0;
+        bool ok = true;
+        for (auto& stream : streams)
+        {
+            if (stream)
+            {
+                count++;
+                ok = ok && static_cast<bool>(*stream);
+            }
+        }
+        std::cout << std::format("{}: {} parts, {:.3f} s ({:.1f}x realtime)\n", mml_file, count, seconds, options.Seconds / seconds);
+        return ok;
+    }
+
+} // namespace KbAsciiMmlTool
@@ -0,0 +1,24 @@
+﻿#pragma once
+
+#include <string>
+
+namespace KbAsciiMmlTool
+{
+    struct StemOptions
+    {
+        StemOptions()
+            : Rate(55466),
+              Seconds(10)
+        {
+        }
+
+        unsigned int Rate;
+        unsigned int Seconds;
+    };
+
+    // MMLファイルを 1 回だけシーケンス処理して、パートごとの PCM (16bit モノラル) を
+    // <out_prefix>.<パート>.raw (パートは 1-6 と D、使用していないパートは作らない) に保存する
+    // 処理時間を標準出力に表示する
+    bool ExportStems(const std::string& mml_file, const std::string& out_prefix, const StemOptions& options);
+
+} // namespace KbAsciiMmlTool
@@ -0,0 +1,54 @@
+﻿#include "trace.h"
+#include "../KbAsciiMml/musiccom/musiccom.h"
+#include "../KbAsciiMml/musiccom/regtrace.h"
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#ifndef MUSICCOM_ENABLE_TRACE
+#error KbAsciiMmlTool requires MUSICCOM_ENABLE_TRACE
+#endif
+
+namespace KbAsciiMmlTool
+{
+    bool TraceRegisterWrites(const std::string& mml_file, const TraceOptions& options)
+    {
+        MusicCom::RegisterTrace trace;
+        MusicCom::MusicCom music_com;
+        music_com.SetRegisterTrace(&trace);
+
+        if (!music_com.Load(mml_file.c_str()))
+        {
+            throw std::runtime_error(std::format("{}: cannot open", mml_file));
+        }
+        if (!music_com.PrepareMix(options.Rate))
+        {
+            throw std::runtime_error(std::format("{}: cannot initialize OPN", mml_file));
+        }
+
+        const int block_size = 1024;
+        std::vector<int16_t> buffer(block_size * 2);
+        uint64_t samples = static_cast<uint64_t>(options.Seconds) * options.Rate;
+        for (uint64_t pos = 0; pos < samples; pos += block_size)
+        {
+            music_com.Mix(buffer.data(), static_cast<int>(std::min<uint64_t>(block_size, samples - pos)));
+        }
+
+        std::cout << mml_file << "\n";
+        trace.WriteSummary(std::cout);
+
+        if (!options.ChromeTracePath.empty())
+        {
+            std::ofstream stream(options.ChromeTracePath);
+            if (!stream)
+            {
+                throw std::runtime_error(std::format("{}: cannot create", options.ChromeTracePath));
+            }
+            trace.WriteChromeTrace(stream, options.Rate);
+        }
+        return true;
+    }
+
+} // namespace KbAsciiMmlTool
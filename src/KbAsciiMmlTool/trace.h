@@ -0,0 +1,24 @@
+﻿#pragma once
+
+#include <string>
+
+namespace KbAsciiMmlTool
+{
+    struct TraceOptions
+    {
+        TraceOptions()
+            : Rate(55466),
+              Seconds(60)
+        {
+        }
+
+        unsigned int Rate;
+        unsigned int Seconds;
+        // Chrome トレース形式の出力先 (空の場合は出力しない)
+        std::string ChromeTracePath;
+    };
+
+    // MMLファイルを規定時間レンダリングし、レジスタ書き込みの集計を標準出力に表示する
+    bool TraceRegisterWrites(const std::string& mml_file, const TraceOptions& options);
+
+} // namespace KbAsciiMmlTool